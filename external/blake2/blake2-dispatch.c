@@ -0,0 +1,817 @@
+/*
+   BLAKE2 accelerated compression functions and runtime selection
+
+   Copyright 2012, Samuel Neves <sneves@dei.uc.pt>.  You may use this under the
+   terms of the CC0, the OpenSSL Licence, or the Apache Public License 2.0, at
+   your option.  The terms of these licenses can be found at:
+
+   - CC0 1.0 Universal : http://creativecommons.org/publicdomain/zero/1.0
+   - OpenSSL license   : https://www.openssl.org/source/license.html
+   - Apache 2.0        : http://www.apache.org/licenses/LICENSE-2.0
+
+   More information about the BLAKE2 hash function can be found at
+   https://blake2.net.
+
+   The SIMD code keeps one row of the 4x4 state matrix per vector (two
+   vectors per row for BLAKE2b without AVX2) and rotates rows between the
+   column and diagonal steps.  The reference code stays the fallback.
+*/
+#ifdef HAVE_CONFIG_H
+#include "pkg_config.h"
+#endif
+
+#include <stdint.h>
+#include <string.h>
+
+#include "blake2.h"
+#include "blake2-impl.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(HAVE_CPUID_H) && \
+    (defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 5))
+#define BLAKE2_X86
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__) || (defined(__ARM_NEON) && defined(__ARM_NEON__))
+#define BLAKE2_NEON
+#include <arm_neon.h>
+#endif
+
+static const uint32_t blake2s_IV[8] =
+{
+  0x6A09E667UL, 0xBB67AE85UL, 0x3C6EF372UL, 0xA54FF53AUL,
+  0x510E527FUL, 0x9B05688CUL, 0x1F83D9ABUL, 0x5BE0CD19UL
+};
+
+static const uint64_t blake2b_IV[8] =
+{
+  0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL,
+  0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL,
+  0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL,
+  0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL
+};
+
+static const uint8_t blake2_sigma[12][16] =
+{
+  {  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15 } ,
+  { 14, 10,  4,  8,  9, 15, 13,  6,  1, 12,  0,  2, 11,  7,  5,  3 } ,
+  { 11,  8, 12,  0,  5,  2, 15, 13, 10, 14,  3,  6,  7,  1,  9,  4 } ,
+  {  7,  9,  3,  1, 13, 12, 11, 14,  2,  6,  5, 10,  4,  0, 15,  8 } ,
+  {  9,  0,  5,  7,  2,  4, 10, 15, 14,  1, 11, 12,  6,  8,  3, 13 } ,
+  {  2, 12,  6, 10,  0, 11,  8,  3,  4, 13,  7,  5, 15, 14,  1,  9 } ,
+  { 12,  5,  1, 15, 14, 13,  4, 10,  0,  7,  6,  3,  9,  2,  8, 11 } ,
+  { 13, 11,  7, 14, 12,  1,  3,  9,  5,  0, 15,  4,  8,  6,  2, 10 } ,
+  {  6, 15, 14,  9, 11,  3,  0,  8, 12,  2, 13,  7,  1,  4, 10,  5 } ,
+  { 10,  2,  8,  4,  7,  6,  1,  5, 15, 11,  9, 14,  3, 12, 13 , 0 } ,
+  {  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15 } ,
+  { 14, 10,  4,  8,  9, 15, 13,  6,  1, 12,  0,  2, 11,  7,  5,  3 }
+};
+
+#if defined(BLAKE2_X86)
+static int blake2_cpu_has_sse41( void )
+{
+  unsigned int eax, ebx, ecx, edx;
+
+  if( !__get_cpuid( 1, &eax, &ebx, &ecx, &edx ) ) return 0;
+  /* SSSE3 for the byte shuffles, SSE4.1 for the rest */
+  return ( ecx & ( 1U << 9 ) ) != 0 && ( ecx & ( 1U << 19 ) ) != 0;
+}
+
+static int blake2_cpu_has_avx2( void )
+{
+  unsigned int eax, ebx, ecx, edx;
+
+  if( !blake2_cpu_has_sse41() ) return 0;
+  if( !__get_cpuid( 1, &eax, &ebx, &ecx, &edx ) ) return 0;
+  /* the OS must save the ymm registers: OSXSAVE, then XCR0 bits 1 and 2 */
+  if( ( ecx & ( 1U << 27 ) ) == 0 || ( ecx & ( 1U << 28 ) ) == 0 ) return 0;
+  __asm__ __volatile__( "xgetbv" : "=a"( eax ), "=d"( edx ) : "c"( 0 ) );
+  if( ( eax & 6 ) != 6 ) return 0;
+  if( __get_cpuid_max( 0, NULL ) < 7 ) return 0;
+  __cpuid_count( 7, 0, eax, ebx, ecx, edx );
+  return ( ebx & ( 1U << 5 ) ) != 0;
+}
+
+#define BLAKE2_SSE41 __attribute__((target("ssse3,sse4.1")))
+#define BLAKE2_AVX2  __attribute__((target("avx2")))
+
+/* BLAKE2s, one row per __m128i */
+#define S_ROT16( x ) _mm_shuffle_epi8( ( x ), r16 )
+#define S_ROT8( x )  _mm_shuffle_epi8( ( x ), r8 )
+#define S_ROT12( x ) _mm_xor_si128( _mm_srli_epi32( ( x ), 12 ), _mm_slli_epi32( ( x ), 20 ) )
+#define S_ROT7( x )  _mm_xor_si128( _mm_srli_epi32( ( x ), 7 ), _mm_slli_epi32( ( x ), 25 ) )
+
+#define S_G( mx, my )                                              \
+  do {                                                             \
+    a = _mm_add_epi32( _mm_add_epi32( a, b ), mx );                \
+    d = S_ROT16( _mm_xor_si128( d, a ) );                          \
+    c = _mm_add_epi32( c, d );                                     \
+    b = S_ROT12( _mm_xor_si128( b, c ) );                          \
+    a = _mm_add_epi32( _mm_add_epi32( a, b ), my );                \
+    d = S_ROT8( _mm_xor_si128( d, a ) );                           \
+    c = _mm_add_epi32( c, d );                                     \
+    b = S_ROT7( _mm_xor_si128( b, c ) );                           \
+  } while( 0 )
+
+#define S_MSG( r, i, j, k, l ) \
+  _mm_setr_epi32( m[blake2_sigma[r][i]], m[blake2_sigma[r][j]], \
+      m[blake2_sigma[r][k]], m[blake2_sigma[r][l]] )
+
+#define S_ROUND( r )                                               \
+  do {                                                             \
+    S_G( S_MSG( r, 0, 2, 4, 6 ), S_MSG( r, 1, 3, 5, 7 ) );         \
+    b = _mm_shuffle_epi32( b, _MM_SHUFFLE( 0, 3, 2, 1 ) );         \
+    c = _mm_shuffle_epi32( c, _MM_SHUFFLE( 1, 0, 3, 2 ) );         \
+    d = _mm_shuffle_epi32( d, _MM_SHUFFLE( 2, 1, 0, 3 ) );         \
+    S_G( S_MSG( r, 8, 10, 12, 14 ), S_MSG( r, 9, 11, 13, 15 ) );   \
+    b = _mm_shuffle_epi32( b, _MM_SHUFFLE( 2, 1, 0, 3 ) );         \
+    c = _mm_shuffle_epi32( c, _MM_SHUFFLE( 1, 0, 3, 2 ) );         \
+    d = _mm_shuffle_epi32( d, _MM_SHUFFLE( 0, 3, 2, 1 ) );         \
+  } while( 0 )
+
+BLAKE2_SSE41
+static void blake2s_compress_sse41( blake2s_state *S, const uint8_t in[BLAKE2S_BLOCKBYTES] )
+{
+  const __m128i r16 = _mm_setr_epi8( 2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13 );
+  const __m128i r8 = _mm_setr_epi8( 1, 2, 3, 0, 5, 6, 7, 4, 9, 10, 11, 8, 13, 14, 15, 12 );
+  const __m128i h0 = _mm_loadu_si128( ( const __m128i * )&S->h[0] );
+  const __m128i h1 = _mm_loadu_si128( ( const __m128i * )&S->h[4] );
+  __m128i a, b, c, d;
+  uint32_t m[16];
+  size_t i;
+
+  for( i = 0; i < 16; ++i )
+    m[i] = load32( in + i * sizeof( m[i] ) );
+
+  a = h0;
+  b = h1;
+  c = _mm_loadu_si128( ( const __m128i * )&blake2s_IV[0] );
+  d = _mm_xor_si128( _mm_loadu_si128( ( const __m128i * )&blake2s_IV[4] ),
+      _mm_setr_epi32( S->t[0], S->t[1], S->f[0], S->f[1] ) );
+
+  S_ROUND( 0 ); S_ROUND( 1 ); S_ROUND( 2 ); S_ROUND( 3 ); S_ROUND( 4 );
+  S_ROUND( 5 ); S_ROUND( 6 ); S_ROUND( 7 ); S_ROUND( 8 ); S_ROUND( 9 );
+
+  _mm_storeu_si128( ( __m128i * )&S->h[0], _mm_xor_si128( h0, _mm_xor_si128( a, c ) ) );
+  _mm_storeu_si128( ( __m128i * )&S->h[4], _mm_xor_si128( h1, _mm_xor_si128( b, d ) ) );
+}
+
+/* BLAKE2b, one row per pair of __m128i */
+#define B_ROT32( x ) _mm_shuffle_epi32( ( x ), _MM_SHUFFLE( 2, 3, 0, 1 ) )
+#define B_ROT24( x ) _mm_shuffle_epi8( ( x ), r24 )
+#define B_ROT16( x ) _mm_shuffle_epi8( ( x ), r16 )
+#define B_ROT63( x ) _mm_xor_si128( _mm_srli_epi64( ( x ), 63 ), _mm_add_epi64( ( x ), ( x ) ) )
+
+#define B_HALF_G( a, b, c, d, mx, my )                             \
+  do {                                                             \
+    a = _mm_add_epi64( _mm_add_epi64( a, b ), mx );                \
+    d = B_ROT32( _mm_xor_si128( d, a ) );                          \
+    c = _mm_add_epi64( c, d );                                     \
+    b = B_ROT24( _mm_xor_si128( b, c ) );                          \
+    a = _mm_add_epi64( _mm_add_epi64( a, b ), my );                \
+    d = B_ROT16( _mm_xor_si128( d, a ) );                          \
+    c = _mm_add_epi64( c, d );                                     \
+    b = B_ROT63( _mm_xor_si128( b, c ) );                          \
+  } while( 0 )
+
+#define B_MSG( r, i, j ) _mm_set_epi64x( m[blake2_sigma[r][j]], m[blake2_sigma[r][i]] )
+
+#define B_ROUND( r )                                                     \
+  do {                                                                   \
+    B_HALF_G( al, bl, cl, dl, B_MSG( r, 0, 2 ), B_MSG( r, 1, 3 ) );      \
+    B_HALF_G( ah, bh, ch, dh, B_MSG( r, 4, 6 ), B_MSG( r, 5, 7 ) );      \
+    /* diagonalize */                                                    \
+    t0 = _mm_alignr_epi8( bh, bl, 8 ); t1 = _mm_alignr_epi8( bl, bh, 8 ); \
+    bl = t0; bh = t1;                                                    \
+    t0 = cl; cl = ch; ch = t0;                                           \
+    t0 = _mm_alignr_epi8( dl, dh, 8 ); t1 = _mm_alignr_epi8( dh, dl, 8 ); \
+    dl = t0; dh = t1;                                                    \
+    B_HALF_G( al, bl, cl, dl, B_MSG( r, 8, 10 ), B_MSG( r, 9, 11 ) );    \
+    B_HALF_G( ah, bh, ch, dh, B_MSG( r, 12, 14 ), B_MSG( r, 13, 15 ) );  \
+    /* undiagonalize */                                                  \
+    t0 = _mm_alignr_epi8( bl, bh, 8 ); t1 = _mm_alignr_epi8( bh, bl, 8 ); \
+    bl = t0; bh = t1;                                                    \
+    t0 = cl; cl = ch; ch = t0;                                           \
+    t0 = _mm_alignr_epi8( dh, dl, 8 ); t1 = _mm_alignr_epi8( dl, dh, 8 ); \
+    dl = t0; dh = t1;                                                    \
+  } while( 0 )
+
+BLAKE2_SSE41
+static void blake2b_compress_sse41( blake2b_state *S, const uint8_t block[BLAKE2B_BLOCKBYTES] )
+{
+  const __m128i r16 = _mm_setr_epi8( 2, 3, 4, 5, 6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9 );
+  const __m128i r24 = _mm_setr_epi8( 3, 4, 5, 6, 7, 0, 1, 2, 11, 12, 13, 14, 15, 8, 9, 10 );
+  __m128i al, ah, bl, bh, cl, ch, dl, dh, t0, t1;
+  uint64_t m[16];
+  size_t i;
+
+  for( i = 0; i < 16; ++i )
+    m[i] = load64( block + i * sizeof( m[i] ) );
+
+  al = _mm_loadu_si128( ( const __m128i * )&S->h[0] );
+  ah = _mm_loadu_si128( ( const __m128i * )&S->h[2] );
+  bl = _mm_loadu_si128( ( const __m128i * )&S->h[4] );
+  bh = _mm_loadu_si128( ( const __m128i * )&S->h[6] );
+  cl = _mm_loadu_si128( ( const __m128i * )&blake2b_IV[0] );
+  ch = _mm_loadu_si128( ( const __m128i * )&blake2b_IV[2] );
+  dl = _mm_xor_si128( _mm_loadu_si128( ( const __m128i * )&blake2b_IV[4] ),
+      _mm_loadu_si128( ( const __m128i * )&S->t[0] ) );
+  dh = _mm_xor_si128( _mm_loadu_si128( ( const __m128i * )&blake2b_IV[6] ),
+      _mm_loadu_si128( ( const __m128i * )&S->f[0] ) );
+
+  B_ROUND( 0 ); B_ROUND( 1 ); B_ROUND( 2 ); B_ROUND( 3 ); B_ROUND( 4 ); B_ROUND( 5 );
+  B_ROUND( 6 ); B_ROUND( 7 ); B_ROUND( 8 ); B_ROUND( 9 ); B_ROUND( 10 ); B_ROUND( 11 );
+
+  _mm_storeu_si128( ( __m128i * )&S->h[0], _mm_xor_si128(
+      _mm_loadu_si128( ( const __m128i * )&S->h[0] ), _mm_xor_si128( al, cl ) ) );
+  _mm_storeu_si128( ( __m128i * )&S->h[2], _mm_xor_si128(
+      _mm_loadu_si128( ( const __m128i * )&S->h[2] ), _mm_xor_si128( ah, ch ) ) );
+  _mm_storeu_si128( ( __m128i * )&S->h[4], _mm_xor_si128(
+      _mm_loadu_si128( ( const __m128i * )&S->h[4] ), _mm_xor_si128( bl, dl ) ) );
+  _mm_storeu_si128( ( __m128i * )&S->h[6], _mm_xor_si128(
+      _mm_loadu_si128( ( const __m128i * )&S->h[6] ), _mm_xor_si128( bh, dh ) ) );
+}
+
+/* BLAKE2b, one row per __m256i */
+#define Y_ROT32( x ) _mm256_shuffle_epi32( ( x ), _MM_SHUFFLE( 2, 3, 0, 1 ) )
+#define Y_ROT24( x ) _mm256_shuffle_epi8( ( x ), r24 )
+#define Y_ROT16( x ) _mm256_shuffle_epi8( ( x ), r16 )
+#define Y_ROT63( x ) _mm256_xor_si256( _mm256_srli_epi64( ( x ), 63 ), _mm256_add_epi64( ( x ), ( x ) ) )
+
+#define Y_G( mx, my )                                              \
+  do {                                                             \
+    a = _mm256_add_epi64( _mm256_add_epi64( a, b ), mx );          \
+    d = Y_ROT32( _mm256_xor_si256( d, a ) );                       \
+    c = _mm256_add_epi64( c, d );                                  \
+    b = Y_ROT24( _mm256_xor_si256( b, c ) );                       \
+    a = _mm256_add_epi64( _mm256_add_epi64( a, b ), my );          \
+    d = Y_ROT16( _mm256_xor_si256( d, a ) );                       \
+    c = _mm256_add_epi64( c, d );                                  \
+    b = Y_ROT63( _mm256_xor_si256( b, c ) );                       \
+  } while( 0 )
+
+#define Y_MSG( r, i, j, k, l ) \
+  _mm256_set_epi64x( m[blake2_sigma[r][l]], m[blake2_sigma[r][k]], \
+      m[blake2_sigma[r][j]], m[blake2_sigma[r][i]] )
+
+#define Y_ROUND( r )                                               \
+  do {                                                             \
+    Y_G( Y_MSG( r, 0, 2, 4, 6 ), Y_MSG( r, 1, 3, 5, 7 ) );         \
+    b = _mm256_permute4x64_epi64( b, _MM_SHUFFLE( 0, 3, 2, 1 ) );  \
+    c = _mm256_permute4x64_epi64( c, _MM_SHUFFLE( 1, 0, 3, 2 ) );  \
+    d = _mm256_permute4x64_epi64( d, _MM_SHUFFLE( 2, 1, 0, 3 ) );  \
+    Y_G( Y_MSG( r, 8, 10, 12, 14 ), Y_MSG( r, 9, 11, 13, 15 ) );   \
+    b = _mm256_permute4x64_epi64( b, _MM_SHUFFLE( 2, 1, 0, 3 ) );  \
+    c = _mm256_permute4x64_epi64( c, _MM_SHUFFLE( 1, 0, 3, 2 ) );  \
+    d = _mm256_permute4x64_epi64( d, _MM_SHUFFLE( 0, 3, 2, 1 ) );  \
+  } while( 0 )
+
+BLAKE2_AVX2
+static void blake2b_compress_avx2( blake2b_state *S, const uint8_t block[BLAKE2B_BLOCKBYTES] )
+{
+  const __m256i r16 = _mm256_setr_epi8( 2, 3, 4, 5, 6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9,
+      2, 3, 4, 5, 6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9 );
+  const __m256i r24 = _mm256_setr_epi8( 3, 4, 5, 6, 7, 0, 1, 2, 11, 12, 13, 14, 15, 8, 9, 10,
+      3, 4, 5, 6, 7, 0, 1, 2, 11, 12, 13, 14, 15, 8, 9, 10 );
+  const __m256i h0 = _mm256_loadu_si256( ( const __m256i * )&S->h[0] );
+  const __m256i h1 = _mm256_loadu_si256( ( const __m256i * )&S->h[4] );
+  __m256i a, b, c, d;
+  uint64_t m[16];
+  size_t i;
+
+  for( i = 0; i < 16; ++i )
+    m[i] = load64( block + i * sizeof( m[i] ) );
+
+  a = h0;
+  b = h1;
+  c = _mm256_loadu_si256( ( const __m256i * )&blake2b_IV[0] );
+  d = _mm256_xor_si256( _mm256_loadu_si256( ( const __m256i * )&blake2b_IV[4] ),
+      _mm256_set_epi64x( S->f[1], S->f[0], S->t[1], S->t[0] ) );
+
+  Y_ROUND( 0 ); Y_ROUND( 1 ); Y_ROUND( 2 ); Y_ROUND( 3 ); Y_ROUND( 4 ); Y_ROUND( 5 );
+  Y_ROUND( 6 ); Y_ROUND( 7 ); Y_ROUND( 8 ); Y_ROUND( 9 ); Y_ROUND( 10 ); Y_ROUND( 11 );
+
+  _mm256_storeu_si256( ( __m256i * )&S->h[0], _mm256_xor_si256( h0, _mm256_xor_si256( a, c ) ) );
+  _mm256_storeu_si256( ( __m256i * )&S->h[4], _mm256_xor_si256( h1, _mm256_xor_si256( b, d ) ) );
+}
+#endif /* BLAKE2_X86 */
+
+#if defined(BLAKE2_NEON)
+/* rotr by n: shift left, then insert the bits shifted right */
+#define N_ROTR32( x, n ) vsriq_n_u32( vshlq_n_u32( ( x ), 32 - ( n ) ), ( x ), ( n ) )
+#define N_ROTR64( x, n ) vsriq_n_u64( vshlq_n_u64( ( x ), 64 - ( n ) ), ( x ), ( n ) )
+#define N_ROT16S( x ) vreinterpretq_u32_u16( vrev32q_u16( vreinterpretq_u16_u32( x ) ) )
+#define N_ROT32B( x ) vreinterpretq_u64_u32( vrev64q_u32( vreinterpretq_u32_u64( x ) ) )
+
+#define N_SG( mx, my )                                             \
+  do {                                                             \
+    a = vaddq_u32( vaddq_u32( a, b ), mx );                        \
+    d = N_ROT16S( veorq_u32( d, a ) );                             \
+    c = vaddq_u32( c, d );                                         \
+    b = N_ROTR32( veorq_u32( b, c ), 12 );                         \
+    a = vaddq_u32( vaddq_u32( a, b ), my );                        \
+    d = N_ROTR32( veorq_u32( d, a ), 8 );                          \
+    c = vaddq_u32( c, d );                                         \
+    b = N_ROTR32( veorq_u32( b, c ), 7 );                          \
+  } while( 0 )
+
+static BLAKE2_INLINE uint32x4_t blake2s_neon_msg( const uint32_t *m, const uint8_t *s,
+    int i, int j, int k, int l )
+{
+  const uint32_t w[4] = { m[s[i]], m[s[j]], m[s[k]], m[s[l]] };
+
+  return vld1q_u32( w );
+}
+
+static void blake2s_compress_neon( blake2s_state *S, const uint8_t in[BLAKE2S_BLOCKBYTES] )
+{
+  const uint32x4_t h0 = vld1q_u32( &S->h[0] );
+  const uint32x4_t h1 = vld1q_u32( &S->h[4] );
+  const uint32_t tf[4] = { S->t[0], S->t[1], S->f[0], S->f[1] };
+  uint32x4_t a, b, c, d;
+  uint32_t m[16];
+  size_t i, r;
+
+  for( i = 0; i < 16; ++i )
+    m[i] = load32( in + i * sizeof( m[i] ) );
+
+  a = h0;
+  b = h1;
+  c = vld1q_u32( &blake2s_IV[0] );
+  d = veorq_u32( vld1q_u32( &blake2s_IV[4] ), vld1q_u32( tf ) );
+
+  for( r = 0; r < 10; ++r ) {
+    const uint8_t *s = blake2_sigma[r];
+
+    N_SG( blake2s_neon_msg( m, s, 0, 2, 4, 6 ), blake2s_neon_msg( m, s, 1, 3, 5, 7 ) );
+    b = vextq_u32( b, b, 1 );
+    c = vextq_u32( c, c, 2 );
+    d = vextq_u32( d, d, 3 );
+    N_SG( blake2s_neon_msg( m, s, 8, 10, 12, 14 ), blake2s_neon_msg( m, s, 9, 11, 13, 15 ) );
+    b = vextq_u32( b, b, 3 );
+    c = vextq_u32( c, c, 2 );
+    d = vextq_u32( d, d, 1 );
+  }
+
+  vst1q_u32( &S->h[0], veorq_u32( h0, veorq_u32( a, c ) ) );
+  vst1q_u32( &S->h[4], veorq_u32( h1, veorq_u32( b, d ) ) );
+}
+
+#define N_HALF_BG( a, b, c, d, mx, my )                            \
+  do {                                                             \
+    a = vaddq_u64( vaddq_u64( a, b ), mx );                        \
+    d = N_ROT32B( veorq_u64( d, a ) );                             \
+    c = vaddq_u64( c, d );                                         \
+    b = N_ROTR64( veorq_u64( b, c ), 24 );                         \
+    a = vaddq_u64( vaddq_u64( a, b ), my );                        \
+    d = N_ROTR64( veorq_u64( d, a ), 16 );                         \
+    c = vaddq_u64( c, d );                                         \
+    b = N_ROTR64( veorq_u64( b, c ), 63 );                         \
+  } while( 0 )
+
+#define N_BMSG( s, i, j ) vcombine_u64( vcreate_u64( m[s[i]] ), vcreate_u64( m[s[j]] ) )
+
+static void blake2b_compress_neon( blake2b_state *S, const uint8_t block[BLAKE2B_BLOCKBYTES] )
+{
+  uint64x2_t al, ah, bl, bh, cl, ch, dl, dh, t0, t1;
+  uint64_t m[16];
+  size_t i, r;
+
+  for( i = 0; i < 16; ++i )
+    m[i] = load64( block + i * sizeof( m[i] ) );
+
+  al = vld1q_u64( &S->h[0] );
+  ah = vld1q_u64( &S->h[2] );
+  bl = vld1q_u64( &S->h[4] );
+  bh = vld1q_u64( &S->h[6] );
+  cl = vld1q_u64( &blake2b_IV[0] );
+  ch = vld1q_u64( &blake2b_IV[2] );
+  dl = veorq_u64( vld1q_u64( &blake2b_IV[4] ), vld1q_u64( &S->t[0] ) );
+  dh = veorq_u64( vld1q_u64( &blake2b_IV[6] ), vld1q_u64( &S->f[0] ) );
+
+  for( r = 0; r < 12; ++r ) {
+    const uint8_t *s = blake2_sigma[r];
+
+    N_HALF_BG( al, bl, cl, dl, N_BMSG( s, 0, 2 ), N_BMSG( s, 1, 3 ) );
+    N_HALF_BG( ah, bh, ch, dh, N_BMSG( s, 4, 6 ), N_BMSG( s, 5, 7 ) );
+
+    /* diagonalize */
+    t0 = vextq_u64( bl, bh, 1 );
+    t1 = vextq_u64( bh, bl, 1 );
+    bl = t0; bh = t1;
+    t0 = cl; cl = ch; ch = t0;
+    t0 = vextq_u64( dh, dl, 1 );
+    t1 = vextq_u64( dl, dh, 1 );
+    dl = t0; dh = t1;
+
+    N_HALF_BG( al, bl, cl, dl, N_BMSG( s, 8, 10 ), N_BMSG( s, 9, 11 ) );
+    N_HALF_BG( ah, bh, ch, dh, N_BMSG( s, 12, 14 ), N_BMSG( s, 13, 15 ) );
+
+    /* undiagonalize */
+    t0 = vextq_u64( bh, bl, 1 );
+    t1 = vextq_u64( bl, bh, 1 );
+    bl = t0; bh = t1;
+    t0 = cl; cl = ch; ch = t0;
+    t0 = vextq_u64( dl, dh, 1 );
+    t1 = vextq_u64( dh, dl, 1 );
+    dl = t0; dh = t1;
+  }
+
+  vst1q_u64( &S->h[0], veorq_u64( vld1q_u64( &S->h[0] ), veorq_u64( al, cl ) ) );
+  vst1q_u64( &S->h[2], veorq_u64( vld1q_u64( &S->h[2] ), veorq_u64( ah, ch ) ) );
+  vst1q_u64( &S->h[4], veorq_u64( vld1q_u64( &S->h[4] ), veorq_u64( bl, dl ) ) );
+  vst1q_u64( &S->h[6], veorq_u64( vld1q_u64( &S->h[6] ), veorq_u64( bh, dh ) ) );
+}
+#endif /* BLAKE2_NEON */
+
+struct blake2_backend
+{
+  const char *name;
+  blake2s_compress_fn compress_s;
+  blake2b_compress_fn compress_b;
+  int many_lanes; /* the multi-buffer code may use 256-bit vectors */
+  int ( *supported )( void );
+};
+
+/* Fastest first */
+static const struct blake2_backend blake2_backends[] =
+{
+#if defined(BLAKE2_X86)
+  { "avx2", blake2s_compress_sse41, blake2b_compress_avx2, 1, blake2_cpu_has_avx2 },
+  { "sse41", blake2s_compress_sse41, blake2b_compress_sse41, 0, blake2_cpu_has_sse41 },
+#endif
+#if defined(BLAKE2_NEON)
+  { "neon", blake2s_compress_neon, blake2b_compress_neon, 0, NULL },
+#endif
+  { "ref", blake2s_compress_ref, blake2b_compress_ref, 0, NULL }
+};
+
+#define BLAKE2_NBACKENDS ( sizeof( blake2_backends ) / sizeof( blake2_backends[0] ) )
+
+static const struct blake2_backend *blake2_backend = NULL;
+
+static const struct blake2_backend *blake2_backend_get( void )
+{
+  size_t i;
+
+  if( blake2_backend == NULL ) {
+    for( i = 0; i < BLAKE2_NBACKENDS; ++i )
+      if( blake2_backends[i].supported == NULL || blake2_backends[i].supported() )
+        break;
+    blake2_backend = &blake2_backends[i];
+    blake2s_compress_impl = blake2_backend->compress_s;
+    blake2b_compress_impl = blake2_backend->compress_b;
+  }
+
+  return blake2_backend;
+}
+
+static void blake2s_compress_auto( blake2s_state *S, const uint8_t in[BLAKE2S_BLOCKBYTES] )
+{
+  blake2_backend_get()->compress_s( S, in );
+}
+
+static void blake2b_compress_auto( blake2b_state *S, const uint8_t block[BLAKE2B_BLOCKBYTES] )
+{
+  blake2_backend_get()->compress_b( S, block );
+}
+
+blake2s_compress_fn blake2s_compress_impl = blake2s_compress_auto;
+blake2b_compress_fn blake2b_compress_impl = blake2b_compress_auto;
+
+const char *blake2_backend_name( size_t idx )
+{
+  size_t i;
+
+  for( i = 0; i < BLAKE2_NBACKENDS; ++i ) {
+    if( blake2_backends[i].supported != NULL && !blake2_backends[i].supported() )
+      continue;
+    if( idx-- == 0 )
+      return blake2_backends[i].name;
+  }
+
+  return NULL;
+}
+
+int blake2_backend_select( const char *name )
+{
+  size_t i;
+
+  for( i = 0; i < BLAKE2_NBACKENDS; ++i ) {
+    if( strcmp( blake2_backends[i].name, name ) != 0 )
+      continue;
+    if( blake2_backends[i].supported != NULL && !blake2_backends[i].supported() )
+      return -1;
+    blake2_backend = &blake2_backends[i];
+    blake2s_compress_impl = blake2_backend->compress_s;
+    blake2b_compress_impl = blake2_backend->compress_b;
+    return 0;
+  }
+
+  return -1;
+}
+
+const char *blake2_backend_current( void )
+{
+  return blake2_backend_get()->name;
+}
+
+/*
+   Multi-buffer hashing.  Independent inputs are hashed side by side, one per
+   lane, with the state stored word-major so that every step of G operates on
+   all lanes at once and is vectorized by the compiler.  A lane that finishes
+   its input picks up the next one, so inputs of uneven length keep the lanes
+   busy.
+*/
+#define BLAKE2S_LANES 8
+#define BLAKE2B_LANES 4
+
+#if defined(__GNUC__)
+#define BLAKE2_ALWAYS_INLINE static inline __attribute__((always_inline))
+#else
+#define BLAKE2_ALWAYS_INLINE static BLAKE2_INLINE
+#endif
+
+typedef struct blake2s_lanes__
+{
+  uint32_t h[8][BLAKE2S_LANES];
+  uint32_t t[2][BLAKE2S_LANES];
+  uint32_t f[BLAKE2S_LANES];
+  uint32_t m[16][BLAKE2S_LANES];
+} blake2s_lanes;
+
+typedef struct blake2b_lanes__
+{
+  uint64_t h[8][BLAKE2B_LANES];
+  uint64_t t[2][BLAKE2B_LANES];
+  uint64_t f[BLAKE2B_LANES];
+  uint64_t m[16][BLAKE2B_LANES];
+} blake2b_lanes;
+
+#define BLAKE2S_LG( a, b, c, d, x, y )                             \
+  for( l = 0; l < BLAKE2S_LANES; ++l ) {                           \
+    v[a][l] = v[a][l] + v[b][l] + L->m[x][l];                      \
+    v[d][l] = rotr32( v[d][l] ^ v[a][l], 16 );                     \
+    v[c][l] = v[c][l] + v[d][l];                                   \
+    v[b][l] = rotr32( v[b][l] ^ v[c][l], 12 );                     \
+    v[a][l] = v[a][l] + v[b][l] + L->m[y][l];                      \
+    v[d][l] = rotr32( v[d][l] ^ v[a][l], 8 );                      \
+    v[c][l] = v[c][l] + v[d][l];                                   \
+    v[b][l] = rotr32( v[b][l] ^ v[c][l], 7 );                      \
+  }
+
+#define BLAKE2B_LG( a, b, c, d, x, y )                             \
+  for( l = 0; l < BLAKE2B_LANES; ++l ) {                           \
+    v[a][l] = v[a][l] + v[b][l] + L->m[x][l];                      \
+    v[d][l] = rotr64( v[d][l] ^ v[a][l], 32 );                     \
+    v[c][l] = v[c][l] + v[d][l];                                   \
+    v[b][l] = rotr64( v[b][l] ^ v[c][l], 24 );                     \
+    v[a][l] = v[a][l] + v[b][l] + L->m[y][l];                      \
+    v[d][l] = rotr64( v[d][l] ^ v[a][l], 16 );                     \
+    v[c][l] = v[c][l] + v[d][l];                                   \
+    v[b][l] = rotr64( v[b][l] ^ v[c][l], 63 );                     \
+  }
+
+#define BLAKE2_LROUND( LG, r )                                     \
+  do {                                                             \
+    LG(  0,  4,  8, 12, blake2_sigma[r][ 0], blake2_sigma[r][ 1] ); \
+    LG(  1,  5,  9, 13, blake2_sigma[r][ 2], blake2_sigma[r][ 3] ); \
+    LG(  2,  6, 10, 14, blake2_sigma[r][ 4], blake2_sigma[r][ 5] ); \
+    LG(  3,  7, 11, 15, blake2_sigma[r][ 6], blake2_sigma[r][ 7] ); \
+    LG(  0,  5, 10, 15, blake2_sigma[r][ 8], blake2_sigma[r][ 9] ); \
+    LG(  1,  6, 11, 12, blake2_sigma[r][10], blake2_sigma[r][11] ); \
+    LG(  2,  7,  8, 13, blake2_sigma[r][12], blake2_sigma[r][13] ); \
+    LG(  3,  4,  9, 14, blake2_sigma[r][14], blake2_sigma[r][15] ); \
+  } while( 0 )
+
+BLAKE2_ALWAYS_INLINE void blake2s_lanes_compress_body( blake2s_lanes *L )
+{
+  uint32_t v[16][BLAKE2S_LANES];
+  size_t i, l;
+
+  for( i = 0; i < 8; ++i ) {
+    for( l = 0; l < BLAKE2S_LANES; ++l ) {
+      v[i][l] = L->h[i][l];
+      v[i + 8][l] = blake2s_IV[i];
+    }
+  }
+  for( l = 0; l < BLAKE2S_LANES; ++l ) {
+    v[12][l] ^= L->t[0][l];
+    v[13][l] ^= L->t[1][l];
+    v[14][l] ^= L->f[l];
+  }
+
+  BLAKE2_LROUND( BLAKE2S_LG, 0 ); BLAKE2_LROUND( BLAKE2S_LG, 1 );
+  BLAKE2_LROUND( BLAKE2S_LG, 2 ); BLAKE2_LROUND( BLAKE2S_LG, 3 );
+  BLAKE2_LROUND( BLAKE2S_LG, 4 ); BLAKE2_LROUND( BLAKE2S_LG, 5 );
+  BLAKE2_LROUND( BLAKE2S_LG, 6 ); BLAKE2_LROUND( BLAKE2S_LG, 7 );
+  BLAKE2_LROUND( BLAKE2S_LG, 8 ); BLAKE2_LROUND( BLAKE2S_LG, 9 );
+
+  for( i = 0; i < 8; ++i )
+    for( l = 0; l < BLAKE2S_LANES; ++l )
+      L->h[i][l] ^= v[i][l] ^ v[i + 8][l];
+}
+
+BLAKE2_ALWAYS_INLINE void blake2b_lanes_compress_body( blake2b_lanes *L )
+{
+  uint64_t v[16][BLAKE2B_LANES];
+  size_t i, l;
+
+  for( i = 0; i < 8; ++i ) {
+    for( l = 0; l < BLAKE2B_LANES; ++l ) {
+      v[i][l] = L->h[i][l];
+      v[i + 8][l] = blake2b_IV[i];
+    }
+  }
+  for( l = 0; l < BLAKE2B_LANES; ++l ) {
+    v[12][l] ^= L->t[0][l];
+    v[13][l] ^= L->t[1][l];
+    v[14][l] ^= L->f[l];
+  }
+
+  BLAKE2_LROUND( BLAKE2B_LG, 0 ); BLAKE2_LROUND( BLAKE2B_LG, 1 );
+  BLAKE2_LROUND( BLAKE2B_LG, 2 ); BLAKE2_LROUND( BLAKE2B_LG, 3 );
+  BLAKE2_LROUND( BLAKE2B_LG, 4 ); BLAKE2_LROUND( BLAKE2B_LG, 5 );
+  BLAKE2_LROUND( BLAKE2B_LG, 6 ); BLAKE2_LROUND( BLAKE2B_LG, 7 );
+  BLAKE2_LROUND( BLAKE2B_LG, 8 ); BLAKE2_LROUND( BLAKE2B_LG, 9 );
+  BLAKE2_LROUND( BLAKE2B_LG, 10 ); BLAKE2_LROUND( BLAKE2B_LG, 11 );
+
+  for( i = 0; i < 8; ++i )
+    for( l = 0; l < BLAKE2B_LANES; ++l )
+      L->h[i][l] ^= v[i][l] ^ v[i + 8][l];
+}
+
+static void blake2s_lanes_compress( blake2s_lanes *L )
+{
+  blake2s_lanes_compress_body( L );
+}
+
+static void blake2b_lanes_compress( blake2b_lanes *L )
+{
+  blake2b_lanes_compress_body( L );
+}
+
+#if defined(BLAKE2_X86)
+BLAKE2_AVX2
+static void blake2s_lanes_compress_avx2( blake2s_lanes *L )
+{
+  blake2s_lanes_compress_body( L );
+}
+
+BLAKE2_AVX2
+static void blake2b_lanes_compress_avx2( blake2b_lanes *L )
+{
+  blake2b_lanes_compress_body( L );
+}
+#endif
+
+int blake2s_many( uint8_t *const out[], size_t outlen, const void *const in[],
+                  const size_t inlen[], size_t count )
+{
+  void ( *compress )( blake2s_lanes * ) = blake2s_lanes_compress;
+  blake2s_lanes L;
+  uint8_t tail[BLAKE2S_LANES][BLAKE2S_BLOCKBYTES];
+  uint8_t digest[BLAKE2S_OUTBYTES];
+  size_t idx[BLAKE2S_LANES], pos[BLAKE2S_LANES];
+  size_t next = 0, active = 0, i, l, n;
+  const uint8_t *src;
+
+  if( outlen == 0 || outlen > BLAKE2S_OUTBYTES ) return -1;
+  if( count > 0 && ( out == NULL || in == NULL || inlen == NULL ) ) return -1;
+
+#if defined(BLAKE2_X86)
+  if( blake2_backend_get()->many_lanes )
+    compress = blake2s_lanes_compress_avx2;
+#endif
+
+  memset( &L, 0, sizeof( L ) );
+  for( l = 0; l < BLAKE2S_LANES; ++l ) {
+    idx[l] = count;
+    L.f[l] = 0xFFFFFFFFUL; /* ask for a new input */
+  }
+
+  for( ;; ) {
+    for( l = 0; l < BLAKE2S_LANES; ++l ) {
+      if( L.f[l] != 0 ) {
+        if( idx[l] < count ) {
+          for( i = 0; i < 8; ++i )
+            store32( digest + i * 4, L.h[i][l] );
+          memcpy( out[idx[l]], digest, outlen );
+          --active;
+        }
+        if( next == count ) {
+          idx[l] = count;
+          continue;
+        }
+        idx[l] = next++;
+        pos[l] = 0;
+        ++active;
+        for( i = 0; i < 8; ++i )
+          L.h[i][l] = blake2s_IV[i];
+        L.h[0][l] ^= 0x01010000UL ^ ( uint32_t )outlen;
+        L.t[0][l] = L.t[1][l] = 0;
+        L.f[l] = 0;
+      }
+
+      n = inlen[idx[l]] - pos[l];
+      src = ( const uint8_t * )in[idx[l]] + pos[l];
+      if( n > BLAKE2S_BLOCKBYTES ) {
+        n = BLAKE2S_BLOCKBYTES;
+      } else {
+        /* the last block, padded with zeros */
+        memset( tail[l], 0, BLAKE2S_BLOCKBYTES );
+        if( n > 0 )
+          memcpy( tail[l], src, n );
+        src = tail[l];
+        L.f[l] = 0xFFFFFFFFUL;
+      }
+      pos[l] += n;
+      L.t[0][l] += ( uint32_t )n;
+      L.t[1][l] += ( L.t[0][l] < ( uint32_t )n );
+      for( i = 0; i < 16; ++i )
+        L.m[i][l] = load32( src + i * 4 );
+    }
+
+    if( active == 0 )
+      break;
+    compress( &L );
+  }
+
+  return 0;
+}
+
+int blake2b_many( uint8_t *const out[], size_t outlen, const void *const in[],
+                  const size_t inlen[], size_t count )
+{
+  void ( *compress )( blake2b_lanes * ) = blake2b_lanes_compress;
+  blake2b_lanes L;
+  uint8_t tail[BLAKE2B_LANES][BLAKE2B_BLOCKBYTES];
+  uint8_t digest[BLAKE2B_OUTBYTES];
+  size_t idx[BLAKE2B_LANES], pos[BLAKE2B_LANES];
+  size_t next = 0, active = 0, i, l, n;
+  const uint8_t *src;
+
+  if( outlen == 0 || outlen > BLAKE2B_OUTBYTES ) return -1;
+  if( count > 0 && ( out == NULL || in == NULL || inlen == NULL ) ) return -1;
+
+#if defined(BLAKE2_X86)
+  if( blake2_backend_get()->many_lanes )
+    compress = blake2b_lanes_compress_avx2;
+#endif
+
+  memset( &L, 0, sizeof( L ) );
+  for( l = 0; l < BLAKE2B_LANES; ++l ) {
+    idx[l] = count;
+    L.f[l] = ( uint64_t )-1; /* ask for a new input */
+  }
+
+  for( ;; ) {
+    for( l = 0; l < BLAKE2B_LANES; ++l ) {
+      if( L.f[l] != 0 ) {
+        if( idx[l] < count ) {
+          for( i = 0; i < 8; ++i )
+            store64( digest + i * 8, L.h[i][l] );
+          memcpy( out[idx[l]], digest, outlen );
+          --active;
+        }
+        if( next == count ) {
+          idx[l] = count;
+          continue;
+        }
+        idx[l] = next++;
+        pos[l] = 0;
+        ++active;
+        for( i = 0; i < 8; ++i )
+          L.h[i][l] = blake2b_IV[i];
+        L.h[0][l] ^= 0x01010000ULL ^ ( uint64_t )outlen;
+        L.t[0][l] = L.t[1][l] = 0;
+        L.f[l] = 0;
+      }
+
+      n = inlen[idx[l]] - pos[l];
+      src = ( const uint8_t * )in[idx[l]] + pos[l];
+      if( n > BLAKE2B_BLOCKBYTES ) {
+        n = BLAKE2B_BLOCKBYTES;
+      } else {
+        /* the last block, padded with zeros */
+        memset( tail[l], 0, BLAKE2B_BLOCKBYTES );
+        if( n > 0 )
+          memcpy( tail[l], src, n );
+        src = tail[l];
+        L.f[l] = ( uint64_t )-1;
+      }
+      pos[l] += n;
+      L.t[0][l] += ( uint64_t )n;
+      L.t[1][l] += ( L.t[0][l] < ( uint64_t )n );
+      for( i = 0; i < 16; ++i )
+        L.m[i][l] = load64( src + i * 8 );
+    }
+
+    if( active == 0 )
+      break;
+    compress( &L );
+  }
+
+  return 0;
+}
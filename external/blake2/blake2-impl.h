@@ -18,6 +18,8 @@
 #include <stdint.h>
 #include <string.h>
 
+#include "blake2.h"
+
 #if !defined(__cplusplus) && (!defined(__STDC_VERSION__) || __STDC_VERSION__ < 199901L)
   #if   defined(_MSC_VER)
     #define BLAKE2_INLINE __inline
@@ -150,6 +152,16 @@ static BLAKE2_INLINE uint64_t rotr64( const uint64_t w, const unsigned c )
   return ( w >> c ) | ( w << ( 64 - c ) );
 }
 
+/* Compression functions, the implementation is picked at runtime */
+typedef void ( *blake2s_compress_fn )( blake2s_state *S, const uint8_t in[BLAKE2S_BLOCKBYTES] );
+typedef void ( *blake2b_compress_fn )( blake2b_state *S, const uint8_t block[BLAKE2B_BLOCKBYTES] );
+
+void blake2s_compress_ref( blake2s_state *S, const uint8_t in[BLAKE2S_BLOCKBYTES] );
+void blake2b_compress_ref( blake2b_state *S, const uint8_t block[BLAKE2B_BLOCKBYTES] );
+
+extern blake2s_compress_fn blake2s_compress_impl;
+extern blake2b_compress_fn blake2b_compress_impl;
+
 /* prevents compiler optimizing out memset() */
 static BLAKE2_INLINE void secure_zero_memory(void *v, size_t n)
 {
@@ -188,6 +188,15 @@ extern "C" {
   /* This is simply an alias for blake2b */
   int blake2( void *out, size_t outlen, const void *in, size_t inlen, const void *key, size_t keylen );
 
+  /* Multi-buffer API: hash count unkeyed inputs, in[i] into out[i] */
+  int blake2s_many( uint8_t *const out[], size_t outlen, const void *const in[], const size_t inlen[], size_t count );
+  int blake2b_many( uint8_t *const out[], size_t outlen, const void *const in[], const size_t inlen[], size_t count );
+
+  /* Compression backends, the fastest supported one is used by default */
+  const char *blake2_backend_name( size_t idx );
+  int blake2_backend_select( const char *name );
+  const char *blake2_backend_current( void );
+
 #if defined(__cplusplus)
 }
 #endif
@@ -169,7 +169,7 @@ int blake2s_init_key( blake2s_state *S, size_t outlen, const void *key, size_t k
     G(r,7,v[ 3],v[ 4],v[ 9],v[14]); \
   } while(0)
 
-static void blake2s_compress( blake2s_state *S, const uint8_t in[BLAKE2S_BLOCKBYTES] )
+void blake2s_compress_ref( blake2s_state *S, const uint8_t in[BLAKE2S_BLOCKBYTES] )
 {
   uint32_t m[16];
   uint32_t v[16];
@@ -223,11 +223,11 @@ int blake2s_update( blake2s_state *S, const void *pin, size_t inlen )
       S->buflen = 0;
       memcpy( S->buf + left, in, fill ); /* Fill buffer */
       blake2s_increment_counter( S, BLAKE2S_BLOCKBYTES );
-      blake2s_compress( S, S->buf ); /* Compress */
+      blake2s_compress_impl( S, S->buf ); /* Compress */
       in += fill; inlen -= fill;
       while(inlen > BLAKE2S_BLOCKBYTES) {
         blake2s_increment_counter(S, BLAKE2S_BLOCKBYTES);
-        blake2s_compress( S, in );
+        blake2s_compress_impl( S, in );
         in += BLAKE2S_BLOCKBYTES;
         inlen -= BLAKE2S_BLOCKBYTES;
       }
@@ -252,7 +252,7 @@ int blake2s_final( blake2s_state *S, void *out, size_t outlen )
   blake2s_increment_counter( S, ( uint32_t )S->buflen );
   blake2s_set_lastblock( S );
   memset( S->buf + S->buflen, 0, BLAKE2S_BLOCKBYTES - S->buflen ); /* Padding */
-  blake2s_compress( S, S->buf );
+  blake2s_compress_impl( S, S->buf );
 
   for( i = 0; i < 8; ++i ) /* Output full hash to temp buffer */
     store32( buffer + sizeof( S->h[i] ) * i, S->h[i] );
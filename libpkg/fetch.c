@@ -37,6 +37,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <fetch.h>
+#include <netdb.h>
 #include <paths.h>
 #include <poll.h>
 
@@ -83,6 +84,515 @@ gethttpmirrors(struct pkg_repo *repo, const char *url) {
 	return;
 }
 
+static void
+fetch_env_set(struct pkg_repo *repo, struct pkg_kv **envtorestore,
+    struct pkg_kv **envtounset)
+{
+	struct pkg_kv *kv, *kvtmp;
+	char *tmp;
+
+	if (repo == NULL)
+		return;
+
+	LL_FOREACH(repo->env, kv) {
+		kvtmp = xcalloc(1, sizeof(*kvtmp));
+		kvtmp->key = xstrdup(kv->key);
+		if ((tmp = getenv(kv->key)) != NULL) {
+			kvtmp->value = xstrdup(tmp);
+			DL_APPEND(*envtorestore, kvtmp);
+		} else {
+			DL_APPEND(*envtounset, kvtmp);
+		}
+		setenv(kv->key, kv->value, 1);
+	}
+}
+
+static void
+fetch_env_restore(struct pkg_kv **envtorestore, struct pkg_kv **envtounset)
+{
+	struct pkg_kv *kv, *kvtmp;
+
+	LL_FOREACH_SAFE(*envtorestore, kv, kvtmp) {
+		setenv(kv->key, kv->value, 1);
+		LL_DELETE(*envtorestore, kv);
+		pkg_kv_free(kv);
+	}
+	LL_FOREACH_SAFE(*envtounset, kv, kvtmp) {
+		unsetenv(kv->key);
+		LL_DELETE(*envtounset, kv);
+		pkg_kv_free(kv);
+	}
+}
+
+/*
+ * Mirrors are ranked on what they were measured at: the latency to the
+ * answer of a request and the transfer rate, as moving averages, and the
+ * failures in a row.  The measures are kept next to the repository
+ * catalogue from one run to the next.
+ */
+#define MIRROR_STATS_SUFFIX	".mirrors"
+#define MIRROR_STATS_TTL	(7 * 24 * 60 * 60)
+#define MIRROR_WEIGHT		0.3	/* of a new measure in the average */
+#define MIRROR_REF_SIZE		(1024 * 1024)
+#define MIRROR_RATE_MIN_SIZE	(64 * 1024)	/* below, latency dominates */
+#define MIRROR_FAILURES_MAX	8
+#define MIRROR_STALL_WINDOW	5.0
+#define MIRROR_STALL_FACTOR	8
+
+struct mirror {
+	char key[URL_SCHEMELEN + MAXHOSTNAMELEN + 16];
+	const char *host;
+	int port;
+	struct http_mirror *http;	/* NULL for SRV records */
+	struct mirror_stat *stat;
+	double score;
+	size_t rank;
+};
+
+static double
+fetch_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+static void
+mirror_stat_free(struct mirror_stat *stat)
+{
+	free(stat->key);
+	free(stat);
+}
+
+static void
+mirror_stats_file(struct pkg_repo *repo, char *path, size_t len)
+{
+	snprintf(path, len, "repo-%s" MIRROR_STATS_SUFFIX, pkg_repo_name(repo));
+}
+
+static bool
+mirror_stats_number(const ucl_object_t *o)
+{
+	if (ucl_object_type(o) != UCL_FLOAT && ucl_object_type(o) != UCL_INT)
+		return (false);
+	return (ucl_object_todouble(o) >= 0);
+}
+
+static void
+mirror_stats_load(struct pkg_repo *repo)
+{
+	struct ucl_parser *p;
+	ucl_object_t *obj;
+	const ucl_object_t *cur, *o, *latency, *rate, *failures;
+	ucl_object_iter_t it = NULL;
+	struct mirror_stat *stat;
+	char path[MAXPATHLEN];
+	time_t now;
+	int fd;
+
+	if (repo->mirror_stats != NULL)
+		return;
+	repo->mirror_stats = kh_init_mirror_stats();
+
+	mirror_stats_file(repo, path, sizeof(path));
+	if ((fd = openat(pkg_get_dbdirfd(), path, O_RDONLY|O_CLOEXEC)) == -1)
+		return;
+	p = ucl_parser_new(0);
+	if (!ucl_parser_add_fd(p, fd)) {
+		pkg_debug(1, "Fetch: ignoring %s: %s", path,
+		    ucl_parser_get_error(p));
+		ucl_parser_free(p);
+		close(fd);
+		return;
+	}
+	close(fd);
+	obj = ucl_parser_get_object(p);
+	ucl_parser_free(p);
+
+	now = time(NULL);
+	while ((cur = ucl_iterate_object(obj, &it, true))) {
+		/* Anything else than what mirror_stats_save() writes is dropped */
+		if (ucl_object_type(cur) != UCL_OBJECT)
+			continue;
+		o = ucl_object_find_key(cur, "updated");
+		if (ucl_object_type(o) != UCL_INT ||
+		    ucl_object_toint(o) + MIRROR_STATS_TTL < now)
+			continue;
+		latency = ucl_object_find_key(cur, "latency");
+		rate = ucl_object_find_key(cur, "rate");
+		failures = ucl_object_find_key(cur, "failures");
+		if (!mirror_stats_number(latency) ||
+		    !mirror_stats_number(rate) ||
+		    ucl_object_type(failures) != UCL_INT ||
+		    ucl_object_toint(failures) < 0)
+			continue;
+		stat = xcalloc(1, sizeof(*stat));
+		stat->key = xstrdup(ucl_object_key(cur));
+		stat->updated = ucl_object_toint(o);
+		stat->latency = ucl_object_todouble(latency);
+		stat->rate = ucl_object_todouble(rate);
+		stat->failures = MIN(ucl_object_toint(failures),
+		    MIRROR_FAILURES_MAX);
+		kh_add(mirror_stats, repo->mirror_stats, stat, stat->key,
+		    mirror_stat_free);
+	}
+	ucl_object_unref(obj);
+}
+
+static void
+mirror_stats_save(struct pkg_repo *repo)
+{
+	ucl_object_t *obj, *o;
+	struct mirror_stat *stat;
+	unsigned char *buf;
+	char path[MAXPATHLEN], tmp[MAXPATHLEN];
+	int dfd, fd;
+
+	obj = ucl_object_typed_new(UCL_OBJECT);
+	kh_each_value(repo->mirror_stats, stat, {
+		o = ucl_object_typed_new(UCL_OBJECT);
+		ucl_object_insert_key(o, ucl_object_fromdouble(stat->latency),
+		    "latency", 7, false);
+		ucl_object_insert_key(o, ucl_object_fromdouble(stat->rate),
+		    "rate", 4, false);
+		ucl_object_insert_key(o, ucl_object_fromint(stat->failures),
+		    "failures", 8, false);
+		ucl_object_insert_key(o, ucl_object_fromint(stat->updated),
+		    "updated", 7, false);
+		ucl_object_insert_key(obj, o, stat->key, 0, true);
+	});
+	buf = ucl_object_emit(obj, UCL_EMIT_JSON_COMPACT);
+	ucl_object_unref(obj);
+	if (buf == NULL)
+		return;
+
+	/* Not being able to write it only means measuring again */
+	dfd = pkg_get_dbdirfd();
+	mirror_stats_file(repo, path, sizeof(path));
+	snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid());
+	if ((fd = openat(dfd, tmp, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC,
+	    0644)) == -1) {
+		pkg_debug(1, "Fetch: cannot write %s: %s", path,
+		    strerror(errno));
+		free(buf);
+		return;
+	}
+	if (write(fd, buf, strlen(buf)) != (ssize_t)strlen(buf) ||
+	    renameat(dfd, tmp, dfd, path) == -1) {
+		pkg_debug(1, "Fetch: cannot write %s: %s", path,
+		    strerror(errno));
+		unlinkat(dfd, tmp, 0);
+	}
+	close(fd);
+	free(buf);
+}
+
+void
+pkg_fetch_mirrors_free(struct pkg_repo *repo)
+{
+	if (repo->mirror_stats_dirty)
+		mirror_stats_save(repo);
+	kh_free(mirror_stats, repo->mirror_stats, struct mirror_stat,
+	    mirror_stat_free);
+	repo->mirror_stats_dirty = false;
+}
+
+static struct mirror_stat *
+mirror_stat_get(struct pkg_repo *repo, struct mirror *m)
+{
+	struct mirror_stat *stat;
+
+	if ((stat = m->stat) == NULL) {
+		stat = xcalloc(1, sizeof(*stat));
+		stat->key = xstrdup(m->key);
+		kh_add(mirror_stats, repo->mirror_stats, stat, stat->key,
+		    mirror_stat_free);
+		m->stat = stat;
+	}
+	repo->mirror_stats_dirty = true;
+	stat->updated = time(NULL);
+
+	return (stat);
+}
+
+static double
+mirror_average(double avg, double measure)
+{
+	if (avg <= 0)
+		return (measure);
+	return (avg + MIRROR_WEIGHT * (measure - avg));
+}
+
+static void
+mirror_success(struct pkg_repo *repo, struct mirror *m, double latency)
+{
+	struct mirror_stat *stat = mirror_stat_get(repo, m);
+
+	stat->latency = mirror_average(stat->latency, latency);
+	stat->failures = 0;
+}
+
+static void
+mirror_failure(struct pkg_repo *repo, struct mirror *m)
+{
+	struct mirror_stat *stat = mirror_stat_get(repo, m);
+
+	if (stat->failures < MIRROR_FAILURES_MAX)
+		stat->failures++;
+}
+
+static void
+mirror_rate(struct pkg_repo *repo, struct mirror *m, off_t bytes,
+    double elapsed)
+{
+	struct mirror_stat *stat;
+
+	if (bytes < MIRROR_RATE_MIN_SIZE || elapsed <= 0)
+		return;
+	stat = mirror_stat_get(repo, m);
+	stat->rate = mirror_average(stat->rate, bytes / elapsed);
+}
+
+/*
+ * Expected seconds to fetch a reference package, doubled on each failure
+ * in a row.  Mirrors never measured come first so that they are.
+ */
+static double
+mirror_score(const struct mirror_stat *stat)
+{
+	double score;
+
+	if (stat == NULL)
+		return (0);
+	score = stat->latency;
+	if (stat->rate > 0)
+		score += MIRROR_REF_SIZE / stat->rate;
+	if (stat->failures > 0)
+		score = (score + 1) * (1U << stat->failures);
+
+	return (score);
+}
+
+static int
+mirror_cmp(const void *a, const void *b)
+{
+	const struct mirror *ma = a, *mb = b;
+
+	if (ma->score != mb->score)
+		return (ma->score < mb->score ? -1 : 1);
+	return (ma->rank < mb->rank ? -1 : 1);
+}
+
+/*
+ * The mirrors of the repository, best first.  SRV records keep their
+ * priority and weight order between mirrors which score the same.
+ */
+static size_t
+mirrors_rank(struct pkg_repo *repo, const char *scheme,
+    struct mirror **mirrors)
+{
+	struct dns_srvinfo *srv;
+	struct http_mirror *http;
+	struct mirror *m;
+	size_t n = 0;
+
+	if (repo->mirror_type == SRV) {
+		LL_COUNT(repo->srv, srv, n);
+	} else {
+		LL_COUNT(repo->http, http, n);
+	}
+	if (n == 0)
+		return (0);
+
+	mirror_stats_load(repo);
+	*mirrors = m = xcalloc(n, sizeof(**mirrors));
+	if (repo->mirror_type == SRV) {
+		LL_FOREACH(repo->srv, srv) {
+			m->host = srv->host;
+			m->port = srv->port;
+			snprintf(m->key, sizeof(m->key), "%s://%s:%d", scheme,
+			    m->host, m->port);
+			m++;
+		}
+	} else {
+		LL_FOREACH(repo->http, http) {
+			m->host = http->url->host;
+			m->port = http->url->port;
+			m->http = http;
+			snprintf(m->key, sizeof(m->key), "%s://%s:%d",
+			    http->url->scheme, m->host, m->port);
+			m++;
+		}
+	}
+	for (size_t i = 0; i < n; i++) {
+		m = &(*mirrors)[i];
+		kh_find(mirror_stats, repo->mirror_stats, m->key, m->stat);
+		m->score = mirror_score(m->stat);
+		m->rank = i;
+	}
+	qsort(*mirrors, n, sizeof(**mirrors), mirror_cmp);
+
+	return (n);
+}
+
+static int
+mirror_default_port(struct mirror *m, const char *scheme)
+{
+	if (m->port != 0)
+		return (m->port);
+	if (m->http != NULL)
+		scheme = m->http->url->scheme;
+	if (strcmp(scheme, "https") == 0)
+		return (443);
+	if (strcmp(scheme, "ftp") == 0)
+		return (21);
+	return (80);
+}
+
+/*
+ * Start connecting to the next address of a mirror, returns the socket
+ * or -1 once none is left
+ */
+static int
+mirror_race_connect(struct addrinfo **ai)
+{
+	struct addrinfo *cur;
+	int fd;
+
+	while ((cur = *ai) != NULL) {
+		*ai = cur->ai_next;
+		fd = socket(cur->ai_family, cur->ai_socktype, cur->ai_protocol);
+		if (fd == -1)
+			continue;
+		set_nonblocking(fd);
+		if (connect(fd, cur->ai_addr, cur->ai_addrlen) == 0 ||
+		    errno == EINPROGRESS)
+			return (fd);
+		close(fd);
+	}
+
+	return (-1);
+}
+
+/*
+ * The first request to a repository connects to the best mirrors at once
+ * and goes to the first which answers, so that a mirror gone slow since
+ * it was measured is not waited for.  Each address of a mirror is tried
+ * in turn, a mirror none of them answers for counting as a failure;
+ * losing the race does not.  fetch(3) cannot take over the connection,
+ * it is only used to pick the mirror.
+ */
+static void
+mirrors_race(struct pkg_repo *repo, const char *scheme,
+    struct mirror *mirrors, size_t n)
+{
+	struct addrinfo hints, **res, **next;
+	struct pollfd *pfd;
+	struct mirror winner;
+	char port[8];
+	size_t count, i, pending;
+	int64_t race;
+	int err, timeout;
+	socklen_t errlen;
+	double start;
+
+	if (repo->mirror_raced || n < 2)
+		return;
+	repo->mirror_raced = true;
+	race = pkg_object_int(pkg_config_get("FETCH_MIRROR_RACE"));
+	/* Through a proxy the mirrors are not connected to */
+	if (race < 2 || getenv("HTTP_PROXY") != NULL ||
+	    getenv("http_proxy") != NULL || getenv("HTTPS_PROXY") != NULL ||
+	    getenv("https_proxy") != NULL || getenv("FTP_PROXY") != NULL)
+		return;
+	count = (size_t)race < n ? (size_t)race : n;
+	pfd = xcalloc(count, sizeof(*pfd));
+	res = xcalloc(count, sizeof(*res));
+	next = xcalloc(count, sizeof(*next));
+	/* No FETCH_TIMEOUT, no limit either */
+	timeout = fetchTimeout > 0 ? fetchTimeout * 1000 : -1;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_socktype = SOCK_STREAM;
+	if ((repo->flags & REPO_FLAGS_USE_IPV4) == REPO_FLAGS_USE_IPV4)
+		hints.ai_family = AF_INET;
+	else if ((repo->flags & REPO_FLAGS_USE_IPV6) == REPO_FLAGS_USE_IPV6)
+		hints.ai_family = AF_INET6;
+
+	pending = 0;
+	start = fetch_now();
+	for (i = 0; i < count; i++) {
+		pfd[i].events = POLLOUT;
+		snprintf(port, sizeof(port), "%d",
+		    mirror_default_port(&mirrors[i], scheme));
+		if (getaddrinfo(mirrors[i].host, port, &hints, &res[i]) != 0)
+			res[i] = NULL;
+		next[i] = res[i];
+		if ((pfd[i].fd = mirror_race_connect(&next[i])) == -1)
+			mirror_failure(repo, &mirrors[i]);
+		else
+			pending++;
+	}
+
+	i = count;
+	while (pending > 0 && i == count) {
+		if (poll(pfd, count, timeout) <= 0)
+			break;
+		for (i = 0; i < count; i++) {
+			if (pfd[i].fd == -1 || pfd[i].revents == 0)
+				continue;
+			errlen = sizeof(err);
+			if (getsockopt(pfd[i].fd, SOL_SOCKET, SO_ERROR, &err,
+			    &errlen) == 0 && err == 0)
+				break;
+			close(pfd[i].fd);
+			if ((pfd[i].fd = mirror_race_connect(&next[i])) == -1) {
+				mirror_failure(repo, &mirrors[i]);
+				pending--;
+			}
+		}
+	}
+	for (size_t j = 0; j < count; j++) {
+		if (pfd[j].fd != -1)
+			close(pfd[j].fd);
+		if (res[j] != NULL)
+			freeaddrinfo(res[j]);
+	}
+	free(pfd);
+	free(res);
+	free(next);
+	if (i >= count)
+		return;
+
+	pkg_debug(1, "Fetch: %s connected first, in %.3fs", mirrors[i].key,
+	    fetch_now() - start);
+	winner = mirrors[i];
+	memmove(&mirrors[1], &mirrors[0], i * sizeof(*mirrors));
+	mirrors[0] = winner;
+}
+
+/*
+ * Whether the transfer from the current mirror is so much slower than
+ * another healthy mirror was measured at that it is worth starting over
+ * from where it stopped elsewhere.
+ */
+static bool
+mirror_stalled(struct mirror *mirrors, size_t n, size_t cur, double rate)
+{
+	double best = 0;
+
+	for (size_t i = 0; i < n; i++) {
+		if (i == cur || mirrors[i].stat == NULL ||
+		    mirrors[i].stat->failures > 0)
+			continue;
+		if (mirrors[i].stat->rate > best)
+			best = mirrors[i].stat->rate;
+	}
+
+	return (rate * MIRROR_STALL_FACTOR < best);
+}
+
 int
 pkg_fetch_file_tmp(struct pkg_repo *repo, const char *url, char *dest,
 	time_t t)
@@ -306,6 +816,22 @@ ssh_write(void *data, const char *buf, int l)
 	return (ssh_writev(repo->sshio.out, &iov, 1));
 }
 
+/* Number of requests the client keeps outstanding on an ssh connection */
+#define SSH_PIPELINE_DEPTH	32
+
+static void
+ssh_free_pending(struct pkg_repo *repo)
+{
+	struct ssh_request *req, *tmp;
+
+	LL_FOREACH_SAFE(repo->sshio.pending, req, tmp) {
+		LL_DELETE(repo->sshio.pending, req);
+		free(req->doc);
+		free(req);
+	}
+	repo->sshio.inflight = 0;
+}
+
 static int
 ssh_close(void *data)
 {
@@ -313,6 +839,10 @@ ssh_close(void *data)
 	int pstat;
 
 	write(repo->sshio.out, "quit\n", 5);
+	close(repo->sshio.out);
+	/* Unblock a server still writing answers nobody will read */
+	close(repo->sshio.in);
+	ssh_free_pending(repo);
 
 	while (waitpid(repo->sshio.pid, &pstat, 0) == -1) {
 		if (errno != EINTR)
@@ -325,100 +855,170 @@ ssh_close(void *data)
 }
 
 static int
-start_ssh(struct pkg_repo *repo, struct url *u, off_t *sz)
+ssh_connect(struct pkg_repo *repo, struct url *u)
 {
 	char *line = NULL;
 	size_t linecap = 0;
-	size_t linelen;
 	UT_string *cmd = NULL;
-	const char *errstr;
-	const char *ssh_args;
+	const char *ssh, *ssh_args;
 	int sshin[2];
 	int sshout[2];
 	int retcode = EPKG_FATAL;
 	const char *argv[4];
 
+	ssh = pkg_object_string(pkg_config_get("PKG_SSH"));
 	ssh_args = pkg_object_string(pkg_config_get("PKG_SSH_ARGS"));
 
-	if (repo->ssh == NULL) {
-		/* Use socket pair because pipe have blocking issues */
-		if (socketpair(AF_UNIX, SOCK_STREAM, 0, sshin) <0 ||
-		    socketpair(AF_UNIX, SOCK_STREAM, 0, sshout) < 0)
-			return(EPKG_FATAL);
+	/* Use socket pair because pipe have blocking issues */
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sshin) <0 ||
+	    socketpair(AF_UNIX, SOCK_STREAM, 0, sshout) < 0)
+		return(EPKG_FATAL);
+
+	repo->sshio.pid = fork();
+	if (repo->sshio.pid == -1) {
+		pkg_emit_errno("Cannot fork", "start_ssh");
+		goto ssh_cleanup;
+	}
 
-		repo->sshio.pid = fork();
-		if (repo->sshio.pid == -1) {
-			pkg_emit_errno("Cannot fork", "start_ssh");
+	if (repo->sshio.pid == 0) {
+		if (dup2(sshin[0], STDIN_FILENO) < 0 ||
+		    close(sshin[1]) < 0 ||
+		    close(sshout[0]) < 0 ||
+		    dup2(sshout[1], STDOUT_FILENO) < 0) {
+			pkg_emit_errno("Cannot prepare pipes", "start_ssh");
 			goto ssh_cleanup;
 		}
 
-		if (repo->sshio.pid == 0) {
-			if (dup2(sshin[0], STDIN_FILENO) < 0 ||
-			    close(sshin[1]) < 0 ||
-			    close(sshout[0]) < 0 ||
-			    dup2(sshout[1], STDOUT_FILENO) < 0) {
-				pkg_emit_errno("Cannot prepare pipes", "start_ssh");
-				goto ssh_cleanup;
-			}
+		utstring_new(cmd);
+		utstring_printf(cmd, "%s -e none -T ", ssh);
+		if (ssh_args != NULL)
+			utstring_printf(cmd, "%s ", ssh_args);
+		if ((repo->flags & REPO_FLAGS_USE_IPV4) == REPO_FLAGS_USE_IPV4)
+			utstring_printf(cmd, "-4 ");
+		else if ((repo->flags & REPO_FLAGS_USE_IPV6) == REPO_FLAGS_USE_IPV6)
+			utstring_printf(cmd, "-6 ");
+		if (u->port > 0)
+			utstring_printf(cmd, "-p %d ", u->port);
+		if (u->user[0] != '\0')
+			utstring_printf(cmd, "%s@", u->user);
+		utstring_printf(cmd, "%s", u->host);
+		utstring_printf(cmd, " pkg ssh");
+		pkg_debug(1, "Fetch: running '%s'", utstring_body(cmd));
+		argv[0] = _PATH_BSHELL;
+		argv[1] = "-c";
+		argv[2] = utstring_body(cmd);
+		argv[3] = NULL;
+
+		if (sshin[0] != STDIN_FILENO)
+			close(sshin[0]);
+		if (sshout[1] != STDOUT_FILENO)
+			close(sshout[1]);
+		execvp(argv[0], __DECONST(char **, argv));
+		/* NOT REACHED */
+	}
 
-			utstring_new(cmd);
-			utstring_printf(cmd, "/usr/bin/ssh -e none -T ");
-			if (ssh_args != NULL)
-				utstring_printf(cmd, "%s ", ssh_args);
-			if ((repo->flags & REPO_FLAGS_USE_IPV4) == REPO_FLAGS_USE_IPV4)
-				utstring_printf(cmd, "-4 ");
-			else if ((repo->flags & REPO_FLAGS_USE_IPV6) == REPO_FLAGS_USE_IPV6)
-				utstring_printf(cmd, "-6 ");
-			if (u->port > 0)
-				utstring_printf(cmd, "-p %d ", u->port);
-			if (u->user[0] != '\0')
-				utstring_printf(cmd, "%s@", u->user);
-			utstring_printf(cmd, "%s", u->host);
-			utstring_printf(cmd, " pkg ssh");
-			pkg_debug(1, "Fetch: running '%s'", utstring_body(cmd));
-			argv[0] = _PATH_BSHELL;
-			argv[1] = "-c";
-			argv[2] = utstring_body(cmd);
-			argv[3] = NULL;
-
-			if (sshin[0] != STDIN_FILENO)
-				close(sshin[0]);
-			if (sshout[1] != STDOUT_FILENO)
-				close(sshout[1]);
-			execvp(argv[0], __DECONST(char **, argv));
-			/* NOT REACHED */
-		}
+	if (close(sshout[1]) < 0 || close(sshin[0]) < 0) {
+		pkg_emit_errno("Failed to close pipes", "start_ssh");
+		goto ssh_cleanup;
+	}
 
-		if (close(sshout[1]) < 0 || close(sshin[0]) < 0) {
-			pkg_emit_errno("Failed to close pipes", "start_ssh");
-			goto ssh_cleanup;
-		}
+	pkg_debug(1, "SSH> connected");
 
-		pkg_debug(1, "SSH> connected");
+	repo->sshio.in = sshout[0];
+	repo->sshio.out = sshin[1];
+	repo->sshio.pending = NULL;
+	repo->sshio.inflight = 0;
+	set_nonblocking(repo->sshio.in);
 
-		repo->sshio.in = sshout[0];
-		repo->sshio.out = sshin[1];
-		set_nonblocking(repo->sshio.in);
+	repo->ssh = funopen(repo, ssh_read, ssh_write, NULL, ssh_close);
+	if (repo->ssh == NULL) {
+		pkg_emit_errno("Failed to open stream", "start_ssh");
+		goto ssh_cleanup;
+	}
 
-		repo->ssh = funopen(repo, ssh_read, ssh_write, NULL, ssh_close);
-		if (repo->ssh == NULL) {
-			pkg_emit_errno("Failed to open stream", "start_ssh");
+	if (getline(&line, &linecap, repo->ssh) > 0) {
+		if (strncmp(line, "ok:", 3) != 0) {
+			pkg_debug(1, "SSH> server rejected, got: %s", line);
 			goto ssh_cleanup;
 		}
+		pkg_debug(1, "SSH> server is: %s", line +4);
+	} else {
+		pkg_debug(1, "SSH> nothing to read, got: %s", line);
+		goto ssh_cleanup;
+	}
+	retcode = EPKG_OK;
 
-		if (getline(&line, &linecap, repo->ssh) > 0) {
-			if (strncmp(line, "ok:", 3) != 0) {
-				pkg_debug(1, "SSH> server rejected, got: %s", line);
-				goto ssh_cleanup;
-			}
-			pkg_debug(1, "SSH> server is: %s", line +4);
-		} else {
-			pkg_debug(1, "SSH> nothing to read, got: %s", line);
-			goto ssh_cleanup;
-		}
+ssh_cleanup:
+	if (retcode == EPKG_FATAL && repo->ssh != NULL) {
+		fclose(repo->ssh);
+		repo->ssh = NULL;
 	}
-	pkg_debug(1, "SSH> get %s %" PRIdMAX "", u->doc, (intmax_t)u->ims_time);
-	fprintf(repo->ssh, "get %s %" PRIdMAX "\n", u->doc, (intmax_t)u->ims_time);
+	if (cmd != NULL)
+		utstring_free(cmd);
+	free(line);
+	return (retcode);
+}
+
+/*
+ * Requests bypass the stdio stream: answers to earlier requests may still
+ * sit in its read buffer, and switching it to write mode would drop them.
+ */
+static int
+ssh_send_request(struct pkg_repo *repo, struct ssh_request *req)
+{
+	char *cmd;
+	int len, ret;
+
+	pkg_debug(1, "SSH> get %s %" PRIdMAX "", req->doc, (intmax_t)req->ims);
+	len = xasprintf(&cmd, "get %s %" PRIdMAX "\n", req->doc,
+	    (intmax_t)req->ims);
+	ret = ssh_write(repo, cmd, len);
+	free(cmd);
+	if (ret != len)
+		return (EPKG_FATAL);
+
+	req->sent = true;
+	repo->sshio.inflight++;
+
+	return (EPKG_OK);
+}
+
+/*
+ * Keep up to SSH_PIPELINE_DEPTH requests on the wire so the server never
+ * waits for us; answers come back in the order the requests were sent.
+ */
+static int
+ssh_fill_pipeline(struct pkg_repo *repo)
+{
+	struct ssh_request *req;
+
+	LL_FOREACH(repo->sshio.pending, req) {
+		if (repo->sshio.inflight >= SSH_PIPELINE_DEPTH)
+			break;
+		if (req->sent)
+			continue;
+		if (ssh_send_request(repo, req) != EPKG_OK)
+			return (EPKG_FATAL);
+	}
+
+	return (EPKG_OK);
+}
+
+/*
+ * Read the answer header of the oldest request sent.  A 'ko:' answer is a
+ * regular failure that leaves the stream usable; *broken is set when the
+ * connection cannot be trusted anymore.
+ */
+static int
+ssh_read_response(struct pkg_repo *repo, off_t *sz, bool *broken)
+{
+	char *line = NULL;
+	size_t linecap = 0;
+	ssize_t linelen;
+	const char *errstr;
+	int retcode = EPKG_FATAL;
+
+	*broken = true;
 	if ((linelen = getline(&line, &linecap, repo->ssh)) > 0) {
 		if (line[linelen -1 ] == '\n')
 			line[linelen -1 ] = '\0';
@@ -426,28 +1026,145 @@ start_ssh(struct pkg_repo *repo, struct url *u, off_t *sz)
 		pkg_debug(1, "SSH> recv: %s", line);
 		if (strncmp(line, "ok:", 3) == 0) {
 			*sz = strtonum(line + 4, 0, LONG_MAX, &errstr);
-			if (errstr) {
-				goto ssh_cleanup;
+			if (errstr == NULL) {
+				*broken = false;
+				retcode = (*sz == 0) ? EPKG_UPTODATE : EPKG_OK;
 			}
+		} else if (strncmp(line, "ko:", 3) == 0) {
+			*broken = false;
+		}
+	}
+	free(line);
 
-			if (*sz == 0) {
-				retcode = EPKG_UPTODATE;
+	return (retcode);
+}
+
+/* Consume the answer of a request whose content is not wanted anymore */
+static int
+ssh_skip_response(struct pkg_repo *repo)
+{
+	char buf[8192];
+	off_t sz = 0;
+	size_t r;
+	bool broken;
+
+	if (ssh_read_response(repo, &sz, &broken) == EPKG_OK) {
+		while (sz > 0) {
+			r = fread(buf, 1, MIN((off_t)sizeof(buf), sz), repo->ssh);
+			if (r == 0)
+				return (EPKG_FATAL);
+			sz -= r;
+		}
+	}
+
+	return (broken ? EPKG_FATAL : EPKG_OK);
+}
+
+static int
+start_ssh(struct pkg_repo *repo, struct url *u, off_t *sz)
+{
+	struct ssh_request *req, *skip;
+	int retcode = EPKG_FATAL;
+	bool broken = true;
+
+	if (repo->ssh == NULL && ssh_connect(repo, u) != EPKG_OK)
+		return (EPKG_FATAL);
+
+	LL_FOREACH(repo->sshio.pending, req) {
+		if (req->ims == u->ims_time && strcmp(req->doc, u->doc) == 0)
+			break;
+	}
+
+	if (req == NULL) {
+		req = xcalloc(1, sizeof(*req));
+		req->doc = xstrdup(u->doc);
+		req->ims = u->ims_time;
+		LL_APPEND(repo->sshio.pending, req);
+	}
+
+	/* Drop whatever was queued before this request and not fetched */
+	while (repo->sshio.pending != req) {
+		skip = repo->sshio.pending;
+		LL_DELETE(repo->sshio.pending, skip);
+		if (skip->sent) {
+			repo->sshio.inflight--;
+			pkg_debug(1, "SSH> skipping answer for %s", skip->doc);
+			if (ssh_skip_response(repo) != EPKG_OK) {
+				free(skip->doc);
+				free(skip);
 				goto ssh_cleanup;
 			}
-
-			retcode = EPKG_OK;
-			goto ssh_cleanup;
 		}
+		free(skip->doc);
+		free(skip);
 	}
 
+	if (!req->sent && ssh_send_request(repo, req) != EPKG_OK)
+		goto ssh_cleanup;
+
+	LL_DELETE(repo->sshio.pending, req);
+	repo->sshio.inflight--;
+	free(req->doc);
+	free(req);
+
+	if (ssh_fill_pipeline(repo) != EPKG_OK)
+		goto ssh_cleanup;
+
+	retcode = ssh_read_response(repo, sz, &broken);
+
 ssh_cleanup:
-	if (retcode == EPKG_FATAL && repo->ssh != NULL) {
+	if (broken && repo->ssh != NULL) {
 		fclose(repo->ssh);
 		repo->ssh = NULL;
+		retcode = EPKG_FATAL;
 	}
-	if (cmd != NULL)
-		utstring_free(cmd);
-	free(line);
+	return (retcode);
+}
+
+/*
+ * Announce a file that is going to be fetched soon.  Only the ssh transport
+ * can do something useful with it: the request is pipelined so its answer
+ * is ready when pkg_fetch_file_to_fd() asks for the same url.
+ */
+int
+pkg_fetch_ssh_queue(struct pkg_repo *repo, const char *url)
+{
+	struct ssh_request *req;
+	struct url *u;
+	struct pkg_kv *envtorestore = NULL;
+	struct pkg_kv *envtounset = NULL;
+	int retcode = EPKG_OK;
+
+	if ((u = fetchParseURL(url)) == NULL) {
+		pkg_emit_error("%s: parse error", url);
+		return (EPKG_FATAL);
+	}
+
+	if (strcmp(u->scheme, "ssh") != 0)
+		goto cleanup;
+
+	fetchTimeout = (int)pkg_object_int(pkg_config_get("FETCH_TIMEOUT"));
+	fetch_env_set(repo, &envtorestore, &envtounset);
+
+	if (repo->ssh == NULL && ssh_connect(repo, u) != EPKG_OK) {
+		retcode = EPKG_FATAL;
+		goto cleanup;
+	}
+
+	req = xcalloc(1, sizeof(*req));
+	req->doc = xstrdup(u->doc);
+	LL_APPEND(repo->sshio.pending, req);
+
+	if (ssh_fill_pipeline(repo) != EPKG_OK) {
+		fclose(repo->ssh);
+		repo->ssh = NULL;
+		retcode = EPKG_FATAL;
+	}
+
+cleanup:
+	fetch_env_restore(&envtorestore, &envtounset);
+	fetchFreeURL(u);
+
 	return (retcode);
 }
 
@@ -460,10 +1177,8 @@ pkg_fetch_file_to_fd(struct pkg_repo *repo, const char *url, int dest,
 	FILE		*remote = NULL;
 	struct url	*u = NULL;
 	struct url_stat	 st;
-	struct pkg_kv	*kv, *kvtmp;
 	struct pkg_kv	*envtorestore = NULL;
 	struct pkg_kv	*envtounset = NULL;
-	char		*tmp;
 	off_t		 done = 0;
 	off_t		 r;
 	int64_t		 max_retry, retry;
@@ -473,12 +1188,20 @@ pkg_fetch_file_to_fd(struct pkg_repo *repo, const char *url, int dest,
 	char		 docpath[MAXPATHLEN];
 	int		 retcode = EPKG_OK;
 	char		 zone[MAXHOSTNAMELEN + 13];
-	struct dns_srvinfo	*srv_current = NULL;
-	struct http_mirror	*http_current = NULL;
+	struct mirror	*mirrors = NULL;
+	struct mirror	*m = NULL;
+	size_t		 nmirrors = 0, cur = 0;
+	double		 begin, now, window = 0;
 	off_t		 sz = 0;
+	off_t		 resumed = 0, windone = 0;
+	off_t		 firstsize = -1;
+	time_t		 firstmtime = 0;
 	size_t		 buflen = 0;
 	size_t		 left = 0;
 	bool		 pkg_url_scheme = false;
+	bool		 transfer = false;
+	bool		 stalled = false;
+	bool		 begun = false;
 	UT_string	*fetchOpts = NULL;
 
 	max_retry = pkg_object_int(pkg_config_get("FETCH_RETRY"));
@@ -517,19 +1240,7 @@ pkg_fetch_file_to_fd(struct pkg_repo *repo, const char *url, int dest,
 		pkg_url_scheme = true;
 	}
 
-	if (repo != NULL) {
-		LL_FOREACH(repo->env, kv) {
-			kvtmp = xcalloc(1, sizeof(*kvtmp));
-			kvtmp->key = xstrdup(kv->key);
-			if ((tmp = getenv(kv->key)) != NULL) {
-				kvtmp->value = xstrdup(tmp);
-				DL_APPEND(envtorestore, kvtmp);
-			} else {
-				DL_APPEND(envtounset, kvtmp);
-			}
-			setenv(kv->key, kv->value, 1);
-		}
-	}
+	fetch_env_set(repo, &envtorestore, &envtounset);
 
 	u = fetchParseURL(url);
 	if (u == NULL) {
@@ -537,6 +1248,7 @@ pkg_fetch_file_to_fd(struct pkg_repo *repo, const char *url, int dest,
 		/* Too early for there to be anything to cleanup */
 		return(EPKG_FATAL);
 	}
+	pkg_trace_begin("fetch", url);
 
 	if (t != NULL)
 		u->ims_time = *t;
@@ -548,6 +1260,7 @@ pkg_fetch_file_to_fd(struct pkg_repo *repo, const char *url, int dest,
 	}
 
 	doc = u->doc;
+again:
 	while (remote == NULL) {
 		if (retry == max_retry) {
 			if (repo != NULL && repo->mirror_type == SRV &&
@@ -563,7 +1276,8 @@ pkg_fetch_file_to_fd(struct pkg_repo *repo, const char *url, int dest,
 				    "_%s._tcp.%s", u->scheme, u->host);
 				if (repo->srv == NULL)
 					repo->srv = dns_getsrvinfo(zone);
-				srv_current = repo->srv;
+				nmirrors = mirrors_rank(repo, u->scheme,
+				    &mirrors);
 			} else if (repo != NULL && repo->mirror_type == HTTP &&
 			           strncmp(u->scheme, "http", 4) == 0) {
 				if (u->port == 0) {
@@ -576,20 +1290,25 @@ pkg_fetch_file_to_fd(struct pkg_repo *repo, const char *url, int dest,
 				    "%s://%s:%d", u->scheme, u->host, u->port);
 				if (repo->http == NULL)
 					gethttpmirrors(repo, zone);
-				http_current = repo->http;
+				nmirrors = mirrors_rank(repo, u->scheme,
+				    &mirrors);
 			}
+			if (nmirrors > 0)
+				mirrors_race(repo, u->scheme, mirrors,
+				    nmirrors);
 		}
 
-		if (repo != NULL && repo->mirror_type == SRV && repo->srv != NULL) {
-			strlcpy(u->host, srv_current->host, sizeof(u->host));
-			u->port = srv_current->port;
+		m = nmirrors > 0 ? &mirrors[cur] : NULL;
+		if (m != NULL && m->http == NULL) {
+			strlcpy(u->host, m->host, sizeof(u->host));
+			u->port = m->port;
 		}
-		else if (repo != NULL && repo->mirror_type == HTTP && repo->http != NULL) {
-			strlcpy(u->scheme, http_current->url->scheme, sizeof(u->scheme));
-			strlcpy(u->host, http_current->url->host, sizeof(u->host));
-			snprintf(docpath, sizeof(docpath), "%s%s", http_current->url->doc, doc);
+		else if (m != NULL) {
+			strlcpy(u->scheme, m->http->url->scheme, sizeof(u->scheme));
+			strlcpy(u->host, m->host, sizeof(u->host));
+			snprintf(docpath, sizeof(docpath), "%s%s", m->http->url->doc, doc);
 			u->doc = docpath;
-			u->port = http_current->url->port;
+			u->port = m->port;
 		}
 
 		utstring_new(fetchOpts);
@@ -616,6 +1335,7 @@ pkg_fetch_file_to_fd(struct pkg_repo *repo, const char *url, int dest,
 
 		if (offset > 0)
 			u->offset = offset;
+		begin = fetch_now();
 		remote = fetchXGet(u, &st, utstring_body(fetchOpts));
 		utstring_free(fetchOpts);
 		if (remote == NULL) {
@@ -624,44 +1344,103 @@ pkg_fetch_file_to_fd(struct pkg_repo *repo, const char *url, int dest,
 				goto cleanup;
 			}
 			--retry;
+			if (m != NULL && fetchLastErrCode != FETCH_UNAVAIL)
+				mirror_failure(repo, m);
 			if (retry <= 0 || fetchLastErrCode == FETCH_UNAVAIL) {
 				pkg_emit_error("%s: %s", url,
 				    fetchLastErrString);
 				retcode = EPKG_FATAL;
 				goto cleanup;
 			}
-			if (repo != NULL && repo->mirror_type == SRV && repo->srv != NULL) {
-				srv_current = srv_current->next;
-				if (srv_current == NULL)
-					srv_current = repo->srv;
-			} else if (repo != NULL && repo->mirror_type == HTTP && repo->http != NULL) {
-				http_current = repo->http->next;
-				if (http_current == NULL)
-					http_current = repo->http;
-			} else {
+			if (m != NULL)
+				cur = (cur + 1) % nmirrors;
+			else
 				sleep(1);
-			}
-		}
+		} else if (m != NULL)
+			mirror_success(repo, m, fetch_now() - begin);
 	}
 
 	if (strcmp(u->scheme, "ssh") != 0) {
-		if (t != NULL && st.mtime != 0) {
+		/* After a change of mirror, *t is already the one sent */
+		if (t != NULL && st.mtime != 0 && !begun) {
 			if (st.mtime <= *t) {
 				retcode = EPKG_UPTODATE;
 				goto cleanup;
 			} else
 				*t = st.mtime;
 		}
+		/*
+		 * Another mirror may serve another version of the file: only
+		 * complete what the first one sent with the same one, fetch
+		 * the other from the start
+		 */
+		if (begun && offset > 0 &&
+		    (st.size != firstsize || st.mtime != firstmtime)) {
+			pkg_debug(1, "Fetch: %s serves another version of %s, "
+			    "restarting at 0", m != NULL ? m->key : u->host,
+			    doc);
+			fclose(remote);
+			remote = NULL;
+			if (ftruncate(dest, 0) == -1 ||
+			    lseek(dest, 0, SEEK_SET) == -1) {
+				pkg_emit_errno("ftruncate", url);
+				retcode = EPKG_FATAL;
+				goto cleanup;
+			}
+			offset = 0;
+			u->offset = 0;
+			goto again;
+		}
+		if (t != NULL && st.mtime != 0 && begun)
+			*t = st.mtime;
+		firstsize = st.size;
+		firstmtime = st.mtime;
 		sz = st.size;
+		/*
+		 * The server may ignore the Range request and send the
+		 * whole file, or start earlier than asked: drop what we
+		 * have past the offset it actually gave us.  dest is not
+		 * always opened with O_APPEND, write from there too.
+		 */
+		if (offset > 0 && u->offset != offset) {
+			pkg_debug(1, "Resume at %jd refused, restarting at %jd",
+			    (intmax_t)offset, (intmax_t)u->offset);
+			if (ftruncate(dest, u->offset) == -1 ||
+			    lseek(dest, u->offset, SEEK_SET) == -1) {
+				pkg_emit_errno("ftruncate", url);
+				retcode = EPKG_FATAL;
+				goto cleanup;
+			}
+			offset = u->offset;
+		}
 	}
 
 	if (sz <= 0 && size > 0)
 		sz = size;
 
-	pkg_emit_fetch_begin(url);
-	pkg_emit_progress_start(NULL);
+	transfer = true;
+	if (offset > 0 && repo != NULL && remote == repo->ssh) {
+		/* The ssh server always sends whole files */
+		left = offset;
+		while (left > 0 && (r = fread(buf, 1,
+		    left < sizeof(buf) ? left : sizeof(buf), remote)) > 0)
+			left -= r;
+		if (left > 0) {
+			pkg_emit_error("An error occurred while fetching package");
+			retcode = EPKG_FATAL;
+			goto cleanup;
+		}
+	}
+
+	if (!begun) {
+		pkg_emit_fetch_begin(url);
+		pkg_emit_progress_start(NULL);
+		begun = true;
+	}
 	if (offset > 0)
 		done += offset;
+	resumed = windone = done;
+	begin = window = fetch_now();
 	buflen = sizeof(buf);
 	left = sizeof(buf);
 	if (sz > 0)
@@ -672,6 +1451,7 @@ pkg_fetch_file_to_fd(struct pkg_repo *repo, const char *url, int dest,
 			retcode = EPKG_FATAL;
 			goto cleanup;
 		}
+		pkg_trace_count(PKG_TRACE_BYTES, r);
 		done += r;
 		if (sz > 0) {
 			left -= r;
@@ -680,6 +1460,39 @@ pkg_fetch_file_to_fd(struct pkg_repo *repo, const char *url, int dest,
 			pkg_debug(4, "Read status: %jd", (intmax_t)done);
 		if (sz > 0)
 			pkg_emit_progress_tick(done, sz);
+		if (nmirrors > 1 && retry > 1 &&
+		    (now = fetch_now()) - window >= MIRROR_STALL_WINDOW) {
+			if (mirror_stalled(mirrors, nmirrors, cur,
+			    (done - windone) / (now - window))) {
+				stalled = true;
+				break;
+			}
+			window = now;
+			windone = done;
+		}
+	}
+
+	if (m != NULL)
+		mirror_rate(repo, m, done - resumed, fetch_now() - begin);
+	/*
+	 * Go on from another mirror when this one stalls or breaks, a
+	 * connection closed early is only an end of file to fetch(3)
+	 */
+	if (m != NULL && nmirrors > 1 && retry > 1 &&
+	    (stalled || (sz > 0 ? done < sz : ferror(remote)))) {
+		pkg_debug(1, "Fetch: %s stalled at %jd, changing mirror",
+		    m->key, (intmax_t)done);
+		mirror_failure(repo, m);
+		fclose(remote);
+		remote = NULL;
+		stalled = false;
+		--retry;
+		cur = (cur + 1) % nmirrors;
+		offset = done;
+		done = 0;
+		/* The file is not up to date anymore once it is begun */
+		u->ims_time = 0;
+		goto again;
 	}
 
 	if (r != 0) {
@@ -698,21 +1511,17 @@ pkg_fetch_file_to_fd(struct pkg_repo *repo, const char *url, int dest,
 	}
 
 cleanup:
-	if (repo != NULL) {
-		LL_FOREACH_SAFE(envtorestore, kv, kvtmp) {
-			setenv(kv->key, kv->value, 1);
-			LL_DELETE(envtorestore, kv);
-			pkg_kv_free(kv);
-		}
-		LL_FOREACH_SAFE(envtounset, kv, kvtmp) {
-			unsetenv(kv->key);
-			pkg_kv_free(kv);
-		}
-	}
+	fetch_env_restore(&envtorestore, &envtounset);
 
 	if (u != NULL) {
 		if (remote != NULL &&  repo != NULL && remote != repo->ssh)
 			fclose(remote);
+		else if (remote != NULL && repo != NULL && transfer &&
+		    retcode != EPKG_OK) {
+			/* an interrupted answer leaves the ssh stream unusable */
+			fclose(repo->ssh);
+			repo->ssh = NULL;
+		}
 	}
 
 	if (retcode == EPKG_OK) {
@@ -732,6 +1541,8 @@ cleanup:
 	/* restore original doc */
 	u->doc = doc;
 	fetchFreeURL(u);
+	free(mirrors);
+	pkg_trace_end();
 
 	return (retcode);
 }
@@ -31,6 +31,7 @@
 #include <assert.h>
 #include <fcntl.h>
 #include <fts.h>
+#include <inttypes.h>
 #include <string.h>
 #include <pwd.h>
 #include <grp.h>
@@ -40,6 +41,7 @@
 #include "private/pkg.h"
 
 static const char *packing_set_format(struct archive *a, pkg_formats format);
+static void packing_set_filter_options(struct archive *a, pkg_formats format);
 
 struct packing {
 	struct archive *aread;
@@ -72,6 +74,7 @@ packing_init(struct packing **pack, const char *path, pkg_formats format)
 		*pack = NULL;
 		return EPKG_FATAL; /* error set by _set_format() */
 	}
+	packing_set_filter_options((*pack)->awrite, format);
 	snprintf(archive_path, sizeof(archive_path), "%s.%s", path,
 	    ext);
 
@@ -132,6 +135,21 @@ packing_append_file_attr(struct packing *pack, const char *filepath,
     const char *newpath, const char *uname, const char *gname, mode_t perm,
     u_long fflags)
 {
+
+	return (packing_append_file_data(pack, filepath, newpath, uname, gname,
+	    perm, fflags, NULL, 0));
+}
+
+/*
+ * Same as packing_append_file_attr() but the content of a regular file is
+ * taken from data when the caller already has it in memory.  The file is
+ * read again if its size no longer matches datalen.
+ */
+int
+packing_append_file_data(struct packing *pack, const char *filepath,
+    const char *newpath, const char *uname, const char *gname, mode_t perm,
+    u_long fflags, const void *data, size_t datalen)
+{
 	int fd;
 	int retcode = EPKG_OK;
 	int ret;
@@ -217,6 +235,14 @@ packing_append_file_attr(struct packing *pack, const char *filepath,
 	if (archive_entry_size(entry) <= 0)
 		goto cleanup;
 
+	if (data != NULL && archive_entry_size(entry) == (int64_t)datalen) {
+		if (archive_write_data(pack->awrite, data, datalen) == -1) {
+			pkg_emit_errno("archive_write_data", "archive write error");
+			retcode = EPKG_FATAL;
+		}
+		goto cleanup;
+	}
+
 	if ((fd = open(filepath, O_RDONLY)) < 0) {
 		pkg_emit_errno("open", filepath);
 		retcode = EPKG_FATAL;
@@ -242,6 +268,35 @@ cleanup:
 	return (retcode);
 }
 
+/*
+ * Append the header of an entry taken from another archive, its data, if
+ * any, follows through packing_append_data().
+ */
+int
+packing_append_entry(struct packing *pack, struct archive_entry *entry)
+{
+	if (archive_write_header(pack->awrite, entry) != ARCHIVE_OK) {
+		pkg_emit_error("archive_write_header(%s): %s",
+		    archive_entry_pathname(entry),
+		    archive_error_string(pack->awrite));
+		return (EPKG_FATAL);
+	}
+
+	return (EPKG_OK);
+}
+
+int
+packing_append_data(struct packing *pack, const void *buf, size_t len)
+{
+	if (archive_write_data(pack->awrite, buf, len) == -1) {
+		pkg_emit_error("archive_write_data: %s",
+		    archive_error_string(pack->awrite));
+		return (EPKG_FATAL);
+	}
+
+	return (EPKG_OK);
+}
+
 int
 packing_append_tree(struct packing *pack, const char *treepath,
     const char *newroot)
@@ -315,6 +370,12 @@ packing_set_format(struct archive *a, pkg_formats format)
 	const char *notsupp_fmt = "%s is not supported, trying %s";
 
 	switch (format) {
+	case TZS:
+#ifdef HAVE_ARCHIVE_WRITE_ADD_FILTER_ZSTD
+		if (archive_write_add_filter_zstd(a) == ARCHIVE_OK)
+			return ("tzst");
+#endif
+		pkg_emit_error(notsupp_fmt, "zstd", "xz");
 	case TXZ:
 		if (archive_write_add_filter_xz(a) == ARCHIVE_OK)
 			return ("txz");
@@ -337,6 +398,39 @@ packing_set_format(struct archive *a, pkg_formats format)
 	return (NULL);
 }
 
+/*
+ * Apply COMPRESSION_LEVEL and COMPRESSION_THREADS to the compression
+ * filter, -1 keeps the libarchive default.  A filter that does not know
+ * an option (threads only exist for xz and zstd) is not an error.
+ */
+static void
+packing_set_filter_options(struct archive *a, pkg_formats format)
+{
+	char buf[16];
+	int64_t level, threads;
+
+	if (format == TAR)
+		return;
+
+	level = pkg_object_int(pkg_config_get("COMPRESSION_LEVEL"));
+	threads = pkg_object_int(pkg_config_get("COMPRESSION_THREADS"));
+
+	if (level >= 0) {
+		snprintf(buf, sizeof(buf), "%"PRId64, level);
+		if (archive_write_set_filter_option(a, NULL,
+		    "compression-level", buf) != ARCHIVE_OK)
+			pkg_emit_error("Invalid compression level %s: %s",
+			    buf, archive_error_string(a));
+	}
+	if (threads >= 0) {
+		snprintf(buf, sizeof(buf), "%"PRId64, threads);
+		if (archive_write_set_filter_option(a, NULL, "threads",
+		    buf) != ARCHIVE_OK)
+			pkg_debug(1, "compression filter ignored threads=%s",
+			    buf);
+	}
+}
+
 pkg_formats
 packing_format_from_string(const char *str)
 {
@@ -344,6 +438,8 @@ packing_format_from_string(const char *str)
 		return TXZ;
 	if (strcmp(str, "txz") == 0)
 		return TXZ;
+	if (strcmp(str, "tzst") == 0)
+		return TZS;
 	if (strcmp(str, "tbz") == 0)
 		return TBZ;
 	if (strcmp(str, "tgz") == 0)
@@ -363,6 +459,9 @@ packing_format_to_string(pkg_formats format)
 	case TXZ:
 		res = "txz";
 		break;
+	case TZS:
+		res = "tzst";
+		break;
 	case TBZ:
 		res = "tbz";
 		break;
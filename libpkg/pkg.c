@@ -106,6 +106,8 @@ pkg_free(struct pkg *pkg)
 	DL_FREE(pkg->message, pkg_message_free);
 	DL_FREE(pkg->annotations, pkg_kv_free);
 
+	pkg_dir_to_del_free(pkg);
+
 	if (pkg->rootfd != -1)
 		close(pkg->rootfd);
 
@@ -1553,9 +1555,13 @@ pkg_test_filesum(struct pkg *pkg)
 
 	assert(pkg != NULL);
 
+	if (pkg_open_root_fd(pkg) != EPKG_OK)
+		return (EPKG_FATAL);
+
 	while (pkg_files(pkg, &f) == EPKG_OK) {
 		if (f->sum != NULL) {
-			ret = pkg_checksum_validate_file(f->path, f->sum);
+			ret = pkg_checksum_validate_fileat(pkg->rootfd,
+			    RELATIVE_PATH(f->path), f->sum);
 			if (ret != 0) {
 				if (ret == ENOENT)
 					pkg_emit_file_missing(pkg, f);
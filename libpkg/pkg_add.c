@@ -61,6 +61,12 @@ KHASH_MAP_INIT_INT(hls, char *);
 static const unsigned char litchar[] =
 "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
 
+/* Files left in place by the current extraction */
+static struct {
+	int files;
+	int64_t bytes;
+} unchanged;
+
 static void
 pkg_add_file_random_suffix(char *buf, int buflen, int suflen)
 {
@@ -462,6 +468,7 @@ create_hardlink(struct pkg *pkg, struct pkg_file *f, const char *path)
 {
 	bool tried_mkdir = false;
 	struct pkg_file *fh;
+	const char *src;
 
 	pkg_hidden_tempfile(f->temppath, sizeof(f->temppath), f->path);
 	fh = pkg_get_file(pkg, path);
@@ -470,10 +477,11 @@ create_hardlink(struct pkg *pkg, struct pkg_file *f, const char *path)
 		    " hardlinked to %s", f->path, path);
 		return (EPKG_FATAL);
 	}
-
+	/* The target may have been left in place as unchanged */
+	src = *fh->temppath != '\0' ? fh->temppath : fh->path;
 
 retry:
-	if (linkat(pkg->rootfd, RELATIVE_PATH(fh->temppath),
+	if (linkat(pkg->rootfd, RELATIVE_PATH(src),
 	    pkg->rootfd, RELATIVE_PATH(f->temppath), 0) == -1) {
 		if (!tried_mkdir) {
 			if (!mkdirat_p(pkg->rootfd,
@@ -515,6 +523,78 @@ do_extract_hardlink(struct pkg *pkg, struct archive *a __unused, struct archive_
 	return (EPKG_OK);
 }
 
+static void
+checksum_zeros(struct pkg_checksum_stream *st, int64_t len)
+{
+	static const char zeros[8192];
+	size_t chunk;
+
+	while (len > 0) {
+		chunk = len > (int64_t)sizeof(zeros) ? sizeof(zeros) : len;
+		pkg_checksum_stream_update(st, zeros, chunk);
+		len -= chunk;
+	}
+}
+
+/*
+ * Write the data of the current entry into fd, hashing it on the way when
+ * the manifest has a sum for the file so that it is verified without
+ * being read back.  Holes are kept, and hashed as the zeros they read as.
+ */
+static int
+extract_regfile_data(struct pkg *pkg, struct pkg_file *f, struct archive *a,
+    struct archive_entry *ae, int fd)
+{
+	struct pkg_checksum_stream *st;
+	const void *buf;
+	const char *p;
+	size_t size;
+	ssize_t w;
+	int64_t offset, pos = 0;
+	int r;
+
+	st = pkg_checksum_stream_new(f->sum);
+	while ((r = archive_read_data_block(a, &buf, &size, &offset)) ==
+	    ARCHIVE_OK) {
+		if (st != NULL) {
+			checksum_zeros(st, offset - pos);
+			pkg_checksum_stream_update(st, buf, size);
+		}
+		pos = offset + size;
+		for (p = buf; size > 0; p += w, size -= w, offset += w) {
+			if ((w = pwrite(fd, p, size, offset)) == -1) {
+				if (errno == EINTR) {
+					w = 0;
+					continue;
+				}
+				pkg_errno("Fail to write file: %s", f->temppath);
+				goto error;
+			}
+		}
+	}
+	if (r != ARCHIVE_EOF) {
+		pkg_emit_error("Fail to extract %s from package: %s",
+		    f->path, archive_error_string(a));
+		goto error;
+	}
+	if (st == NULL)
+		return (EPKG_OK);
+
+	checksum_zeros(st, archive_entry_size(ae) - pos);
+	if (pkg_checksum_stream_final(st) != 0) {
+		pkg_emit_error("%s-%s: checksum mismatch for %s", pkg->name,
+		    pkg->version, f->path);
+		return (EPKG_FATAL);
+	}
+
+	return (EPKG_OK);
+
+error:
+	if (st != NULL)
+		pkg_checksum_stream_final(st);
+	return (EPKG_FATAL);
+}
+
 static int
 create_regfile(struct pkg *pkg, struct pkg_file *f, struct archive *a,
     struct archive_entry *ae, int fromfd, struct pkg *local)
@@ -549,6 +629,7 @@ retry:
 		    f->config);
 		if (f->config) {
 			const char *cfdata;
+			struct pkg_checksum_stream *st;
 			bool merge = pkg_object_bool(pkg_config_get("AUTOMERGE"));
 
 			pkg_debug(1, "Populating config_file %s", f->path);
@@ -556,6 +637,17 @@ retry:
 			f->config->content = xmalloc(len + 1);
 			archive_read_data(a, f->config->content, len);
 			f->config->content[len] = '\0';
+			if ((st = pkg_checksum_stream_new(f->sum)) != NULL) {
+				pkg_checksum_stream_update(st,
+				    f->config->content, len);
+				if (pkg_checksum_stream_final(st) != 0) {
+					pkg_emit_error("%s-%s: checksum mismatch "
+					    "for %s", pkg->name, pkg->version,
+					    f->path);
+					close(fd);
+					return (EPKG_FATAL);
+				}
+			}
 			cfdata = f->config->content;
 			attempt_to_merge(pkg->rootfd, f->config, local, merge);
 			if (f->config->status == MERGE_SUCCESS)
@@ -569,11 +661,12 @@ retry:
 			}
 		}
 
-		if (!f->config && archive_read_data_into_fd(a, fd) != ARCHIVE_OK) {
-			pkg_emit_error("Fail to extract %s from package: %s",
-			    f->path, archive_error_string(a));
+		if (!f->config &&
+		    extract_regfile_data(pkg, f, a, ae, fd) != EPKG_OK) {
+			close(fd);
 			return (EPKG_FATAL);
 		}
+		pkg_trace_count(PKG_TRACE_BYTES, archive_entry_size(ae));
 	} else {
 		while ((len = read(fromfd, buf, sizeof(buf))) > 0)
 			if (write(fd, buf, len) == -1) {
@@ -581,6 +674,7 @@ retry:
 			}
 	}
 	if (fd != -1) {
+		pkg_sync_writeback(fd);
 		close(fd);
 	}
 
@@ -591,6 +685,52 @@ retry:
 	return (EPKG_OK);
 }
 
+/*
+ * On upgrade, a file whose content does not change is left in place: it
+ * has the same checksum in both manifests and is still, on disk, the
+ * regular file that was installed.  Only its attributes are updated, if
+ * they changed.
+ */
+static bool
+keep_unchanged_regfile(struct pkg *pkg, struct pkg_file *f,
+    struct archive_entry *ae, struct pkg *local)
+{
+	struct pkg_file *lf;
+	struct stat st;
+
+	if (local == NULL || f->sum == NULL || f->fflags != 0 ||
+	    !pkg_object_bool(pkg_config_get("SKIP_UNCHANGED_FILES")))
+		return (false);
+	if (kh_contains(pkg_config_files, pkg->config_files, f->path))
+		return (false);
+
+	lf = pkg_get_file(local, f->path);
+	if (lf == NULL || lf->sum == NULL || strcmp(lf->sum, f->sum) != 0)
+		return (false);
+
+	if (fstatat(pkg->rootfd, RELATIVE_PATH(f->path), &st,
+	    AT_SYMLINK_NOFOLLOW) == -1 || !S_ISREG(st.st_mode) ||
+	    st.st_size != archive_entry_size(ae))
+		return (false);
+	/* Reading is cheaper than writing, and catches local changes */
+	if (pkg_checksum_validate_fileat(pkg->rootfd, RELATIVE_PATH(f->path),
+	    f->sum) != 0)
+		return (false);
+
+	if ((st.st_mode & ~S_IFMT) != (f->perm & ~S_IFMT) ||
+	    st.st_mtime != f->time[1].tv_sec ||
+	    (getenv("INSTALL_AS_USER") == NULL &&
+	    (st.st_uid != f->uid || st.st_gid != f->gid))) {
+		pkg_debug(2, "Updating the attributes of unchanged %s",
+		    f->path);
+		if (set_attrs(pkg->rootfd, f->path, f->perm, f->uid, f->gid,
+		    &f->time[0], &f->time[1]) != EPKG_OK)
+			return (false);
+	}
+
+	return (true);
+}
+
 static int
 do_extract_regfile(struct pkg *pkg, struct archive *a, struct archive_entry *ae,
     const char *path, struct pkg *local)
@@ -613,7 +753,11 @@ do_extract_regfile(struct pkg *pkg, struct archive *a, struct archive_entry *ae,
 	fill_timespec_buf(aest, f->time);
 	archive_entry_fflags(ae, &f->fflags, &clear);
 
-	if (create_regfile(pkg, f, a, ae, -1, local) == EPKG_FATAL)
+	if (keep_unchanged_regfile(pkg, f, ae, local)) {
+		/* Its data is skipped with the next header */
+		unchanged.files++;
+		unchanged.bytes += archive_entry_size(ae);
+	} else if (create_regfile(pkg, f, a, ae, -1, local) == EPKG_FATAL)
 		return (EPKG_FATAL);
 
 	metalog_add(PKG_METALOG_FILE, RELATIVE_PATH(path),
@@ -643,6 +787,8 @@ do_extract(struct archive *a, struct archive_entry *ae,
 	pkg_emit_extract_begin(pkg);
 	pkg_open_root_fd(pkg);
 	pkg_emit_progress_start(NULL);
+	unchanged.files = 0;
+	unchanged.bytes = 0;
 
 	do {
 		pkg_absolutepath(archive_entry_pathname(ae), path, sizeof(path), true);
@@ -709,6 +855,10 @@ do_extract(struct archive *a, struct archive_entry *ae,
 
 cleanup:
 	pkg_emit_progress_tick(nfiles, nfiles);
+	if (unchanged.files > 0)
+		pkg_debug(1, "%s-%s: %d unchanged files left in place, "
+		    "%jd bytes not written", pkg->name, pkg->version,
+		    unchanged.files, (intmax_t)unchanged.bytes);
 	pkg_emit_extract_finished(pkg);
 
 	return (retcode);
@@ -723,6 +873,9 @@ pkg_extract_finalize(struct pkg *pkg)
 	char path[MAXPATHLEN];
 	const char *fto;
 
+	if (pkg_sync_files(pkg) != EPKG_OK)
+		return (EPKG_FATAL);
+
 	while (pkg_files(pkg, &f) == EPKG_OK) {
 		if (*f->temppath == '\0')
 			continue;
@@ -770,7 +923,7 @@ pkg_extract_finalize(struct pkg *pkg)
 			return (EPKG_FATAL);
 	}
 
-	return (EPKG_OK);
+	return (pkg_sync_dirs(pkg));
 }
 
 static char *
@@ -1081,8 +1234,10 @@ pkg_add_common(struct pkgdb *db, const char *path, unsigned flags,
 
 	/* register the package before installing it in case there are
 	 * problems that could be caught here. */
+	pkg_trace_begin("register", pkg->name);
 	retcode = pkgdb_register_pkg(db, pkg,
 			flags & PKG_ADD_FORCE);
+	pkg_trace_end();
 
 	if (retcode != EPKG_OK)
 		goto cleanup;
@@ -1103,7 +1258,9 @@ pkg_add_common(struct pkgdb *db, const char *path, unsigned flags,
 	 */
 	if (extract) {
 		pkg_register_cleanup_callback(pkg_rollback_cb, pkg);
+		pkg_trace_begin("extract", pkg->name);
 		retcode = do_extract(a, ae, nfiles, pkg, local);
+		pkg_trace_end();
 		pkg_unregister_cleanup_callback(pkg_rollback_cb, pkg);
 		if (retcode != EPKG_OK) {
 			/* If the add failed, clean up (silently) */
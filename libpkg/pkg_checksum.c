@@ -34,10 +34,30 @@
 #include "sha256.h"
 #include "blake2.h"
 
+/*
+ * Entries point into the package, nothing is copied.  A dependency is
+ * hashed as "name~origin": value holds the name and value2 the origin.
+ */
 struct pkg_checksum_entry {
 	const char *field;
-	char *value;
-	struct pkg_checksum_entry *next, *prev;
+	const char *value;
+	const char *value2;
+	size_t flen;
+	size_t vlen;
+	size_t v2len;
+};
+
+/*
+ * Scratch array for the entries of one package.  Most packages fit in the
+ * embedded storage, larger ones spill into a single heap buffer.
+ */
+#define PKG_CHECKSUM_SCRATCH 64
+
+struct pkg_checksum_scratch {
+	struct pkg_checksum_entry *entries;
+	size_t len;
+	size_t cap;
+	struct pkg_checksum_entry local[PKG_CHECKSUM_SCRATCH];
 };
 
 /* Separate checksum parts */
@@ -49,8 +69,8 @@ struct pkg_checksum_entry {
 #define PKG_CHECKSUM_BLAKE2S_LEN (BLAKE2S_OUTBYTES * 8 / 5 + sizeof("100") * 2 + 2)
 #define PKG_CHECKSUM_CUR_VERSION 2
 
-typedef void (*pkg_checksum_hash_func)(struct pkg_checksum_entry *entries,
-				unsigned char **out, size_t *outlen);
+typedef size_t (*pkg_checksum_hash_func)(const struct pkg_checksum_entry *entries,
+				size_t nentries, unsigned char *out);
 typedef void (*pkg_checksum_hash_bulk_func)(const unsigned char *in, size_t inlen,
 				unsigned char **out, size_t *outlen);
 typedef void (*pkg_checksum_encode_func)(unsigned char *in, size_t inlen,
@@ -58,25 +78,31 @@ typedef void (*pkg_checksum_encode_func)(unsigned char *in, size_t inlen,
 
 typedef void (*pkg_checksum_hash_file_func)(int fd, unsigned char **out,
     size_t *outlen);
+typedef size_t (*pkg_checksum_hash_many_func)(const void *const in[],
+    const size_t inlen[], size_t count, unsigned char *const out[]);
 
-static void pkg_checksum_hash_sha256(struct pkg_checksum_entry *entries,
-				unsigned char **out, size_t *outlen);
+static size_t pkg_checksum_hash_sha256(const struct pkg_checksum_entry *entries,
+				size_t nentries, unsigned char *out);
 static void pkg_checksum_hash_sha256_bulk(const unsigned char *in, size_t inlen,
 				unsigned char **out, size_t *outlen);
 static void pkg_checksum_hash_sha256_file(int fd, unsigned char **out,
     size_t *outlen);
-static void pkg_checksum_hash_blake2(struct pkg_checksum_entry *entries,
-				unsigned char **out, size_t *outlen);
+static size_t pkg_checksum_hash_blake2(const struct pkg_checksum_entry *entries,
+				size_t nentries, unsigned char *out);
 static void pkg_checksum_hash_blake2_bulk(const unsigned char *in, size_t inlen,
 				unsigned char **out, size_t *outlen);
 static void pkg_checksum_hash_blake2_file(int fd, unsigned char **out,
     size_t *outlen);
-static void pkg_checksum_hash_blake2s(struct pkg_checksum_entry *entries,
-				unsigned char **out, size_t *outlen);
+static size_t pkg_checksum_hash_blake2_many(const void *const in[],
+    const size_t inlen[], size_t count, unsigned char *const out[]);
+static size_t pkg_checksum_hash_blake2s(const struct pkg_checksum_entry *entries,
+				size_t nentries, unsigned char *out);
 static void pkg_checksum_hash_blake2s_bulk(const unsigned char *in, size_t inlen,
 				unsigned char **out, size_t *outlen);
 static void pkg_checksum_hash_blake2s_file(int fd, unsigned char **out,
     size_t *outlen);
+static size_t pkg_checksum_hash_blake2s_many(const void *const in[],
+    const size_t inlen[], size_t count, unsigned char *const out[]);
 static void pkg_checksum_encode_base32(unsigned char *in, size_t inlen,
 				char *out, size_t outlen);
 static void pkg_checksum_encode_hex(unsigned char *in, size_t inlen,
@@ -89,6 +115,7 @@ static const struct _pkg_cksum_type {
 	pkg_checksum_hash_bulk_func hbulkfunc;
 	pkg_checksum_hash_file_func hfilefunc;
 	pkg_checksum_encode_func encfunc;
+	pkg_checksum_hash_many_func hmanyfunc;
 } checksum_types[] = {
 	[PKG_HASH_TYPE_SHA256_BASE32] = {
 		"sha256_base32",
@@ -96,7 +123,8 @@ static const struct _pkg_cksum_type {
 		pkg_checksum_hash_sha256,
 		pkg_checksum_hash_sha256_bulk,
 		pkg_checksum_hash_sha256_file,
-		pkg_checksum_encode_base32
+		pkg_checksum_encode_base32,
+		NULL
 	},
 	[PKG_HASH_TYPE_SHA256_HEX] = {
 		"sha256_hex",
@@ -104,7 +132,8 @@ static const struct _pkg_cksum_type {
 		pkg_checksum_hash_sha256,
 		pkg_checksum_hash_sha256_bulk,
 		pkg_checksum_hash_sha256_file,
-		pkg_checksum_encode_hex
+		pkg_checksum_encode_hex,
+		NULL
 	},
 	[PKG_HASH_TYPE_BLAKE2_BASE32] = {
 		"blake2_base32",
@@ -112,7 +141,8 @@ static const struct _pkg_cksum_type {
 		pkg_checksum_hash_blake2,
 		pkg_checksum_hash_blake2_bulk,
 		pkg_checksum_hash_blake2_file,
-		pkg_checksum_encode_base32
+		pkg_checksum_encode_base32,
+		pkg_checksum_hash_blake2_many
 	},
 	[PKG_HASH_TYPE_SHA256_RAW] = {
 		"sha256_raw",
@@ -120,6 +150,7 @@ static const struct _pkg_cksum_type {
 		pkg_checksum_hash_sha256,
 		pkg_checksum_hash_sha256_bulk,
 		pkg_checksum_hash_sha256_file,
+		NULL,
 		NULL
 	},
 	[PKG_HASH_TYPE_BLAKE2_RAW] = {
@@ -128,7 +159,8 @@ static const struct _pkg_cksum_type {
 		pkg_checksum_hash_blake2,
 		pkg_checksum_hash_blake2_bulk,
 		pkg_checksum_hash_blake2_file,
-		NULL
+		NULL,
+		pkg_checksum_hash_blake2_many
 	},
 	[PKG_HASH_TYPE_BLAKE2S_BASE32] = {
 		"blake2s_base32",
@@ -136,7 +168,8 @@ static const struct _pkg_cksum_type {
 		pkg_checksum_hash_blake2s,
 		pkg_checksum_hash_blake2s_bulk,
 		pkg_checksum_hash_blake2s_file,
-		pkg_checksum_encode_base32
+		pkg_checksum_encode_base32,
+		pkg_checksum_hash_blake2s_many
 	},
 	[PKG_HASH_TYPE_BLAKE2S_RAW] = {
 		"blake2_raw",
@@ -144,7 +177,8 @@ static const struct _pkg_cksum_type {
 		pkg_checksum_hash_blake2s,
 		pkg_checksum_hash_blake2s_bulk,
 		pkg_checksum_hash_blake2s_file,
-		NULL
+		NULL,
+		pkg_checksum_hash_blake2s_many
 	},
 	[PKG_HASH_TYPE_UNKNOWN] = {
 		NULL,
@@ -156,32 +190,80 @@ static const struct _pkg_cksum_type {
 };
 
 static void
-pkg_checksum_free_entry(struct pkg_checksum_entry *e)
+pkg_checksum_add_entry2(struct pkg_checksum_scratch *sc, const char *key,
+	const char *value, const char *value2)
 {
-	if (e != NULL) {
-		if (e->value) {
-			free(e->value);
+	struct pkg_checksum_entry *e;
+
+	if (sc->len == sc->cap) {
+		sc->cap *= 2;
+		if (sc->entries == sc->local) {
+			sc->entries = xmalloc(sc->cap * sizeof(*e));
+			memcpy(sc->entries, sc->local, sizeof(sc->local));
+		} else {
+			sc->entries = xrealloc(sc->entries, sc->cap * sizeof(*e));
 		}
-		free(e);
 	}
+
+	e = &sc->entries[sc->len++];
+	e->field = key;
+	e->flen = strlen(key);
+	e->value = value;
+	e->vlen = strlen(value);
+	e->value2 = value2;
+	e->v2len = value2 != NULL ? strlen(value2) : 0;
 }
 
-static void
-pkg_checksum_add_entry(const char *key,
-	const char *value,
-	struct pkg_checksum_entry **entries)
+static inline void
+pkg_checksum_add_entry(struct pkg_checksum_scratch *sc, const char *key,
+	const char *value)
 {
-	struct pkg_checksum_entry *e;
+	pkg_checksum_add_entry2(sc, key, value, NULL);
+}
 
-	e = xmalloc(sizeof(*e));
-	e->field = key;
-	e->value = xstrdup(value);
-	DL_APPEND(*entries, e);
+/* Byte at offset off of the value, with value2 appended after a '~' */
+static inline int
+pkg_checksum_value_at(const struct pkg_checksum_entry *e, size_t off)
+{
+	if (off < e->vlen)
+		return ((unsigned char)e->value[off]);
+	if (e->value2 == NULL)
+		return (0);
+	if (off == e->vlen)
+		return ('~');
+	off -= e->vlen + 1;
+	if (off < e->v2len)
+		return ((unsigned char)e->value2[off]);
+	return (0);
+}
+
+static int
+pkg_checksum_value_cmp(const struct pkg_checksum_entry *e1,
+	const struct pkg_checksum_entry *e2)
+{
+	size_t off;
+	int c1, c2, r;
+
+	if (e1->value2 == NULL && e2->value2 == NULL)
+		return (strcmp(e1->value, e2->value));
+
+	off = MIN(e1->vlen, e2->vlen);
+	r = memcmp(e1->value, e2->value, off);
+	if (r != 0)
+		return (r);
+
+	do {
+		c1 = pkg_checksum_value_at(e1, off);
+		c2 = pkg_checksum_value_at(e2, off);
+		off++;
+	} while (c1 == c2 && c1 != 0);
+
+	return (c1 - c2);
 }
 
 static int
-pkg_checksum_entry_cmp(struct pkg_checksum_entry *e1,
-	struct pkg_checksum_entry *e2)
+pkg_checksum_entry_cmp(const struct pkg_checksum_entry *e1,
+	const struct pkg_checksum_entry *e2)
 {
 	int r;
 
@@ -191,7 +273,37 @@ pkg_checksum_entry_cmp(struct pkg_checksum_entry *e1,
 		return r;
 
 	/* If field names are the same, compare values. */
-	return (strcmp(e1->value, e2->value));
+	return (pkg_checksum_value_cmp(e1, e2));
+}
+
+static int
+pkg_checksum_entry_qcmp(const void *a, const void *b)
+{
+	return (pkg_checksum_entry_cmp(a, b));
+}
+
+/*
+ * A package has a few dozen entries at most, insertion sort on the
+ * contiguous array beats qsort there; larger sets go to qsort.
+ */
+static void
+pkg_checksum_sort(struct pkg_checksum_entry *entries, size_t n)
+{
+	struct pkg_checksum_entry tmp;
+	size_t i, j;
+
+	if (n > 32) {
+		qsort(entries, n, sizeof(*entries), pkg_checksum_entry_qcmp);
+		return;
+	}
+
+	for (i = 1; i < n; i++) {
+		tmp = entries[i];
+		for (j = i; j > 0 &&
+		    pkg_checksum_entry_cmp(&entries[j - 1], &tmp) > 0; j--)
+			entries[j] = entries[j - 1];
+		entries[j] = tmp;
+	}
 }
 
 /*
@@ -209,76 +321,101 @@ pkg_checksum_entry_cmp(struct pkg_checksum_entry *e1,
  * - dependencies
  */
 
-int
-pkg_checksum_generate(struct pkg *pkg, char *dest, size_t destlen,
-	pkg_checksum_type_t type)
+static void
+pkg_checksum_entries(struct pkg *pkg, struct pkg_checksum_scratch *sc)
 {
-	unsigned char *bdigest;
-	char *olduid, *buf;
-	size_t blen;
-	struct pkg_checksum_entry *entries = NULL;
+	char *buf;
 	struct pkg_option *option = NULL;
 	struct pkg_dep *dep = NULL;
-	int i;
 
-	if (pkg == NULL || type >= PKG_HASH_TYPE_UNKNOWN ||
-					destlen < checksum_types[type].hlen)
-		return (EPKG_FATAL);
+	sc->entries = sc->local;
+	sc->len = 0;
+	sc->cap = PKG_CHECKSUM_SCRATCH;
 
-	pkg_checksum_add_entry("name", pkg->name, &entries);
-	pkg_checksum_add_entry("origin", pkg->origin, &entries);
-	pkg_checksum_add_entry("version", pkg->version, &entries);
-	pkg_checksum_add_entry("arch", pkg->arch, &entries);
+	pkg_checksum_add_entry(sc, "name", pkg->name);
+	pkg_checksum_add_entry(sc, "origin", pkg->origin);
+	pkg_checksum_add_entry(sc, "version", pkg->version);
+	pkg_checksum_add_entry(sc, "arch", pkg->arch);
 
 	while (pkg_options(pkg, &option) == EPKG_OK) {
-		pkg_checksum_add_entry(option->key, option->value, &entries);
+		pkg_checksum_add_entry(sc, option->key, option->value);
 	}
 
 	buf = NULL;
 	while (pkg_shlibs_required(pkg, &buf) == EPKG_OK) {
-		pkg_checksum_add_entry("required_shlib", buf, &entries);
+		pkg_checksum_add_entry(sc, "required_shlib", buf);
 	}
 
 	buf = NULL;
 	while (pkg_shlibs_provided(pkg, &buf) == EPKG_OK) {
-		pkg_checksum_add_entry("provided_shlib", buf, &entries);
+		pkg_checksum_add_entry(sc, "provided_shlib", buf);
 	}
 
 	buf = NULL;
 	while (pkg_users(pkg, &buf) == EPKG_OK) {
-		pkg_checksum_add_entry("user", buf, &entries);
+		pkg_checksum_add_entry(sc, "user", buf);
 	}
 
 	buf = NULL;
 	while (pkg_groups(pkg, &buf) == EPKG_OK) {
-		pkg_checksum_add_entry("group", buf, &entries);
+		pkg_checksum_add_entry(sc, "group", buf);
 	}
 
 	while (pkg_deps(pkg, &dep) == EPKG_OK) {
-		xasprintf(&olduid, "%s~%s", dep->name, dep->origin);
-		pkg_checksum_add_entry("depend", olduid, &entries);
-		free(olduid);
+		pkg_checksum_add_entry2(sc, "depend", dep->name, dep->origin);
 	}
 
 	buf = NULL;
 	while (pkg_provides(pkg, &buf) == EPKG_OK) {
-		pkg_checksum_add_entry("provide", buf, &entries);
+		pkg_checksum_add_entry(sc, "provide", buf);
 	}
 
 	buf = NULL;
 	while (pkg_requires(pkg, &buf) == EPKG_OK) {
-		pkg_checksum_add_entry("require", buf, &entries);
+		pkg_checksum_add_entry(sc, "require", buf);
 	}
 
 	/* Sort before hashing */
-	DL_SORT(entries, pkg_checksum_entry_cmp);
+	pkg_checksum_sort(sc->entries, sc->len);
+}
 
-	checksum_types[type].hfunc(entries, &bdigest, &blen);
-	if (blen == 0 || bdigest == NULL) {
-		LL_FREE(entries, pkg_checksum_free_entry);
-		return (EPKG_FATAL);
+/* The bytes the hash functions read from the entries, in one buffer */
+static unsigned char *
+pkg_checksum_flatten(const struct pkg_checksum_entry *entries,
+	size_t nentries, size_t *len)
+{
+	unsigned char *buf, *p;
+	size_t i;
+
+	*len = 0;
+	for (i = 0; i < nentries; i++) {
+		*len += entries[i].flen + entries[i].vlen;
+		if (entries[i].value2 != NULL)
+			*len += 1 + entries[i].v2len;
+	}
+
+	p = buf = xmalloc(*len + 1);
+	for (i = 0; i < nentries; i++) {
+		memcpy(p, entries[i].field, entries[i].flen);
+		p += entries[i].flen;
+		memcpy(p, entries[i].value, entries[i].vlen);
+		p += entries[i].vlen;
+		if (entries[i].value2 != NULL) {
+			*p++ = '~';
+			memcpy(p, entries[i].value2, entries[i].v2len);
+			p += entries[i].v2len;
+		}
 	}
 
+	return (buf);
+}
+
+static void
+pkg_checksum_encode_digest(pkg_checksum_type_t type, unsigned char *bdigest,
+	size_t blen, char *dest, size_t destlen)
+{
+	int i;
+
 	if (checksum_types[type].encfunc) {
 		i = snprintf(dest, destlen, "%d%c%d%c", PKG_CHECKSUM_CUR_VERSION,
 				PKG_CKSUM_SEPARATOR, type, PKG_CKSUM_SEPARATOR);
@@ -290,9 +427,29 @@ pkg_checksum_generate(struct pkg *pkg, char *dest, size_t destlen,
 		assert(destlen >= blen);
 		memcpy(dest, bdigest, blen);
 	}
+}
 
-	free(bdigest);
-	LL_FREE(entries, pkg_checksum_free_entry);
+int
+pkg_checksum_generate(struct pkg *pkg, char *dest, size_t destlen,
+	pkg_checksum_type_t type)
+{
+	unsigned char bdigest[BLAKE2B_OUTBYTES];
+	size_t blen;
+	struct pkg_checksum_scratch sc;
+
+	if (pkg == NULL || type >= PKG_HASH_TYPE_UNKNOWN ||
+					destlen < checksum_types[type].hlen)
+		return (EPKG_FATAL);
+
+	pkg_checksum_entries(pkg, &sc);
+
+	blen = checksum_types[type].hfunc(sc.entries, sc.len, bdigest);
+	if (sc.entries != sc.local)
+		free(sc.entries);
+	if (blen == 0)
+		return (EPKG_FATAL);
+
+	pkg_checksum_encode_digest(type, bdigest, blen, dest, destlen);
 
 	return (EPKG_OK);
 }
@@ -361,22 +518,25 @@ pkg_checksum_get_type(const char *cksum, size_t clen)
 	return (PKG_HASH_TYPE_UNKNOWN);
 }
 
-static void
-pkg_checksum_hash_sha256(struct pkg_checksum_entry *entries,
-		unsigned char **out, size_t *outlen)
+static size_t
+pkg_checksum_hash_sha256(const struct pkg_checksum_entry *entries,
+		size_t nentries, unsigned char *out)
 {
 	SHA256_CTX sign_ctx;
+	size_t i;
 
 	sha256_init(&sign_ctx);
 
-	while(entries) {
-		sha256_update(&sign_ctx, entries->field, strlen(entries->field));
-		sha256_update(&sign_ctx, entries->value, strlen(entries->value));
-		entries = entries->next;
+	for (i = 0; i < nentries; i++) {
+		sha256_update(&sign_ctx, entries[i].field, entries[i].flen);
+		sha256_update(&sign_ctx, entries[i].value, entries[i].vlen);
+		if (entries[i].value2 != NULL) {
+			sha256_update(&sign_ctx, "~", 1);
+			sha256_update(&sign_ctx, entries[i].value2, entries[i].v2len);
+		}
 	}
-	*out = xmalloc(SHA256_BLOCK_SIZE);
-	sha256_final(&sign_ctx, *out);
-	*outlen = SHA256_BLOCK_SIZE;
+	sha256_final(&sign_ctx, out);
+	return (SHA256_BLOCK_SIZE);
 }
 
 static void
@@ -395,8 +555,8 @@ pkg_checksum_hash_sha256_bulk(const unsigned char *in, size_t inlen,
 static void
 pkg_checksum_hash_sha256_file(int fd, unsigned char **out, size_t *outlen)
 {
-	char buffer[8192];
-	size_t r;
+	char buffer[32768];
+	ssize_t r;
 
 	SHA256_CTX sign_ctx;
 	*out = xmalloc(SHA256_BLOCK_SIZE);
@@ -407,22 +567,25 @@ pkg_checksum_hash_sha256_file(int fd, unsigned char **out, size_t *outlen)
 	*outlen = SHA256_BLOCK_SIZE;
 }
 
-static void
-pkg_checksum_hash_blake2(struct pkg_checksum_entry *entries,
-		unsigned char **out, size_t *outlen)
+static size_t
+pkg_checksum_hash_blake2(const struct pkg_checksum_entry *entries,
+		size_t nentries, unsigned char *out)
 {
 	blake2b_state st;
+	size_t i;
 
 	blake2b_init (&st, BLAKE2B_OUTBYTES);
 
-	while(entries) {
-		blake2b_update (&st, entries->field, strlen(entries->field));
-		blake2b_update (&st, entries->value, strlen(entries->value));
-		entries = entries->next;
+	for (i = 0; i < nentries; i++) {
+		blake2b_update (&st, entries[i].field, entries[i].flen);
+		blake2b_update (&st, entries[i].value, entries[i].vlen);
+		if (entries[i].value2 != NULL) {
+			blake2b_update (&st, "~", 1);
+			blake2b_update (&st, entries[i].value2, entries[i].v2len);
+		}
 	}
-	*out = xmalloc(BLAKE2B_OUTBYTES);
-	blake2b_final (&st, *out, BLAKE2B_OUTBYTES);
-	*outlen = BLAKE2B_OUTBYTES;
+	blake2b_final (&st, out, BLAKE2B_OUTBYTES);
+	return (BLAKE2B_OUTBYTES);
 }
 
 static void
@@ -451,22 +614,34 @@ pkg_checksum_hash_blake2_file(int fd, unsigned char **out, size_t *outlen)
 	*outlen = BLAKE2B_OUTBYTES;
 }
 
-static void
-pkg_checksum_hash_blake2s(struct pkg_checksum_entry *entries,
-		unsigned char **out, size_t *outlen)
+static size_t
+pkg_checksum_hash_blake2_many(const void *const in[], const size_t inlen[],
+	size_t count, unsigned char *const out[])
+{
+	if (blake2b_many(out, BLAKE2B_OUTBYTES, in, inlen, count) != 0)
+		return (0);
+	return (BLAKE2B_OUTBYTES);
+}
+
+static size_t
+pkg_checksum_hash_blake2s(const struct pkg_checksum_entry *entries,
+		size_t nentries, unsigned char *out)
 {
 	blake2s_state st;
+	size_t i;
 
 	blake2s_init (&st, BLAKE2S_OUTBYTES);
 
-	while(entries) {
-		blake2s_update (&st, entries->field, strlen(entries->field));
-		blake2s_update (&st, entries->value, strlen(entries->value));
-		entries = entries->next;
+	for (i = 0; i < nentries; i++) {
+		blake2s_update (&st, entries[i].field, entries[i].flen);
+		blake2s_update (&st, entries[i].value, entries[i].vlen);
+		if (entries[i].value2 != NULL) {
+			blake2s_update (&st, "~", 1);
+			blake2s_update (&st, entries[i].value2, entries[i].v2len);
+		}
 	}
-	*out = xmalloc(BLAKE2S_OUTBYTES);
-	blake2s_final (&st, *out, BLAKE2S_OUTBYTES);
-	*outlen = BLAKE2S_OUTBYTES;
+	blake2s_final (&st, out, BLAKE2S_OUTBYTES);
+	return (BLAKE2S_OUTBYTES);
 }
 
 static void
@@ -495,6 +670,15 @@ pkg_checksum_hash_blake2s_file(int fd, unsigned char **out, size_t *outlen)
 	*outlen = BLAKE2S_OUTBYTES;
 }
 
+static size_t
+pkg_checksum_hash_blake2s_many(const void *const in[], const size_t inlen[],
+	size_t count, unsigned char *const out[])
+{
+	if (blake2s_many(out, BLAKE2S_OUTBYTES, in, inlen, count) != 0)
+		return (0);
+	return (BLAKE2S_OUTBYTES);
+}
+
 /*
  * We use here z-base32 encoding described here:
  * http://philzimmermann.com/docs/human-oriented-base-32-encoding.txt
@@ -601,26 +785,32 @@ pkg_checksum_type_size(pkg_checksum_type_t type)
 	return (checksum_types[type].hlen);
 }
 
-int
-pkg_checksum_calculate(struct pkg *pkg, struct pkgdb *db)
+static pkg_checksum_type_t
+pkg_checksum_calculate_type(struct pkg *pkg)
 {
-	char *new_digest;
 	struct pkg_repo *repo;
-	int rc = EPKG_OK;
-	pkg_checksum_type_t type;
-
-	if (sizeof(void *) == 8)
-		type = PKG_HASH_TYPE_BLAKE2_BASE32;
-	else
-		type = PKG_HASH_TYPE_BLAKE2S_BASE32;
 
 	if (pkg->reponame != NULL) {
 		repo = pkg_repo_find(pkg->reponame);
 
 		if (repo != NULL)
-			type = repo->meta->digest_format;
+			return (repo->meta->digest_format);
 	}
 
+	if (sizeof(void *) == 8)
+		return (PKG_HASH_TYPE_BLAKE2_BASE32);
+	return (PKG_HASH_TYPE_BLAKE2S_BASE32);
+}
+
+int
+pkg_checksum_calculate(struct pkg *pkg, struct pkgdb *db)
+{
+	char *new_digest;
+	int rc = EPKG_OK;
+	pkg_checksum_type_t type;
+
+	type = pkg_checksum_calculate_type(pkg);
+
 	new_digest = xmalloc(pkg_checksum_type_size(type));
 	if (pkg_checksum_generate(pkg, new_digest, pkg_checksum_type_size(type), type)
 			!= EPKG_OK) {
@@ -637,6 +827,85 @@ pkg_checksum_calculate(struct pkg *pkg, struct pkgdb *db)
 	return (rc);
 }
 
+/*
+ * pkg_checksum_calculate() for many packages, without storing the digests.
+ * The fields of the packages whose digest is a BLAKE2 one are hashed side
+ * by side by the multi-buffer functions, a few hundred bytes per package
+ * being too little to keep the vector units busy on its own.
+ */
+int
+pkg_checksum_calculate_many(struct pkg **pkgs, size_t npkgs)
+{
+	struct pkg_checksum_scratch sc;
+	pkg_checksum_type_t *types, type;
+	unsigned char (*bdigest)[BLAKE2B_OUTBYTES];
+	unsigned char **out;
+	const void **in;
+	size_t *inlen, *idx, i, count, blen;
+	int rc = EPKG_OK;
+
+	if (npkgs == 0)
+		return (EPKG_OK);
+
+	types = xcalloc(npkgs, sizeof(*types));
+	bdigest = xcalloc(npkgs, sizeof(*bdigest));
+	out = xcalloc(npkgs, sizeof(*out));
+	in = xcalloc(npkgs, sizeof(*in));
+	inlen = xcalloc(npkgs, sizeof(*inlen));
+	idx = xcalloc(npkgs, sizeof(*idx));
+
+	for (i = 0; i < npkgs; i++) {
+		types[i] = pkg_checksum_calculate_type(pkgs[i]);
+		if (types[i] >= PKG_HASH_TYPE_UNKNOWN ||
+		    checksum_types[types[i]].hmanyfunc == NULL) {
+			if (pkg_checksum_calculate(pkgs[i], NULL) != EPKG_OK)
+				rc = EPKG_FATAL;
+		}
+	}
+
+	for (type = 0; type < PKG_HASH_TYPE_UNKNOWN; type++) {
+		if (checksum_types[type].hmanyfunc == NULL)
+			continue;
+
+		count = 0;
+		for (i = 0; i < npkgs; i++) {
+			if (types[i] != type)
+				continue;
+			pkg_checksum_entries(pkgs[i], &sc);
+			in[count] = pkg_checksum_flatten(sc.entries, sc.len,
+			    &inlen[count]);
+			if (sc.entries != sc.local)
+				free(sc.entries);
+			out[count] = bdigest[count];
+			idx[count++] = i;
+		}
+		if (count == 0)
+			continue;
+
+		blen = checksum_types[type].hmanyfunc(in, inlen, count, out);
+		for (i = 0; i < count; i++) {
+			free((void *)in[i]);
+			if (blen == 0) {
+				rc = EPKG_FATAL;
+				continue;
+			}
+			free(pkgs[idx[i]]->digest);
+			pkgs[idx[i]]->digest = xmalloc(checksum_types[type].hlen);
+			pkg_checksum_encode_digest(type, out[i], blen,
+			    pkgs[idx[i]]->digest, checksum_types[type].hlen);
+		}
+	}
+
+	free(types);
+	free(bdigest);
+	free(out);
+	free(in);
+	free(inlen);
+	free(idx);
+
+	return (rc);
+}
+
 
 unsigned char *
 pkg_checksum_data(const unsigned char *in, size_t inlen,
@@ -841,6 +1110,30 @@ pkg_checksum_generate_file(const char *path, pkg_checksum_type_t type)
 	return (cksum);
 }
 
+/*
+ * Same output as pkg_checksum_generate_file() for a regular file whose
+ * content is already in memory.
+ */
+char *
+pkg_checksum_generate_data(const unsigned char *in, size_t inlen,
+    pkg_checksum_type_t type)
+{
+	unsigned char *sum;
+	char *cksum;
+
+	if (inlen == 0)
+		return (NULL);
+
+	sum = pkg_checksum_data(in, inlen, type);
+	if (sum == NULL)
+		return (NULL);
+
+	xasprintf(&cksum, "%d%c%s", type, PKG_CKSUM_SEPARATOR, sum);
+	free(sum);
+
+	return (cksum);
+}
+
 int
 pkg_checksum_validate_fileat(int rootfd, const char *path, const char *sum)
 {
@@ -905,3 +1198,102 @@ pkg_checksum_generate_fileat(int rootfd, const char *path,
 
 	return (cksum);
 }
+
+/*
+ * Incremental form of pkg_checksum_validate_file(), for data that is
+ * hashed as it is written out rather than read back afterwards.
+ */
+struct pkg_checksum_stream {
+	pkg_checksum_type_t type;
+	const char *expected;
+	union {
+		SHA256_CTX sha256;
+		blake2b_state blake2b;
+		blake2s_state blake2s;
+	} ctx;
+};
+
+struct pkg_checksum_stream *
+pkg_checksum_stream_new(const char *sum)
+{
+	struct pkg_checksum_stream *st;
+	pkg_checksum_type_t type;
+
+	if (sum == NULL || *sum == '\0')
+		return (NULL);
+
+	type = pkg_checksum_file_get_type(sum, strlen(sum));
+	if (type == PKG_HASH_TYPE_UNKNOWN) {
+		type = PKG_HASH_TYPE_SHA256_HEX;
+	} else {
+		sum = strchr(sum, PKG_CKSUM_SEPARATOR) + 1;
+	}
+	/* Per file sums are always encoded */
+	if (checksum_types[type].encfunc == NULL)
+		return (NULL);
+
+	st = xcalloc(1, sizeof(*st));
+	st->type = type;
+	st->expected = sum;
+	switch (type) {
+	case PKG_HASH_TYPE_BLAKE2_BASE32:
+		blake2b_init(&st->ctx.blake2b, BLAKE2B_OUTBYTES);
+		break;
+	case PKG_HASH_TYPE_BLAKE2S_BASE32:
+		blake2s_init(&st->ctx.blake2s, BLAKE2S_OUTBYTES);
+		break;
+	default:
+		sha256_init(&st->ctx.sha256);
+		break;
+	}
+
+	return (st);
+}
+
+void
+pkg_checksum_stream_update(struct pkg_checksum_stream *st, const void *in,
+    size_t inlen)
+{
+	switch (st->type) {
+	case PKG_HASH_TYPE_BLAKE2_BASE32:
+		blake2b_update(&st->ctx.blake2b, in, inlen);
+		break;
+	case PKG_HASH_TYPE_BLAKE2S_BASE32:
+		blake2s_update(&st->ctx.blake2s, in, inlen);
+		break;
+	default:
+		sha256_update(&st->ctx.sha256, in, inlen);
+		break;
+	}
+}
+
+/* Frees st, returns 0 when the data matched the sum and -1 otherwise */
+int
+pkg_checksum_stream_final(struct pkg_checksum_stream *st)
+{
+	const struct _pkg_cksum_type *cksum = &checksum_types[st->type];
+	unsigned char out[BLAKE2B_OUTBYTES];
+	char res[PKG_CHECKSUM_BLAKE2_LEN];
+	size_t outlen;
+	int ret;
+
+	switch (st->type) {
+	case PKG_HASH_TYPE_BLAKE2_BASE32:
+		outlen = BLAKE2B_OUTBYTES;
+		blake2b_final(&st->ctx.blake2b, out, outlen);
+		break;
+	case PKG_HASH_TYPE_BLAKE2S_BASE32:
+		outlen = BLAKE2S_OUTBYTES;
+		blake2s_final(&st->ctx.blake2s, out, outlen);
+		break;
+	default:
+		outlen = SHA256_BLOCK_SIZE;
+		sha256_final(&st->ctx.sha256, out);
+		break;
+	}
+	cksum->encfunc(out, outlen, res, cksum->hlen);
+	ret = strcmp(res, st->expected) == 0 ? 0 : -1;
+	free(st);
+
+	return (ret);
+}
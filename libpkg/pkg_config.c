@@ -181,6 +181,12 @@ static struct config_entry c[] = {
 		"3",
 		"How many times to retry fetching files",
 	},
+	{
+		PKG_INT,
+		"FETCH_MIRROR_RACE",
+		"3",
+		"How many of the best mirrors race to connect first for a repository",
+	},
 	{
 		PKG_STRING,
 		"PKG_PLUGINS_DIR",
@@ -223,6 +229,18 @@ static struct config_entry c[] = {
 		"YES",
 		"Automatically update repository catalogues prior to package updates",
 	},
+	{
+		PKG_BOOL,
+		"REPO_FILELIST",
+		"YES",
+		"Import the file list of repositories which provide one, to check conflicts before fetching",
+	},
+	{
+		PKG_BOOL,
+		"REPO_DELTAS",
+		"YES",
+		"Import the package deltas of repositories which provide them, to fetch upgrades as deltas",
+	},
 	{
 		PKG_STRING,
 		"NAMESERVER",
@@ -265,6 +283,12 @@ static struct config_entry c[] = {
 		NULL,
 		"Environment variables pkg will use",
 	},
+	{
+		PKG_STRING,
+		"PKG_SSH",
+		"/usr/bin/ssh",
+		"ssh(1) command used to reach ssh:// repositories",
+	},
 	{
 		PKG_STRING,
 		"PKG_SSH_ARGS",
@@ -379,6 +403,24 @@ static struct config_entry c[] = {
 		"NO",
 		"Always cleanup the cache directory after install/upgrade",
 	},
+	{
+		PKG_BOOL,
+		"REPO_VALIDATION_STAMP",
+		"YES",
+		"Skip the checks of a repository database already validated",
+	},
+	{
+		PKG_STRING,
+		"FSYNC_POLICY",
+		"none",
+		"How extracted files are flushed to disk: none, batch or syncfs",
+	},
+	{
+		PKG_BOOL,
+		"SKIP_UNCHANGED_FILES",
+		"YES",
+		"Do not extract again the files an upgrade does not change",
+	},
 	{
 		PKG_STRING,
 		"DOT_FILE",
@@ -414,17 +456,61 @@ static struct config_entry c[] = {
 		NULL,
 		"Write out the METALOG to the specified file",
 	},
+	{
+		PKG_STRING,
+		"PKG_TRACE_FILE",
+		NULL,
+		"Write a timing trace of the pkg phases to the specified file",
+	},
 	{
 		PKG_BOOL,
 		"NFS_WITH_PROPER_LOCKING",
 		"NO",
 		"Set if running on NFS with properly setup locking system",
 	},
+	{
+		PKG_INT,
+		"COMPRESSION_LEVEL",
+		"-1",
+		"Compression level used when creating packages, -1 for default",
+	},
+	{
+		PKG_INT,
+		"COMPRESSION_THREADS",
+		"-1",
+		"Compression threads for xz and zstd, 0 for auto, -1 for default",
+	},
+	{
+		PKG_BOOL,
+		"SANDBOX_WORKER",
+		"YES",
+		"Run sandboxed verifications in one long-lived process",
+	},
+	{
+		PKG_BOOL,
+		"CONFIG_SNAPSHOT",
+		"YES",
+		"Reuse a snapshot of the parsed configuration while it is current",
+	},
 };
 
 static bool parsed = false;
 static size_t c_size = NELEM(c);
 
+/*
+ * Configuration snapshot being recorded by a full parse: the files it
+ * depends on and the repository objects in the order they were applied.
+ */
+static struct {
+	char		 path[MAXPATHLEN];
+	char		*key;
+	ucl_object_t	*loaded;
+	ucl_object_t	*config;
+	ucl_object_t	*stamps;
+	ucl_object_t	*repos;
+	bool		 usable;
+} snapshot;
+
 static struct pkg_repo* pkg_repo_new(const char *name,
 	const char *url, const char *type);
 static void pkg_repo_overwrite(struct pkg_repo*, const char *name,
@@ -512,6 +598,104 @@ disable_plugins_if_static(void)
 	return;
 }
 
+static void
+config_stamp(const char *path, char *stamp, size_t len)
+{
+	struct stat st;
+	long nsec;
+
+	if (stat(path, &st) == -1) {
+		/* A file showing up later is a change too */
+		strlcpy(stamp, "-", len);
+		return;
+	}
+#ifdef HAVE_STRUCT_STAT_ST_MTIM
+	nsec = st.st_mtim.tv_nsec;
+#elif defined(_DARWIN_C_SOURCE) || defined(__APPLE__)
+	nsec = st.st_mtimespec.tv_nsec;
+#else
+	nsec = 0;
+#endif
+	snprintf(stamp, len, "%ju:%ju:%jd:%jd.%09ld:%jd", (uintmax_t)st.st_dev,
+	    (uintmax_t)st.st_ino, (intmax_t)st.st_size,
+	    (intmax_t)st.st_mtime, nsec, (intmax_t)st.st_ctime);
+}
+
+static void
+config_snapshot_stamp(const char *dir, const char *file)
+{
+	ucl_object_t *o;
+	char path[MAXPATHLEN], stamp[128];
+
+	if (snapshot.stamps == NULL)
+		return;
+
+	if (file != NULL)
+		snprintf(path, sizeof(path), "%s/%s", dir, file);
+	else
+		strlcpy(path, dir, sizeof(path));
+	config_stamp(path, stamp, sizeof(stamp));
+	o = ucl_object_typed_new(UCL_ARRAY);
+	ucl_array_append(o, ucl_object_fromstring(path));
+	ucl_array_append(o, ucl_object_fromstring(stamp));
+	ucl_array_append(snapshot.stamps, o);
+}
+
+/*
+ * libucl reads the files named by .include, .try_include, .includes and
+ * .load itself so they cannot be stamped, a file using them disables the
+ * snapshot.  A false match in a comment only costs a full parse.
+ */
+static void
+config_snapshot_scan(int fd, const char *path)
+{
+	static const char *macros[] = { ".include", "_include", ".load" };
+	struct stat st;
+	char *buf;
+	ssize_t r;
+	off_t off;
+	size_t i;
+
+	if (!snapshot.usable)
+		return;
+
+	if (fstat(fd, &st) == -1) {
+		snapshot.usable = false;
+		return;
+	}
+	buf = xmalloc(st.st_size + 1);
+	for (off = 0; off < st.st_size; off += r) {
+		r = pread(fd, buf + off, st.st_size - off, off);
+		if (r <= 0)
+			break;
+	}
+	buf[off] = '\0';
+	if (off < st.st_size)
+		snapshot.usable = false;
+	for (i = 0; i < NELEM(macros) && snapshot.usable; i++) {
+		if (strstr(buf, macros[i]) != NULL) {
+			pkg_debug(1, "PkgConfig: %s includes files, not using "
+			    "a snapshot", path);
+			snapshot.usable = false;
+		}
+	}
+	free(buf);
+}
+
+static void
+config_snapshot_add_repo(const ucl_object_t *obj, const char *name)
+{
+	ucl_object_t *o;
+
+	if (snapshot.repos == NULL)
+		return;
+
+	o = ucl_object_typed_new(UCL_OBJECT);
+	ucl_object_insert_key(o, ucl_object_fromstring(name), "name", 4, true);
+	ucl_object_insert_key(o, ucl_object_copy(obj), "repo", 4, true);
+	ucl_array_append(snapshot.repos, o);
+}
+
 static void
 add_repo(const ucl_object_t *obj, struct pkg_repo *r, const char *rname, pkg_init_flags flags)
 {
@@ -720,11 +904,14 @@ walk_repo_obj(const ucl_object_t *obj, const char *file, pkg_init_flags flags)
 		r = pkg_repo_find(key);
 		if (r != NULL)
 			pkg_debug(1, "PkgConfig: overwriting repository %s", key);
-		if (cur->type == UCL_OBJECT)
+		if (cur->type == UCL_OBJECT) {
 			add_repo(cur, r, key, flags);
-		else
+			config_snapshot_add_repo(cur, key);
+		} else {
 			pkg_emit_error("Ignoring bad configuration entry in %s: %s",
 			    file, ucl_object_emit(cur, UCL_EMIT_YAML));
+			snapshot.usable = false;
+		}
 	}
 }
 
@@ -747,14 +934,18 @@ load_repo_file(int dfd, const char *repodir, const char *repofile,
 	ucl_parser_register_variable (p, "ALTABI", myarch_legacy);
 
 	pkg_debug(1, "PKgConfig: loading %s/%s", repodir, repofile);
+	config_snapshot_stamp(repodir, repofile);
 	fd = openat(dfd, repofile, O_RDONLY);
 	if (fd == -1) {
 		pkg_errno("Unable to open '%s/%s'", repodir, repofile);
+		snapshot.usable = false;
 		return;
 	}
+	config_snapshot_scan(fd, repofile);
 	if (!ucl_parser_add_fd(p, fd)) {
 		pkg_emit_error("Error parsing: '%s/%s': %s", repodir,
 		    repofile, ucl_parser_get_error(p));
+		snapshot.usable = false;
 		ucl_parser_free(p);
 		close(fd);
 		return;
@@ -797,6 +988,8 @@ load_repo_files(const char *repodir, pkg_init_flags flags)
 	int nents, i, fd;
 
 	pkg_debug(1, "PkgConfig: loading repositories in %s", repodir);
+	/* Files added to or removed from the directory change its mtime */
+	config_snapshot_stamp(repodir, NULL);
 	if ((fd = open(repodir, O_DIRECTORY|O_CLOEXEC)) == -1)
 		return;
 
@@ -826,6 +1019,168 @@ load_repositories(const char *repodir, pkg_init_flags flags)
 		load_repo_files(pkg_object_string(cur), flags);
 }
 
+/*
+ * Everything a parse depends on besides the files: pkg(8) itself, the
+ * arguments, the ABI and the environment overrides.
+ */
+static void
+config_snapshot_init(const char *path, const char *reposdir,
+    pkg_init_flags flags)
+{
+	UT_string *key;
+	const char *dbdir, *val;
+	size_t i;
+
+	utstring_new(key);
+	utstring_printf(key, "%s\n%s\n%s\n%s\n%d\n%s\n%s\n", PKGVERSION,
+	    path != NULL ? path : "", reposdir != NULL ? reposdir : "",
+	    ctx.pkg_rootdir != NULL ? ctx.pkg_rootdir : "", (int)flags,
+	    myabi, myabi_legacy);
+	dbdir = NULL;
+	for (i = 0; i < c_size; i++) {
+		if ((val = getenv(c[i].key)) != NULL)
+			utstring_printf(key, "%s=%s\n", c[i].key, val);
+		if (strcmp(c[i].key, "PKG_DBDIR") == 0)
+			dbdir = c[i].def;
+	}
+	snapshot.key = xstrdup(utstring_body(key));
+	utstring_free(key);
+
+	/* The snapshot lives where PKG_DBDIR is before pkg.conf is read */
+	if ((val = getenv("PKG_DBDIR")) != NULL)
+		snprintf(snapshot.path, sizeof(snapshot.path),
+		    "%s/config.snapshot", val);
+	else
+		snprintf(snapshot.path, sizeof(snapshot.path),
+		    "%s%s/config.snapshot",
+		    ctx.pkg_rootdir != NULL ? ctx.pkg_rootdir : "", dbdir);
+}
+
+static ucl_object_t *
+config_snapshot_load(void)
+{
+	struct ucl_parser *p;
+	ucl_object_t *obj;
+	const ucl_object_t *o, *cur, *file, *saved;
+	ucl_object_iter_t it = NULL;
+	char stamp[128];
+	int fd;
+
+	if ((fd = open(snapshot.path, O_RDONLY|O_CLOEXEC)) == -1)
+		return (NULL);
+
+	p = ucl_parser_new(0);
+	if (!ucl_parser_add_fd_full(p, fd, 0, UCL_DUPLICATE_APPEND,
+	    UCL_PARSE_MSGPACK)) {
+		pkg_debug(1, "PkgConfig: ignoring snapshot %s: %s",
+		    snapshot.path, ucl_parser_get_error(p));
+		ucl_parser_free(p);
+		close(fd);
+		return (NULL);
+	}
+	close(fd);
+	obj = ucl_parser_get_object(p);
+	ucl_parser_free(p);
+	if (obj == NULL)
+		return (NULL);
+
+	o = ucl_object_find_key(obj, "key");
+	if (o == NULL || o->type != UCL_STRING ||
+	    strcmp(ucl_object_tostring(o), snapshot.key) != 0)
+		goto stale;
+	if (ucl_object_type(ucl_object_find_key(obj, "config")) != UCL_OBJECT ||
+	    ucl_object_type(ucl_object_find_key(obj, "repos")) != UCL_ARRAY)
+		goto stale;
+
+	o = ucl_object_find_key(obj, "stamps");
+	if (ucl_object_type(o) != UCL_ARRAY)
+		goto stale;
+	while ((cur = ucl_iterate_object(o, &it, true))) {
+		file = ucl_array_find_index(cur, 0);
+		saved = ucl_array_find_index(cur, 1);
+		if (ucl_object_type(file) != UCL_STRING ||
+		    ucl_object_type(saved) != UCL_STRING)
+			goto stale;
+		config_stamp(ucl_object_tostring(file), stamp, sizeof(stamp));
+		if (strcmp(stamp, ucl_object_tostring(saved)) != 0)
+			goto stale;
+	}
+
+	return (obj);
+
+stale:
+	pkg_debug(1, "PkgConfig: snapshot %s is out of date", snapshot.path);
+	ucl_object_unref(obj);
+	return (NULL);
+}
+
+static void
+config_snapshot_save(void)
+{
+	ucl_object_t *obj;
+	unsigned char *buf;
+	char tmp[MAXPATHLEN];
+	size_t len;
+	int fd;
+
+	obj = ucl_object_typed_new(UCL_OBJECT);
+	ucl_object_insert_key(obj, ucl_object_fromstring(snapshot.key),
+	    "key", 3, true);
+	ucl_object_insert_key(obj, snapshot.stamps, "stamps", 6, true);
+	ucl_object_insert_key(obj, snapshot.repos, "repos", 5, true);
+	ucl_object_insert_key(obj, snapshot.config, "config", 6, true);
+	snapshot.config = snapshot.stamps = snapshot.repos = NULL;
+	buf = ucl_object_emit_len(obj, UCL_EMIT_MSGPACK, &len);
+	ucl_object_unref(obj);
+	if (buf == NULL)
+		return;
+
+	/* Not being able to write it only means parsing again next time */
+	snprintf(tmp, sizeof(tmp), "%s.XXXXXX", snapshot.path);
+	if ((fd = mkstemp(tmp)) == -1) {
+		pkg_debug(1, "PkgConfig: cannot write snapshot %s: %s",
+		    snapshot.path, strerror(errno));
+		free(buf);
+		return;
+	}
+	if (fchmod(fd, 0644) == -1 || write(fd, buf, len) != (ssize_t)len ||
+	    rename(tmp, snapshot.path) == -1) {
+		pkg_debug(1, "PkgConfig: cannot write snapshot %s: %s",
+		    snapshot.path, strerror(errno));
+		unlink(tmp);
+	}
+	close(fd);
+	free(buf);
+}
+
+static void
+config_snapshot_replay(pkg_init_flags flags)
+{
+	const ucl_object_t *repos, *cur, *name, *obj;
+	ucl_object_iter_t it = NULL;
+
+	repos = ucl_object_find_key(snapshot.loaded, "repos");
+	while ((cur = ucl_iterate_object(repos, &it, true))) {
+		name = ucl_object_find_key(cur, "name");
+		obj = ucl_object_find_key(cur, "repo");
+		if (name == NULL || obj == NULL)
+			continue;
+		add_repo(obj, pkg_repo_find(ucl_object_tostring(name)),
+		    ucl_object_tostring(name), flags);
+	}
+}
+
+static void
+config_snapshot_free(void)
+{
+	free(snapshot.key);
+	ucl_object_unref(snapshot.loaded);
+	ucl_object_unref(snapshot.config);
+	ucl_object_unref(snapshot.stamps);
+	ucl_object_unref(snapshot.repos);
+	memset(&snapshot, 0, sizeof(snapshot));
+}
+
 bool
 pkg_compiled_for_same_os_major(void)
 {
@@ -862,6 +1217,7 @@ pkg_ini(const char *path, const char *reposdir, pkg_init_flags flags)
 	const char *evkey = NULL;
 	const char *nsname = NULL;
 	const char *metalog = NULL;
+	const char *trace = NULL;
 	const char *useragent = NULL;
 	const char *evpipe = NULL;
 	const char *url;
@@ -873,6 +1229,7 @@ pkg_ini(const char *path, const char *reposdir, pkg_init_flags flags)
 	bool fatal_errors = false;
 	int conffd = -1;
 	char *tmp = NULL;
+	char confpath[MAXPATHLEN];
 
 	k = NULL;
 	o = NULL;
@@ -894,6 +1251,18 @@ pkg_ini(const char *path, const char *reposdir, pkg_init_flags flags)
 		return (EPKG_FATAL);
 	}
 
+	/* Reuse the configuration of a previous run if nothing changed */
+	config_snapshot_init(path, reposdir, flags);
+	if ((snapshot.loaded = config_snapshot_load()) != NULL) {
+		pkg_debug(1, "PkgConfig: using snapshot %s", snapshot.path);
+		config = ucl_object_ref(ucl_object_find_key(snapshot.loaded,
+		    "config"));
+		goto configured;
+	}
+	snapshot.stamps = ucl_object_typed_new(UCL_ARRAY);
+	snapshot.repos = ucl_object_typed_new(UCL_ARRAY);
+	snapshot.usable = true;
+
 	config = ucl_object_typed_new(UCL_OBJECT);
 
 	for (i = 0; i < c_size; i++) {
@@ -973,6 +1342,14 @@ pkg_ini(const char *path, const char *reposdir, pkg_init_flags flags)
 		}
 	}
 
+	if (path == NULL)
+		snprintf(confpath, sizeof(confpath), "%s%s",
+		    ctx.pkg_rootdir != NULL ? ctx.pkg_rootdir : "",
+		    PREFIX"/etc/pkg.conf");
+	else
+		strlcpy(confpath, path, sizeof(confpath));
+	config_snapshot_stamp(confpath, NULL);
+
 	if (path == NULL)
 		conffd = openat(ctx.rootfd, PREFIX"/etc/pkg.conf" + 1, 0);
 	else
@@ -981,6 +1358,7 @@ pkg_ini(const char *path, const char *reposdir, pkg_init_flags flags)
 		pkg_errno("Cannot open %s/%s",
 		    ctx.pkg_rootdir != NULL ? ctx.pkg_rootdir : "",
 		    path);
+		snapshot.usable = false;
 	}
 
 	p = ucl_parser_new(0);
@@ -990,8 +1368,10 @@ pkg_ini(const char *path, const char *reposdir, pkg_init_flags flags)
 	errno = 0;
 	obj = NULL;
 	if (conffd != -1) {
+		config_snapshot_scan(conffd, confpath);
 		if (!ucl_parser_add_fd(p, conffd)) {
 			pkg_emit_error("Invalid configuration file: %s", ucl_parser_get_error(p));
+			snapshot.usable = false;
 		} else {
 			obj = ucl_parser_get_object(p);
 		}
@@ -1026,6 +1406,7 @@ pkg_ini(const char *path, const char *reposdir, pkg_init_flags flags)
 
 		if (object->type != cur->type) {
 			pkg_emit_error("Malformed key %s, ignoring", key);
+			snapshot.usable = false;
 			continue;
 		}
 
@@ -1068,6 +1449,7 @@ pkg_ini(const char *path, const char *reposdir, pkg_init_flags flags)
 				pkg_emit_error("Invalid type for environment "
 				    "variable %s, got %s, while expecting an integer",
 				    key, val);
+				snapshot.usable = false;
 				ucl_object_unref(o);
 				continue;
 			}
@@ -1078,6 +1460,7 @@ pkg_ini(const char *path, const char *reposdir, pkg_init_flags flags)
 				pkg_emit_error("Invalid type for environment "
 				    "variable %s, got %s, while expecting a boolean",
 				    key, val);
+				snapshot.usable = false;
 				ucl_object_unref(o);
 				continue;
 			}
@@ -1141,12 +1524,15 @@ pkg_ini(const char *path, const char *reposdir, pkg_init_flags flags)
 		}
 		ucl_object_unref(ncfg);
 	}
+	ucl_object_unref(obj);
+	ucl_parser_free(p);
+	/* pkg and pkg-static share the snapshot */
+	snapshot.config = ucl_object_copy(config);
 
+configured:
 	disable_plugins_if_static();
 
 	parsed = true;
-	ucl_object_unref(obj);
-	ucl_parser_free(p);
 
 	if (pkg_object_string(pkg_config_get("ABI")) == NULL ||
 	    strcmp(pkg_object_string(pkg_config_get("ABI")), "unknown") == 0) {
@@ -1163,6 +1549,7 @@ pkg_ini(const char *path, const char *reposdir, pkg_init_flags flags)
 
 	ctx.debug_level = pkg_object_int(pkg_config_get("DEBUG_LEVEL"));
 	ctx.developer_mode = pkg_object_bool(pkg_config_get("DEVELOPER_MODE"));
+	pkg_sync_init();
 
 	it = NULL;
 	object = ucl_object_find_key(config, "PKG_ENV");
@@ -1181,7 +1568,10 @@ pkg_ini(const char *path, const char *reposdir, pkg_init_flags flags)
 		setenv("HTTP_USER_AGENT", "pkg/"PKGVERSION, 1);
 
 	/* load the repositories */
-	load_repositories(reposdir, flags);
+	if (snapshot.loaded != NULL)
+		config_snapshot_replay(flags);
+	else
+		load_repositories(reposdir, flags);
 
 	object = ucl_object_find_key(config, "REPOSITORIES");
 	while ((cur = ucl_iterate_object(object, &it, true))) {
@@ -1213,6 +1603,11 @@ pkg_ini(const char *path, const char *reposdir, pkg_init_flags flags)
 		}
 	}
 
+	if (snapshot.config != NULL && snapshot.usable &&
+	    pkg_object_bool(pkg_config_get("CONFIG_SNAPSHOT")))
+		config_snapshot_save();
+	config_snapshot_free();
+
 	/* bypass resolv.conf with specified NAMESERVER if any */
 	nsname = pkg_object_string(pkg_config_get("NAMESERVER"));
 	if (nsname != NULL && set_nameserver(nsname) != 0)
@@ -1226,6 +1621,11 @@ pkg_ini(const char *path, const char *reposdir, pkg_init_flags flags)
 		}
 	}
 
+	/* Open the phase trace */
+	trace = pkg_object_string(pkg_config_get("PKG_TRACE_FILE"));
+	if (trace != NULL && pkg_trace_open(trace) != EPKG_OK)
+		return (EPKG_FATAL);
+
 	return (EPKG_OK);
 }
 
@@ -1291,14 +1691,13 @@ pkg_repo_free(struct pkg_repo *r)
 {
 	struct pkg_kv *kv, *tmp;
 
+	pkg_fetch_mirrors_free(r);
 	free(r->url);
 	free(r->name);
 	free(r->pubkey);
 	free(r->meta);
-	if (r->ssh != NULL) {
-		fprintf(r->ssh, "quit\n");
-		pclose(r->ssh);
-	}
+	if (r->ssh != NULL)
+		fclose(r->ssh);
 	LL_FOREACH_SAFE(r->env, kv, tmp) {
 		LL_DELETE(r->env, kv);
 		pkg_kv_free(kv);
@@ -1315,15 +1714,21 @@ pkg_shutdown(void)
 		/* NOTREACHED */
 	}
 
-	ucl_object_unref(config);
+	pkg_sandbox_worker_stop();
+	pkg_trace_close();
+	config_snapshot_free();
+	/* repositories may save state where the configuration says */
 	HASH_FREE(repos, pkg_repo_free);
+	ucl_object_unref(config);
 
+	/* pkg_ini() may be called again */
 	if (ctx.rootfd != -1)
 		close(ctx.rootfd);
 	if (ctx.cachedirfd != -1)
-		close(ctx.rootfd);
+		close(ctx.cachedirfd);
 	if (ctx.pkg_dbdirfd != -1)
 		close(ctx.pkg_dbdirfd);
+	ctx.rootfd = ctx.cachedirfd = ctx.pkg_dbdirfd = -1;
 
 	parsed = false;
 
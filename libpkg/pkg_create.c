@@ -27,11 +27,14 @@
  * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <sys/mman.h>
 #include <sys/stat.h>
 
 #include <errno.h>
 #include <regex.h>
 #include <fcntl.h>
+#include <stdint.h>
+#include <unistd.h>
 
 #include <bsd_compat.h>
 
@@ -46,6 +49,128 @@ static void counter_init(const char *what, int64_t max);
 static void counter_count(void);
 static void counter_end(void);
 
+/*
+ * The checksums go in the manifest, which has to be the first entry of
+ * the archive, so every file is hashed before anything is packed.  To
+ * avoid reading each file twice its content is kept from the hashing pass
+ * to the packing one: big files are mapped, small ones copied on the heap.
+ * Past these limits a file is read again when packed.
+ */
+#define CONTENT_MAP_MIN		(64 * 1024)
+#define CONTENT_MAP_MAX		16384
+#define CONTENT_HEAP_MAX	(64 * 1024 * 1024)
+
+struct pkg_content {
+	void	*data;
+	size_t	 len;
+	bool	 mapped;
+	bool	 reread;	/* not kept, read again when packed */
+};
+
+struct pkg_contents {
+	struct pkg_content *c;
+	size_t	 nmaps;
+	size_t	 heap;
+	int64_t	 bytes;		/* content of the regular files */
+	int64_t	 read;		/* read from disk to hash and pack them */
+};
+
+static bool
+pkg_content_load(struct pkg_contents *pc, struct pkg_content *c,
+    const char *fpath, const struct stat *st)
+{
+	struct stat fst;
+	void *data;
+	size_t len, off;
+	ssize_t r;
+	int fd;
+
+	len = st->st_size;
+	if (len < CONTENT_MAP_MIN) {
+		if (pc->heap + len > CONTENT_HEAP_MAX)
+			return (false);
+	} else if (pc->nmaps >= CONTENT_MAP_MAX)
+		return (false);
+
+	if ((fd = open(fpath, O_RDONLY|O_CLOEXEC)) == -1)
+		return (false);
+	if (fstat(fd, &fst) == -1 || fst.st_size != st->st_size) {
+		close(fd);
+		return (false);
+	}
+
+	if (len >= CONTENT_MAP_MIN) {
+		data = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED) {
+			close(fd);
+			return (false);
+		}
+		posix_madvise(data, len, POSIX_MADV_SEQUENTIAL);
+		c->mapped = true;
+		pc->nmaps++;
+	} else {
+		data = xmalloc(len);
+		for (off = 0; off < len; off += r) {
+			r = read(fd, (char *)data + off, len - off);
+			if (r <= 0) {
+				free(data);
+				close(fd);
+				return (false);
+			}
+		}
+		pc->heap += len;
+	}
+	close(fd);
+
+	c->data = data;
+	c->len = len;
+
+	return (true);
+}
+
+static char *
+pkg_content_checksum(struct pkg_contents *pc, struct pkg_content *c,
+    const char *fpath, const struct stat *st)
+{
+	if (!S_ISREG(st->st_mode) || st->st_size == 0)
+		return (pkg_checksum_generate_file(fpath,
+		    PKG_HASH_TYPE_SHA256_HEX));
+
+	pc->bytes += st->st_size;
+	pc->read += st->st_size;
+	if (!pkg_content_load(pc, c, fpath, st)) {
+		c->reread = true;
+		c->len = st->st_size;
+		return (pkg_checksum_generate_file(fpath,
+		    PKG_HASH_TYPE_SHA256_HEX));
+	}
+
+	return (pkg_checksum_generate_data(c->data, c->len,
+	    PKG_HASH_TYPE_SHA256_HEX));
+}
+
+static void
+pkg_content_release(struct pkg_content *c)
+{
+	if (c->data == NULL)
+		return;
+	if (c->mapped)
+		munmap(c->data, c->len);
+	else
+		free(c->data);
+	c->data = NULL;
+}
+
+static void
+pkg_contents_free(struct pkg_contents *pc, int64_t nfiles)
+{
+	int64_t i;
+
+	for (i = 0; i < nfiles; i++)
+		pkg_content_release(&pc->c[i]);
+	free(pc->c);
+}
+
 static int
 pkg_create_from_dir(struct pkg *pkg, const char *root,
     struct packing *pkg_archive)
@@ -53,10 +178,12 @@ pkg_create_from_dir(struct pkg *pkg, const char *root,
 	char		 fpath[MAXPATHLEN];
 	struct pkg_file	*file = NULL;
 	struct pkg_dir	*dir = NULL;
-	int		 ret;
+	struct pkg_contents contents;
+	struct pkg_content *c;
+	int		 ret = EPKG_OK;
 	struct stat	 st;
 	int64_t		 flatsize = 0;
-	int64_t		 nfiles;
+	int64_t		 nfiles, i;
 	const char	*relocation;
 	hardlinks_t	*hardlinks;
 
@@ -78,8 +205,12 @@ pkg_create_from_dir(struct pkg *pkg, const char *root,
 	nfiles = kh_count(pkg->filehash);
 	counter_init("file sizes/checksums", nfiles);
 
+	memset(&contents, 0, sizeof(contents));
+	contents.c = xcalloc(nfiles + 1, sizeof(*contents.c));
 	hardlinks = kh_init_hardlinks();
+	i = 0;
 	while (pkg_files(pkg, &file) == EPKG_OK) {
+		c = &contents.c[i++];
 
 		snprintf(fpath, sizeof(fpath), "%s%s%s", root ? root : "",
 		    relocation, file->path);
@@ -87,7 +218,8 @@ pkg_create_from_dir(struct pkg *pkg, const char *root,
 		if (lstat(fpath, &st) == -1) {
 			pkg_emit_error("file '%s' is missing", fpath);
 			kh_destroy_hardlinks(hardlinks);
-			return (EPKG_FATAL);
+			ret = EPKG_FATAL;
+			goto cleanup;
 		}
 
 		if (file->size == 0)
@@ -95,13 +227,17 @@ pkg_create_from_dir(struct pkg *pkg, const char *root,
 
 		if (st.st_nlink == 1 || !check_for_hardlink(hardlinks, &st)) {
 			flatsize += file->size;
+			file->sum = pkg_content_checksum(&contents, c, fpath,
+			    &st);
+		} else {
+			/* Only the first link carries data in the archive */
+			file->sum = pkg_checksum_generate_file(fpath,
+			    PKG_HASH_TYPE_SHA256_HEX);
 		}
-
-		file->sum = pkg_checksum_generate_file(fpath,
-		    PKG_HASH_TYPE_SHA256_HEX);
 		if (file->sum == NULL) {
 			kh_destroy_hardlinks(hardlinks);
-			return (EPKG_FATAL);
+			ret = EPKG_FATAL;
+			goto cleanup;
 		}
 
 		counter_count();
@@ -114,7 +250,8 @@ pkg_create_from_dir(struct pkg *pkg, const char *root,
 
 	if (pkg->type == PKG_OLD_FILE) {
 		pkg_emit_error("Cannot create an old format package");
-		return (EPKG_FATAL);
+		ret = EPKG_FATAL;
+		goto cleanup;
 	}
 	/*
 	 * Register shared libraries used by the package if
@@ -132,19 +269,29 @@ pkg_create_from_dir(struct pkg *pkg, const char *root,
 
 	counter_init("packing files", nfiles);
 
+	i = 0;
 	while (pkg_files(pkg, &file) == EPKG_OK) {
+		c = &contents.c[i++];
 
 		snprintf(fpath, sizeof(fpath), "%s%s%s", root ? root : "",
 		    relocation, file->path);
 
-		ret = packing_append_file_attr(pkg_archive, fpath, file->path,
-		    file->uname, file->gname, file->perm, file->fflags);
+		if (c->reread)
+			contents.read += c->len;
+		ret = packing_append_file_data(pkg_archive, fpath, file->path,
+		    file->uname, file->gname, file->perm, file->fflags,
+		    c->data, c->len);
+		pkg_content_release(c);
 		if (ctx.developer_mode && ret != EPKG_OK)
-			return (ret);
+			goto cleanup;
 		counter_count();
 	}
 
 	counter_end();
+	pkg_contents_free(&contents, nfiles);
+
+	pkg_debug(1, "Packed %jd bytes of file content, %jd bytes read",
+	    (intmax_t)contents.bytes, (intmax_t)contents.read);
 
 	nfiles = kh_count(pkg->dirhash);
 	counter_init("packing directories", nfiles);
@@ -163,6 +310,10 @@ pkg_create_from_dir(struct pkg *pkg, const char *root,
 	counter_end();
 
 	return (EPKG_OK);
+
+cleanup:
+	pkg_contents_free(&contents, nfiles);
+	return (ret);
 }
 
 static struct packing *
@@ -418,7 +418,8 @@ pkg_jobs_cudf_add_package(struct pkg_jobs *j, struct pkg_cudf_entry *entry)
 				entry->uid, ver);
 		assert(old != NULL);
 		/* XXX: this is a hack due to iterators stupidity */
-		selected->pkg->old_version = old->pkg->version;
+		free(selected->pkg->old_version);
+		selected->pkg->old_version = xstrdup(old->pkg->version);
 		pkg_jobs_cudf_insert_res_job (&j->jobs, selected, old, PKG_SOLVED_UPGRADE);
 		j->count ++;
 	}
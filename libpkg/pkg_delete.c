@@ -136,12 +136,61 @@ pkg_delete(struct pkg *pkg, struct pkgdb *db, unsigned flags)
 	return (pkgdb_unregister_pkg(db, pkg->id));
 }
 
+static void
+pkg_dir_node_free(struct pkg_dir_node *n)
+{
+	struct pkg_dir_node *c, *tmp;
+
+	HASH_ITER(hh, n->children, c, tmp) {
+		HASH_DEL(n->children, c);
+		pkg_dir_node_free(c);
+	}
+	free(n->name);
+	free(n);
+}
+
+void
+pkg_dir_to_del_free(struct pkg *pkg)
+{
+	size_t i;
+
+	for (i = 0; i < pkg->dir_to_del_len; i++)
+		free(pkg->dir_to_del[i]);
+	free(pkg->dir_to_del);
+	pkg->dir_to_del = NULL;
+	pkg->dir_to_del_len = pkg->dir_to_del_cap = 0;
+
+	if (pkg->dir_to_del_trie != NULL)
+		pkg_dir_node_free(pkg->dir_to_del_trie);
+	pkg->dir_to_del_trie = NULL;
+}
+
+static size_t
+pkg_dir_to_del_append(struct pkg *pkg, const char *path)
+{
+	if (pkg->dir_to_del_len + 1 > pkg->dir_to_del_cap) {
+		pkg->dir_to_del_cap += 64;
+		pkg->dir_to_del = xrealloc(pkg->dir_to_del,
+		    pkg->dir_to_del_cap * sizeof(char *));
+	}
+
+	pkg->dir_to_del[pkg->dir_to_del_len] = xstrdup(path);
+	return (pkg->dir_to_del_len++);
+}
+
+/*
+ * Only the deepest directories are kept: a directory already covered by a
+ * deeper one is ignored, and a deeper directory replaces its parent.  The
+ * trie finds both cases in one walk over the path components.
+ */
 void
 pkg_add_dir_to_del(struct pkg *pkg, const char *file, const char *dir)
 {
 	char path[MAXPATHLEN];
 	char *tmp;
-	size_t i, len, len2;
+	const char *comp, *end;
+	struct pkg_dir_node *n, *child, *parent;
+	size_t len, clen;
 
 	strlcpy(path, file != NULL ? file : dir, MAXPATHLEN);
 
@@ -159,36 +208,64 @@ pkg_add_dir_to_del(struct pkg *pkg, const char *file, const char *dir)
 		path[len] = '\0';
 	}
 
-	for (i = 0; i < pkg->dir_to_del_len ; i++) {
-		len2 = strlen(pkg->dir_to_del[i]);
-		if (len2 >= len && strncmp(path, pkg->dir_to_del[i], len) == 0)
-			return;
+	if (pkg->dir_to_del_trie == NULL) {
+		pkg->dir_to_del_trie = xcalloc(1, sizeof(struct pkg_dir_node));
+		pkg->dir_to_del_trie->idx = -1;
+	}
 
-		if (strncmp(path, pkg->dir_to_del[i], len2) == 0) {
-			pkg_debug(1, "Replacing in deletion %s with %s",
-			    pkg->dir_to_del[i], path);
-			free(pkg->dir_to_del[i]);
-			pkg->dir_to_del[i] = xstrdup(path);
-			return;
+	n = pkg->dir_to_del_trie;
+	parent = NULL;
+	for (comp = path; *comp != '\0'; comp = end + 1) {
+		end = strchr(comp, '/');
+		if (end == comp)
+			continue;
+		if (n->idx >= 0)
+			parent = n;
+		clen = end - comp;
+		HASH_FIND(hh, n->children, comp, clen, child);
+		if (child == NULL) {
+			child = xcalloc(1, sizeof(*child));
+			child->name = xstrndup(comp, clen);
+			child->idx = -1;
+			HASH_ADD_KEYPTR(hh, n->children, child->name, clen,
+			    child);
 		}
+		n = child;
 	}
 
-	pkg_debug(1, "Adding to deletion %s", path);
+	if (n->has_entry)
+		return;
 
-	if (pkg->dir_to_del_len + 1 > pkg->dir_to_del_cap) {
-		pkg->dir_to_del_cap += 64;
-		pkg->dir_to_del = xrealloc(pkg->dir_to_del,
-		    pkg->dir_to_del_cap * sizeof(char *));
+	if (parent != NULL) {
+		pkg_debug(1, "Replacing in deletion %s with %s",
+		    pkg->dir_to_del[parent->idx], path);
+		n->idx = parent->idx;
+		parent->idx = -1;
+		free(pkg->dir_to_del[n->idx]);
+		pkg->dir_to_del[n->idx] = xstrdup(path);
+	} else {
+		pkg_debug(1, "Adding to deletion %s", path);
+		n->idx = pkg_dir_to_del_append(pkg, path);
 	}
 
-	pkg->dir_to_del[pkg->dir_to_del_len++] = xstrdup(path);
+	/* Flag the new entry on every node down to it */
+	n = pkg->dir_to_del_trie;
+	n->has_entry = true;
+	for (comp = path; *comp != '\0'; comp = end + 1) {
+		end = strchr(comp, '/');
+		if (end == comp)
+			continue;
+		clen = end - comp;
+		HASH_FIND(hh, n->children, comp, clen, child);
+		child->has_entry = true;
+		n = child;
+	}
 }
 
 static void
-rmdir_p(struct pkgdb *db, struct pkg *pkg, char *dir, const char *prefix_r)
+rmdir_p(kh_strings_t *used, struct pkg *pkg, char *dir, const char *prefix_r)
 {
 	char *tmp;
-	int64_t cnt;
 	char fullpath[MAXPATHLEN];
 	size_t len;
 #if defined(HAVE_CHFLAGS)
@@ -203,18 +280,17 @@ rmdir_p(struct pkgdb *db, struct pkg *pkg, char *dir, const char *prefix_r)
 		fullpath[len - 1] = '\0';
 		len--;
 	}
-	if (pkgdb_is_dir_used(db, pkg, fullpath, &cnt) != EPKG_OK)
-		return;
 
-	pkg_debug(1, "Number of packages owning the directory '%s': %d",
-	    fullpath, (int)cnt);
 	/*
 	 * At this moment the package we are removing have already been removed
 	 * from the local database so if anything else is owning the directory
-	 * that is another package meaning only remove the diretory is cnt == 0
+	 * that is another package meaning only remove the diretory if unused
 	 */
-	if (cnt > 0)
+	if (kh_contains(strings, used, fullpath)) {
+		pkg_debug(1, "Directory '%s' is owned by another package",
+		    fullpath);
 		return;
+	}
 
 	if (strcmp(prefix_r, fullpath + 1) == 0)
 		return;
@@ -263,18 +339,72 @@ rmdir_p(struct pkgdb *db, struct pkg *pkg, char *dir, const char *prefix_r)
 
 	tmp[1] = '\0';
 
-	rmdir_p(db, pkg, dir, prefix_r);
+	rmdir_p(used, pkg, dir, prefix_r);
+}
+
+/*
+ * Collect every directory rmdir_p() may look at: the planned ones and,
+ * inside the prefix, their parents up to the prefix.
+ */
+static void
+pkg_rmdir_candidates(struct pkg *pkg, const char *prefix_r, kh_strings_t **seen,
+    char ***dirs, size_t *ndirs, size_t *cap)
+{
+	char fullpath[MAXPATHLEN];
+	char *p, *slash;
+	size_t i, len, plen;
+	bool inprefix;
+
+	plen = strlen(prefix_r);
+	for (i = 0; i < pkg->dir_to_del_len; i++) {
+		len = snprintf(fullpath, sizeof(fullpath), "/%s",
+		    pkg->dir_to_del[i]);
+		while (len > 1 && fullpath[len - 1] == '/')
+			fullpath[--len] = '\0';
+		inprefix = strncmp(prefix_r, pkg->dir_to_del[i], plen) == 0;
+
+		for (;;) {
+			if (strcmp(prefix_r, fullpath + 1) == 0 ||
+			    kh_contains(strings, *seen, fullpath))
+				break;
+			p = xstrdup(fullpath);
+			kh_safe_add(strings, *seen, p, p);
+			if (*ndirs == *cap) {
+				*cap += 64;
+				*dirs = xrealloc(*dirs, *cap * sizeof(char *));
+			}
+			(*dirs)[(*ndirs)++] = p;
+
+			if (!inprefix)
+				break;
+			slash = strrchr(fullpath, '/');
+			if (slash == NULL || slash == fullpath)
+				break;
+			*slash = '\0';
+		}
+	}
 }
 
 static void
 pkg_effective_rmdir(struct pkgdb *db, struct pkg *pkg)
 {
 	char prefix_r[MAXPATHLEN];
-	size_t i;
+	kh_strings_t *seen = NULL, *used = NULL;
+	char **dirs = NULL;
+	size_t i, ndirs = 0, cap = 0;
 
 	snprintf(prefix_r, sizeof(prefix_r), "%s", pkg->prefix + 1);
-	for (i = 0; i < pkg->dir_to_del_len; i++)
-		rmdir_p(db, pkg, pkg->dir_to_del[i], prefix_r);
+
+	pkg_rmdir_candidates(pkg, prefix_r, &seen, &dirs, &ndirs, &cap);
+	if (ndirs > 0 &&
+	    pkgdb_dirs_used(db, pkg, dirs, ndirs, &used) == EPKG_OK) {
+		for (i = 0; i < pkg->dir_to_del_len; i++)
+			rmdir_p(used, pkg, pkg->dir_to_del[i], prefix_r);
+	}
+
+	kh_free(strings, used, char, free);
+	kh_free(strings, seen, char, free);
+	free(dirs);
 }
 
 void
@@ -385,12 +515,7 @@ pkg_delete_dir(struct pkg *pkg, struct pkg_dir *dir)
 	if ((strncmp(prefix_rel, path, len) == 0) && path[len] == '/') {
 		pkg_add_dir_to_del(pkg, NULL, path);
 	} else {
-		if (pkg->dir_to_del_len + 1 > pkg->dir_to_del_cap) {
-			pkg->dir_to_del_cap += 64;
-			pkg->dir_to_del = xrealloc(pkg->dir_to_del,
-			    pkg->dir_to_del_cap * sizeof(char *));
-		}
-		pkg->dir_to_del[pkg->dir_to_del_len++] = xstrdup(path);
+		pkg_dir_to_del_append(pkg, path);
 	}
 }
 
@@ -0,0 +1,507 @@
+/*-
+ * Copyright (c) 2026 The pkg contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer
+ *    in this position and unchanged.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Package deltas, published by pkg repo -d.  A delta rebuilds the archive
+ * of a package from another version of it.  It is an archive holding:
+ *
+ * +DELTA	the files whose data is taken from the base, one path per
+ *		line: the regular files with the same checksum in both
+ *		manifests.
+ *
+ * followed by every entry of the new archive, in order, the files listed
+ * in +DELTA being stored without their data.
+ *
+ * The base is either the archive of the previous version or its installed
+ * files.  The rebuilt archive is compressed again, so it is not byte for
+ * byte the one of the repository: the data taken from the base is
+ * verified against the checksums of the new +MANIFEST, the rest being
+ * covered by the checksum of the delta.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <archive.h>
+#include <archive_entry.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <bsd_compat.h>
+
+#include "pkg.h"
+#include "private/event.h"
+#include "private/pkg.h"
+#include "private/utils.h"
+
+#define DELTA_LIST	"+DELTA"
+
+struct delta_extent {
+	char *path;
+	off_t off;		/* in the spool, -1 until found in the base */
+	int64_t size;
+};
+
+KHASH_MAP_INIT_STR(delta_extents, struct delta_extent *);
+
+static void
+delta_extent_free(struct delta_extent *e)
+{
+	free(e->path);
+	free(e);
+}
+
+/*
+ * Only plain regular files are taken from the base, hardlinks carry no
+ * data of their own.
+ */
+static bool
+delta_entry_has_data(struct archive_entry *ae)
+{
+	return (archive_entry_filetype(ae) == AE_IFREG &&
+	    archive_entry_hardlink(ae) == NULL);
+}
+
+static bool
+delta_file_shared(struct pkg *base, struct pkg *pkg, const char *path)
+{
+	struct pkg_file *f, *bf;
+
+	if ((f = pkg_get_file(pkg, path)) == NULL || f->sum == NULL ||
+	    *f->sum == '\0')
+		return (false);
+	if ((bf = pkg_get_file(base, path)) == NULL || bf->sum == NULL)
+		return (false);
+
+	return (strcmp(f->sum, bf->sum) == 0);
+}
+
+static struct archive *
+delta_archive_open(const char *path)
+{
+	struct archive *a;
+
+	a = archive_read_new();
+	archive_read_support_filter_all(a);
+	archive_read_support_format_tar(a);
+	if (archive_read_open_filename(a, path, 4096) != ARCHIVE_OK) {
+		pkg_emit_error("archive_read_open_filename(%s): %s", path,
+		    archive_error_string(a));
+		archive_read_free(a);
+		return (NULL);
+	}
+
+	return (a);
+}
+
+/*
+ * Copy the data of the current entry, holes included: the entry is
+ * written back as a plain file of the same size.
+ */
+static int
+delta_copy_data(struct archive *a, struct archive_entry *ae,
+    struct packing *pack)
+{
+	static const char zeros[8192];
+	const void *buf;
+	size_t size, chunk;
+	int64_t offset, pos = 0;
+	int r;
+
+	for (;;) {
+		r = archive_read_data_block(a, &buf, &size, &offset);
+		if (r == ARCHIVE_EOF)
+			offset = archive_entry_size(ae);
+		else if (r != ARCHIVE_OK) {
+			pkg_emit_error("archive_read_data_block(%s): %s",
+			    archive_entry_pathname(ae), archive_error_string(a));
+			return (EPKG_FATAL);
+		}
+		for (; pos < offset; pos += chunk) {
+			chunk = MIN((int64_t)sizeof(zeros), offset - pos);
+			if (packing_append_data(pack, zeros, chunk) != EPKG_OK)
+				return (EPKG_FATAL);
+		}
+		if (r == ARCHIVE_EOF)
+			return (EPKG_OK);
+		if (packing_append_data(pack, buf, size) != EPKG_OK)
+			return (EPKG_FATAL);
+		pos += size;
+	}
+}
+
+/*
+ * Write to <dest>.<format> a delta rebuilding target from base.  Returns
+ * EPKG_END, writing nothing, when the versions share no file.
+ */
+int
+pkg_delta_create(const char *base, const char *target, const char *dest,
+    pkg_formats format)
+{
+	struct pkg_manifest_key *keys = NULL;
+	struct pkg *bp = NULL, *tp = NULL;
+	struct pkg_file *f = NULL;
+	struct packing *pack = NULL;
+	struct archive *a = NULL;
+	struct archive_entry *ae;
+	UT_string *list;
+	char path[MAXPATHLEN];
+	int r, ret = EPKG_FATAL;
+
+	utstring_new(list);
+	pkg_manifest_keys_new(&keys);
+	if (pkg_open(&bp, base, keys, PKG_OPEN_MANIFEST_ONLY) != EPKG_OK ||
+	    pkg_open(&tp, target, keys, PKG_OPEN_MANIFEST_ONLY) != EPKG_OK)
+		goto cleanup;
+
+	while (pkg_files(tp, &f) == EPKG_OK) {
+		if (delta_file_shared(bp, tp, f->path))
+			utstring_printf(list, "%s\n", f->path);
+	}
+	if (utstring_len(list) == 0) {
+		ret = EPKG_END;
+		goto cleanup;
+	}
+
+	if ((a = delta_archive_open(target)) == NULL)
+		goto cleanup;
+	if (packing_init(&pack, dest, format) != EPKG_OK)
+		goto cleanup;
+	if (packing_append_buffer(pack, utstring_body(list), DELTA_LIST,
+	    utstring_len(list)) != EPKG_OK)
+		goto cleanup;
+
+	while ((r = archive_read_next_header(a, &ae)) == ARCHIVE_OK) {
+		pkg_absolutepath(archive_entry_pathname(ae), path, sizeof(path),
+		    true);
+		if (delta_entry_has_data(ae) && delta_file_shared(bp, tp, path)) {
+			archive_entry_set_size(ae, 0);
+			if (packing_append_entry(pack, ae) != EPKG_OK)
+				goto cleanup;
+			continue;
+		}
+		if (packing_append_entry(pack, ae) != EPKG_OK ||
+		    delta_copy_data(a, ae, pack) != EPKG_OK)
+			goto cleanup;
+	}
+	if (r != ARCHIVE_EOF) {
+		pkg_emit_error("archive_read_next_header(%s): %s", target,
+		    archive_error_string(a));
+		goto cleanup;
+	}
+	ret = EPKG_OK;
+
+cleanup:
+	packing_finish(pack);
+	if (a != NULL) {
+		archive_read_close(a);
+		archive_read_free(a);
+	}
+	utstring_free(list);
+	pkg_free(bp);
+	pkg_free(tp);
+	pkg_manifest_keys_free(keys);
+
+	return (ret);
+}
+
+static int
+delta_read_list(struct archive *a, struct archive_entry *ae,
+    kh_delta_extents_t **extents)
+{
+	struct delta_extent *e;
+	char *buf, *line, *next;
+	int64_t len;
+
+	len = archive_entry_size(ae);
+	buf = xmalloc(len + 1);
+	if (archive_read_data(a, buf, len) != len) {
+		pkg_emit_error("Invalid delta: cannot read %s", DELTA_LIST);
+		free(buf);
+		return (EPKG_FATAL);
+	}
+	buf[len] = '\0';
+
+	for (line = buf; *line != '\0'; line = next) {
+		if ((next = strchr(line, '\n')) != NULL)
+			*next++ = '\0';
+		else
+			next = line + strlen(line);
+		if (*line == '\0')
+			continue;
+		e = xcalloc(1, sizeof(*e));
+		e->path = xstrdup(line);
+		e->off = -1;
+		kh_add(delta_extents, *extents, e, e->path, delta_extent_free);
+	}
+	free(buf);
+
+	return (EPKG_OK);
+}
+
+/*
+ * Copy the data of the listed files of the base archive into the spool,
+ * an unlinked temporary file next to the rebuilt archive.
+ */
+static int
+delta_spool_base(const char *base, const char *dest,
+    kh_delta_extents_t *extents, int *spoolfd)
+{
+	struct archive *a;
+	struct archive_entry *ae;
+	struct delta_extent *e;
+	char path[MAXPATHLEN];
+	const void *buf;
+	size_t size;
+	int64_t offset;
+	off_t end = 0;
+	int r, ret = EPKG_FATAL;
+
+	snprintf(path, sizeof(path), "%s.spool", dest);
+	if ((*spoolfd = open(path, O_RDWR|O_CREAT|O_TRUNC|O_CLOEXEC,
+	    0600)) == -1) {
+		pkg_emit_errno("open", path);
+		return (EPKG_FATAL);
+	}
+	unlink(path);
+
+	if ((a = delta_archive_open(base)) == NULL)
+		return (EPKG_FATAL);
+
+	while ((r = archive_read_next_header(a, &ae)) == ARCHIVE_OK) {
+		if (!delta_entry_has_data(ae))
+			continue;
+		pkg_absolutepath(archive_entry_pathname(ae), path, sizeof(path),
+		    true);
+		kh_find(delta_extents, extents, path, e);
+		if (e == NULL)
+			continue;
+		e->off = end;
+		e->size = archive_entry_size(ae);
+		/* Holes are left as such, they read as zeros */
+		while ((r = archive_read_data_block(a, &buf, &size, &offset)) ==
+		    ARCHIVE_OK) {
+			if (pwrite(*spoolfd, buf, size, e->off + offset) !=
+			    (ssize_t)size) {
+				pkg_emit_errno("pwrite", "delta spool");
+				goto cleanup;
+			}
+		}
+		if (r != ARCHIVE_EOF)
+			break;
+		end += e->size;
+	}
+	if (r != ARCHIVE_EOF) {
+		pkg_emit_error("%s: %s", base, archive_error_string(a));
+		goto cleanup;
+	}
+	if (ftruncate(*spoolfd, end) == -1) {
+		pkg_emit_errno("ftruncate", "delta spool");
+		goto cleanup;
+	}
+	ret = EPKG_OK;
+
+cleanup:
+	archive_read_close(a);
+	archive_read_free(a);
+
+	return (ret);
+}
+
+/*
+ * Write the data of a file taken from the base, from the spool or from
+ * the installed file, checking it against the sum of the new manifest.
+ */
+static int
+delta_copy_base(struct packing *pack, struct archive_entry *ae,
+    struct pkg_file *f, struct delta_extent *e, int spoolfd)
+{
+	struct pkg_checksum_stream *st;
+	struct stat sb;
+	char buf[32768];
+	off_t off;
+	int64_t size;
+	ssize_t r;
+	int fd, ret = EPKG_FATAL;
+
+	if (spoolfd != -1) {
+		if (e->off == -1) {
+			pkg_emit_error("Invalid delta: %s is not in the base",
+			    f->path);
+			return (EPKG_FATAL);
+		}
+		fd = spoolfd;
+		off = e->off;
+		size = e->size;
+	} else {
+		fd = openat(ctx.rootfd, RELATIVE_PATH(f->path),
+		    O_RDONLY|O_NOFOLLOW|O_CLOEXEC);
+		if (fd == -1 || fstat(fd, &sb) == -1 || !S_ISREG(sb.st_mode)) {
+			pkg_emit_error("Cannot use the installed %s for the "
+			    "delta", f->path);
+			if (fd != -1)
+				close(fd);
+			return (EPKG_FATAL);
+		}
+		off = 0;
+		size = sb.st_size;
+	}
+
+	if ((st = pkg_checksum_stream_new(f->sum)) == NULL) {
+		pkg_emit_error("Invalid delta: no checksum for %s", f->path);
+		goto cleanup;
+	}
+	archive_entry_set_size(ae, size);
+	if (packing_append_entry(pack, ae) != EPKG_OK) {
+		pkg_checksum_stream_final(st);
+		goto cleanup;
+	}
+	while (size > 0) {
+		r = pread(fd, buf, MIN((int64_t)sizeof(buf), size), off);
+		if (r <= 0) {
+			if (r == -1 && errno == EINTR)
+				continue;
+			pkg_emit_errno("pread", f->path);
+			pkg_checksum_stream_final(st);
+			goto cleanup;
+		}
+		pkg_checksum_stream_update(st, buf, r);
+		if (packing_append_data(pack, buf, r) != EPKG_OK) {
+			pkg_checksum_stream_final(st);
+			goto cleanup;
+		}
+		off += r;
+		size -= r;
+	}
+	if (pkg_checksum_stream_final(st) != 0) {
+		pkg_emit_error("Delta base: checksum mismatch for %s", f->path);
+		goto cleanup;
+	}
+	ret = EPKG_OK;
+
+cleanup:
+	if (fd != spoolfd)
+		close(fd);
+
+	return (ret);
+}
+
+/*
+ * Rebuild into <dest>.<format> the archive described by delta, taking the
+ * unchanged files from the base archive, or from the installed files when
+ * base is NULL.
+ */
+int
+pkg_delta_apply(const char *delta, const char *base, const char *dest,
+    pkg_formats format)
+{
+	struct pkg_manifest_key *keys = NULL;
+	struct pkg *pkg = NULL;
+	struct pkg_file *f;
+	struct packing *pack = NULL;
+	struct archive *a;
+	struct archive_entry *ae;
+	kh_delta_extents_t *extents = NULL;
+	struct delta_extent *e;
+	char path[MAXPATHLEN];
+	char *buf;
+	int64_t len;
+	int r, spoolfd = -1, ret = EPKG_FATAL;
+
+	if ((a = delta_archive_open(delta)) == NULL)
+		return (EPKG_FATAL);
+
+	if (archive_read_next_header(a, &ae) != ARCHIVE_OK ||
+	    strcmp(archive_entry_pathname(ae), DELTA_LIST) != 0) {
+		pkg_emit_error("%s is not a package delta", delta);
+		goto cleanup;
+	}
+	if (delta_read_list(a, ae, &extents) != EPKG_OK)
+		goto cleanup;
+	if (base != NULL &&
+	    delta_spool_base(base, dest, extents, &spoolfd) != EPKG_OK)
+		goto cleanup;
+
+	if (packing_init(&pack, dest, format) != EPKG_OK)
+		goto cleanup;
+	pkg_manifest_keys_new(&keys);
+	while ((r = archive_read_next_header(a, &ae)) == ARCHIVE_OK) {
+		if (pkg == NULL && strcmp(archive_entry_pathname(ae),
+		    "+MANIFEST") == 0) {
+			len = archive_entry_size(ae);
+			buf = xmalloc(len);
+			if (archive_read_data(a, buf, len) != len ||
+			    pkg_new(&pkg, PKG_FILE) != EPKG_OK ||
+			    pkg_parse_manifest(pkg, buf, len, keys) != EPKG_OK ||
+			    packing_append_entry(pack, ae) != EPKG_OK ||
+			    packing_append_data(pack, buf, len) != EPKG_OK) {
+				pkg_emit_error("Invalid delta: bad +MANIFEST");
+				free(buf);
+				goto cleanup;
+			}
+			free(buf);
+			continue;
+		}
+		pkg_absolutepath(archive_entry_pathname(ae), path, sizeof(path),
+		    true);
+		e = NULL;
+		if (delta_entry_has_data(ae))
+			kh_find(delta_extents, extents, path, e);
+		if (e == NULL) {
+			if (packing_append_entry(pack, ae) != EPKG_OK ||
+			    delta_copy_data(a, ae, pack) != EPKG_OK)
+				goto cleanup;
+			continue;
+		}
+		if (pkg == NULL || (f = pkg_get_file(pkg, path)) == NULL) {
+			pkg_emit_error("Invalid delta: %s is not in the "
+			    "manifest", path);
+			goto cleanup;
+		}
+		if (delta_copy_base(pack, ae, f, e, spoolfd) != EPKG_OK)
+			goto cleanup;
+	}
+	if (r != ARCHIVE_EOF) {
+		pkg_emit_error("archive_read_next_header(%s): %s", delta,
+		    archive_error_string(a));
+		goto cleanup;
+	}
+	ret = EPKG_OK;
+
+cleanup:
+	packing_finish(pack);
+	archive_read_close(a);
+	archive_read_free(a);
+	if (spoolfd != -1)
+		close(spoolfd);
+	kh_free(delta_extents, extents, struct delta_extent, delta_extent_free);
+	pkg_free(pkg);
+	pkg_manifest_keys_free(keys);
+
+	return (ret);
+}
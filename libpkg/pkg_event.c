@@ -29,6 +29,7 @@
 #include <errno.h>
 #include <string.h>
 #include <syslog.h>
+#include <time.h>
 #include <utstring.h>
 
 #include "pkg.h"
@@ -38,6 +39,22 @@
 static pkg_event_cb _cb = NULL;
 static void *_data = NULL;
 
+/* Kept between events, only their content is reset */
+static UT_string *pipe_msg = NULL, *pipe_buf = NULL;
+
+/*
+ * Progress ticks are delivered when the percentage changes, at most every
+ * TICK_INTERVAL_NSEC otherwise so that rate and stall displays keep
+ * moving, and always for the first and the last one.
+ */
+#define TICK_INTERVAL_NSEC	100000000L
+
+static struct {
+	int64_t		total;
+	int		percent;
+	struct timespec	last;
+} tick = { -1, -1, { 0, 0 } };
+
 static char *
 buf_json_escape(UT_string *buf, const char *str)
 {
@@ -62,8 +79,13 @@ pipeevent(struct pkg_event *ev)
 	if (ctx.eventpipe < 0)
 		return;
 
-	utstring_new(msg);
-	utstring_new(buf);
+	if (pipe_msg == NULL) {
+		utstring_new(pipe_msg);
+		utstring_new(pipe_buf);
+	}
+	msg = pipe_msg;
+	buf = pipe_buf;
+	utstring_clear(msg);
 
 	switch(ev->type) {
 	case PKG_EVENT_ERRNO:
@@ -386,8 +408,6 @@ pipeevent(struct pkg_event *ev)
 		break;
 	}
 	dprintf(ctx.eventpipe, "%s\n", utstring_body(msg));
-	utstring_free(msg);
-	utstring_free(buf);
 }
 
 void
@@ -992,6 +1012,9 @@ pkg_emit_progress_start(const char *fmt, ...)
 	struct pkg_event ev;
 	va_list ap;
 
+	tick.total = -1;
+	tick.percent = -1;
+
 	ev.type = PKG_EVENT_PROGRESS_START;
 	if (fmt != NULL) {
 		va_start(ap, fmt);
@@ -1009,6 +1032,22 @@ void
 pkg_emit_progress_tick(int64_t current, int64_t total)
 {
 	struct pkg_event ev;
+	struct timespec now;
+	int percent;
+
+	percent = total > 0 ? (int)(current * 100 / total) : -1;
+	if (current > 0 && (total <= 0 || current < total) &&
+	    total == tick.total && percent == tick.percent) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if ((now.tv_sec - tick.last.tv_sec) * 1000000000L +
+		    (now.tv_nsec - tick.last.tv_nsec) < TICK_INTERVAL_NSEC)
+			return;
+		tick.last = now;
+	} else {
+		clock_gettime(CLOCK_MONOTONIC, &tick.last);
+	}
+	tick.total = total;
+	tick.percent = percent;
 
 	ev.type = PKG_EVENT_PROGRESS_TICK;
 	ev.e_progress_tick.current = current;
@@ -189,10 +189,11 @@ pkg_jobs_maybe_match_file(struct job_pattern *jp, const char *pattern)
 	dot_pos = strrchr(pattern, '.');
 	if (dot_pos != NULL) {
 		/*
-		 * Compare suffix with .txz or .tbz
+		 * Compare suffix with .txz, .tzst or .tbz
 		 */
 		dot_pos ++;
 		if (strcmp(dot_pos, "txz") == 0 ||
+			strcmp(dot_pos, "tzst") == 0 ||
 			strcmp(dot_pos, "tbz") == 0 ||
 			strcmp(dot_pos, "tgz") == 0 ||
 			strcmp(dot_pos, "tar") == 0) {
@@ -1448,26 +1449,27 @@ struct pkg_jobs_install_candidate {
 };
 
 static struct pkg_jobs_install_candidate *
-pkg_jobs_new_candidate(struct pkg *pkg)
+pkg_jobs_new_candidate(int64_t id)
 {
 	struct pkg_jobs_install_candidate *n;
 
 	n = xmalloc(sizeof(*n));
-	n->id = pkg->id;
+	n->id = id;
 	return (n);
 }
 
 static bool
-pkg_jobs_check_remote_candidate(struct pkg_jobs *j, struct pkg *pkg)
+pkg_jobs_check_remote_candidate(struct pkg_jobs *j, const char *uid,
+    const char *digest)
 {
 	struct pkgdb_it *it;
 	struct pkg *p = NULL;
 
 	/* If we have no digest, we need to check this package */
-	if (pkg->digest == NULL)
+	if (digest == NULL)
 		return (true);
 
-	it = pkgdb_repo_query(j->db, pkg->uid, MATCH_EXACT, j->reponame);
+	it = pkgdb_repo_query(j->db, uid, MATCH_EXACT, j->reponame);
 	if (it != NULL) {
 		/*
 		 * If we have the same package in a remote repo, it is not an
@@ -1480,7 +1482,7 @@ pkg_jobs_check_remote_candidate(struct pkg_jobs *j, struct pkg *pkg)
 			 * Check package with the same uid and explore whether digest
 			 * has been changed
 			 */
-			if (strcmp(p->digest, pkg->digest) != 0)
+			if (strcmp(p->digest, digest) != 0)
 				npkg ++;
 
 			pkg_free(p);
@@ -1496,27 +1498,126 @@ pkg_jobs_check_remote_candidate(struct pkg_jobs *j, struct pkg *pkg)
 	return (true);
 }
 
+/*
+ * Remote packages by name, matched the way MATCH_EXACT does.  The value
+ * is the digest shared by all the packages of that name, or NULL if they
+ * differ.
+ */
+static char *
+pkg_jobs_digest_key(const char *name)
+{
+	char *key, *p;
+
+	key = xstrdup(name);
+	if (!pkgdb_case_sensitive())
+		for (p = key; *p != '\0'; p++)
+			*p = tolower((unsigned char)*p);
+	return (key);
+}
+
+static int
+pkg_jobs_add_remote_digest(const char *name, const char *digest, void *ud)
+{
+	kh_strings_t *remote = ud;
+	khint_t k;
+	char *key;
+	int ret;
+
+	if (name == NULL)
+		return (EPKG_OK);
+
+	key = pkg_jobs_digest_key(name);
+	k = kh_put_strings(remote, key, &ret);
+	if (ret == 0) {
+		free(key);
+		if (kh_val(remote, k) != NULL &&
+		    (digest == NULL || strcmp(kh_val(remote, k), digest) != 0)) {
+			free(kh_val(remote, k));
+			kh_val(remote, k) = NULL;
+		}
+	} else {
+		kh_val(remote, k) = digest != NULL ? xstrdup(digest) : NULL;
+	}
+
+	return (EPKG_OK);
+}
+
+static void
+pkg_jobs_free_remote_digests(kh_strings_t *remote)
+{
+	khint_t k;
+
+	for (k = kh_begin(remote); k != kh_end(remote); k++) {
+		if (!kh_exist(remote, k))
+			continue;
+		free((char *)kh_key(remote, k));
+		free(kh_val(remote, k));
+	}
+	kh_destroy_strings(remote);
+}
+
 static struct pkg_jobs_install_candidate *
 pkg_jobs_find_install_candidates(struct pkg_jobs *j, size_t *count)
 {
-	struct pkg *pkg = NULL;
-	struct pkgdb_it *it;
 	struct pkg_jobs_install_candidate *candidates = NULL, *c;
+	kh_strings_t *remote = NULL;
+	sqlite3_stmt *stmt;
+	const char *name, *digest;
+	const char sql[] = ""
+		"SELECT id, name, manifestdigest FROM packages ORDER BY name;";
+	char *key;
+	khint_t k;
+	bool candidate;
 
-	if ((it = pkgdb_query(j->db, NULL, MATCH_ALL)) == NULL)
+	/*
+	 * Compare the digests of the installed packages with those of the
+	 * remote packages of the same name loaded once, rather than
+	 * querying the repositories for each installed package.
+	 */
+	if ((j->flags & PKG_FLAG_FORCE) == 0) {
+		remote = kh_init_strings();
+		if (pkgdb_repo_digests(j->db, j->reponame,
+		    pkg_jobs_add_remote_digest, remote) != EPKG_OK) {
+			pkg_jobs_free_remote_digests(remote);
+			remote = NULL;
+		}
+	}
+
+	pkg_debug(4, "jobs: running '%s'", sql);
+	if (sqlite3_prepare_v2(j->db->sqlite, sql, -1, &stmt, NULL) !=
+	    SQLITE_OK) {
+		ERROR_SQLITE(j->db->sqlite, sql);
+		if (remote != NULL)
+			pkg_jobs_free_remote_digests(remote);
 		return (NULL);
+	}
 
-	while (pkgdb_it_next(it, &pkg, PKG_LOAD_BASIC) == EPKG_OK) {
-		if ((j->flags & PKG_FLAG_FORCE) ||
-						pkg_jobs_check_remote_candidate(j, pkg)) {
-			c = pkg_jobs_new_candidate(pkg);
+	while (sqlite3_step(stmt) == SQLITE_ROW) {
+		name = (const char *)sqlite3_column_text(stmt, 1);
+		digest = (const char *)sqlite3_column_text(stmt, 2);
+		if (j->flags & PKG_FLAG_FORCE || digest == NULL) {
+			candidate = true;
+		} else if (remote != NULL) {
+			/* Not known remotely: nothing to upgrade to */
+			key = pkg_jobs_digest_key(name);
+			k = kh_get_strings(remote, key);
+			free(key);
+			candidate = k != kh_end(remote) &&
+			    (kh_val(remote, k) == NULL ||
+			    strcmp(kh_val(remote, k), digest) != 0);
+		} else {
+			candidate = pkg_jobs_check_remote_candidate(j, name,
+			    digest);
+		}
+		if (candidate) {
+			c = pkg_jobs_new_candidate(sqlite3_column_int64(stmt, 0));
 			LL_PREPEND(candidates, c);
 			(*count)++;
 		}
-		pkg_free(pkg);
-		pkg = NULL;
 	}
-	pkgdb_it_free(it);
+	sqlite3_finalize(stmt);
+	if (remote != NULL)
+		pkg_jobs_free_remote_digests(remote);
 
 	return (candidates);
 }
@@ -1719,9 +1820,29 @@ pkg_jobs_apply_replacements(struct pkg_jobs *j)
 	sqlite3_finalize(stmt);
 }
 
+/*
+ * Whether the package is in the cache already
+ */
+static bool
+pkg_jobs_is_cached(struct pkg *p)
+{
+	char cachedpath[MAXPATHLEN];
+	struct stat st;
+
+	if (pkg_repo_cached_name(p, cachedpath, sizeof(cachedpath)) != EPKG_OK)
+		return (false);
+
+	/* A package rebuilt from a delta does not have the size of the archive */
+	if (pkg_repo_cached_rebuilt(cachedpath))
+		return (true);
+
+	return (stat(cachedpath, &st) == 0 && st.st_size == p->pkgsize);
+}
+
 int
 pkg_jobs_solve(struct pkg_jobs *j)
 {
+	bool files_known;
 	int ret, pstatus;
 	struct pkg_solve_problem *problem;
 	struct pkg_solved *job;
@@ -1731,6 +1852,7 @@ pkg_jobs_solve(struct pkg_jobs *j)
 
 	pkgdb_begin_solver(j->db);
 
+	pkg_trace_begin("universe", NULL);
 	switch (j->type) {
 	case PKG_JOBS_AUTOREMOVE:
 		ret = jobs_solve_autoremove(j);
@@ -1746,9 +1868,11 @@ pkg_jobs_solve(struct pkg_jobs *j)
 		ret = jobs_solve_fetch(j);
 		break;
 	default:
+		pkg_trace_end();
 		pkgdb_end_solver(j->db);
 		return (EPKG_FATAL);
 	}
+	pkg_trace_end();
 
 	if (ret == EPKG_OK) {
 		if ((solver = pkg_object_string(pkg_config_get("CUDF_SOLVER"))) != NULL) {
@@ -1768,8 +1892,10 @@ pkg_jobs_solve(struct pkg_jobs *j)
 		else {
 again:
 
+			pkg_trace_begin("sat_build", NULL);
 			pkg_jobs_universe_process_upgrade_chains(j);
 			problem = pkg_solve_jobs_to_sat(j);
+			pkg_trace_end();
 			if (problem != NULL) {
 				if ((solver = pkg_object_string(pkg_config_get("SAT_SOLVER"))) != NULL) {
 					pchild = process_spawn_pipe(spipe, solver);
@@ -1796,7 +1922,9 @@ again:
 						}
 					}
 
+					pkg_trace_begin("sat_solve", NULL);
 					ret = pkg_solve_sat_problem(problem);
+					pkg_trace_end();
 					if (ret == EPKG_FATAL) {
 						pkg_emit_error("cannot solve job using SAT solver");
 						ret = EPKG_FATAL;
@@ -1843,7 +1971,12 @@ again:
 
 	pkg_jobs_apply_replacements(j);
 
-	/* Check if we need to fetch and re-run the solver */
+	/*
+	 * Check if we need to fetch, and whether the files of all packages
+	 * are known, from the cache or the repository file list, so that
+	 * conflicts can be checked now
+	 */
+	files_known = true;
 	DL_FOREACH(j->jobs, job) {
 		struct pkg *p;
 
@@ -1851,16 +1984,19 @@ again:
 		if (p->type != PKG_REMOTE)
 			continue;
 
-		if (pkgdb_ensure_loaded(j->db, p, PKG_LOAD_FILES|PKG_LOAD_DIRS)
-				== EPKG_FATAL) {
+		if (!pkg_jobs_is_cached(p))
 			j->need_fetch = true;
-			break;
-		}
+		if (files_known && j->type != PKG_JOBS_FETCH &&
+		    pkgdb_ensure_loaded(j->db, p, PKG_LOAD_FILES)
+				== EPKG_FATAL)
+			files_known = false;
 	}
 
-	if (j->solved == 1 && !j->need_fetch && j->type != PKG_JOBS_FETCH) {
+	if (j->solved == 1 && files_known && j->type != PKG_JOBS_FETCH) {
 		int rc;
 		bool has_conflicts = false;
+
+		j->conflicts_checked = true;
 		do {
 			j->conflicts_registered = 0;
 			rc = pkg_jobs_check_conflicts(j);
@@ -1935,8 +2071,10 @@ pkg_jobs_handle_install(struct pkg_solved *ps, struct pkg_jobs *j,
 		target = path;
 	}
 
-	if (old != NULL)
+	if (old != NULL) {
+		free(new->old_version);
 		new->old_version = xstrdup(old->version);
+	}
 
 	if ((j->flags & PKG_FLAG_FORCE) == PKG_FLAG_FORCE)
 		flags |= PKG_ADD_FORCE;
@@ -1983,6 +2121,7 @@ pkg_jobs_execute(struct pkg_jobs *j)
 
 	p = NULL;
 	pkg_manifest_keys_new(&keys);
+	pkg_sync_begin();
 
 	pkg_jobs_set_priorities(j);
 
@@ -2038,6 +2177,7 @@ pkg_jobs_execute(struct pkg_jobs *j)
 	}
 
 cleanup:
+	pkg_sync_end();
 	pkgdb_release_lock(j->db, PKGDB_LOCK_EXCLUSIVE);
 	pkg_manifest_keys_free(keys);
 
@@ -2084,7 +2224,7 @@ pkg_jobs_apply(struct pkg_jobs *j)
 			pkg_plugins_hook_run(PKG_PLUGIN_HOOK_POST_FETCH, j, j->db);
 			if (rc == EPKG_OK) {
 				/* Check local conflicts in the first run */
-				if (j->solved == 1) {
+				if (j->solved == 1 && !j->conflicts_checked) {
 					do {
 						j->conflicts_registered = 0;
 						rc = pkg_jobs_check_conflicts(j);
@@ -2167,13 +2307,20 @@ pkg_jobs_fetch(struct pkg_jobs *j)
 				snprintf(cachedpath, sizeof(cachedpath),
 				   "%s/%s", cachedir, p->repopath);
 			}
-			else
+			else {
 				pkg_repo_cached_name(p, cachedpath, sizeof(cachedpath));
+				/* Rebuilt from a delta, nothing to download */
+				if (pkg_repo_cached_rebuilt(cachedpath))
+					continue;
+			}
 
-			if (stat(cachedpath, &st) == -1)
-				dlsize += p->pkgsize;
-			else
-				dlsize += p->pkgsize - st.st_size;
+			/* Partial downloads are resumed */
+			if (stat(cachedpath, &st) == -1) {
+				strlcat(cachedpath, ".part", sizeof(cachedpath));
+				if (stat(cachedpath, &st) == -1)
+					st.st_size = 0;
+			}
+			dlsize += p->pkgsize - st.st_size;
 		}
 	}
 
@@ -2221,6 +2368,18 @@ pkg_jobs_fetch(struct pkg_jobs *j)
 	if ((j->flags & PKG_FLAG_DRY_RUN) == PKG_FLAG_DRY_RUN)
 		return (EPKG_OK); /* don't download anything */
 
+	/* Let pipelining transports ask for all the packages at once */
+	if (!mirror) {
+		DL_FOREACH(j->jobs, ps) {
+			if (ps->type != PKG_SOLVED_DELETE
+			    && ps->type != PKG_SOLVED_UPGRADE_REMOVE) {
+				p = ps->items[0]->pkg;
+				if (p->type == PKG_REMOTE)
+					pkg_repo_queue_package(p);
+			}
+		}
+	}
+
 	/* Fetch */
 	DL_FOREACH(j->jobs, ps) {
 		if (ps->type != PKG_SOLVED_DELETE
@@ -2234,6 +2393,12 @@ pkg_jobs_fetch(struct pkg_jobs *j)
 					return (EPKG_FATAL);
 			}
 			else {
+				/* Lets an upgrade be fetched as a delta */
+				if (ps->items[1] != NULL) {
+					free(p->old_version);
+					p->old_version =
+					    xstrdup(ps->items[1]->pkg->version);
+				}
 				if (pkg_repo_fetch_package(p) != EPKG_OK)
 					return (EPKG_FATAL);
 			}
@@ -2261,7 +2426,7 @@ pkg_jobs_check_conflicts(struct pkg_jobs *j)
 			p = ps->items[0]->pkg;
 
 			if (p->type == PKG_REMOTE)
-				pkgdb_ensure_loaded(j->db, p, PKG_LOAD_FILES|PKG_LOAD_DIRS);
+				pkgdb_ensure_loaded(j->db, p, PKG_LOAD_FILES);
 		}
 		if ((res = pkg_conflicts_append_chain(ps->items[0], j)) != EPKG_OK)
 			ret = res;
@@ -208,8 +208,8 @@ pkg_conflicts_need_conflict(struct pkg_jobs *j, struct pkg *p1, struct pkg *p2)
 {
 	struct pkg_file *fcur;
 
-	if (pkgdb_ensure_loaded(j->db, p1, PKG_LOAD_FILES|PKG_LOAD_DIRS) != EPKG_OK ||
-			pkgdb_ensure_loaded(j->db, p2, PKG_LOAD_FILES|PKG_LOAD_DIRS)
+	if (pkgdb_ensure_loaded(j->db, p1, PKG_LOAD_FILES) != EPKG_OK ||
+			pkgdb_ensure_loaded(j->db, p2, PKG_LOAD_FILES)
 						!= EPKG_OK) {
 		/*
 		 * If some of packages are not loaded we could silently and safely
@@ -229,7 +229,8 @@ pkg_conflicts_need_conflict(struct pkg_jobs *j, struct pkg *p1, struct pkg *p2)
 		return false;
 
 	/*
-	 * We need to check all files and dirs and find the similar ones
+	 * We need to check all files and dirs and find the similar ones,
+	 * the dirs of p2 are only known when its package was read
 	 */
 	LL_FOREACH(p1->files, fcur) {
 		if (pkg_has_file(p2, fcur->path))
@@ -522,7 +523,7 @@ pkg_conflicts_append_chain(struct pkg_job_universe_item *it,
 	while (cur != it) {
 		if (cur->pkg->type == PKG_INSTALLED) {
 			lp = cur;
-			if (pkgdb_ensure_loaded(j->db, cur->pkg, PKG_LOAD_FILES|PKG_LOAD_DIRS)
+			if (pkgdb_ensure_loaded(j->db, cur->pkg, PKG_LOAD_FILES)
 							!= EPKG_OK)
 				return (EPKG_FATAL);
 
@@ -539,7 +540,7 @@ pkg_conflicts_append_chain(struct pkg_job_universe_item *it,
 	cur = it;
 	do {
 		if (cur != lp) {
-			if (pkgdb_ensure_loaded(j->db, cur->pkg, PKG_LOAD_FILES|PKG_LOAD_DIRS)
+			if (pkgdb_ensure_loaded(j->db, cur->pkg, PKG_LOAD_FILES)
 							!= EPKG_OK) {
 				/*
 				 * This means that a package was not downloaded, so we can safely
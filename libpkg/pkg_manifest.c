@@ -941,6 +941,63 @@ pkg_emit_filelist(struct pkg *pkg, FILE *f)
 	return (EPKG_OK);
 }
 
+/*
+ * Read back one entry written by pkg_emit_filelist()
+ */
+int
+pkg_parse_filelist(struct pkg *pkg, const char *buf, size_t len)
+{
+	struct ucl_parser *p;
+	ucl_object_t *obj;
+	const ucl_object_t *cur, *files;
+	ucl_object_iter_t it = NULL;
+	UT_string *b = NULL;
+	int rc = EPKG_OK;
+
+	p = ucl_parser_new(UCL_PARSER_NO_FILEVARS);
+	if (!ucl_parser_add_chunk(p, buf, len)) {
+		pkg_emit_error("Error parsing file list: %s",
+		    ucl_parser_get_error(p));
+		ucl_parser_free(p);
+		return (EPKG_FATAL);
+	}
+	obj = ucl_parser_get_object(p);
+	ucl_parser_free(p);
+	if (obj == NULL)
+		return (EPKG_FATAL);
+
+	if ((cur = ucl_object_find_key(obj, "origin")) != NULL &&
+	    cur->type == UCL_STRING)
+		pkg->origin = xstrdup(ucl_object_tostring(cur));
+	if ((cur = ucl_object_find_key(obj, "name")) != NULL &&
+	    cur->type == UCL_STRING)
+		pkg->name = xstrdup(ucl_object_tostring(cur));
+	if ((cur = ucl_object_find_key(obj, "version")) != NULL &&
+	    cur->type == UCL_STRING)
+		pkg->version = xstrdup(ucl_object_tostring(cur));
+	if (pkg->name == NULL || pkg->version == NULL) {
+		pkg_emit_error("Error parsing file list: missing name or version");
+		ucl_object_unref(obj);
+		return (EPKG_FATAL);
+	}
+
+	files = ucl_object_find_key(obj, "files");
+	while (rc == EPKG_OK && (cur = ucl_iterate_object(files, &it, true))) {
+		if (cur->type != UCL_STRING ||
+		    urldecode(ucl_object_tostring(cur), &b) != EPKG_OK) {
+			rc = EPKG_FATAL;
+			break;
+		}
+		rc = pkg_addfile(pkg, utstring_body(b), NULL, false);
+	}
+
+	if (b != NULL)
+		utstring_free(b);
+	ucl_object_unref(obj);
+
+	return (rc);
+}
+
 pkg_object*
 pkg_emit_object(struct pkg *pkg, short flags)
 {
@@ -220,11 +220,12 @@ pkg_repo_signatures_free(struct sig_cert *sc)
 }
 
 
+/* Copied to the sandbox worker, which replaces both descriptors */
 struct pkg_extract_cbdata {
 	int afd;
 	int tfd;
-	const char *fname;
 	bool need_sig;
+	char fname[MAXPATHLEN];
 };
 
 static int
@@ -253,13 +254,15 @@ pkg_repo_meta_extract_signature_pubkey(int fd, void *ud)
 				pkg_emit_errno("pkg_repo_meta_extract_signature",
 						"archive_read_data failed");
 				free(sig);
-				return (EPKG_FATAL);
+				rc = EPKG_FATAL;
+				break;
 			}
 			if (write(fd, sig, siglen) == -1) {
 				pkg_emit_errno("pkg_repo_meta_extract_signature",
 						"write failed");
 				free(sig);
-				return (EPKG_FATAL);
+				rc = EPKG_FATAL;
+				break;
 			}
 			free(sig);
 			rc = EPKG_OK;
@@ -276,10 +279,8 @@ pkg_repo_meta_extract_signature_pubkey(int fd, void *ud)
 		}
 	}
 
-	close(cb->tfd);
-	/*
-	 * XXX: do not free resources here since the sandbox is terminated anyway
-	 */
+	archive_read_free(a);
+
 	return (rc);
 }
 /*
@@ -317,7 +318,8 @@ pkg_repo_meta_extract_signature_fingerprints(int fd, void *ud)
 				pkg_emit_errno("pkg_repo_meta_extract_signature",
 						"archive_read_data failed");
 				free(sig);
-				return (EPKG_FATAL);
+				rc = EPKG_FATAL;
+				break;
 			}
 			/* Signature type */
 			t = 0;
@@ -336,7 +338,8 @@ pkg_repo_meta_extract_signature_fingerprints(int fd, void *ud)
 				pkg_emit_errno("pkg_repo_meta_extract_signature",
 						"writev failed");
 				free(sig);
-				return (EPKG_FATAL);
+				rc = EPKG_FATAL;
+				break;
 			}
 			free(sig);
 			rc = EPKG_OK;
@@ -351,7 +354,8 @@ pkg_repo_meta_extract_signature_fingerprints(int fd, void *ud)
 				pkg_emit_errno("pkg_repo_meta_extract_signature",
 						"archive_read_data failed");
 				free(sig);
-				return (EPKG_FATAL);
+				rc = EPKG_FATAL;
+				break;
 			}
 			/* Pubkey type */
 			t = 1;
@@ -370,7 +374,8 @@ pkg_repo_meta_extract_signature_fingerprints(int fd, void *ud)
 				pkg_emit_errno("pkg_repo_meta_extract_signature",
 						"writev failed");
 				free(sig);
-				return (EPKG_FATAL);
+				rc = EPKG_FATAL;
+				break;
 			}
 			free(sig);
 			rc = EPKG_OK;
@@ -385,10 +390,8 @@ pkg_repo_meta_extract_signature_fingerprints(int fd, void *ud)
 			}
 		}
 	}
-	close(cb->tfd);
-	/*
-	 * XXX: do not free resources here since the sandbox is terminated anyway
-	 */
+	archive_read_free(a);
+
 	return (rc);
 }
 
@@ -529,14 +532,16 @@ pkg_repo_archive_extract_archive(int fd, const char *file,
 	/* Seek to the begin of file */
 	(void)lseek(fd, 0, SEEK_SET);
 
+	memset(&cbdata, 0, sizeof(cbdata));
 	cbdata.afd = fd;
-	cbdata.fname = file;
 	cbdata.tfd = dest_fd;
+	strlcpy(cbdata.fname, file, sizeof(cbdata.fname));
 
 	if (pkg_repo_signature_type(repo) == SIG_PUBKEY) {
 		cbdata.need_sig = true;
-		if (pkg_emit_sandbox_get_string(pkg_repo_meta_extract_signature_pubkey,
-				&cbdata, (char **)&sig, &siglen) == EPKG_OK && sig != NULL) {
+		if (pkg_sandbox_get_string(pkg_repo_meta_extract_signature_pubkey,
+				&cbdata, sizeof(cbdata), 2, (char **)&sig,
+				&siglen) == EPKG_OK && sig != NULL) {
 			s = xcalloc(1, sizeof(struct sig_cert));
 			s->sig = sig;
 			s->siglen = siglen;
@@ -545,8 +550,9 @@ pkg_repo_archive_extract_archive(int fd, const char *file,
 		}
 	}
 	else if (pkg_repo_signature_type(repo) == SIG_FINGERPRINT) {
-		if (pkg_emit_sandbox_get_string(pkg_repo_meta_extract_signature_fingerprints,
-				&cbdata, (char **)&sig, &siglen) == EPKG_OK && sig != NULL &&
+		if (pkg_sandbox_get_string(pkg_repo_meta_extract_signature_fingerprints,
+				&cbdata, sizeof(cbdata), 2, (char **)&sig,
+				&siglen) == EPKG_OK && sig != NULL &&
 				siglen > 0) {
 			if (pkg_repo_parse_sigkeys(sig, siglen, &sc) == EPKG_FATAL) {
 				return (EPKG_FATAL);
@@ -563,8 +569,9 @@ pkg_repo_archive_extract_archive(int fd, const char *file,
 	}
 	else {
 		cbdata.need_sig = false;
-		if (pkg_emit_sandbox_get_string(pkg_repo_meta_extract_signature_pubkey,
-			&cbdata, (char **)&sig, &siglen) == EPKG_OK) {
+		if (pkg_sandbox_get_string(pkg_repo_meta_extract_signature_pubkey,
+			&cbdata, sizeof(cbdata), 2, (char **)&sig,
+			&siglen) == EPKG_OK) {
 			free(sig);
 		}
 		else {
@@ -1066,6 +1073,18 @@ pkg_repo_fetch_package(struct pkg *pkg)
 	return (repo->ops->fetch_pkg(repo, pkg));
 }
 
+int
+pkg_repo_queue_package(struct pkg *pkg)
+{
+	struct pkg_repo *repo;
+
+	repo = pkg->repo;
+	if (repo == NULL || repo->ops->queue_pkg == NULL)
+		return (EPKG_OK);
+
+	return (repo->ops->queue_pkg(repo, pkg));
+}
+
 int
 pkg_repo_mirror_package(struct pkg *pkg, const char *destdir)
 {
@@ -1099,3 +1118,32 @@ pkg_repo_cached_name(struct pkg *pkg, char *dest, size_t destlen)
 
 	return (repo->ops->get_cached_name(repo, pkg, dest, destlen));
 }
+
+/*
+ * A package rebuilt from a delta is compressed again, so it is not the
+ * archive of the repository.  It is stored under the same cache entry,
+ * <dest>.rebuilt holding its own checksum, which is what a later run
+ * checks it against.  Returns true if dest is such a package and intact.
+ */
+bool
+pkg_repo_cached_rebuilt(const char *dest)
+{
+	char rebuilt[MAXPATHLEN];
+	char *sum = NULL;
+	struct stat st;
+	off_t len;
+	bool ret;
+
+	snprintf(rebuilt, sizeof(rebuilt), "%s.rebuilt", dest);
+	if (stat(rebuilt, &st) == -1)
+		return (false);
+	ret = (file_to_buffer(rebuilt, &sum, &len) == EPKG_OK && len > 0 &&
+	    pkg_checksum_validate_file(dest, sum) == 0);
+	free(sum);
+	if (!ret) {
+		unlink(rebuilt);
+		unlink(dest);
+	}
+
+	return (ret);
+}
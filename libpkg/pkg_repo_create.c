@@ -160,12 +160,14 @@ pkg_create_repo_read_fts(struct pkg_fts_item **items, FTS *fts,
 		}
 		/*
 		 * Ignore 'Latest' directory as it is just symlinks back to
-		 * already-processed packages.
+		 * already-processed packages, and 'Deltas' which holds the
+		 * package deltas.
 		 */
 		if ((fts_ent->fts_info == FTS_D ||
 		    fts_ent->fts_info == FTS_DP ||
 		    fts_ent->fts_info == FTS_SL) &&
-		    strcmp(fts_ent->fts_name, "Latest") == 0) {
+		    (strcmp(fts_ent->fts_name, "Latest") == 0 ||
+		    strcmp(fts_ent->fts_name, "Deltas") == 0)) {
 			fts_set(fts, fts_ent, FTS_SKIP);
 			continue;
 		}
@@ -731,6 +733,7 @@ pkg_create_repo(char *path, const char *output_dir, bool filelist,
 	snprintf(repodb, sizeof(repodb), "%s/%s", output_dir,
 		"meta");
 	if ((mfile = fopen(repodb, "w")) != NULL) {
+		meta->filelist = filelist;
 		meta_dump = pkg_repo_meta_to_ucl(meta);
 		ucl_object_emit_file(meta_dump, UCL_EMIT_CONFIG, mfile);
 		ucl_object_unref(meta_dump);
@@ -776,6 +779,248 @@ cleanup:
 	return (retcode);
 }
 
+struct delta_base {
+	char *path;
+	char *version;
+};
+
+KHASH_MAP_INIT_STR(delta_bases, struct delta_base *);
+
+static void
+delta_base_free(struct delta_base *b)
+{
+	free(b->path);
+	free(b->version);
+	free(b);
+}
+
+/*
+ * Map the name of each package of basedir to its newest archive there.
+ */
+static int
+pkg_create_repo_delta_bases(const char *basedir, struct pkg_repo_meta *meta,
+    struct pkg_manifest_key *keys, kh_delta_bases_t **bases)
+{
+	FTS *fts;
+	struct pkg_fts_item *items = NULL, *cur;
+	struct pkg *pkg = NULL;
+	struct delta_base *b;
+	char *paths[2] = { __DECONST(char *, basedir), NULL };
+	size_t len = 0;
+	khint_t k;
+	int r, ret;
+
+	if ((fts = fts_open(paths, FTS_PHYSICAL|FTS_NOCHDIR, NULL)) == NULL) {
+		pkg_emit_errno("fts_open", basedir);
+		return (EPKG_FATAL);
+	}
+	ret = pkg_create_repo_read_fts(&items, fts, basedir, &len, meta);
+	fts_close(fts);
+
+	LL_FOREACH(items, cur) {
+		if (ret != EPKG_OK)
+			break;
+		pkg_free(pkg);
+		pkg = NULL;
+		if (pkg_open(&pkg, cur->fts_accpath, keys,
+		    PKG_OPEN_MANIFEST_ONLY | PKG_OPEN_MANIFEST_COMPACT) !=
+		    EPKG_OK)
+			continue;
+		if (*bases == NULL)
+			*bases = kh_init_delta_bases();
+		k = kh_get_delta_bases(*bases, pkg->name);
+		if (k != kh_end(*bases)) {
+			b = kh_value(*bases, k);
+			if (pkg_version_cmp(b->version, pkg->version) >= 0)
+				continue;
+			free(b->path);
+			free(b->version);
+		} else {
+			b = xcalloc(1, sizeof(*b));
+			k = kh_put_delta_bases(*bases, xstrdup(pkg->name), &r);
+			kh_value(*bases, k) = b;
+		}
+		b->path = xstrdup(cur->fts_accpath);
+		b->version = xstrdup(pkg->version);
+	}
+	pkg_free(pkg);
+	LL_FREE(items, pkg_create_repo_fts_free);
+
+	return (ret);
+}
+
+static int
+pkg_create_repo_delta(FILE *deltasite, const char *output_dir,
+    struct pkg *pkg, const char *target, off_t size, struct delta_base *b,
+    struct pkg_repo_meta *meta)
+{
+	char stem[MAXPATHLEN], delta[MAXPATHLEN];
+	char *sum, *basesum;
+	ucl_object_t *obj;
+	unsigned char *line;
+	struct stat st;
+	int ret;
+
+	snprintf(stem, sizeof(stem), "%s/Deltas", output_dir);
+	if (mkdirs(stem) != EPKG_OK)
+		return (EPKG_FATAL);
+	snprintf(stem, sizeof(stem), "%s/Deltas/%s-%s-%s", output_dir,
+	    pkg->name, b->version, pkg->version);
+	snprintf(delta, sizeof(delta), "%s.%s", stem,
+	    packing_format_to_string(meta->packing_format));
+
+	ret = pkg_delta_create(b->path, target, stem, meta->packing_format);
+	if (ret != EPKG_OK) {
+		unlink(delta);
+		return (ret == EPKG_END ? EPKG_OK : ret);
+	}
+	/* Not worth it: fetching the package is as cheap */
+	if (stat(delta, &st) == -1 || st.st_size * 2 >= size) {
+		unlink(delta);
+		return (EPKG_OK);
+	}
+
+	sum = pkg_checksum_file(delta, PKG_HASH_TYPE_SHA256_HEX);
+	basesum = pkg_checksum_file(b->path, PKG_HASH_TYPE_SHA256_HEX);
+	if (sum == NULL || basesum == NULL) {
+		free(sum);
+		free(basesum);
+		unlink(delta);
+		return (EPKG_FATAL);
+	}
+
+	obj = ucl_object_typed_new(UCL_OBJECT);
+	ucl_object_insert_key(obj, ucl_object_fromstring(pkg->name), "name",
+	    0, false);
+	ucl_object_insert_key(obj, ucl_object_fromstring(pkg->version),
+	    "version", 0, false);
+	ucl_object_insert_key(obj, ucl_object_fromstring(b->version),
+	    "basever", 0, false);
+	ucl_object_insert_key(obj, ucl_object_fromstring(basesum), "basesum",
+	    0, false);
+	ucl_object_insert_key(obj,
+	    ucl_object_fromstring(delta + strlen(output_dir) + 1), "path", 0,
+	    false);
+	ucl_object_insert_key(obj, ucl_object_fromstring(sum), "sum", 0,
+	    false);
+	ucl_object_insert_key(obj, ucl_object_fromint(st.st_size), "pkgsize",
+	    0, false);
+	line = ucl_object_emit(obj, UCL_EMIT_JSON_COMPACT);
+	fprintf(deltasite, "%s\n", line);
+	free(line);
+	ucl_object_unref(obj);
+	free(sum);
+	free(basesum);
+
+	return (EPKG_OK);
+}
+
+/*
+ * Publish deltas against the packages of basedir, usually the previous
+ * state of the repository: a package of path whose version there is
+ * older gets Deltas/<name>-<basever>-<version> rebuilding it from that
+ * version, see pkg_delta.c.  Only deltas less than half the size of the
+ * package are kept.  Runs between pkg_create_repo() and pkg_finish_repo().
+ */
+int
+pkg_create_repo_deltas(const char *path, const char *output_dir,
+    const char *basedir)
+{
+	FTS *fts = NULL;
+	FILE *deltasite = NULL, *mfile;
+	struct pkg_fts_item *items = NULL, *cur;
+	struct pkg_repo_meta *meta = NULL;
+	struct pkg_manifest_key *keys = NULL;
+	struct pkg *pkg = NULL;
+	kh_delta_bases_t *bases = NULL;
+	struct delta_base *b;
+	ucl_object_t *meta_dump;
+	char *paths[2] = { __DECONST(char *, path), NULL };
+	char repo_path[MAXPATHLEN];
+	size_t len = 0, n = 0;
+	int fd, ret = EPKG_FATAL;
+
+	snprintf(repo_path, sizeof(repo_path), "%s/%s", output_dir,
+	    repo_meta_file);
+	if ((fd = open(repo_path, O_RDONLY)) == -1 ||
+	    pkg_repo_meta_load(fd, &meta) != EPKG_OK) {
+		pkg_emit_error("meta loading error while trying %s", repo_path);
+		if (fd != -1)
+			close(fd);
+		return (EPKG_FATAL);
+	}
+	close(fd);
+
+	pkg_manifest_keys_new(&keys);
+	if (pkg_create_repo_delta_bases(basedir, meta, keys, &bases) !=
+	    EPKG_OK)
+		goto cleanup;
+
+	if ((fts = fts_open(paths, FTS_PHYSICAL|FTS_NOCHDIR, NULL)) == NULL) {
+		pkg_emit_errno("fts_open", path);
+		goto cleanup;
+	}
+	if (pkg_create_repo_read_fts(&items, fts, path, &len, meta) != EPKG_OK)
+		goto cleanup;
+
+	snprintf(repo_path, sizeof(repo_path), "%s/%s", output_dir,
+	    meta->deltasite);
+	if ((deltasite = fopen(repo_path, "w")) == NULL) {
+		pkg_emit_errno("fopen", repo_path);
+		goto cleanup;
+	}
+
+	pkg_emit_progress_start("Creating deltas against %s", basedir);
+	ret = EPKG_OK;
+	LL_FOREACH(items, cur) {
+		pkg_emit_progress_tick(n++, len);
+		pkg_free(pkg);
+		pkg = NULL;
+		if (pkg_open(&pkg, cur->fts_accpath, keys,
+		    PKG_OPEN_MANIFEST_ONLY | PKG_OPEN_MANIFEST_COMPACT) !=
+		    EPKG_OK)
+			continue;
+		kh_find(delta_bases, bases, pkg->name, b);
+		if (b == NULL || pkg_version_cmp(b->version, pkg->version) >= 0)
+			continue;
+		if ((ret = pkg_create_repo_delta(deltasite, output_dir, pkg,
+		    cur->fts_accpath, cur->fts_size, b, meta)) != EPKG_OK)
+			break;
+	}
+	pkg_emit_progress_tick(len, len);
+	fclose(deltasite);
+	if (ret != EPKG_OK)
+		goto cleanup;
+
+	/* Rewrite the meta so that clients look for the deltas */
+	meta->deltas = true;
+	snprintf(repo_path, sizeof(repo_path), "%s/%s", output_dir,
+	    repo_meta_file);
+	if ((mfile = fopen(repo_path, "w")) == NULL) {
+		pkg_emit_errno("fopen", repo_path);
+		ret = EPKG_FATAL;
+		goto cleanup;
+	}
+	meta_dump = pkg_repo_meta_to_ucl(meta);
+	ucl_object_emit_file(meta_dump, UCL_EMIT_CONFIG, mfile);
+	ucl_object_unref(meta_dump);
+	fclose(mfile);
+
+cleanup:
+	if (fts != NULL)
+		fts_close(fts);
+	LL_FREE(items, pkg_create_repo_fts_free);
+	if (bases != NULL) {
+		kh_foreach_value(bases, b, delta_base_free(b));
+		kh_destroy_delta_bases(bases);
+	}
+	pkg_free(pkg);
+	pkg_manifest_keys_free(keys);
+	pkg_repo_meta_free(meta);
+
+	return (ret);
+}
+
 
 static int
 pkg_repo_sign(char *path, char **argv, int argc, UT_string **sig, UT_string **cert)
@@ -848,7 +1093,7 @@ done:
 
 static int
 pkg_repo_pack_db(const char *name, const char *archive, char *path,
-		struct rsa_key *rsa, struct pkg_repo_meta *meta,
+		struct rsa_key *rsa, pkg_formats format,
 		char **argv, int argc)
 {
 	struct packing *pack;
@@ -861,7 +1106,7 @@ pkg_repo_pack_db(const char *name, const char *archive, char *path,
 	sig = NULL;
 	pub = NULL;
 
-	if (packing_init(&pack, archive, meta->packing_format) != EPKG_OK)
+	if (packing_init(&pack, archive, format) != EPKG_OK)
 		return (EPKG_FATAL);
 
 	if (rsa != NULL) {
@@ -916,8 +1161,9 @@ pkg_finish_repo(const char *output_dir, pkg_password_cb *password_cb,
 	struct rsa_key *rsa = NULL;
 	struct pkg_repo_meta *meta;
 	struct stat st;
+	const char *ext;
 	int ret = EPKG_OK, nfile = 0, fd;
-	const int files_to_pack = 4;
+	const int files_to_pack = 5;
 	bool legacy = false;
 
 	if (!is_dir(output_dir)) {
@@ -951,10 +1197,10 @@ pkg_finish_repo(const char *output_dir, pkg_password_cb *password_cb,
 			rsa_free(rsa);
 			close(fd);
 			return (EPKG_FATAL);
-		} else {
-			meta = pkg_repo_meta_default();
 		}
-		if (pkg_repo_pack_db(repo_meta_file, repo_path, repo_path, rsa, meta,
+		close(fd);
+		/* Clients always fetch meta.txz, whatever the packing format */
+		if (pkg_repo_pack_db(repo_meta_file, repo_path, repo_path, rsa, TXZ,
 			argv, argc) != EPKG_OK) {
 			ret = EPKG_FATAL;
 			goto cleanup;
@@ -969,8 +1215,8 @@ pkg_finish_repo(const char *output_dir, pkg_password_cb *password_cb,
 	    meta->manifests);
 	snprintf(repo_archive, sizeof(repo_archive), "%s/%s", output_dir,
 		meta->manifests_archive);
-	if (pkg_repo_pack_db(meta->manifests, repo_archive, repo_path, rsa, meta,
-		argv, argc) != EPKG_OK) {
+	if (pkg_repo_pack_db(meta->manifests, repo_archive, repo_path, rsa,
+		meta->packing_format, argv, argc) != EPKG_OK) {
 		ret = EPKG_FATAL;
 		goto cleanup;
 	}
@@ -982,8 +1228,20 @@ pkg_finish_repo(const char *output_dir, pkg_password_cb *password_cb,
 		    meta->filesite);
 		snprintf(repo_archive, sizeof(repo_archive), "%s/%s",
 		    output_dir, meta->filesite_archive);
-		if (pkg_repo_pack_db(meta->filesite, repo_archive, repo_path, rsa, meta,
-			argv, argc) != EPKG_OK) {
+		if (pkg_repo_pack_db(meta->filesite, repo_archive, repo_path, rsa,
+			meta->packing_format, argv, argc) != EPKG_OK) {
+			ret = EPKG_FATAL;
+			goto cleanup;
+		}
+	}
+
+	if (meta->deltas) {
+		snprintf(repo_path, sizeof(repo_path), "%s/%s", output_dir,
+		    meta->deltasite);
+		snprintf(repo_archive, sizeof(repo_archive), "%s/%s",
+		    output_dir, meta->deltasite_archive);
+		if (pkg_repo_pack_db(meta->deltasite, repo_archive, repo_path,
+		    rsa, meta->packing_format, argv, argc) != EPKG_OK) {
 			ret = EPKG_FATAL;
 			goto cleanup;
 		}
@@ -995,8 +1253,8 @@ pkg_finish_repo(const char *output_dir, pkg_password_cb *password_cb,
 	    meta->digests);
 	snprintf(repo_archive, sizeof(repo_archive), "%s/%s", output_dir,
 	    meta->digests_archive);
-	if (pkg_repo_pack_db(meta->digests, repo_archive, repo_path, rsa, meta,
-		argv, argc) != EPKG_OK) {
+	if (pkg_repo_pack_db(meta->digests, repo_archive, repo_path, rsa,
+		meta->packing_format, argv, argc) != EPKG_OK) {
 		ret = EPKG_FATAL;
 		goto cleanup;
 	}
@@ -1008,14 +1266,18 @@ pkg_finish_repo(const char *output_dir, pkg_password_cb *password_cb,
 		meta->conflicts);
 	snprintf(repo_archive, sizeof(repo_archive), "%s/%s", output_dir,
 		meta->conflicts_archive);
-	if (pkg_repo_pack_db(meta->conflicts, repo_archive, repo_path, rsa, meta,
-		argv, argc) != EPKG_OK) {
+	if (pkg_repo_pack_db(meta->conflicts, repo_archive, repo_path, rsa,
+		meta->packing_format, argv, argc) != EPKG_OK) {
 		ret = EPKG_FATAL;
 		goto cleanup;
 	}
 #endif
 
-	/* Now we need to set the equal mtime for all archives in the repo */
+	/*
+	 * Now we need to set the equal mtime for all archives in the repo,
+	 * the meta archive is always a txz
+	 */
+	ext = packing_format_to_string(meta->packing_format);
 	snprintf(repo_archive, sizeof(repo_archive), "%s/%s.txz",
 	    output_dir, repo_meta_file);
 	if (stat(repo_archive, &st) == 0) {
@@ -1029,15 +1291,22 @@ pkg_finish_repo(const char *output_dir, pkg_password_cb *password_cb,
 			.tv_usec = 0
 			}
 		};
-		snprintf(repo_archive, sizeof(repo_archive), "%s/%s.txz",
-		    output_dir, meta->manifests_archive);
+		snprintf(repo_archive, sizeof(repo_archive), "%s/%s.%s",
+		    output_dir, meta->manifests_archive, ext);
 		utimes(repo_archive, ftimes);
-		snprintf(repo_archive, sizeof(repo_archive), "%s/%s.txz",
-		    output_dir, meta->digests_archive);
+		snprintf(repo_archive, sizeof(repo_archive), "%s/%s.%s",
+		    output_dir, meta->digests_archive, ext);
 		utimes(repo_archive, ftimes);
 		if (filelist) {
 			snprintf(repo_archive, sizeof(repo_archive),
-			    "%s/%s.txz", output_dir, meta->filesite_archive);
+			    "%s/%s.%s", output_dir, meta->filesite_archive,
+			    ext);
+			utimes(repo_archive, ftimes);
+		}
+		if (meta->deltas) {
+			snprintf(repo_archive, sizeof(repo_archive),
+			    "%s/%s.%s", output_dir, meta->deltasite_archive,
+			    ext);
 			utimes(repo_archive, ftimes);
 		}
 		if (!legacy) {
@@ -47,6 +47,8 @@ pkg_repo_meta_set_default(struct pkg_repo_meta *meta)
 	meta->digests_archive = xstrdup("digests");
 	meta->filesite = xstrdup("filesite.yaml");
 	meta->filesite_archive = xstrdup("filesite");
+	meta->deltasite = xstrdup("deltasite.yaml");
+	meta->deltasite_archive = xstrdup("deltasite");
 	/* Not using fulldb */
 	meta->fulldb = NULL;
 	meta->fulldb_archive = NULL;
@@ -72,6 +74,8 @@ pkg_repo_meta_free(struct pkg_repo_meta *meta)
 		free(meta->digests_archive);
 		free(meta->fulldb_archive);
 		free(meta->filesite_archive);
+		free(meta->deltasite);
+		free(meta->deltasite_archive);
 		free(meta->maintainer);
 		free(meta->source);
 		free(meta->source_identifier);
@@ -97,7 +101,7 @@ pkg_repo_meta_open_schema_v1()
 			"version = {type = integer};\n"
 			"maintainer = {type = string};\n"
 			"source = {type = string};\n"
-			"packing_format = {enum = [txz, tbz, tgz, tar]};\n"
+			"packing_format = {enum = [tzst, txz, tbz, tgz, tar]};\n"
 			"digest_format = {enum = [sha256_base32, sha256_hex, blake2_base32, blake2s_base32]};\n"
 			"digests = {type = string};\n"
 			"manifests = {type = string};\n"
@@ -109,6 +113,10 @@ pkg_repo_meta_open_schema_v1()
 			"conflicts_archive = {type = string};\n"
 			"fulldb_archive = {type = string};\n"
 			"filesite_archive = {type = string};\n"
+			"filelist = {type = boolean};\n"
+			"deltasite = {type = string};\n"
+			"deltasite_archive = {type = string};\n"
+			"deltas = {type = boolean};\n"
 			"source_identifier = {type = string};\n"
 			"revision = {type = integer};\n"
 			"eol = {type = integer};\n"
@@ -195,9 +203,21 @@ pkg_repo_meta_parse(ucl_object_t *top, struct pkg_repo_meta **target, int versio
 	META_EXTRACT_STRING(manifests_archive);
 	META_EXTRACT_STRING(fulldb_archive);
 	META_EXTRACT_STRING(filesite_archive);
+	META_EXTRACT_STRING(deltasite);
+	META_EXTRACT_STRING(deltasite_archive);
 
 	META_EXTRACT_STRING(source_identifier);
 
+	obj = ucl_object_find_key(top, "filelist");
+	if (obj != NULL && obj->type == UCL_BOOLEAN) {
+		meta->filelist = ucl_object_toboolean(obj);
+	}
+
+	obj = ucl_object_find_key(top, "deltas");
+	if (obj != NULL && obj->type == UCL_BOOLEAN) {
+		meta->deltas = ucl_object_toboolean(obj);
+	}
+
 	obj = ucl_object_find_key(top, "eol");
 	if (obj != NULL && obj->type == UCL_INT) {
 		meta->eol = ucl_object_toint(obj);
@@ -342,6 +362,10 @@ pkg_repo_meta_to_ucl(struct pkg_repo_meta *meta)
 	META_EXPORT_FIELD(result, meta, conflicts_archive, string);
 	META_EXPORT_FIELD(result, meta, fulldb_archive, string);
 	META_EXPORT_FIELD(result, meta, filesite_archive, string);
+	META_EXPORT_FIELD(result, meta, filelist, bool);
+	META_EXPORT_FIELD(result, meta, deltasite, string);
+	META_EXPORT_FIELD(result, meta, deltasite_archive, string);
+	META_EXPORT_FIELD(result, meta, deltas, bool);
 
 	META_EXPORT_FIELD(result, meta, source_identifier, string);
 	META_EXPORT_FIELD(result, meta, revision, int);
@@ -366,6 +390,7 @@ pkg_repo_meta_is_special_file(const char *file, struct pkg_repo_meta *meta)
 	special = META_SPECIAL_FILE(file, meta, digests_archive);
 	special = META_SPECIAL_FILE(file, meta, manifests_archive);
 	special = META_SPECIAL_FILE(file, meta, filesite_archive);
+	special = META_SPECIAL_FILE(file, meta, deltasite_archive);
 	special = META_SPECIAL_FILE(file, meta, conflicts_archive);
 	special = META_SPECIAL_FILE(file, meta, fulldb_archive);
 
@@ -0,0 +1,447 @@
+/*-
+ * Copyright (c) 2026 The pkg contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer
+ *    in this position and unchanged.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Long-lived sandboxed worker.
+ *
+ * pkg_emit_sandbox_call() forks a new sandboxed child for every call,
+ * which dominates the cost of checking many signatures.  The worker is
+ * started once, through the same sandbox event so that the frontend's
+ * sandboxing applies to it, and then runs callbacks on request.
+ *
+ * It is a fork of this process, so a callback is sent as a plain function
+ * pointer.  Its user data is copied and therefore must not hold pointers;
+ * the first udfds ints of it may be file descriptors, which are passed
+ * along and replaced by the worker's copies.  A request is:
+ *
+ *	struct sandbox_req, user data, descriptors (SCM_RIGHTS)
+ *
+ * and the reply is the int returned by the callback.  For a string call
+ * the callback writes its output to a socket passed as its fd argument.
+ *
+ * When the worker cannot be used (disabled, failed to start, used from a
+ * forked child) calls go through pkg_emit_sandbox_*() as before.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "pkg.h"
+#include "private/event.h"
+#include "private/pkg.h"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+#define SANDBOX_MAXFDS	3
+
+struct sandbox_req {
+	pkg_sandbox_cb	 call;
+	size_t		 udlen;
+	int		 fdmask;	/* bit 0: fd argument, bit n: nth int of ud */
+};
+
+static struct {
+	int	 fd;		/* control socket, -1 if not running */
+	pid_t	 pid;
+	pid_t	 owner;
+	bool	 disabled;
+} worker = { -1, -1, -1, false };
+
+static int
+sandbox_write(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+	ssize_t w;
+
+	while (len > 0) {
+		w = send(fd, p, len, MSG_NOSIGNAL);
+		if (w == -1) {
+			if (errno == EINTR)
+				continue;
+			return (-1);
+		}
+		p += w;
+		len -= w;
+	}
+
+	return (0);
+}
+
+/* Returns 1 when done, 0 on end of file before anything was read */
+static int
+sandbox_read(int fd, void *buf, size_t len)
+{
+	char *p = buf;
+	size_t done = 0;
+	ssize_t r;
+
+	while (done < len) {
+		r = read(fd, p + done, len - done);
+		if (r == -1) {
+			if (errno == EINTR)
+				continue;
+			return (-1);
+		}
+		if (r == 0)
+			return (done == 0 ? 0 : -1);
+		done += r;
+	}
+
+	return (1);
+}
+
+static int
+sandbox_send_req(int fd, struct sandbox_req *req, int *fds, int nfds)
+{
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	struct iovec iov;
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(sizeof(int) * SANDBOX_MAXFDS)];
+	} cbuf;
+	ssize_t w;
+
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = req;
+	iov.iov_len = sizeof(*req);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	if (nfds > 0) {
+		memset(&cbuf, 0, sizeof(cbuf));
+		msg.msg_control = cbuf.buf;
+		msg.msg_controllen = CMSG_SPACE(sizeof(int) * nfds);
+		cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int) * nfds);
+		memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * nfds);
+	}
+
+	while ((w = sendmsg(fd, &msg, MSG_NOSIGNAL)) == -1 && errno == EINTR)
+		;
+	if (w != sizeof(*req))
+		return (-1);
+
+	return (0);
+}
+
+static int
+sandbox_recv_req(int fd, struct sandbox_req *req, int *fds, int *nfds)
+{
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	struct iovec iov;
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(sizeof(int) * SANDBOX_MAXFDS)];
+	} cbuf;
+	ssize_t r;
+
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = req;
+	iov.iov_len = sizeof(*req);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cbuf.buf;
+	msg.msg_controllen = sizeof(cbuf.buf);
+
+	while ((r = recvmsg(fd, &msg, 0)) == -1 && errno == EINTR)
+		;
+	if (r == 0)
+		return (0);
+	if (r != sizeof(*req))
+		return (-1);
+
+	*nfds = 0;
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+	    cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET ||
+		    cmsg->cmsg_type != SCM_RIGHTS)
+			continue;
+		*nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		if (*nfds > SANDBOX_MAXFDS)
+			return (-1);
+		memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * *nfds);
+	}
+
+	return (1);
+}
+
+/* Runs in the sandbox until the control socket is closed */
+static int
+sandbox_worker_main(int fd, void *ud __unused)
+{
+	struct sandbox_req req;
+	int fds[SANDBOX_MAXFDS], slots[SANDBOX_MAXFDS];
+	int nfds, i, n, ret;
+	char *buf, ready = 1;
+
+	if (sandbox_write(fd, &ready, sizeof(ready)) == -1)
+		return (EPKG_FATAL);
+
+	for (;;) {
+		ret = sandbox_recv_req(fd, &req, fds, &nfds);
+		if (ret == 0)
+			return (EPKG_OK);
+		if (ret == -1)
+			return (EPKG_FATAL);
+
+		buf = xmalloc(req.udlen + 1);
+		if (sandbox_read(fd, buf, req.udlen) == -1) {
+			free(buf);
+			return (EPKG_FATAL);
+		}
+
+		for (i = 0, n = 0; i < SANDBOX_MAXFDS; i++)
+			slots[i] = (req.fdmask & (1 << i)) && n < nfds ?
+			    fds[n++] : -1;
+		for (i = 1; i < SANDBOX_MAXFDS; i++) {
+			if ((req.fdmask & (1 << i)) &&
+			    i * sizeof(int) <= req.udlen)
+				memcpy(buf + (i - 1) * sizeof(int), &slots[i],
+				    sizeof(int));
+		}
+
+		ret = req.call(slots[0], buf);
+
+		for (i = 0; i < nfds; i++)
+			close(fds[i]);
+		free(buf);
+
+		if (sandbox_write(fd, &ret, sizeof(ret)) == -1)
+			return (EPKG_FATAL);
+	}
+}
+
+static void
+sandbox_worker_reap(void)
+{
+	int status;
+
+	if (worker.fd != -1)
+		close(worker.fd);
+	worker.fd = -1;
+	if (worker.pid > 0) {
+		while (waitpid(worker.pid, &status, 0) == -1 &&
+		    errno == EINTR)
+			;
+	}
+	worker.pid = -1;
+}
+
+static bool
+sandbox_worker_start(void)
+{
+	int sv[2];
+	char ready;
+	pid_t pid;
+
+	if (worker.disabled)
+		return (false);
+	if (!pkg_object_bool(pkg_config_get("SANDBOX_WORKER"))) {
+		worker.disabled = true;
+		return (false);
+	}
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1) {
+		worker.disabled = true;
+		return (false);
+	}
+	(void)fcntl(sv[0], F_SETFD, FD_CLOEXEC);
+
+	/*
+	 * The frontend forks the sandboxed process and waits for it, so
+	 * ask for it from a child of ours.
+	 */
+	pid = fork();
+	if (pid == -1) {
+		close(sv[0]);
+		close(sv[1]);
+		worker.disabled = true;
+		return (false);
+	}
+	if (pid == 0) {
+		close(sv[0]);
+		_exit(pkg_emit_sandbox_call(sandbox_worker_main, sv[1], NULL)
+		    == EPKG_OK ? EXIT_SUCCESS : EXIT_FAILURE);
+	}
+	close(sv[1]);
+
+	worker.fd = sv[0];
+	worker.pid = pid;
+	worker.owner = getpid();
+
+	/* No ready byte: the frontend does not run sandboxed calls */
+	if (sandbox_read(worker.fd, &ready, sizeof(ready)) != 1) {
+		pkg_debug(1, "sandbox worker unavailable, forking per call");
+		sandbox_worker_reap();
+		worker.disabled = true;
+		return (false);
+	}
+	pkg_debug(1, "sandbox worker started, pid %d", (int)pid);
+
+	return (true);
+}
+
+static bool
+sandbox_worker_usable(void)
+{
+	if (worker.fd != -1)
+		return (worker.owner == getpid());
+	if (worker.owner != -1 && worker.owner != getpid())
+		return (false);
+
+	return (sandbox_worker_start());
+}
+
+/*
+ * Send a request, -1 if it could not be sent at all (the caller may then
+ * fall back), otherwise the worker owns it.
+ */
+static int
+sandbox_worker_send(pkg_sandbox_cb call, int fd, void *ud, size_t udlen,
+    int udfds)
+{
+	struct sandbox_req req;
+	int fds[SANDBOX_MAXFDS], nfds = 0, i, slot;
+
+	memset(&req, 0, sizeof(req));
+	req.call = call;
+	req.udlen = udlen;
+	for (i = 0; i <= udfds && i < SANDBOX_MAXFDS; i++) {
+		if (i == 0)
+			slot = fd;
+		else
+			memcpy(&slot, (char *)ud + (i - 1) * sizeof(int),
+			    sizeof(int));
+		if (slot < 0)
+			continue;
+		req.fdmask |= 1 << i;
+		fds[nfds++] = slot;
+	}
+
+	if (sandbox_send_req(worker.fd, &req, fds, nfds) == -1 ||
+	    sandbox_write(worker.fd, ud, udlen) == -1) {
+		sandbox_worker_reap();
+		return (-1);
+	}
+
+	return (0);
+}
+
+static int
+sandbox_worker_result(void)
+{
+	int ret;
+
+	if (sandbox_read(worker.fd, &ret, sizeof(ret)) != 1) {
+		pkg_emit_error("sandboxed worker terminated abnormally");
+		sandbox_worker_reap();
+		return (EPKG_FATAL);
+	}
+
+	return (ret);
+}
+
+int
+pkg_sandbox_call(pkg_sandbox_cb call, int fd, void *ud, size_t udlen,
+    int udfds)
+{
+	assert(udfds < SANDBOX_MAXFDS);
+
+	if (!sandbox_worker_usable() ||
+	    sandbox_worker_send(call, fd, ud, udlen, udfds) == -1)
+		return (pkg_emit_sandbox_call(call, fd, ud));
+
+	return (sandbox_worker_result());
+}
+
+int
+pkg_sandbox_get_string(pkg_sandbox_cb call, void *ud, size_t udlen,
+    int udfds, char **str, int64_t *len)
+{
+	UT_string *b;
+	char buf[BUFSIZ];
+	ssize_t r;
+	int sv[2], ret;
+
+	assert(udfds < SANDBOX_MAXFDS);
+
+	if (!sandbox_worker_usable() ||
+	    socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1)
+		return (pkg_emit_sandbox_get_string(call, ud, str, len));
+
+	if (sandbox_worker_send(call, sv[1], ud, udlen, udfds) == -1) {
+		close(sv[0]);
+		close(sv[1]);
+		return (pkg_emit_sandbox_get_string(call, ud, str, len));
+	}
+	close(sv[1]);
+
+	utstring_new(b);
+	for (;;) {
+		r = read(sv[0], buf, sizeof(buf));
+		if (r == -1 && errno == EINTR)
+			continue;
+		if (r <= 0)
+			break;
+		utstring_bincpy(b, buf, r);
+	}
+	close(sv[0]);
+
+	ret = sandbox_worker_result();
+
+	*len = utstring_len(b);
+	*str = xmalloc(*len + 1);
+	memcpy(*str, utstring_body(b), *len);
+	(*str)[*len] = '\0';
+	utstring_free(b);
+
+	return (ret);
+}
+
+void
+pkg_sandbox_worker_stop(void)
+{
+	if (worker.fd != -1 && worker.owner == getpid())
+		sandbox_worker_reap();
+	worker.fd = -1;
+	worker.owner = -1;
+	worker.disabled = false;
+}
@@ -0,0 +1,291 @@
+/*-
+ * Copyright (c) 2026 The pkg contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer
+ *    in this position and unchanged.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Durability of the extracted files, following FSYNC_POLICY:
+ *
+ * none		nothing is flushed, a crash can leave empty or missing files
+ *		behind packages the database has registered.
+ * batch	the temporary files of a package are flushed, writeback having
+ *		been started when each of them was closed, then renamed, then
+ *		each directory they were renamed into is flushed once.
+ * syncfs	the whole filesystem of the root is flushed before and after
+ *		the renames of a package: two barriers however many files.
+ *		Without syncfs(2) this is batch.
+ *
+ * Both barriers happen before the package is committed to the database.
+ * pkg_jobs_execute() brackets its packages with pkg_sync_begin() and
+ * pkg_sync_end(), which reports what the transaction flushed.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <bsd_compat.h>
+
+#include "pkg.h"
+#include "private/event.h"
+#include "private/pkg.h"
+#include "private/utils.h"
+
+enum sync_policy {
+	SYNC_NONE = 0,
+	SYNC_BATCH,
+	SYNC_FS,
+};
+
+static struct {
+	bool		 active;
+	enum sync_policy config;
+	enum sync_policy policy;
+	int64_t		 files;
+	int64_t		 dirs;
+	int64_t		 barriers;
+	double		 seconds;
+} sync_state;
+
+/* Called once the configuration is loaded */
+void
+pkg_sync_init(void)
+{
+	const char *p;
+
+	p = pkg_object_string(pkg_config_get("FSYNC_POLICY"));
+	if (p == NULL || strcasecmp(p, "none") == 0)
+		sync_state.config = SYNC_NONE;
+	else if (strcasecmp(p, "batch") == 0)
+		sync_state.config = SYNC_BATCH;
+	else if (strcasecmp(p, "syncfs") == 0)
+		sync_state.config = SYNC_FS;
+	else {
+		pkg_emit_error("Unknown FSYNC_POLICY '%s', using 'batch'", p);
+		sync_state.config = SYNC_BATCH;
+	}
+#ifndef HAVE_SYNCFS
+	/* sync(2) would flush every filesystem and may not wait for it */
+	if (sync_state.config == SYNC_FS) {
+		pkg_debug(1, "Sync: no syncfs(2), using 'batch'");
+		sync_state.config = SYNC_BATCH;
+	}
+#endif
+}
+
+static enum sync_policy
+sync_policy_get(void)
+{
+	if (sync_state.active)
+		return (sync_state.policy);
+	return (sync_state.config);
+}
+
+static double
+sync_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+static int
+sync_fd(int fd, bool data)
+{
+#ifdef HAVE_FDATASYNC
+	if (data)
+		return (fdatasync(fd));
+#endif
+	return (fsync(fd));
+}
+
+static int
+sync_root(struct pkg *pkg)
+{
+	sync_state.barriers++;
+#ifdef HAVE_SYNCFS
+	if (syncfs(pkg->rootfd) == -1)
+		pkg_fatal_errno("Fail to sync the filesystem of %s",
+		    *pkg->rootpath != '\0' ? pkg->rootpath : "/");
+#else
+	/* pkg_sync_init() never selects syncfs */
+	(void)pkg;
+#endif
+	return (EPKG_OK);
+}
+
+static int
+sync_path(struct pkg *pkg, const char *path, bool data)
+{
+	int fd, flags = O_RDONLY|O_CLOEXEC;
+
+	if (!data)
+		flags |= O_DIRECTORY;
+	if ((fd = openat(pkg->rootfd, RELATIVE_PATH(path), flags)) == -1) {
+		/* Gone already, nothing left to flush */
+		if (errno == ENOENT)
+			return (EPKG_OK);
+		pkg_fatal_errno("Fail to open %s", path);
+	}
+	if (sync_fd(fd, data) == -1) {
+		close(fd);
+		pkg_fatal_errno("Fail to sync %s", path);
+	}
+	close(fd);
+
+	return (EPKG_OK);
+}
+
+void
+pkg_sync_begin(void)
+{
+	sync_state.policy = sync_state.config;
+	sync_state.active = true;
+	sync_state.files = sync_state.dirs = sync_state.barriers = 0;
+	sync_state.seconds = 0;
+}
+
+void
+pkg_sync_end(void)
+{
+	if (sync_state.active && sync_state.policy != SYNC_NONE)
+		pkg_debug(1, "Sync: %jd files, %jd directories, %jd "
+		    "filesystem barriers in %.3fs", (intmax_t)sync_state.files,
+		    (intmax_t)sync_state.dirs, (intmax_t)sync_state.barriers,
+		    sync_state.seconds);
+	sync_state.active = false;
+}
+
+/*
+ * Called on each temporary file before it is closed: start its writeback
+ * so that the barrier only has to wait for it.
+ */
+void
+pkg_sync_writeback(int fd)
+{
+#ifdef HAVE_SYNC_FILE_RANGE
+	if (sync_policy_get() == SYNC_BATCH)
+		sync_file_range(fd, 0, 0, SYNC_FILE_RANGE_WRITE);
+#else
+	(void)fd;
+#endif
+}
+
+/* Flush the content of the temporary files of pkg before their rename */
+int
+pkg_sync_files(struct pkg *pkg)
+{
+	struct pkg_file *f = NULL;
+	enum sync_policy policy;
+	double start;
+	int ret = EPKG_OK;
+
+	if ((policy = sync_policy_get()) == SYNC_NONE)
+		return (EPKG_OK);
+
+	start = sync_now();
+	pkg_trace_begin("sync_files", pkg->name);
+	if (policy == SYNC_FS) {
+		ret = sync_root(pkg);
+	} else {
+		while (pkg_files(pkg, &f) == EPKG_OK) {
+			if (*f->temppath == '\0')
+				continue;
+			if ((ret = sync_path(pkg, f->temppath, true)) != EPKG_OK)
+				break;
+			sync_state.files++;
+		}
+	}
+	pkg_trace_end();
+	sync_state.seconds += sync_now() - start;
+
+	return (ret);
+}
+
+/* Flush the directories the files of pkg have been renamed into */
+int
+pkg_sync_dirs(struct pkg *pkg)
+{
+	struct pkg_file *f = NULL;
+	struct pkg_dir *d = NULL;
+	enum sync_policy policy;
+	kh_strings_t *dirs;
+	khint_t k;
+	double start;
+	char *dir;
+	int ret = EPKG_OK, absent;
+
+	if ((policy = sync_policy_get()) == SYNC_NONE)
+		return (EPKG_OK);
+
+	start = sync_now();
+	pkg_trace_begin("sync_dirs", pkg->name);
+	if (policy == SYNC_FS) {
+		ret = sync_root(pkg);
+		goto out;
+	}
+
+	/*
+	 * The parent of a directory holds its entry, the directories of the
+	 * package are therefore flushed through their parent.
+	 */
+	dirs = kh_init_strings();
+	while (pkg_files(pkg, &f) == EPKG_OK) {
+		if (*f->temppath == '\0')
+			continue;
+		dir = xstrdup(bsd_dirname(f->path));
+		kh_put_strings(dirs, dir, &absent);
+		if (!absent)
+			free(dir);
+	}
+	while (pkg_dirs(pkg, &d) == EPKG_OK) {
+		dir = xstrdup(bsd_dirname(d->path));
+		kh_put_strings(dirs, dir, &absent);
+		if (!absent)
+			free(dir);
+	}
+
+	for (k = kh_begin(dirs); k != kh_end(dirs); k++) {
+		if (!kh_exist(dirs, k))
+			continue;
+		if (ret == EPKG_OK &&
+		    (ret = sync_path(pkg, kh_key(dirs, k), false)) == EPKG_OK)
+			sync_state.dirs++;
+		free((char *)kh_key(dirs, k));
+	}
+	kh_destroy_strings(dirs);
+
+out:
+	pkg_trace_end();
+	sync_state.seconds += sync_now() - start;
+
+	return (ret);
+}
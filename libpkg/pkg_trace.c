@@ -0,0 +1,219 @@
+/*-
+ * Copyright (c) 2026 The pkg contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer
+ *    in this position and unchanged.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Phase tracing.  Spans are written as they begin and end, one JSON
+ * event per line, in the Chrome trace event format so that the file can
+ * be loaded as is in chrome://tracing or Perfetto, or read with jq.
+ * The counters of a span are reported with its end event and include
+ * those of the spans nested in it.
+ */
+
+#include <sys/types.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "pkg.h"
+#include "private/event.h"
+#include "private/pkg.h"
+
+#define TRACE_MAXDEPTH	32
+
+static const char *counter_names[PKG_TRACE_NCOUNTERS] = {
+	[PKG_TRACE_BYTES] = "bytes",
+	[PKG_TRACE_ROWS] = "rows",
+	[PKG_TRACE_SQL] = "sql",
+};
+
+static struct {
+	FILE		*fp;
+	pid_t		 pid;
+	struct timespec	 start;
+	int		 depth;
+	int64_t		 counters[TRACE_MAXDEPTH][PKG_TRACE_NCOUNTERS];
+} trace;
+
+static bool
+trace_active(void)
+{
+	/* Forked children share the file but do not trace */
+	return (trace.fp != NULL && getpid() == trace.pid);
+}
+
+static double
+trace_ts(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((ts.tv_sec - trace.start.tv_sec) * 1e6 +
+	    (ts.tv_nsec - trace.start.tv_nsec) / 1e3);
+}
+
+static void
+trace_json_string(const char *str)
+{
+	const unsigned char *p;
+
+	fputc('"', trace.fp);
+	for (p = (const unsigned char *)str; *p != '\0'; p++) {
+		if (*p == '"' || *p == '\\')
+			fprintf(trace.fp, "\\%c", *p);
+		else if (*p < 0x20)
+			fprintf(trace.fp, "\\u%04x", *p);
+		else
+			fputc(*p, trace.fp);
+	}
+	fputc('"', trace.fp);
+}
+
+int
+pkg_trace_open(const char *path)
+{
+	if (trace.fp != NULL)
+		pkg_trace_close();
+
+	if ((trace.fp = fopen(path, "w")) == NULL) {
+		pkg_emit_errno("fopen", path);
+		return (EPKG_FATAL);
+	}
+	trace.pid = getpid();
+	trace.depth = 0;
+	clock_gettime(CLOCK_MONOTONIC, &trace.start);
+	fprintf(trace.fp, "[\n");
+	fprintf(trace.fp, "{\"name\":\"process_name\",\"ph\":\"M\","
+	    "\"pid\":%d,\"args\":{\"name\":\"pkg\"}}", (int)trace.pid);
+	/* Nothing is left in the buffer for a forked child to write again */
+	fflush(trace.fp);
+
+	return (EPKG_OK);
+}
+
+void
+pkg_trace_close(void)
+{
+	if (!trace_active())
+		return;
+
+	while (trace.depth > 0)
+		pkg_trace_end();
+	fprintf(trace.fp, "\n]\n");
+	fclose(trace.fp);
+	trace.fp = NULL;
+}
+
+bool
+pkg_trace_enabled(void)
+{
+	return (trace_active());
+}
+
+void
+pkg_trace_begin(const char *name, const char *detail)
+{
+	if (!trace_active())
+		return;
+
+	if (trace.depth < TRACE_MAXDEPTH)
+		memset(trace.counters[trace.depth], 0,
+		    sizeof(trace.counters[trace.depth]));
+	trace.depth++;
+
+	fprintf(trace.fp, ",\n{\"name\":");
+	trace_json_string(name);
+	fprintf(trace.fp, ",\"cat\":\"pkg\",\"ph\":\"B\",\"ts\":%.3f,"
+	    "\"pid\":%d,\"tid\":%d", trace_ts(), (int)trace.pid,
+	    (int)trace.pid);
+	if (detail != NULL) {
+		fprintf(trace.fp, ",\"args\":{\"detail\":");
+		trace_json_string(detail);
+		fputc('}', trace.fp);
+	}
+	fputc('}', trace.fp);
+	fflush(trace.fp);
+}
+
+void
+pkg_trace_end(void)
+{
+	int64_t *counters;
+	int i;
+
+	if (!trace_active() || trace.depth == 0)
+		return;
+
+	trace.depth--;
+	fprintf(trace.fp, ",\n{\"ph\":\"E\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d",
+	    trace_ts(), (int)trace.pid, (int)trace.pid);
+	if (trace.depth < TRACE_MAXDEPTH) {
+		counters = trace.counters[trace.depth];
+		fprintf(trace.fp, ",\"args\":{");
+		for (i = 0; i < PKG_TRACE_NCOUNTERS; i++) {
+			fprintf(trace.fp, "%s\"%s\":%jd", i > 0 ? "," : "",
+			    counter_names[i], (intmax_t)counters[i]);
+			/* Nested counts add up in the enclosing span */
+			if (trace.depth > 0)
+				trace.counters[trace.depth - 1][i] +=
+				    counters[i];
+		}
+		fputc('}', trace.fp);
+	}
+	fputc('}', trace.fp);
+	fflush(trace.fp);
+}
+
+void
+pkg_trace_count(pkg_trace_counter counter, int64_t n)
+{
+	int depth;
+
+	if (trace.fp == NULL || trace.depth == 0)
+		return;
+
+	depth = trace.depth - 1;
+	if (depth >= TRACE_MAXDEPTH)
+		depth = TRACE_MAXDEPTH - 1;
+	trace.counters[depth][counter] += n;
+}
+
+/*
+ * sqlite3_trace_v2() callback counting the statements run, the trigger
+ * programs they start are reported as "-- TRIGGER" and not counted
+ */
+int
+pkg_trace_sqlite_stmt(unsigned type __unused, void *ud __unused,
+    void *stmt __unused, void *x)
+{
+	const char *sql = x;
+
+	if (sql == NULL || strncmp(sql, "--", 2) != 0)
+		pkg_trace_count(PKG_TRACE_SQL, 1);
+	return (0);
+}
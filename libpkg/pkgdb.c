@@ -88,7 +88,7 @@
 */
 
 #define DB_SCHEMA_MAJOR	0
-#define DB_SCHEMA_MINOR	34
+#define DB_SCHEMA_MINOR	35
 
 #define DBVERSION (DB_SCHEMA_MAJOR * 1000 + DB_SCHEMA_MINOR)
 
@@ -604,6 +604,7 @@ pkgdb_init(sqlite3 *sdb)
 	"CREATE INDEX pkg_provides_id ON pkg_provides(package_id);"
 	"CREATE INDEX packages_origin ON packages(origin COLLATE NOCASE);"
 	"CREATE INDEX packages_name ON packages(name COLLATE NOCASE);"
+	"CREATE INDEX packages_namever ON packages((name || '-' || version) COLLATE NOCASE);"
 
 	"CREATE VIEW pkg_shlibs AS SELECT * FROM pkg_shlibs_required;"
 	"CREATE TRIGGER pkg_shlibs_update "
@@ -929,6 +930,14 @@ pkgdb_profile_callback(unsigned type __unused, void *ud __unused,
 	return (0);
 }
 
+static int
+pkgdb_trace_callback(unsigned type, void *ud, void *stmt, void *X)
+{
+	if (type == SQLITE_TRACE_STMT)
+		return (pkg_trace_sqlite_stmt(type, ud, stmt, X));
+	return (pkgdb_profile_callback(type, ud, stmt, X));
+}
+
 int
 pkgdb_open(struct pkgdb **db_p, pkgdb_t type)
 {
@@ -1176,11 +1185,13 @@ retry:
 
 
 	profile = pkg_object_bool(pkg_config_get("SQLITE_PROFILE"));
-	if (profile) {
+	if (profile)
 		pkg_debug(1, "pkgdb profiling is enabled");
-		sqlite3_trace_v2(db->sqlite, SQLITE_TRACE_PROFILE,
-		    pkgdb_profile_callback, NULL);
-	}
+	if (profile || pkg_trace_enabled())
+		sqlite3_trace_v2(db->sqlite,
+		    (profile ? SQLITE_TRACE_PROFILE : 0) |
+		    (pkg_trace_enabled() ? SQLITE_TRACE_STMT : 0),
+		    pkgdb_trace_callback, NULL);
 
 	*db_p = db;
 	return (EPKG_OK);
@@ -1327,12 +1338,26 @@ pkgdb_case_sensitive(void)
 	return (_case_sensitive_flag);
 }
 
+/*
+ * Files are registered FILES_BATCH_ROWS at a time with one statement.
+ * Each row binds a (path, sha256) pair after the package id, rows past
+ * the end of the list are bound to NULL and skipped.
+ */
+#define FILES_BATCH_ROWS	64
+#define FILES_ROW		"(?,?)"
+#define FILES_ROWS4		FILES_ROW "," FILES_ROW "," FILES_ROW "," FILES_ROW
+#define FILES_ROWS16		FILES_ROWS4 "," FILES_ROWS4 "," FILES_ROWS4 "," \
+				FILES_ROWS4
+#define FILES_BATCH_VALUES	FILES_ROWS16 "," FILES_ROWS16 "," FILES_ROWS16 \
+				"," FILES_ROWS16
+
 typedef enum _sql_prstmt_index {
 	MTREE = 0,
 	PKG,
 	DEPS_UPDATE,
 	DEPS,
-	FILES,
+	FILES_BATCH,
+	FILES_OWNERS,
 	FILES_REPLACE,
 	DIRS1,
 	DIRS2,
@@ -1394,11 +1419,21 @@ static sql_prstmt sql_prepared_statements[PRSTMT_LAST] = {
 		"VALUES (?1, ?2, ?3, ?4)",
 		"TTTI",
 	},
-	[FILES] = {
+	/* Bound by pkgdb_register_files(), see FILES_BATCH_ROWS */
+	[FILES_BATCH] = {
 		NULL,
 		"INSERT INTO files (path, sha256, package_id) "
-		"VALUES (?1, ?2, ?3)",
-		"TTI",
+		"SELECT column1, column2, ?1 FROM (VALUES " FILES_BATCH_VALUES ") "
+		"WHERE column1 IS NOT NULL",
+		"I",
+	},
+	[FILES_OWNERS] = {
+		NULL,
+		"SELECT f.path, p.name, p.version FROM files AS f "
+		"LEFT JOIN packages AS p ON p.id = f.package_id "
+		"WHERE f.package_id != ?1 AND f.path IN "
+		"(SELECT column1 FROM (VALUES " FILES_BATCH_VALUES "))",
+		"I",
 	},
 	[FILES_REPLACE] = {
 		NULL,
@@ -1670,17 +1705,168 @@ prstmt_finalize(struct pkgdb *db)
 	return;
 }
 
+static void
+pkgdb_bind_files(sqlite3_stmt *stmt, int64_t package_id,
+    struct pkg_file **files, size_t nfiles)
+{
+	size_t i;
+
+	sqlite3_reset(stmt);
+	sqlite3_bind_int64(stmt, 1, package_id);
+	for (i = 0; i < FILES_BATCH_ROWS; i++) {
+		if (i < nfiles) {
+			sqlite3_bind_text(stmt, 2 * i + 2, files[i]->path, -1,
+			    SQLITE_STATIC);
+			sqlite3_bind_text(stmt, 2 * i + 3, files[i]->sum, -1,
+			    SQLITE_STATIC);
+		} else {
+			sqlite3_bind_null(stmt, 2 * i + 2);
+			sqlite3_bind_null(stmt, 2 * i + 3);
+		}
+	}
+}
+
+static int
+pkgdb_register_files_batch(struct pkgdb *db, struct pkg *pkg,
+    int64_t package_id, struct pkg_file **files, size_t nfiles, int forced)
+{
+	char		*owner[FILES_BATCH_ROWS] = { NULL };
+	bool		 stray[FILES_BATCH_ROWS] = { false };
+	sqlite3		*s = db->sqlite;
+	sqlite3_stmt	*stmt;
+	const char	*path, *name, *version;
+	bool		 permissive = false;
+	size_t		 i;
+	int		 ret, retcode = EPKG_FATAL;
+
+	stmt = STMT(FILES_BATCH);
+	pkgdb_bind_files(stmt, package_id, files, nfiles);
+	ret = sqlite3_step(stmt);
+	if (ret == SQLITE_DONE)
+		return (EPKG_OK);
+	if (ret != SQLITE_CONSTRAINT) {
+		ERROR_SQLITE(s, SQL(FILES_BATCH));
+		return (EPKG_FATAL);
+	}
+
+	/*
+	 * Some of the paths are already registered, the whole batch has
+	 * been rolled back: look up all their owners at once.
+	 */
+	stmt = STMT(FILES_OWNERS);
+	pkgdb_bind_files(stmt, package_id, files, nfiles);
+	while ((ret = sqlite3_step(stmt)) == SQLITE_ROW) {
+		path = (const char *)sqlite3_column_text(stmt, 0);
+		name = (const char *)sqlite3_column_text(stmt, 1);
+		version = (const char *)sqlite3_column_text(stmt, 2);
+		for (i = 0; i < nfiles; i++) {
+			if (strcmp(files[i]->path, path) != 0)
+				continue;
+			/* Stray entry in the files table not related to
+			   any known package: overwrite this */
+			if (name == NULL)
+				stray[i] = true;
+			else if (owner[i] == NULL)
+				xasprintf(&owner[i], "%s-%s", name,
+				    version != NULL ? version : "");
+			break;
+		}
+	}
+	if (ret != SQLITE_DONE) {
+		ERROR_SQLITE(s, SQL(FILES_OWNERS));
+		goto cleanup;
+	}
+
+	if (!forced && !pkg_object_bool(pkg_config_get("DEVELOPER_MODE")))
+		permissive = pkg_object_bool(pkg_config_get("PERMISSIVE"));
+
+	for (i = 0; i < nfiles; i++) {
+		if (owner[i] == NULL || stray[i]) {
+			if (run_prstmt(FILES_REPLACE, files[i]->path,
+			    files[i]->sum, package_id) != SQLITE_DONE) {
+				ERROR_SQLITE(s, SQL(FILES_REPLACE));
+				goto cleanup;
+			}
+			continue;
+		}
+		if (forced) {
+			pkg_emit_error("%s-%s conflicts with %s"
+			    " (installs files into the same place). "
+			    " Problematic file: %s ignored by forced mode",
+			    pkg->name, pkg->version, owner[i], files[i]->path);
+			continue;
+		}
+		pkg_emit_error("%s-%s conflicts with %s"
+		    " (installs files into the same place). "
+		    " Problematic file: %s%s",
+		    pkg->name, pkg->version, owner[i], files[i]->path,
+		    permissive ? " ignored by permissive mode" : "");
+		if (!permissive)
+			goto cleanup;
+	}
+	retcode = EPKG_OK;
+
+cleanup:
+	for (i = 0; i < nfiles; i++)
+		free(owner[i]);
+
+	return (retcode);
+}
+
+static int
+pkg_file_cmp(const void *a, const void *b)
+{
+	const struct pkg_file *fa = *(const struct pkg_file * const *)a;
+	const struct pkg_file *fb = *(const struct pkg_file * const *)b;
+
+	return (strcmp(fa->path, fb->path));
+}
+
+static int
+pkgdb_register_files(struct pkgdb *db, struct pkg *pkg, int64_t package_id,
+    int forced)
+{
+	struct pkg_file	*file = NULL;
+	struct pkg_file	**files;
+	size_t		 nfiles, i, n;
+	int		 ret = EPKG_OK;
+
+	nfiles = pkg_list_count(pkg, PKG_FILES);
+	if (nfiles == 0)
+		return (EPKG_OK);
+
+	/*
+	 * Insert in path order: consecutive rows land in the same pages
+	 * of the files index instead of all over it.
+	 */
+	files = xcalloc(nfiles, sizeof(*files));
+	i = 0;
+	while (i < nfiles && pkg_files(pkg, &file) == EPKG_OK)
+		files[i++] = file;
+	nfiles = i;
+	qsort(files, nfiles, sizeof(*files), pkg_file_cmp);
+
+	for (i = 0; i < nfiles; i += n) {
+		n = MIN(nfiles - i, FILES_BATCH_ROWS);
+		ret = pkgdb_register_files_batch(db, pkg, package_id,
+		    files + i, n, forced);
+		if (ret != EPKG_OK)
+			break;
+		pkg_trace_count(PKG_TRACE_ROWS, n);
+	}
+	free(files);
+
+	return (ret);
+}
+
 int
 pkgdb_register_pkg(struct pkgdb *db, struct pkg *pkg, int forced)
 {
-	struct pkg		*pkg2 = NULL;
 	struct pkg_dep		*dep = NULL;
-	struct pkg_file		*file = NULL;
 	struct pkg_dir		*dir = NULL;
 	struct pkg_option	*option = NULL;
 	struct pkg_conflict	*conflict = NULL;
 	struct pkg_config_file	*cf = NULL;
-	struct pkgdb_it		*it = NULL;
 	char			*buf, *msg = NULL;
 
 	sqlite3			*s;
@@ -1750,65 +1936,8 @@ pkgdb_register_pkg(struct pkgdb *db, struct pkg *pkg, int forced)
 	 * Insert files.
 	 */
 
-	while (pkg_files(pkg, &file) == EPKG_OK) {
-		bool		permissive = false;
-		bool		devmode = false;
-
-		ret = run_prstmt(FILES, file->path, file->sum, package_id);
-		if (ret == SQLITE_DONE)
-			continue;
-		if (ret != SQLITE_CONSTRAINT) {
-			ERROR_SQLITE(s, SQL(FILES));
-			goto cleanup;
-		}
-		it = pkgdb_query_which(db, file->path, false);
-		if (it == NULL) {
-			ERROR_SQLITE(s, "pkg which");
-			goto cleanup;
-		}
-		pkg2 = NULL;
-		ret = pkgdb_it_next(it, &pkg2, PKG_LOAD_BASIC);
-		if (ret == EPKG_END) {
-			/* Stray entry in the files table not related to
-			   any known package: overwrite this */
-			ret = run_prstmt(FILES_REPLACE, file->path, file->sum,
-					 package_id);
-			pkgdb_it_free(it);
-			if (ret == SQLITE_DONE)
-				continue;
-			else {
-				ERROR_SQLITE(s, SQL(FILES_REPLACE));
-				goto cleanup;
-			}
-		}
-		if (ret != EPKG_OK && ret != EPKG_END) {
-			pkgdb_it_free(it);
-			ERROR_SQLITE(s, SQL(FILES_REPLACE));
-			goto cleanup;
-		}
-		if (!forced) {
-			devmode = pkg_object_bool(pkg_config_get("DEVELOPER_MODE"));
-			if (!devmode)
-				permissive = pkg_object_bool(pkg_config_get("PERMISSIVE"));
-			pkg_emit_error("%s-%s conflicts with %s-%s"
-			    " (installs files into the same place). "
-			    " Problematic file: %s%s",
-			    pkg->name, pkg->version, pkg2->name, pkg2->version, file->path,
-			    permissive ? " ignored by permissive mode" : "");
-			pkg_free(pkg2);
-			if (!permissive) {
-				pkgdb_it_free(it);
-				goto cleanup;
-			}
-		} else {
-			pkg_emit_error("%s-%s conflicts with %s-%s"
-			    " (installs files into the same place). "
-			    " Problematic file: %s ignored by forced mode",
-			    pkg->name, pkg->version, pkg2->name, pkg2->version, file->path);
-			pkg_free(pkg2);
-		}
-		pkgdb_it_free(it);
-	}
+	if (pkgdb_register_files(db, pkg, package_id, forced) != EPKG_OK)
+		goto cleanup;
 
 	/*
 	 * Insert config files
@@ -3110,12 +3239,12 @@ pkgdb_begin_solver(struct pkgdb *db)
 	if (it != NULL) {
 		kv_init(pkglist);
 		while (pkgdb_it_next(it, &p, PKG_LOAD_BASIC|PKG_LOAD_OPTIONS) == EPKG_OK) {
-			pkg_checksum_calculate(p, NULL);
 			kv_prepend(typeof(p), pkglist, p);
 			p = NULL;
 			cnt ++;
 		}
 		pkgdb_it_free(it);
+		pkg_checksum_calculate_many(pkglist.a, kv_size(pkglist));
 
 		if (kv_size(pkglist) > 0) {
 			rc = sql_exec(db->sqlite, update_digests_sql);
@@ -3167,36 +3296,66 @@ pkgdb_end_solver(struct pkgdb *db)
 	return (sql_exec(db->sqlite, solver_sql));
 }
 
+/*
+ * Which of dirs are still owned by a package other than p, in a few
+ * queries rather than one per directory.  The owned ones are added to
+ * *used.
+ */
+#define PKGDB_DIRS_USED_CHUNK 256
+
 int
-pkgdb_is_dir_used(struct pkgdb *db, struct pkg *p, const char *dir, int64_t *res)
+pkgdb_dirs_used(struct pkgdb *db, struct pkg *p, char **dirs, size_t ndirs,
+    kh_strings_t **used)
 {
 	sqlite3_stmt *stmt;
-	int ret;
-
-	const char sql[] = ""
-		"SELECT count(package_id) FROM pkg_directories, directories "
-		"WHERE directory_id = directories.id AND directories.path = ?1 "
-		"AND package_id != ?2;";
-
-	if (sqlite3_prepare_v2(db->sqlite, sql, -1, &stmt, NULL) != SQLITE_OK) {
-		ERROR_SQLITE(db->sqlite, sql);
-		return (EPKG_FATAL);
-	}
+	UT_string *sql;
+	const char *path;
+	char *dir;
+	size_t i, n, j;
+	int ret = SQLITE_DONE;
 
-	sqlite3_bind_text(stmt, 1, dir, -1, SQLITE_TRANSIENT);
-	sqlite3_bind_int64(stmt, 2, p->id);
+	utstring_new(sql);
+	for (i = 0; i < ndirs; i += n) {
+		n = MIN(ndirs - i, PKGDB_DIRS_USED_CHUNK);
+
+		utstring_clear(sql);
+		utstring_printf(sql, "SELECT DISTINCT directories.path "
+		    "FROM pkg_directories, directories "
+		    "WHERE directory_id = directories.id "
+		    "AND package_id != ?1 AND directories.path IN (?2");
+		for (j = 1; j < n; j++)
+			utstring_printf(sql, ",?%zu", j + 2);
+		utstring_printf(sql, ");");
+
+		if (sqlite3_prepare_v2(db->sqlite, utstring_body(sql), -1,
+		    &stmt, NULL) != SQLITE_OK) {
+			ERROR_SQLITE(db->sqlite, utstring_body(sql));
+			utstring_free(sql);
+			return (EPKG_FATAL);
+		}
 
-	ret = sqlite3_step(stmt);
+		sqlite3_bind_int64(stmt, 1, p->id);
+		for (j = 0; j < n; j++)
+			sqlite3_bind_text(stmt, j + 2, dirs[i + j], -1,
+			    SQLITE_STATIC);
 
-	if (ret == SQLITE_ROW)
-		*res = sqlite3_column_int64(stmt, 0);
+		while ((ret = sqlite3_step(stmt)) == SQLITE_ROW) {
+			path = sqlite3_column_text(stmt, 0);
+			if (kh_contains(strings, *used, path))
+				continue;
+			dir = xstrdup(path);
+			kh_safe_add(strings, *used, dir, dir);
+		}
 
-	sqlite3_finalize(stmt);
+		sqlite3_finalize(stmt);
 
-	if (ret != SQLITE_ROW) {
-		ERROR_SQLITE(db->sqlite, sql);
-		return (EPKG_FATAL);
+		if (ret != SQLITE_DONE) {
+			ERROR_SQLITE(db->sqlite, utstring_body(sql));
+			utstring_free(sql);
+			return (EPKG_FATAL);
+		}
 	}
+	utstring_free(sql);
 
 	return (EPKG_OK);
 }
@@ -37,6 +37,7 @@
 #endif
 
 #include <assert.h>
+#include <ctype.h>
 #include <errno.h>
 #include <regex.h>
 #include <grp.h>
@@ -103,8 +104,8 @@ pkgdb_get_pattern_query(const char *pattern, match_t match)
 	case MATCH_GLOB:
 		if (checkuid == NULL) {
 			if (checkorigin == NULL)
-				comp = " WHERE name GLOB ?1 "
-					"OR name || '-' || version GLOB ?1";
+				comp = " WHERE (name GLOB ?1 "
+					"OR name || '-' || version GLOB ?1)";
 			else
 				comp = " WHERE origin GLOB ?1";
 		} else {
@@ -114,8 +115,8 @@ pkgdb_get_pattern_query(const char *pattern, match_t match)
 	case MATCH_REGEX:
 		if (checkuid == NULL) {
 			if (checkorigin == NULL)
-				comp = " WHERE name REGEXP ?1 "
-				    "OR name || '-' || version REGEXP ?1";
+				comp = " WHERE (name REGEXP ?1 "
+				    "OR name || '-' || version REGEXP ?1)";
 			else
 				comp = " WHERE origin REGEXP ?1";
 		} else {
@@ -130,12 +131,75 @@ pkgdb_get_pattern_query(const char *pattern, match_t match)
 	return (comp);
 }
 
+/*
+ * Literal text every match of a glob or an anchored regex starts with,
+ * folded to lower case.
+ */
+static size_t
+pattern_prefix(const char *pattern, match_t match, char *prefix, size_t sz)
+{
+	const char	*p = pattern;
+	size_t		 len = 0;
+
+	if (match == MATCH_REGEX) {
+		if (*p++ != '^' || strchr(p, '|') != NULL)
+			return (0);
+		while (*p != '\0' && strchr(".[]()*+?{}|^$\\", *p) == NULL &&
+		    len < sz - 1)
+			prefix[len++] = tolower((unsigned char)*p++);
+		/* The last literal may be repeated zero times */
+		if (len > 0 && *p != '\0' && strchr("*?{", *p) != NULL)
+			len--;
+	} else {
+		while (*p != '\0' && strchr("*?[", *p) == NULL && len < sz - 1)
+			prefix[len++] = tolower((unsigned char)*p++);
+	}
+	prefix[len] = '\0';
+
+	return (len);
+}
+
+/*
+ * The range is compared with NOCASE so that the case insensitive indexes
+ * serve case sensitive globs as well as REG_ICASE regexes: it only has to
+ * hold every match, the pattern clause still decides.
+ */
+char *
+pkgdb_get_pattern_range(const char *pattern, match_t match)
+{
+	char	 lower[MAXPATHLEN], upper[MAXPATHLEN];
+	size_t	 len;
+
+	if (pattern == NULL || (match != MATCH_GLOB && match != MATCH_REGEX))
+		return (NULL);
+	if (strchr(pattern, '~') != NULL || strchr(pattern, '/') != NULL)
+		return (NULL);
+
+	len = pattern_prefix(pattern, match, lower, sizeof(lower));
+	memcpy(upper, lower, len + 1);
+	while (len > 0 && (unsigned char)upper[len - 1] == 0xff)
+		upper[--len] = '\0';
+	if (len == 0)
+		return (NULL);
+	upper[len - 1]++;
+	/* NOCASE would fold the bound back below the prefix */
+	if (isupper((unsigned char)upper[len - 1]))
+		return (NULL);
+
+	return (sqlite3_mprintf(" AND ((name COLLATE NOCASE >= %Q AND "
+	    "name COLLATE NOCASE < %Q) OR "
+	    "((name || '-' || version) COLLATE NOCASE >= %Q AND "
+	    "(name || '-' || version) COLLATE NOCASE < %Q))",
+	    lower, upper, lower, upper));
+}
+
 struct pkgdb_it *
 pkgdb_query(struct pkgdb *db, const char *pattern, match_t match)
 {
 	char		 sql[BUFSIZ];
 	sqlite3_stmt	*stmt;
 	const char	*comp = NULL;
+	char		*range;
 
 	assert(db != NULL);
 
@@ -143,6 +207,7 @@ pkgdb_query(struct pkgdb *db, const char *pattern, match_t match)
 		return (NULL);
 
 	comp = pkgdb_get_pattern_query(pattern, match);
+	range = pkgdb_get_pattern_range(pattern, match);
 
 	sqlite3_snprintf(sizeof(sql), sql,
 			"SELECT id, origin, name, name as uniqueid, "
@@ -150,8 +215,9 @@ pkgdb_query(struct pkgdb *db, const char *pattern, match_t match)
 				"message, arch, maintainer, www, "
 				"prefix, flatsize, licenselogic, automatic, "
 				"locked, time, manifestdigest, vital "
-			"FROM packages AS p%s "
-			"ORDER BY p.name;", comp);
+			"FROM packages AS p%s%s "
+			"ORDER BY p.name;", comp, range != NULL ? range : "");
+	sqlite3_free(range);
 
 	pkg_debug(4, "Pkgdb: running '%s'", sql);
 	if (sqlite3_prepare_v2(db->sqlite, sql, -1, &stmt, NULL) != SQLITE_OK) {
@@ -327,6 +393,40 @@ pkgdb_repo_query(struct pkgdb *db, const char *pattern, match_t match,
 	return (it);
 }
 
+int
+pkgdb_repo_digests(struct pkgdb *db, const char *repo, pkg_repo_digest_cb cb,
+    void *ud)
+{
+	struct _pkg_repo_list_item *cur;
+
+	LL_FOREACH(db->repos, cur) {
+		if (repo != NULL && strcasecmp(cur->repo->name, repo) != 0)
+			continue;
+		if (cur->repo->ops->digests == NULL ||
+		    cur->repo->ops->digests(cur->repo, cb, ud) != EPKG_OK)
+			return (EPKG_FATAL);
+	}
+
+	return (EPKG_OK);
+}
+
+int
+pkgdb_repo_rdeps(struct pkgdb *db, const char *repo, pkg_repo_rdep_cb cb,
+    void *ud)
+{
+	struct _pkg_repo_list_item *cur;
+
+	LL_FOREACH(db->repos, cur) {
+		if (repo != NULL && strcasecmp(cur->repo->name, repo) != 0)
+			continue;
+		if (cur->repo->ops->rdeps == NULL ||
+		    cur->repo->ops->rdeps(cur->repo, cb, ud) != EPKG_OK)
+			return (EPKG_FATAL);
+	}
+
+	return (EPKG_OK);
+}
+
 struct pkgdb_it *
 pkgdb_repo_shlib_require(struct pkgdb *db, const char *require, const char *repo)
 {
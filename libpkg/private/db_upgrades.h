@@ -677,6 +677,9 @@ static struct db_upgrades {
 	{34,
 	"DROP TABLE pkg_search;"
 	},
+	{35,
+	"CREATE INDEX packages_namever ON packages((name || '-' || version) COLLATE NOCASE);"
+	},
 	/* Mark the end of the array */
 	{ -1, NULL }
 
@@ -77,6 +77,11 @@ void pkg_emit_restore(void);
 void pkg_debug(int level, const char *fmt, ...) PKG_FORMAT_ATTRIBUTE(2, 3);
 int pkg_emit_sandbox_call(pkg_sandbox_cb call, int fd, void *ud);
 int pkg_emit_sandbox_get_string(pkg_sandbox_cb call, void *ud, char **str, int64_t *len);
+int pkg_sandbox_call(pkg_sandbox_cb call, int fd, void *ud, size_t udlen,
+	int udfds);
+int pkg_sandbox_get_string(pkg_sandbox_cb call, void *ud, size_t udlen,
+	int udfds, char **str, int64_t *len);
+void pkg_sandbox_worker_stop(void);
 
 bool pkg_emit_query_yesno(bool deft, const char *msg);
 int pkg_emit_query_select(const char *msg, const char **items, int ncnt, int deft);
@@ -251,6 +251,7 @@ KHASH_MAP_INIT_STR(pkg_config_files, struct pkg_config_file *);
 KHASH_MAP_INIT_STR(strings, char *);
 KHASH_MAP_INIT_STR(pkg_options, struct pkg_option *);
 KHASH_MAP_INIT_STR(pkg_conflicts, struct pkg_conflict *);
+KHASH_MAP_INIT_STR(mirror_stats, struct mirror_stat *);
 
 struct pkg {
 	bool		 direct;
@@ -313,10 +314,24 @@ struct pkg {
 	char		**dir_to_del;
 	size_t		dir_to_del_cap;
 	size_t		dir_to_del_len;
+	struct pkg_dir_node	*dir_to_del_trie;
 	pkg_t		 type;
 	struct pkg_repo		*repo;
 };
 
+/*
+ * Path trie over the directories planned for removal, one node per path
+ * component.  idx is the slot of the node in dir_to_del or -1,
+ * has_entry is set when a slot lives in the subtree of the node.
+ */
+struct pkg_dir_node {
+	char			*name;
+	ssize_t			 idx;
+	bool			 has_entry;
+	struct pkg_dir_node	*children;
+	UT_hash_handle		 hh;
+};
+
 struct pkg_dep {
 	char		*origin;
 	char		*name;
@@ -411,6 +426,14 @@ struct http_mirror {
 	struct http_mirror *next;
 };
 
+struct mirror_stat {
+	char *key;
+	double latency;		/* seconds to the answer of a request */
+	double rate;		/* bytes per second */
+	unsigned int failures;	/* in a row */
+	time_t updated;
+};
+
 struct pkg_repo_meta_key {
 	char *pubkey;
 	char *pubkey_type; /* TODO: should be enumeration */
@@ -445,6 +468,10 @@ struct pkg_repo_meta {
 	char *manifests_archive;
 	char *filesite;
 	char *filesite_archive;
+	bool filelist;		/* filesite is published */
+	char *deltasite;
+	char *deltasite_archive;
+	bool deltas;		/* deltasite is published */
 	char *conflicts;
 	char *conflicts_archive;
 	char *fulldb;
@@ -473,6 +500,11 @@ struct pkg_repo_it {
 	void *data;
 };
 
+typedef int (*pkg_repo_digest_cb)(const char *name, const char *digest,
+    void *ud);
+typedef int (*pkg_repo_rdep_cb)(const char *dep, const char *name,
+    const char *origin, const char *version, void *ud);
+
 struct pkg_repo_ops {
 	const char *type;
 	/* Accessing repo */
@@ -500,6 +532,10 @@ struct pkg_repo_ops {
 					pkgdb_field field, pkgdb_field sort);
 
 	int64_t (*stat)(struct pkg_repo *, pkg_stats_t type);
+	/* Name and manifest digest of every package, no struct pkg built */
+	int (*digests)(struct pkg_repo *, pkg_repo_digest_cb, void *);
+	/* Every dependency and the package depending on it, in one pass */
+	int (*rdeps)(struct pkg_repo *, pkg_repo_rdep_cb, void *);
 
 	int (*ensure_loaded)(struct pkg_repo *repo, struct pkg *pkg, unsigned flags);
 
@@ -507,10 +543,18 @@ struct pkg_repo_ops {
 	int (*get_cached_name)(struct pkg_repo *, struct pkg *,
 					char *dest, size_t destlen);
 	int (*fetch_pkg)(struct pkg_repo *, struct pkg *);
+	int (*queue_pkg)(struct pkg_repo *, struct pkg *);
 	int (*mirror_pkg)(struct pkg_repo *repo, struct pkg *pkg,
 		const char *destdir);
 };
 
+struct ssh_request {
+	char *doc;
+	time_t ims;
+	bool sent;
+	struct ssh_request *next;
+};
+
 typedef enum _pkg_repo_flags {
 	REPO_FLAGS_USE_IPV4 = (1U << 0),
 	REPO_FLAGS_USE_IPV6 = (1U << 1)
@@ -527,6 +571,10 @@ struct pkg_repo {
 		struct dns_srvinfo *srv;
 		struct http_mirror *http;
 	};
+	/* what the mirrors were measured at, by key */
+	kh_mirror_stats_t *mirror_stats;
+	bool mirror_stats_dirty;
+	bool mirror_raced;
 	signature_t signature_type;
 	char *fingerprints;
 	FILE *ssh;
@@ -538,6 +586,9 @@ struct pkg_repo {
 		int in;
 		int out;
 		pid_t pid;
+		/* requests queued ahead of time, in server order */
+		struct ssh_request *pending;
+		int inflight;
 	} sshio;
 
 	struct pkg_repo_meta *meta;
@@ -636,7 +687,10 @@ int pkg_delete(struct pkg *pkg, struct pkgdb *db, unsigned flags);
 
 int pkg_fetch_file_to_fd(struct pkg_repo *repo, const char *url, int dest,
     time_t *t, ssize_t offset, int64_t size);
+int pkg_fetch_ssh_queue(struct pkg_repo *repo, const char *url);
+void pkg_fetch_mirrors_free(struct pkg_repo *repo);
 int pkg_repo_fetch_package(struct pkg *pkg);
+int pkg_repo_queue_package(struct pkg *pkg);
 int pkg_repo_mirror_package(struct pkg *pkg, const char *destdir);
 int pkg_repo_fetch_remote_extract_fd(struct pkg_repo *repo,
     const char *filename, time_t *t, int *rc, size_t *sz);
@@ -690,10 +744,20 @@ int packing_init(struct packing **pack, const char *path, pkg_formats format);
 int packing_append_file_attr(struct packing *pack, const char *filepath,
      const char *newpath, const char *uname, const char *gname, mode_t perm,
      u_long fflags);
+int packing_append_file_data(struct packing *pack, const char *filepath,
+     const char *newpath, const char *uname, const char *gname, mode_t perm,
+     u_long fflags, const void *data, size_t datalen);
 int packing_append_buffer(struct packing *pack, const char *buffer,
 			  const char *path, int size);
 int packing_append_tree(struct packing *pack, const char *treepath,
 			const char *newroot);
+int packing_append_entry(struct packing *pack, struct archive_entry *entry);
+int packing_append_data(struct packing *pack, const void *buf, size_t len);
+
+int pkg_delta_create(const char *base, const char *target, const char *dest,
+    pkg_formats format);
+int pkg_delta_apply(const char *delta, const char *base, const char *dest,
+    pkg_formats format);
 void packing_finish(struct packing *pack);
 pkg_formats packing_format_from_string(const char *str);
 const char* packing_format_to_string(pkg_formats format);
@@ -714,12 +778,14 @@ int pkgdb_update_requires(struct pkg *pkg, int64_t package_id, sqlite3 *s);
 int pkgdb_insert_annotations(struct pkg *pkg, int64_t package_id, sqlite3 *s);
 int pkgdb_register_finale(struct pkgdb *db, int retcode);
 int pkgdb_set_pkg_digest(struct pkgdb *db, struct pkg *pkg);
-int pkgdb_is_dir_used(struct pkgdb *db, struct pkg *p, const char *dir, int64_t *res);
+int pkgdb_dirs_used(struct pkgdb *db, struct pkg *p, char **dirs, size_t ndirs,
+    kh_strings_t **used);
 int pkgdb_file_set_cksum(struct pkgdb *db, struct pkg_file *file, const char *sha256);
 
 
 int pkg_emit_manifest_buf(struct pkg*, UT_string *, short, char **);
 int pkg_emit_filelist(struct pkg *, FILE *);
+int pkg_parse_filelist(struct pkg *, const char *, size_t);
 
 bool ucl_object_emit_buf(const ucl_object_t *obj, enum ucl_emitter emit_type,
     UT_string **buf);
@@ -755,9 +821,16 @@ pkg_checksum_type_t pkg_checksum_type_from_string(const char *name);
 const char* pkg_checksum_type_to_string(pkg_checksum_type_t type);
 size_t pkg_checksum_type_size(pkg_checksum_type_t type);
 int pkg_checksum_calculate(struct pkg *pkg, struct pkgdb *db);
+int pkg_checksum_calculate_many(struct pkg **pkgs, size_t npkgs);
 char *pkg_checksum_generate_file(const char *path, pkg_checksum_type_t type);
+char *pkg_checksum_generate_data(const unsigned char *in, size_t inlen,
+    pkg_checksum_type_t type);
 char *pkg_checksum_generate_fileat(int fd, const char *path,
     pkg_checksum_type_t type);
+struct pkg_checksum_stream *pkg_checksum_stream_new(const char *sum);
+void pkg_checksum_stream_update(struct pkg_checksum_stream *st,
+    const void *in, size_t inlen);
+int pkg_checksum_stream_final(struct pkg_checksum_stream *st);
 
 int pkg_add_upgrade(struct pkgdb *db, const char *path, unsigned flags,
     struct pkg_manifest_key *keys, const char *location,
@@ -766,6 +839,7 @@ void pkg_delete_dir(struct pkg *pkg, struct pkg_dir *dir);
 void pkg_delete_file(struct pkg *pkg, struct pkg_file *file, unsigned force);
 int pkg_open_root_fd(struct pkg *pkg);
 void pkg_add_dir_to_del(struct pkg *pkg, const char *file, const char *dir);
+void pkg_dir_to_del_free(struct pkg *pkg);
 struct plist *plist_new(struct pkg *p, const char *stage);
 int plist_parse_line(struct plist *p, char *line);
 void plist_free(struct plist *);
@@ -815,6 +889,17 @@ enum pkg_metalog_type {
 	PKG_METALOG_LINK,
 };
 
+int pkg_trace_open(const char *path);
+void pkg_trace_close(void);
+int pkg_trace_sqlite_stmt(unsigned type, void *ud, void *stmt, void *x);
+
+void pkg_sync_init(void);
+void pkg_sync_begin(void);
+void pkg_sync_end(void);
+void pkg_sync_writeback(int fd);
+int pkg_sync_files(struct pkg *pkg);
+int pkg_sync_dirs(struct pkg *pkg);
+
 int pkg_set_from_file(struct pkg *pkg, pkg_attr attr, const char *file, bool trimcr);
 int pkg_set_from_fileat(int fd, struct pkg *pkg, pkg_attr attr, const char *file, bool trimcr);
 void pkg_rollback_cb(void *);
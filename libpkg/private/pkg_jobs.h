@@ -112,6 +112,7 @@ struct pkg_jobs {
 	int total;
 	int conflicts_registered;
 	bool need_fetch;
+	bool conflicts_checked;	/* before fetching, from known file lists */
 	const char *reponame;
 	const char *destdir;
 	TREE_HEAD(, pkg_jobs_conflict_item) *conflict_items;
@@ -116,6 +116,15 @@ int pkgdb_repo_register_conflicts(const char *origin, char **conflicts,
  */
 const char * pkgdb_get_pattern_query(const char *pattern, match_t match);
 
+/**
+ * Get an index range narrowing a glob or regex query to its literal prefix
+ * @param pattern
+ * @param match
+ * @return a condition to append to the query, to free with sqlite3_free(),
+ * or NULL if the pattern has no usable prefix
+ */
+char * pkgdb_get_pattern_range(const char *pattern, match_t match);
+
 /**
  * Find provides for a specified require in repos
  * @param db
@@ -138,6 +147,25 @@ struct pkgdb_it *pkgdb_repo_shlib_provide(struct pkgdb *db,
 struct pkgdb_it *pkgdb_repo_provide(struct pkgdb *db, const char *require,
     const char *repo);
 
+/**
+ * Call cb with the name and manifest digest of every package of the repos
+ * @param db
+ * @param repo repository name or NULL for all of them
+ * @return EPKG_OK, or EPKG_FATAL if a repo cannot list them
+ */
+int pkgdb_repo_digests(struct pkgdb *db, const char *repo,
+    pkg_repo_digest_cb cb, void *ud);
+
+/**
+ * Call cb with every dependency of the repos and the package depending on
+ * it, the reverse dependencies of all the packages in one statement
+ * @param db
+ * @param repo repository name or NULL for all of them
+ * @return EPKG_OK, or EPKG_FATAL if a repo cannot list them
+ */
+int pkgdb_repo_rdeps(struct pkgdb *db, const char *repo,
+    pkg_repo_rdep_cb cb, void *ud);
+
 struct pkgdb_it *pkgdb_repo_require(struct pkgdb *db, const char *provide,
     const char *repo);
 
@@ -38,8 +38,11 @@ struct pkg_repo_ops pkg_repo_binary_ops = {
 	.required = pkg_repo_binary_require,
 	.search = pkg_repo_binary_search,
 	.fetch_pkg = pkg_repo_binary_fetch,
+	.queue_pkg = pkg_repo_binary_queue,
 	.mirror_pkg = pkg_repo_binary_mirror,
 	.get_cached_name = pkg_repo_binary_get_cached_name,
 	.ensure_loaded = pkg_repo_binary_ensure_loaded,
-	.stat = pkg_repo_binary_stat
+	.stat = pkg_repo_binary_stat,
+	.digests = pkg_repo_binary_digests,
+	.rdeps = pkg_repo_binary_rdeps
 };
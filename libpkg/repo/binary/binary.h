@@ -38,6 +38,7 @@ int pkg_repo_binary_access(struct pkg_repo *repo, unsigned mode);
 
 int pkg_repo_binary_create(struct pkg_repo *repo);
 int pkg_repo_binary_open(struct pkg_repo *repo, unsigned mode);
+void pkg_repo_binary_stamp(struct pkg_repo *repo);
 
 struct pkg_repo_it *pkg_repo_binary_query(struct pkg_repo *repo,
 	const char *pattern, match_t match);
@@ -55,8 +56,13 @@ struct pkg_repo_it *pkg_repo_binary_search(struct pkg_repo *repo,
 int pkg_repo_binary_ensure_loaded(struct pkg_repo *repo,
 	struct pkg *pkg, unsigned flags);
 int64_t pkg_repo_binary_stat(struct pkg_repo *repo, pkg_stats_t type);
+int pkg_repo_binary_digests(struct pkg_repo *repo, pkg_repo_digest_cb cb,
+	void *ud);
+int pkg_repo_binary_rdeps(struct pkg_repo *repo, pkg_repo_rdep_cb cb,
+	void *ud);
 
 int pkg_repo_binary_fetch(struct pkg_repo *repo, struct pkg *pkg);
+int pkg_repo_binary_queue(struct pkg_repo *repo, struct pkg *pkg);
 int pkg_repo_binary_get_cached_name(struct pkg_repo *repo, struct pkg *pkg,
 	char *dest, size_t destlen);
 int pkg_repo_binary_mirror(struct pkg_repo *repo, struct pkg *pkg,
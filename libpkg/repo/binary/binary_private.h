@@ -176,6 +176,24 @@ static const char binary_repo_initsql[] = ""
 		"  ON DELETE RESTRICT ON UPDATE RESTRICT,"
 		"UNIQUE(package_id, require_id)"
 	");"
+	/* Filled from the repository file list, when there is one */
+	"CREATE TABLE files ("
+		"package_id INTEGER NOT NULL REFERENCES packages(id)"
+		"  ON DELETE CASCADE ON UPDATE CASCADE,"
+		"path TEXT NOT NULL"
+	");"
+	"CREATE INDEX files_package ON files(package_id);"
+	/* Filled from the repository deltas, when there are some */
+	"CREATE TABLE deltas ("
+		"package_id INTEGER NOT NULL REFERENCES packages(id)"
+		"  ON DELETE CASCADE ON UPDATE CASCADE,"
+		"basever TEXT NOT NULL,"
+		"basesum TEXT NOT NULL,"
+		"path TEXT NOT NULL,"
+		"sum TEXT NOT NULL,"
+		"pkgsize INTEGER NOT NULL"
+	");"
+	"CREATE INDEX deltas_package ON deltas(package_id);"
 /*	"CREATE INDEX packages_origin ON packages(origin COLLATE NOCASE);"
 	"CREATE INDEX packages_name ON packages(name COLLATE NOCASE);"
 	"CREATE INDEX packages_uid_nocase ON packages(name COLLATE NOCASE, origin COLLATE NOCASE);"
@@ -378,6 +396,51 @@ static const struct repo_changes repo_upgrades[] = {
 	 2014,
 	 "DROP TABLE pkg_search;"
 	},
+	{2014,
+	 2015,
+	 "Add files of the repository file list",
+
+	 "CREATE TABLE files ("
+		"package_id INTEGER NOT NULL REFERENCES packages(id)"
+		"  ON DELETE CASCADE ON UPDATE CASCADE,"
+		"path TEXT NOT NULL"
+	 ");"
+	 "CREATE INDEX files_package ON files(package_id);"
+	},
+	{2015,
+	 2016,
+	 "Index the name-version of packages",
+
+	 "CREATE INDEX IF NOT EXISTS packages_namever "
+		"ON packages((name || '-' || version) COLLATE NOCASE);"
+	},
+	{2016,
+	 2017,
+	 "Index dependencies, provides and requires by name",
+
+	 "CREATE INDEX IF NOT EXISTS deps_name ON deps(name);"
+	 "CREATE INDEX IF NOT EXISTS provides_provide ON provides(provide);"
+	 "CREATE INDEX IF NOT EXISTS pkg_provides_provide "
+		"ON pkg_provides(provide_id);"
+	 "CREATE INDEX IF NOT EXISTS requires_require ON requires(require);"
+	 "CREATE INDEX IF NOT EXISTS pkg_requires_require "
+		"ON pkg_requires(require_id);"
+	},
+	{2017,
+	 2018,
+	 "Add deltas of the repository packages",
+
+	 "CREATE TABLE deltas ("
+		"package_id INTEGER NOT NULL REFERENCES packages(id)"
+		"  ON DELETE CASCADE ON UPDATE CASCADE,"
+		"basever TEXT NOT NULL,"
+		"basesum TEXT NOT NULL,"
+		"path TEXT NOT NULL,"
+		"sum TEXT NOT NULL,"
+		"pkgsize INTEGER NOT NULL"
+	 ");"
+	 "CREATE INDEX deltas_package ON deltas(package_id);"
+	},
 	/* Mark the end of the array */
 	{ -1, -1, NULL, NULL, }
 
@@ -386,6 +449,34 @@ static const struct repo_changes repo_upgrades[] = {
 /* How to downgrade a newer repo to match what the current system
    expects */
 static const struct repo_changes repo_downgrades[] = {
+	{2018,
+	 2017,
+	 "Drop deltas of the repository packages",
+
+	 "DROP TABLE deltas;"
+	},
+	{2017,
+	 2016,
+	 "Drop the name indexes of dependencies, provides and requires",
+
+	 "DROP INDEX IF EXISTS deps_name;"
+	 "DROP INDEX IF EXISTS provides_provide;"
+	 "DROP INDEX IF EXISTS pkg_provides_provide;"
+	 "DROP INDEX IF EXISTS requires_require;"
+	 "DROP INDEX IF EXISTS pkg_requires_require;"
+	},
+	{2016,
+	 2015,
+	 "Drop the name-version index of packages",
+
+	 "DROP INDEX IF EXISTS packages_namever;"
+	},
+	{2015,
+	 2014,
+	 "Drop files of the repository file list",
+
+	 "DROP TABLE files;"
+	},
 	{2013,
 	 2012,
 	 "Drop vital column",
@@ -631,7 +722,7 @@ static const struct repo_changes repo_downgrades[] = {
 /* The package repo schema minor revision.
    Minor schema changes don't prevent older pkgng
    versions accessing the repo. */
-#define REPO_SCHEMA_MINOR 14
+#define REPO_SCHEMA_MINOR 18
 
 #define REPO_SCHEMA_VERSION (REPO_SCHEMA_MAJOR * 1000 + REPO_SCHEMA_MINOR)
 
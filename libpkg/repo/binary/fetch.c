@@ -33,6 +33,7 @@
 #include <sys/param.h>
 #include <sys/mman.h>
 
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -49,13 +50,34 @@
 #include "private/pkg.h"
 #include "binary.h"
 
+/*
+ * Return the hexadecimal part of the package checksum, the key of the
+ * cache entry, or NULL if the package cannot be stored by checksum.
+ */
+static const char *
+pkg_repo_binary_cache_sum(struct pkg *pkg)
+{
+	const char *sum, *sep;
+
+	if (pkg->sum == NULL)
+		return (NULL);
+	sum = pkg->sum;
+	if ((sep = strrchr(sum, '$')) != NULL)
+		sum = sep + 1;
+	if (strlen(sum) <= PKG_FILE_CKSUM_CHARS ||
+	    strspn(sum, "0123456789abcdef") != strlen(sum))
+		return (NULL);
+
+	return (sum);
+}
+
 int
 pkg_repo_binary_get_cached_name(struct pkg_repo *repo, struct pkg *pkg,
 	char *dest, size_t destlen)
 {
 	const char *ext = NULL;
 	const char *cachedir = NULL;
-	const char *packagesite;
+	const char *packagesite, *sum;
 	struct stat st;
 
 	cachedir = pkg_object_string(pkg_config_get("PKG_CACHEDIR"));
@@ -65,7 +87,9 @@ pkg_repo_binary_get_cached_name(struct pkg_repo *repo, struct pkg *pkg,
 	if (strncmp(packagesite, "file:/", 6) == 0) {
 		snprintf(dest, destlen, "%s/%s", packagesite + 6,
 		    pkg->repopath);
-		return (EPKG_OK);
+		/* Missing from the repository, it may be rebuilt in the cache */
+		if (stat(dest, &st) == 0)
+			return (EPKG_OK);
 	}
 
 	if (pkg->repopath != NULL)
@@ -74,11 +98,19 @@ pkg_repo_binary_get_cached_name(struct pkg_repo *repo, struct pkg *pkg,
 	if (ext != NULL) {
 		/*
 		 * The real naming scheme:
-		 * <cachedir>/<name>-<version>-<checksum>.txz
+		 * <cachedir>/<checksum>.txz
+		 * Packages are addressed by their content so the same
+		 * package published by several repositories is only
+		 * fetched and stored once.
 		 */
-		pkg_snprintf(dest, destlen, "%S/%n-%v-%z%S",
-				cachedir, pkg, pkg, pkg, ext);
-		if (stat (dest, &st) == -1 || pkg->pkgsize != st.st_size)
+		if ((sum = pkg_repo_binary_cache_sum(pkg)) != NULL)
+			pkg_snprintf(dest, destlen, "%S/%S%S", cachedir,
+			    sum, ext);
+		else
+			pkg_snprintf(dest, destlen, "%S/%n-%v-%z%S",
+			    cachedir, pkg, pkg, pkg, ext);
+		if (stat (dest, &st) == -1 || (pkg->pkgsize != st.st_size &&
+		    !pkg_repo_cached_rebuilt(dest)))
 			return (EPKG_FATAL);
 
 	}
@@ -123,14 +155,216 @@ pkg_repo_binary_create_symlink(struct pkg *pkg, const char *fname,
 	return (EPKG_OK);
 }
 
+/*
+ * Cache entries used to be named after the package rather than its
+ * checksum: the name such an entry of the package would have.  Returns
+ * false if there is none other than dest.
+ */
+static bool
+pkg_repo_binary_legacy_name(struct pkg_repo *repo, struct pkg *pkg,
+	const char *dest, char *legacy, size_t legacylen)
+{
+	const char *cachedir, *ext;
+
+	if (strncmp(pkg_repo_url(repo), "file:/", 6) == 0 ||
+	    pkg->repopath == NULL ||
+	    (ext = strrchr(pkg->repopath, '.')) == NULL)
+		return (false);
+
+	cachedir = pkg_object_string(pkg_config_get("PKG_CACHEDIR"));
+	pkg_snprintf(legacy, legacylen, "%S/%n-%v-%z%S",
+	    cachedir, pkg, pkg, pkg, ext);
+
+	return (strcmp(legacy, dest) != 0);
+}
+
+/*
+ * Move a legacy cache entry to its new name instead of fetching the
+ * package again.  Returns true if dest is now complete.
+ */
+static bool
+pkg_repo_binary_adopt_legacy(struct pkg_repo *repo, struct pkg *pkg,
+	const char *dest, const char *part)
+{
+	char legacy[MAXPATHLEN];
+	struct stat st;
+
+	if (!pkg_repo_binary_legacy_name(repo, pkg, dest, legacy,
+	    sizeof(legacy)) || stat(legacy, &st) == -1)
+		return (false);
+
+	if (st.st_size < pkg->pkgsize) {
+		(void)rename(legacy, part);
+		return (false);
+	}
+	if (rename(legacy, dest) == -1)
+		return (false);
+
+	pkg_debug(1, "Moved cached %s to %s", legacy, dest);
+	return (true);
+}
+
+/*
+ * Look up the delta of the package against a base that is in the cache,
+ * copied to base, or installed, base left empty.  Returns the statement
+ * on the row of the delta, NULL if there is no usable one.
+ */
+static sqlite3_stmt *
+pkg_repo_binary_find_delta(struct pkg_repo *repo, struct pkg *pkg,
+	char *base, size_t baselen)
+{
+	const char sql[] = ""
+		"SELECT d.basever, d.basesum, d.path, d.sum, d.pkgsize "
+		"FROM deltas AS d INNER JOIN packages AS p "
+		"ON (p.id = d.package_id) WHERE p.name = ?1 AND p.version = ?2;";
+	sqlite3 *sqlite = PRIV_GET(repo);
+	sqlite3_stmt *stmt = NULL;
+	const char *cachedir, *ext, *basever;
+	struct stat st;
+
+	if (pkg->repopath == NULL ||
+	    (ext = strrchr(pkg->repopath, '.')) == NULL ||
+	    pkg_repo_binary_cache_sum(pkg) == NULL)
+		return (NULL);
+
+	if (sqlite3_prepare_v2(sqlite, sql, -1, &stmt, NULL) != SQLITE_OK) {
+		ERROR_SQLITE(sqlite, sql);
+		return (NULL);
+	}
+	sqlite3_bind_text(stmt, 1, pkg->name, -1, SQLITE_STATIC);
+	sqlite3_bind_text(stmt, 2, pkg->version, -1, SQLITE_STATIC);
+	if (sqlite3_step(stmt) != SQLITE_ROW)
+		goto notfound;
+	basever = sqlite3_column_text(stmt, 0);
+
+	cachedir = pkg_object_string(pkg_config_get("PKG_CACHEDIR"));
+	snprintf(base, baselen, "%s/%s%s", cachedir,
+	    sqlite3_column_text(stmt, 1), ext);
+	if (stat(base, &st) == 0)
+		return (stmt);
+	base[0] = '\0';
+	if (pkg->old_version != NULL && strcmp(pkg->old_version, basever) == 0)
+		return (stmt);
+
+notfound:
+	sqlite3_finalize(stmt);
+	return (NULL);
+}
+
+/*
+ * Rebuild the package from a delta against the previous version, in the
+ * cache or installed, see pkg_delta.c, into its cache entry dest.
+ */
+static int
+pkg_repo_binary_try_delta(struct pkg_repo *repo, struct pkg *pkg,
+	const char *dest)
+{
+	sqlite3_stmt *stmt;
+	char base[MAXPATHLEN], delta[MAXPATHLEN], stem[MAXPATHLEN];
+	char rebuilt[MAXPATHLEN], url[MAXPATHLEN], stamp[MAXPATHLEN];
+	const char *cachedir, *packagesite, *ext, *sum, *path, *dsum;
+	char *newsum = NULL;
+	bool local = false, frombase;
+	struct stat st;
+	time_t t = 0;
+	int fd, ret = EPKG_END;
+
+	delta[0] = rebuilt[0] = '\0';
+	if ((stmt = pkg_repo_binary_find_delta(repo, pkg, base,
+	    sizeof(base))) == NULL)
+		return (EPKG_END);
+	ext = strrchr(pkg->repopath, '.');
+	sum = pkg_repo_binary_cache_sum(pkg);
+	path = sqlite3_column_text(stmt, 2);
+	dsum = sqlite3_column_text(stmt, 3);
+	frombase = (base[0] != '\0');
+
+	cachedir = pkg_object_string(pkg_config_get("PKG_CACHEDIR"));
+	packagesite = pkg_repo_url(repo);
+	local = (strncasecmp(packagesite, "file://", 7) == 0);
+	if (local) {
+		snprintf(delta, sizeof(delta), "%s/%s", packagesite + 7, path);
+	} else {
+		snprintf(delta, sizeof(delta), "%s/%s.delta", cachedir, sum);
+		if (packagesite[strlen(packagesite) - 1] == '/')
+			snprintf(url, sizeof(url), "%s%s", packagesite, path);
+		else
+			snprintf(url, sizeof(url), "%s/%s", packagesite, path);
+		if ((fd = open(delta, O_CREAT|O_TRUNC|O_WRONLY, 00644)) == -1) {
+			pkg_emit_errno("open", delta);
+			ret = EPKG_FATAL;
+			goto cleanup;
+		}
+		ret = pkg_fetch_file_to_fd(repo, url, fd, &t, -1,
+		    sqlite3_column_int64(stmt, 4));
+		close(fd);
+		if (ret != EPKG_OK)
+			goto cleanup;
+	}
+	ret = EPKG_FATAL;
+	if (pkg_checksum_validate_file(delta, dsum) != 0) {
+		pkg_emit_error("%s-%s: delta failed checksum from repository",
+		    pkg->name, pkg->version);
+		goto cleanup;
+	}
+
+	snprintf(stem, sizeof(stem), "%s/%s.rebuild", cachedir, sum);
+	snprintf(rebuilt, sizeof(rebuilt), "%s%s", stem, ext);
+	if (pkg_delta_apply(delta, frombase ? base : NULL, stem,
+	    packing_format_from_string(ext + 1)) != EPKG_OK ||
+	    stat(rebuilt, &st) == -1)
+		goto cleanup;
+
+	newsum = pkg_checksum_file(rebuilt, PKG_HASH_TYPE_SHA256_HEX);
+	if (newsum == NULL)
+		goto cleanup;
+	snprintf(stamp, sizeof(stamp), "%s.rebuilt", dest);
+	if ((fd = open(stamp, O_CREAT|O_TRUNC|O_WRONLY, 00644)) == -1) {
+		pkg_emit_errno("open", stamp);
+		goto cleanup;
+	}
+	if (write(fd, newsum, strlen(newsum)) != (ssize_t)strlen(newsum)) {
+		pkg_emit_errno("write", stamp);
+		close(fd);
+		unlink(stamp);
+		goto cleanup;
+	}
+	close(fd);
+	if (rename(rebuilt, dest) == -1) {
+		pkg_emit_errno("rename", rebuilt);
+		unlink(stamp);
+		goto cleanup;
+	}
+	pkg_debug(1, "Rebuilt %s-%s from a delta against %s", pkg->name,
+	    pkg->version, frombase ? base : "the installed files");
+	ret = EPKG_OK;
+
+cleanup:
+	if (ret != EPKG_OK && ret != EPKG_END) {
+		if (rebuilt[0] != '\0')
+			unlink(rebuilt);
+		pkg_emit_notice("Cannot use the delta of %s-%s, fetching it in "
+		    "full", pkg->name, pkg->version);
+	}
+	if (delta[0] != '\0' && !local)
+		unlink(delta);
+	free(newsum);
+	sqlite3_finalize(stmt);
+
+	return (ret);
+}
+
 static int
 pkg_repo_binary_try_fetch(struct pkg_repo *repo, struct pkg *pkg,
 	bool already_tried, bool mirror, const char *destdir)
 {
 	char dest[MAXPATHLEN];
+	char part[MAXPATHLEN];
 	char url[MAXPATHLEN];
 	char *dir = NULL;
 	bool fetched = false;
+	time_t t = 0;
+	int fd;
 	struct stat st;
 	char *path = NULL;
 	const char *packagesite = NULL;
@@ -153,16 +387,18 @@ pkg_repo_binary_try_fetch(struct pkg_repo *repo, struct pkg *pkg,
 	else
 		pkg_repo_binary_get_cached_name(repo, pkg, dest, sizeof(dest));
 
+	snprintf(part, sizeof(part), "%s.part", dest);
+
 	/* If it is already in the local cachedir, dont bother to
 	 * download it */
-	if (stat(dest, &st) == 0) {
-		/* try to resume */
-		if (pkg->pkgsize > st.st_size) {
-			offset = st.st_size;
-			pkg_debug(1, "Resuming fetch");
-		} else {
+	if (!mirror && pkg_repo_cached_rebuilt(dest)) {
+		goto cleanup;
+	} else if (stat(dest, &st) == 0) {
+		if (pkg->pkgsize <= st.st_size)
 			goto checksum;
-		}
+	} else if (!mirror && pkg_repo_binary_adopt_legacy(repo, pkg, dest,
+	    part)) {
+		goto checksum;
 	}
 
 	/* Create the dirs in cachedir */
@@ -194,17 +430,60 @@ pkg_repo_binary_try_fetch(struct pkg_repo *repo, struct pkg *pkg,
 	else
 		pkg_snprintf(url, sizeof(url), "%S/%R", packagesite, pkg);
 
+	/*
+	 * A partial download is resumed rather than replaced by a delta.
+	 * The data of a rebuilt package has been verified while it was
+	 * rebuilt, it does not match the checksum of the repository.
+	 */
+	if (!mirror && !already_tried && stat(part, &st) == -1 &&
+	    pkg_repo_binary_try_delta(repo, pkg, dest) == EPKG_OK)
+		goto cleanup;
+
 	if (!mirror && strncasecmp(packagesite, "file://", 7) == 0) {
 		free(dir);
 		return (EPKG_OK);
 	}
 
-	retcode = pkg_fetch_file(repo, url, dest, 0, offset, pkg->pkgsize);
+	/*
+	 * Download into <dest>.part and only move it in place once
+	 * complete: a partial file is kept across failures and resumed
+	 * from where it stopped on the next attempt.  A short dest is
+	 * left over by an older interrupted fetch.
+	 */
+	if (stat(dest, &st) == 0)
+		(void)rename(dest, part);
+	if (stat(part, &st) == 0) {
+		if (pkg->pkgsize > st.st_size) {
+			offset = st.st_size;
+			pkg_debug(1, "Resuming fetch of %s at %jd", url,
+			    (intmax_t)offset);
+		} else if (rename(part, dest) == 0) {
+			goto checksum;
+		} else {
+			unlink(part);
+		}
+	}
+
+	if ((fd = open(part, O_CREAT|O_APPEND|O_WRONLY, 00644)) == -1) {
+		pkg_emit_errno("open", part);
+		retcode = EPKG_FATAL;
+		goto cleanup;
+	}
+	retcode = pkg_fetch_file_to_fd(repo, url, fd, &t, offset,
+	    pkg->pkgsize);
+	close(fd);
 	fetched = true;
 
 	if (retcode != EPKG_OK)
 		goto cleanup;
 
+	if (rename(part, dest) == -1) {
+		pkg_emit_errno("rename", part);
+		unlink(part);
+		retcode = EPKG_FATAL;
+		goto cleanup;
+	}
+
 checksum:
 	/*	checksum calculation is expensive, if size does not
 		match, skip it and assume failed checksum. */
@@ -258,6 +537,58 @@ pkg_repo_binary_fetch(struct pkg_repo *repo, struct pkg *pkg)
 	return (pkg_repo_binary_try_fetch(repo, pkg, false, false, NULL));
 }
 
+/*
+ * Whether the package is to be fetched in full, rather than found in the
+ * cache, resumed or rebuilt from a delta by try_fetch.
+ */
+static bool
+pkg_repo_binary_need_fetch(struct pkg_repo *repo, struct pkg *pkg,
+	const char *dest)
+{
+	char path[MAXPATHLEN];
+	sqlite3_stmt *stmt;
+	struct stat st;
+
+	if (pkg_repo_cached_rebuilt(dest) || stat(dest, &st) == 0)
+		return (false);
+	snprintf(path, sizeof(path), "%s.part", dest);
+	if (stat(path, &st) == 0)
+		return (false);
+	if (pkg_repo_binary_legacy_name(repo, pkg, dest, path, sizeof(path)) &&
+	    stat(path, &st) == 0)
+		return (false);
+	if ((stmt = pkg_repo_binary_find_delta(repo, pkg, path,
+	    sizeof(path))) == NULL)
+		return (true);
+	sqlite3_finalize(stmt);
+
+	return (false);
+}
+
+int
+pkg_repo_binary_queue(struct pkg_repo *repo, struct pkg *pkg)
+{
+	char dest[MAXPATHLEN];
+	char url[MAXPATHLEN];
+	const char *packagesite;
+
+	packagesite = pkg_repo_url(repo);
+	if (packagesite == NULL || strncmp(packagesite, "ssh://", 6) != 0)
+		return (EPKG_OK);
+
+	/* Only a full download uses the queued answer */
+	pkg_repo_binary_get_cached_name(repo, pkg, dest, sizeof(dest));
+	if (!pkg_repo_binary_need_fetch(repo, pkg, dest))
+		return (EPKG_OK);
+
+	if (packagesite[strlen(packagesite) - 1] == '/')
+		pkg_snprintf(url, sizeof(url), "%S%R", packagesite, pkg);
+	else
+		pkg_snprintf(url, sizeof(url), "%S/%R", packagesite, pkg);
+
+	return (pkg_fetch_ssh_queue(repo, url));
+}
+
 int
 pkg_repo_binary_mirror(struct pkg_repo *repo, struct pkg *pkg,
 	const char *destdir)
@@ -294,6 +294,94 @@ pkg_repo_binary_check_version(struct pkg_repo *repo, sqlite3 *sqlite)
 	return (ret);
 }
 
+/*
+ * The validation done by pkg_repo_binary_open() only depends on the
+ * database file, the schema and checksum formats this pkg understands and
+ * the packagesite.  Once passed, it is recorded in <repo>.stamp along
+ * with the identity of the file, and read-only opens of the same file
+ * skip it.  Any write to the database changes its identity.
+ */
+static bool
+pkg_repo_binary_stamp_get(struct pkg_repo *repo, int dbdirfd,
+    const char *filepath, char *stamp, size_t len)
+{
+	struct stat st;
+	long nsec;
+
+	if (fstatat(dbdirfd, filepath, &st, 0) == -1)
+		return (false);
+#ifdef HAVE_STRUCT_STAT_ST_MTIM
+	nsec = st.st_mtim.tv_nsec;
+#elif defined(_DARWIN_C_SOURCE) || defined(__APPLE__)
+	nsec = st.st_mtimespec.tv_nsec;
+#else
+	nsec = 0;
+#endif
+	snprintf(stamp, len, "%s %d %ju:%ju:%jd:%jd.%09ld:%jd %s\n",
+	    PKGVERSION, REPO_SCHEMA_VERSION, (uintmax_t)st.st_dev,
+	    (uintmax_t)st.st_ino, (intmax_t)st.st_size, (intmax_t)st.st_mtime,
+	    nsec, (intmax_t)st.st_ctime, pkg_repo_url(repo));
+
+	return (true);
+}
+
+static bool
+pkg_repo_binary_stamp_valid(struct pkg_repo *repo, int dbdirfd,
+    const char *filepath)
+{
+	char path[MAXPATHLEN], stamp[MAXPATHLEN + 128], buf[sizeof(stamp)];
+	ssize_t r;
+	int fd;
+
+	if (!pkg_object_bool(pkg_config_get("REPO_VALIDATION_STAMP")) ||
+	    !pkg_repo_binary_stamp_get(repo, dbdirfd, filepath, stamp,
+	    sizeof(stamp)))
+		return (false);
+
+	snprintf(path, sizeof(path), "%s.stamp", pkg_repo_name(repo));
+	if ((fd = openat(dbdirfd, path, O_RDONLY|O_CLOEXEC)) == -1)
+		return (false);
+	r = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (r <= 0)
+		return (false);
+	buf[r] = '\0';
+
+	return (strcmp(buf, stamp) == 0);
+}
+
+void
+pkg_repo_binary_stamp(struct pkg_repo *repo)
+{
+	char path[MAXPATHLEN], tmp[MAXPATHLEN], stamp[MAXPATHLEN + 128];
+	const char *filepath;
+	int dbdirfd, fd;
+
+	if (!pkg_object_bool(pkg_config_get("REPO_VALIDATION_STAMP")))
+		return;
+
+	dbdirfd = pkg_get_dbdirfd();
+	filepath = pkg_repo_binary_get_filename(pkg_repo_name(repo));
+	snprintf(path, sizeof(path), "%s.stamp", pkg_repo_name(repo));
+	if (!pkg_repo_binary_stamp_get(repo, dbdirfd, filepath, stamp,
+	    sizeof(stamp))) {
+		unlinkat(dbdirfd, path, 0);
+		return;
+	}
+
+	/* Not being able to write it only costs the probes next time */
+	snprintf(tmp, sizeof(tmp), "%s.%ld", path, (long)getpid());
+	if ((fd = openat(dbdirfd, tmp, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC,
+	    0644)) == -1)
+		return;
+	if (write(fd, stamp, strlen(stamp)) != (ssize_t)strlen(stamp) ||
+	    renameat(dbdirfd, tmp, dbdirfd, path) == -1)
+		unlinkat(dbdirfd, tmp, 0);
+	close(fd);
+	pkg_debug(1, "PkgRepo: recorded the validation of %s",
+	    pkg_repo_name(repo));
+}
+
 int
 pkg_repo_binary_open(struct pkg_repo *repo, unsigned mode)
 {
@@ -343,6 +431,16 @@ pkg_repo_binary_open(struct pkg_repo *repo, unsigned mode)
 				strerror(errno));
 		return (EPKG_FATAL);
 	}
+	if (pkg_trace_enabled())
+		sqlite3_trace_v2(sqlite, SQLITE_TRACE_STMT,
+		    pkg_trace_sqlite_stmt, NULL);
+
+	/* Opens for an update always check the database */
+	if ((mode & W_OK) == 0 &&
+	    pkg_repo_binary_stamp_valid(repo, dbdirfd, filepath)) {
+		repo->priv = sqlite;
+		return (EPKG_OK);
+	}
 
 	/* Sanitise sqlite database */
 	if (get_pragma(sqlite, "SELECT count(name) FROM sqlite_master "
@@ -392,6 +490,8 @@ pkg_repo_binary_open(struct pkg_repo *repo, unsigned mode)
 
 	if (it->ops->next(it, &pkg, PKG_LOAD_BASIC) != EPKG_OK) {
 		it->ops->free(it);
+		if ((mode & W_OK) == 0)
+			pkg_repo_binary_stamp(repo);
 		return (EPKG_OK);
 	}
 	it->ops->free(it);
@@ -404,6 +504,8 @@ pkg_repo_binary_open(struct pkg_repo *repo, unsigned mode)
 		return (EPKG_FATAL);
 	}
 	pkg_free(pkg);
+	if ((mode & W_OK) == 0)
+		pkg_repo_binary_stamp(repo);
 
 	return (EPKG_OK);
 }
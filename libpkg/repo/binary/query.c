@@ -53,22 +53,37 @@ static struct pkg_repo_it_ops pkg_repo_binary_it_ops = {
 	.reset = pkg_repo_binary_it_reset
 };
 
+struct binary_it {
+	struct pkgdb_it	*it;
+	/*
+	 * Iterators over most of the repository load the reverse
+	 * dependencies of all the packages at once: dependency name ->
+	 * chain of the packages depending on it.
+	 */
+	bool		 bulk_rdeps;
+	kh_pkg_deps_t	*rdeps;
+};
+
 static struct pkg_repo_it*
 pkg_repo_binary_it_new(struct pkg_repo *repo, sqlite3_stmt *s, short flags)
 {
 	struct pkg_repo_it *it;
+	struct binary_it *bit;
 	struct pkgdb fakedb;
 
 	it = xmalloc(sizeof(*it));
+	bit = xcalloc(1, sizeof(*bit));
 
 	it->ops = &pkg_repo_binary_it_ops;
 	it->flags = flags;
 	it->repo = repo;
+	it->data = bit;
 
 	fakedb.sqlite = PRIV_GET(repo);
-	it->data = pkgdb_it_new_sqlite(&fakedb, s, PKG_REMOTE, flags);
+	bit->it = pkgdb_it_new_sqlite(&fakedb, s, PKG_REMOTE, flags);
 
-	if (it->data == NULL) {
+	if (bit->it == NULL) {
+		free(bit);
 		free(it);
 		return (NULL);
 	}
@@ -76,23 +91,103 @@ pkg_repo_binary_it_new(struct pkg_repo *repo, sqlite3_stmt *s, short flags)
 	return (it);
 }
 
+static int
+binary_rdep_add(const char *dep, const char *name, const char *origin,
+    const char *version, void *ud)
+{
+	kh_pkg_deps_t *rdeps = ud;
+	struct pkg_dep *d;
+	khint_t k;
+	int ret;
+
+	d = xcalloc(1, sizeof(*d));
+	d->name = xstrdup(name);
+	if (origin != NULL)
+		d->origin = xstrdup(origin);
+	if (version != NULL)
+		d->version = xstrdup(version);
+	d->uid = xstrdup(dep);
+
+	k = kh_put_pkg_deps(rdeps, d->uid, &ret);
+	if (ret != 0)
+		kh_value(rdeps, k) = NULL;
+	LL_PREPEND(kh_value(rdeps, k), d);
+
+	return (EPKG_OK);
+}
+
+static void
+binary_rdeps_free(kh_pkg_deps_t *rdeps)
+{
+	struct pkg_dep *chain, *d, *dtmp;
+
+	if (rdeps == NULL)
+		return;
+
+	kh_foreach_value(rdeps, chain, {
+		LL_FOREACH_SAFE(chain, d, dtmp)
+			pkg_dep_free(d);
+	});
+	kh_destroy_pkg_deps(rdeps);
+}
+
 static int
 pkg_repo_binary_it_next(struct pkg_repo_it *it, struct pkg **pkg_p, unsigned flags)
 {
-	return (pkgdb_it_next(it->data, pkg_p, flags));
+	struct binary_it *bit = it->data;
+	struct pkg_dep *d;
+	struct pkg *pkg;
+	khint_t k;
+	int ret;
+
+	if (!bit->bulk_rdeps || (flags & PKG_LOAD_RDEPS) == 0)
+		return (pkgdb_it_next(bit->it, pkg_p, flags));
+
+	if (bit->rdeps == NULL) {
+		bit->rdeps = kh_init_pkg_deps();
+		if (pkg_repo_binary_rdeps(it->repo, binary_rdep_add,
+		    bit->rdeps) != EPKG_OK) {
+			binary_rdeps_free(bit->rdeps);
+			bit->rdeps = NULL;
+			return (EPKG_FATAL);
+		}
+	}
+
+	ret = pkgdb_it_next(bit->it, pkg_p, flags & ~PKG_LOAD_RDEPS);
+	if (ret != EPKG_OK)
+		return (ret);
+
+	pkg = *pkg_p;
+	if ((pkg->flags & PKG_LOAD_RDEPS) == 0) {
+		k = kh_get_pkg_deps(bit->rdeps, pkg->uid);
+		if (k != kh_end(bit->rdeps)) {
+			LL_FOREACH(kh_value(bit->rdeps, k), d)
+				pkg_addrdep(pkg, d->name, d->origin,
+				    d->version, false);
+		}
+		pkg->flags |= PKG_LOAD_RDEPS;
+	}
+
+	return (EPKG_OK);
 }
 
 static void
 pkg_repo_binary_it_free(struct pkg_repo_it *it)
 {
-	pkgdb_it_free(it->data);
+	struct binary_it *bit = it->data;
+
+	pkgdb_it_free(bit->it);
+	binary_rdeps_free(bit->rdeps);
+	free(bit);
 	free(it);
 }
 
 static void
 pkg_repo_binary_it_reset(struct pkg_repo_it *it)
 {
-	pkgdb_it_reset(it->data);
+	struct binary_it *bit = it->data;
+
+	pkgdb_it_reset(bit->it);
 }
 
 struct pkg_repo_it *
@@ -100,8 +195,10 @@ pkg_repo_binary_query(struct pkg_repo *repo, const char *pattern, match_t match)
 {
 	sqlite3 *sqlite = PRIV_GET(repo);
 	sqlite3_stmt	*stmt = NULL;
+	struct pkg_repo_it *it;
 	UT_string	*sql = NULL;
 	const char	*comp = NULL;
+	char		*range;
 	int		 ret;
 	char		 basesql[BUFSIZ] = ""
 		"SELECT id, origin, name, name as uniqueid, version, comment, "
@@ -120,6 +217,12 @@ pkg_repo_binary_query(struct pkg_repo *repo, const char *pattern, match_t match)
 
 	utstring_printf(sql, basesql, repo->name);
 
+	range = pkgdb_get_pattern_range(pattern, match);
+	if (range != NULL) {
+		utstring_printf(sql, "%s", range);
+		sqlite3_free(range);
+	}
+
 	utstring_printf(sql, "%s", " ORDER BY name;");
 
 	pkg_debug(4, "Pkgdb: running '%s' query for %s", utstring_body(sql),
@@ -137,7 +240,12 @@ pkg_repo_binary_query(struct pkg_repo *repo, const char *pattern, match_t match)
 	if (match != MATCH_ALL && match != MATCH_CONDITION)
 		sqlite3_bind_text(stmt, 1, pattern, -1, SQLITE_TRANSIENT);
 
-	return (pkg_repo_binary_it_new(repo, stmt, PKGDB_IT_FLAG_ONCE));
+	it = pkg_repo_binary_it_new(repo, stmt, PKGDB_IT_FLAG_ONCE);
+	/* One pass over deps is cheaper than a lookup per package */
+	if (it != NULL && match == MATCH_ALL)
+		((struct binary_it *)it->data)->bulk_rdeps = true;
+
+	return (it);
 }
 
 struct pkg_repo_it *
@@ -415,6 +523,55 @@ pkg_repo_binary_search(struct pkg_repo *repo, const char *pattern, match_t match
 	return (pkg_repo_binary_it_new(repo, stmt, PKGDB_IT_FLAG_ONCE));
 }
 
+/*
+ * Load the files of a remote package from the imported file list, fails
+ * if the repository did not provide one
+ */
+static int
+pkg_repo_binary_load_files(sqlite3 *sqlite, struct pkg *pkg)
+{
+	const char sql[] = ""
+		"SELECT path FROM files WHERE package_id = ?1;";
+	const char any_sql[] = ""
+		"SELECT 1 FROM files LIMIT 1;";
+	sqlite3_stmt *stmt;
+	int ret, nfiles = 0;
+
+	pkg_debug(4, "Pkgdb: running '%s'", sql);
+	if (sqlite3_prepare_v2(sqlite, sql, -1, &stmt, NULL) != SQLITE_OK) {
+		ERROR_SQLITE(sqlite, sql);
+		return (EPKG_FATAL);
+	}
+	sqlite3_bind_int64(stmt, 1, pkg->id);
+	while ((ret = sqlite3_step(stmt)) == SQLITE_ROW) {
+		pkg_addfile(pkg, sqlite3_column_text(stmt, 0), NULL, false);
+		nfiles++;
+	}
+	sqlite3_finalize(stmt);
+	if (ret != SQLITE_DONE) {
+		pkg_list_free(pkg, PKG_FILES);
+		ERROR_SQLITE(sqlite, sql);
+		return (EPKG_FATAL);
+	}
+
+	/* A package without files, or no list at all */
+	if (nfiles == 0) {
+		if (sqlite3_prepare_v2(sqlite, any_sql, -1, &stmt, NULL)
+		    != SQLITE_OK) {
+			ERROR_SQLITE(sqlite, any_sql);
+			return (EPKG_FATAL);
+		}
+		ret = sqlite3_step(stmt);
+		sqlite3_finalize(stmt);
+		if (ret != SQLITE_ROW)
+			return (EPKG_FATAL);
+	}
+
+	pkg->flags |= PKG_LOAD_FILES;
+
+	return (EPKG_OK);
+}
+
 int
 pkg_repo_binary_ensure_loaded(struct pkg_repo *repo,
 	struct pkg *pkg, unsigned flags)
@@ -423,10 +580,13 @@ pkg_repo_binary_ensure_loaded(struct pkg_repo *repo,
 	struct pkg_manifest_key *keys = NULL;
 	struct pkg *cached = NULL;
 	char path[MAXPATHLEN];
+	unsigned missing;
 
-	if (pkg->type != PKG_INSTALLED &&
-			(flags & (PKG_LOAD_FILES|PKG_LOAD_DIRS)) != 0 &&
-			(pkg->flags & (PKG_LOAD_FILES|PKG_LOAD_DIRS)) == 0) {
+	/* The file list only has files, directories need the package */
+	missing = flags & ~pkg->flags & (PKG_LOAD_FILES|PKG_LOAD_DIRS);
+	if (pkg->type != PKG_INSTALLED && missing != 0 &&
+			(missing != PKG_LOAD_FILES ||
+			pkg_repo_binary_load_files(sqlite, pkg) != EPKG_OK)) {
 		/*
 		 * Try to get that information from fetched package in cache
 		 */
@@ -511,3 +671,67 @@ out:
 
 	return (stats);
 }
+
+int
+pkg_repo_binary_digests(struct pkg_repo *repo, pkg_repo_digest_cb cb, void *ud)
+{
+	sqlite3 *sqlite = PRIV_GET(repo);
+	sqlite3_stmt *stmt;
+	const char sql[] = "SELECT name, manifestdigest FROM main.packages;";
+	int ret;
+
+	pkg_debug(4, "binary_repo: running '%s'", sql);
+	if (sqlite3_prepare_v2(sqlite, sql, -1, &stmt, NULL) != SQLITE_OK) {
+		ERROR_SQLITE(sqlite, sql);
+		return (EPKG_FATAL);
+	}
+
+	while ((ret = sqlite3_step(stmt)) == SQLITE_ROW) {
+		if (cb((const char *)sqlite3_column_text(stmt, 0),
+		    (const char *)sqlite3_column_text(stmt, 1), ud) != EPKG_OK)
+			break;
+	}
+	if (ret != SQLITE_ROW && ret != SQLITE_DONE) {
+		ERROR_SQLITE(sqlite, sql);
+		sqlite3_finalize(stmt);
+		return (EPKG_FATAL);
+	}
+	sqlite3_finalize(stmt);
+
+	return (EPKG_OK);
+}
+
+int
+pkg_repo_binary_rdeps(struct pkg_repo *repo, pkg_repo_rdep_cb cb, void *ud)
+{
+	sqlite3 *sqlite = PRIV_GET(repo);
+	sqlite3_stmt *stmt;
+	const char sql[] = ""
+		"SELECT d.name, p.name, p.origin, p.version"
+		"  FROM main.deps AS d"
+		"    INNER JOIN main.packages AS p ON (p.id = d.package_id)"
+		"  WHERE d.name IS NOT NULL;";
+	int ret;
+
+	pkg_debug(4, "binary_repo: running '%s'", sql);
+	if (sqlite3_prepare_v2(sqlite, sql, -1, &stmt, NULL) != SQLITE_OK) {
+		ERROR_SQLITE(sqlite, sql);
+		return (EPKG_FATAL);
+	}
+
+	while ((ret = sqlite3_step(stmt)) == SQLITE_ROW) {
+		if (cb((const char *)sqlite3_column_text(stmt, 0),
+		    (const char *)sqlite3_column_text(stmt, 1),
+		    (const char *)sqlite3_column_text(stmt, 2),
+		    (const char *)sqlite3_column_text(stmt, 3), ud) != EPKG_OK)
+			break;
+	}
+	if (ret != SQLITE_ROW && ret != SQLITE_DONE) {
+		ERROR_SQLITE(sqlite, sql);
+		sqlite3_finalize(stmt);
+		return (EPKG_FATAL);
+	}
+	sqlite3_finalize(stmt);
+
+	return (EPKG_OK);
+}
@@ -405,6 +405,231 @@ cleanup:
 	return (rc);
 }
 
+/*
+ * Import the repository file list so that conflicts between remote
+ * packages can be found before fetching them.  The table is left empty
+ * on failure: a partial list would hide conflicts.
+ */
+static int
+pkg_repo_binary_add_filelist(struct pkg_repo *repo, sqlite3 *sqlite)
+{
+	const char pkg_id_sql[] = ""
+		"SELECT id FROM packages WHERE name = ?1 AND version = ?2;";
+	const char file_sql[] = ""
+		"INSERT INTO files (package_id, path) VALUES (?1, ?2);";
+	sqlite3_stmt *id_stmt = NULL, *file_stmt = NULL;
+	struct pkg *pkg = NULL;
+	struct pkg_file *file;
+	FILE *f = NULL;
+	char *line = NULL;
+	size_t linecap = 0, len = 0;
+	ssize_t linelen;
+	time_t t = 0;
+	int64_t id, nfiles = 0;
+	int fd, rc = EPKG_FATAL;
+
+	fd = pkg_repo_fetch_remote_extract_fd(repo, repo->meta->filesite, &t,
+	    &rc, &len);
+	if (fd == -1)
+		return (rc);
+	if ((f = fdopen(fd, "r")) == NULL) {
+		pkg_emit_errno("fdopen", repo->meta->filesite);
+		close(fd);
+		return (EPKG_FATAL);
+	}
+	rewind(f);
+
+	pkg_debug(4, "Pkgrepo: running '%s'", pkg_id_sql);
+	if (sqlite3_prepare_v2(sqlite, pkg_id_sql, -1, &id_stmt, NULL)
+	    != SQLITE_OK) {
+		ERROR_SQLITE(sqlite, pkg_id_sql);
+		rc = EPKG_FATAL;
+		goto cleanup;
+	}
+	pkg_debug(4, "Pkgrepo: running '%s'", file_sql);
+	if (sqlite3_prepare_v2(sqlite, file_sql, -1, &file_stmt, NULL)
+	    != SQLITE_OK) {
+		ERROR_SQLITE(sqlite, file_sql);
+		rc = EPKG_FATAL;
+		goto cleanup;
+	}
+
+	rc = EPKG_OK;
+	while (rc == EPKG_OK && (linelen = getline(&line, &linecap, f)) > 0) {
+		pkg_free(pkg);
+		pkg = NULL;
+		pkg_new(&pkg, PKG_REMOTE);
+		if ((rc = pkg_parse_filelist(pkg, line, linelen)) != EPKG_OK)
+			break;
+
+		sqlite3_bind_text(id_stmt, 1, pkg->name, -1, SQLITE_STATIC);
+		sqlite3_bind_text(id_stmt, 2, pkg->version, -1, SQLITE_STATIC);
+		id = -1;
+		if (sqlite3_step(id_stmt) == SQLITE_ROW)
+			id = sqlite3_column_int64(id_stmt, 0);
+		sqlite3_reset(id_stmt);
+		/* Not in the catalogue, nothing can install it */
+		if (id == -1)
+			continue;
+
+		LL_FOREACH(pkg->files, file) {
+			sqlite3_bind_int64(file_stmt, 1, id);
+			sqlite3_bind_text(file_stmt, 2, file->path, -1,
+			    SQLITE_STATIC);
+			if (sqlite3_step(file_stmt) != SQLITE_DONE) {
+				ERROR_SQLITE(sqlite, file_sql);
+				rc = EPKG_FATAL;
+				break;
+			}
+			sqlite3_reset(file_stmt);
+			nfiles++;
+		}
+	}
+
+cleanup:
+	if (rc != EPKG_OK)
+		sql_exec(sqlite, "DELETE FROM files;");
+	else
+		pkg_debug(1, "Pkgrepo: imported %jd files for '%s'",
+		    (intmax_t)nfiles, repo->name);
+	if (id_stmt != NULL)
+		sqlite3_finalize(id_stmt);
+	if (file_stmt != NULL)
+		sqlite3_finalize(file_stmt);
+	pkg_free(pkg);
+	free(line);
+	fclose(f);
+
+	return (rc);
+}
+
+/*
+ * Import the deltas the repository publishes so that upgrades can be
+ * fetched as a delta against a version already cached or installed.
+ * Each line of the deltasite is an object describing one delta.
+ */
+static int
+pkg_repo_binary_add_deltas(struct pkg_repo *repo, sqlite3 *sqlite)
+{
+	const char pkg_id_sql[] = ""
+		"SELECT id FROM packages WHERE name = ?1 AND version = ?2;";
+	const char delta_sql[] = ""
+		"INSERT INTO deltas (package_id, basever, basesum, path, sum, "
+		"pkgsize) VALUES (?1, ?2, ?3, ?4, ?5, ?6);";
+	static const char *keys[] = { "name", "version", "basever", "basesum",
+	    "path", "sum" };
+	const char *val[sizeof(keys) / sizeof(keys[0])];
+	sqlite3_stmt *id_stmt = NULL, *delta_stmt = NULL;
+	struct ucl_parser *p;
+	ucl_object_t *obj;
+	const ucl_object_t *o;
+	FILE *f = NULL;
+	char *line = NULL;
+	size_t linecap = 0, len = 0, i;
+	ssize_t linelen;
+	time_t t = 0;
+	int64_t id, ndeltas = 0;
+	int fd, rc = EPKG_FATAL;
+
+	fd = pkg_repo_fetch_remote_extract_fd(repo, repo->meta->deltasite, &t,
+	    &rc, &len);
+	if (fd == -1)
+		return (rc);
+	if ((f = fdopen(fd, "r")) == NULL) {
+		pkg_emit_errno("fdopen", repo->meta->deltasite);
+		close(fd);
+		return (EPKG_FATAL);
+	}
+	rewind(f);
+
+	pkg_debug(4, "Pkgrepo: running '%s'", pkg_id_sql);
+	if (sqlite3_prepare_v2(sqlite, pkg_id_sql, -1, &id_stmt, NULL)
+	    != SQLITE_OK) {
+		ERROR_SQLITE(sqlite, pkg_id_sql);
+		rc = EPKG_FATAL;
+		goto cleanup;
+	}
+	pkg_debug(4, "Pkgrepo: running '%s'", delta_sql);
+	if (sqlite3_prepare_v2(sqlite, delta_sql, -1, &delta_stmt, NULL)
+	    != SQLITE_OK) {
+		ERROR_SQLITE(sqlite, delta_sql);
+		rc = EPKG_FATAL;
+		goto cleanup;
+	}
+
+	rc = EPKG_OK;
+	while (rc == EPKG_OK && (linelen = getline(&line, &linecap, f)) > 0) {
+		p = ucl_parser_new(UCL_PARSER_NO_FILEVARS);
+		if (!ucl_parser_add_chunk(p, (const unsigned char *)line,
+		    linelen) || (obj = ucl_parser_get_object(p)) == NULL) {
+			pkg_emit_error("Invalid delta entry: %s",
+			    ucl_parser_get_error(p));
+			ucl_parser_free(p);
+			rc = EPKG_FATAL;
+			break;
+		}
+		ucl_parser_free(p);
+
+		for (i = 0; i < sizeof(keys) / sizeof(keys[0]); i++) {
+			o = ucl_object_find_key(obj, keys[i]);
+			if (o == NULL || o->type != UCL_STRING)
+				break;
+			val[i] = ucl_object_tostring(o);
+		}
+		o = ucl_object_find_key(obj, "pkgsize");
+		if (i < sizeof(keys) / sizeof(keys[0]) || o == NULL ||
+		    o->type != UCL_INT) {
+			pkg_emit_error("Invalid delta entry: missing %s",
+			    i < sizeof(keys) / sizeof(keys[0]) ? keys[i] :
+			    "pkgsize");
+			ucl_object_unref(obj);
+			rc = EPKG_FATAL;
+			break;
+		}
+
+		sqlite3_bind_text(id_stmt, 1, val[0], -1, SQLITE_STATIC);
+		sqlite3_bind_text(id_stmt, 2, val[1], -1, SQLITE_STATIC);
+		id = -1;
+		if (sqlite3_step(id_stmt) == SQLITE_ROW)
+			id = sqlite3_column_int64(id_stmt, 0);
+		sqlite3_reset(id_stmt);
+		/* Not in the catalogue, nothing can install it */
+		if (id == -1) {
+			ucl_object_unref(obj);
+			continue;
+		}
+
+		sqlite3_bind_int64(delta_stmt, 1, id);
+		for (i = 2; i < sizeof(keys) / sizeof(keys[0]); i++)
+			sqlite3_bind_text(delta_stmt, i, val[i], -1,
+			    SQLITE_STATIC);
+		sqlite3_bind_int64(delta_stmt, 6, ucl_object_toint(o));
+		if (sqlite3_step(delta_stmt) != SQLITE_DONE) {
+			ERROR_SQLITE(sqlite, delta_sql);
+			rc = EPKG_FATAL;
+		} else {
+			ndeltas++;
+		}
+		sqlite3_reset(delta_stmt);
+		ucl_object_unref(obj);
+	}
+
+cleanup:
+	if (rc != EPKG_OK)
+		sql_exec(sqlite, "DELETE FROM deltas;");
+	else
+		pkg_debug(1, "Pkgrepo: imported %jd deltas for '%s'",
+		    (intmax_t)ndeltas, repo->name);
+	if (id_stmt != NULL)
+		sqlite3_finalize(id_stmt);
+	if (delta_stmt != NULL)
+		sqlite3_finalize(delta_stmt);
+	free(line);
+	fclose(f);
+
+	return (rc);
+}
+
 static void __unused
 pkg_repo_binary_parse_conflicts(FILE *f, sqlite3 *sqlite)
 {
@@ -526,8 +751,10 @@ pkg_repo_binary_update_proceed(const char *name, struct pkg_repo *repo,
 		goto cleanup;
 
 	in_trans = true;
+	pkg_trace_begin("catalogue", repo->name);
 	while ((linelen = getline(&line, &linecap, f)) > 0) {
 		cnt++;
+		pkg_trace_count(PKG_TRACE_ROWS, 1);
 		totallen += linelen;
 		if ((cnt % 10 ) == 0)
 			pkg_emit_progress_tick(totallen, len);
@@ -550,9 +777,27 @@ pkg_repo_binary_update_proceed(const char *name, struct pkg_repo *repo,
 	"CREATE INDEX packages_version_nocase ON packages(name COLLATE NOCASE, version);"
 	"CREATE INDEX packages_uid ON packages(name, origin);"
 	"CREATE INDEX packages_version ON packages(name, version);"
+	"CREATE INDEX packages_namever ON packages((name || '-' || version) COLLATE NOCASE);"
 	"CREATE UNIQUE INDEX packages_digest ON packages(manifestdigest);"
+	"CREATE INDEX deps_name ON deps(name);"
+	"CREATE INDEX provides_provide ON provides(provide);"
+	"CREATE INDEX pkg_provides_provide ON pkg_provides(provide_id);"
+	"CREATE INDEX requires_require ON requires(require);"
+	"CREATE INDEX pkg_requires_require ON pkg_requires(require_id);"
 	 );
 
+	if (rc == EPKG_OK && repo->meta->filelist &&
+	    pkg_object_bool(pkg_config_get("REPO_FILELIST")) &&
+	    pkg_repo_binary_add_filelist(repo, sqlite) != EPKG_OK)
+		pkg_emit_notice("Unable to import the file list of repository "
+		    "%s, conflicts will be checked after fetching", repo->name);
+	if (rc == EPKG_OK && repo->meta->deltas &&
+	    pkg_object_bool(pkg_config_get("REPO_DELTAS")) &&
+	    pkg_repo_binary_add_deltas(repo, sqlite) != EPKG_OK)
+		pkg_emit_notice("Unable to import the deltas of repository "
+		    "%s, packages will be fetched in full", repo->name);
+	pkg_trace_end();
+
 cleanup:
 
 	if (in_trans) {
@@ -628,7 +873,9 @@ pkg_repo_binary_update(struct pkg_repo *repo, bool force)
 		}
 	}
 
+	pkg_trace_begin("update", pkg_repo_name(repo));
 	res = pkg_repo_binary_update_proceed(filepath, repo, &t, force);
+	pkg_trace_end();
 	if (res != EPKG_OK && res != EPKG_UPTODATE) {
 		pkg_emit_notice("Unable to update repository %s", repo->name);
 		goto cleanup;
@@ -664,5 +911,9 @@ cleanup:
 	if (repo->priv != NULL)
 		repo->ops->close(repo, false);
 
+	/* The database has been checked, or created, by this update */
+	if (res == EPKG_OK || res == EPKG_UPTODATE)
+		pkg_repo_binary_stamp(repo);
+
 	return (res);
 }
@@ -86,13 +86,36 @@ _load_rsa_public_key_buf(unsigned char *cert, int certlen)
 	return (rsa);
 }
 
+/*
+ * Copied as is to the sandbox worker: the key, NUL terminated, is followed
+ * by the signature in data.
+ */
 struct rsa_verify_cbdata {
-	unsigned char *key;
 	size_t keylen;
-	unsigned char *sig;
 	size_t siglen;
+	unsigned char data[];
 };
 
+#define RSA_CBDATA_KEY(cb)	((cb)->data)
+#define RSA_CBDATA_SIG(cb)	((cb)->data + (cb)->keylen + 1)
+
+static struct rsa_verify_cbdata *
+rsa_verify_cbdata_new(const unsigned char *key, size_t keylen,
+    const unsigned char *sig, size_t siglen, size_t *len)
+{
+	struct rsa_verify_cbdata *cbdata;
+
+	*len = sizeof(*cbdata) + keylen + 1 + siglen;
+	cbdata = xmalloc(*len);
+	cbdata->keylen = keylen;
+	cbdata->siglen = siglen;
+	memcpy(RSA_CBDATA_KEY(cbdata), key, keylen);
+	RSA_CBDATA_KEY(cbdata)[keylen] = '\0';
+	memcpy(RSA_CBDATA_SIG(cbdata), sig, siglen);
+
+	return (cbdata);
+}
+
 static int
 rsa_verify_cert_cb(int fd, void *ud)
 {
@@ -111,13 +134,13 @@ rsa_verify_cert_cb(int fd, void *ud)
 	    PKG_HASH_TYPE_SHA256_RAW);
 	free(sha256);
 
-	rsa = _load_rsa_public_key_buf(cbdata->key, cbdata->keylen);
+	rsa = _load_rsa_public_key_buf(RSA_CBDATA_KEY(cbdata), cbdata->keylen);
 	if (rsa == NULL) {
 		free(hash);
 		return (EPKG_FATAL);
 	}
 	ret = RSA_verify(NID_sha256, hash,
-	    pkg_checksum_type_size(PKG_HASH_TYPE_SHA256_RAW), cbdata->sig,
+	    pkg_checksum_type_size(PKG_HASH_TYPE_SHA256_RAW), RSA_CBDATA_SIG(cbdata),
 	    cbdata->siglen, rsa);
 	free(hash);
 	if (ret == 0) {
@@ -138,23 +161,25 @@ rsa_verify_cert(unsigned char *key, int keylen,
 {
 	int ret;
 	bool need_close = false;
-	struct rsa_verify_cbdata cbdata;
+	struct rsa_verify_cbdata *cbdata;
+	size_t len;
 
 	(void)lseek(fd, 0, SEEK_SET);
 
-	cbdata.key = key;
-	cbdata.keylen = keylen;
-	cbdata.sig = sig;
-	cbdata.siglen = siglen;
+	cbdata = rsa_verify_cbdata_new(key, keylen, sig, siglen, &len);
 
 	SSL_load_error_strings();
 	OpenSSL_add_all_algorithms();
 	OpenSSL_add_all_ciphers();
 
-	ret = pkg_emit_sandbox_call(rsa_verify_cert_cb, fd, &cbdata);
+	pkg_trace_begin("verify", NULL);
+	ret = pkg_sandbox_call(rsa_verify_cert_cb, fd, cbdata, len, 0);
+	pkg_trace_end();
 	if (need_close)
 		close(fd);
 
+	free(cbdata);
+
 	return (ret);
 }
 
@@ -171,18 +196,18 @@ rsa_verify_cb(int fd, void *ud)
 	if (sha256 == NULL)
 		return (EPKG_FATAL);
 
-	rsa = _load_rsa_public_key_buf(cbdata->key, cbdata->keylen);
+	rsa = _load_rsa_public_key_buf(RSA_CBDATA_KEY(cbdata), cbdata->keylen);
 	if (rsa == NULL) {
 		free(sha256);
 		return(EPKG_FATAL);
 	}
 
 	ret = RSA_verify(NID_sha1, sha256,
-	    pkg_checksum_type_size(PKG_HASH_TYPE_SHA256_HEX), cbdata->sig,
+	    pkg_checksum_type_size(PKG_HASH_TYPE_SHA256_HEX), RSA_CBDATA_SIG(cbdata),
 	    cbdata->siglen, rsa);
 	free(sha256);
 	if (ret == 0) {
-		pkg_emit_error("%s: %s", cbdata->key,
+		pkg_emit_error("%s: %s", RSA_CBDATA_KEY(cbdata),
 		    ERR_error_string(ERR_get_error(), errbuf));
 		RSA_free(rsa);
 		return (EPKG_FATAL);
@@ -198,9 +223,10 @@ rsa_verify(const char *key, unsigned char *sig, unsigned int sig_len, int fd)
 {
 	int ret;
 	bool need_close = false;
-	struct rsa_verify_cbdata cbdata;
+	struct rsa_verify_cbdata *cbdata;
 	char *key_buf;
 	off_t key_len;
+	size_t len;
 
 	if (file_to_buffer(key, (char**)&key_buf, &key_len) != EPKG_OK) {
 		pkg_emit_errno("rsa_verify", "cannot read key");
@@ -209,19 +235,20 @@ rsa_verify(const char *key, unsigned char *sig, unsigned int sig_len, int fd)
 
 	(void)lseek(fd, 0, SEEK_SET);
 
-	cbdata.key = key_buf;
-	cbdata.keylen = key_len;
-	cbdata.sig = sig;
-	cbdata.siglen = sig_len;
+	cbdata = rsa_verify_cbdata_new((unsigned char *)key_buf, key_len, sig,
+	    sig_len, &len);
 
 	SSL_load_error_strings();
 	OpenSSL_add_all_algorithms();
 	OpenSSL_add_all_ciphers();
 
-	ret = pkg_emit_sandbox_call(rsa_verify_cb, fd, &cbdata);
+	pkg_trace_begin("verify", key);
+	ret = pkg_sandbox_call(rsa_verify_cb, fd, cbdata, len, 0);
+	pkg_trace_end();
 	if (need_close)
 		close(fd);
 
+	free(cbdata);
 	free(key_buf);
 
 	return (ret);
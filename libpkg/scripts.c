@@ -63,6 +63,7 @@ pkg_script_run(struct pkg * const pkg, pkg_script type)
 	posix_spawn_file_actions_t action;
 	bool use_pipe = 0;
 	bool debug = false;
+	bool traced = false;
 	ssize_t bytes_written;
 	size_t script_cmd_len;
 	long argmax;
@@ -164,6 +165,8 @@ pkg_script_run(struct pkg * const pkg, pkg_script type)
 				use_pipe = 0;
 			}
 
+			pkg_trace_begin("script", map[i].arg);
+			traced = true;
 			if ((error = posix_spawn(&pid, _PATH_BSHELL,
 			    use_pipe ? &action : NULL,
 			    NULL, __DECONST(char **, argv),
@@ -202,11 +205,15 @@ pkg_script_run(struct pkg * const pkg, pkg_script type)
 				ret = EPKG_FATAL;
 				goto cleanup;
 			}
+			pkg_trace_end();
+			traced = false;
 		}
 	}
 
 cleanup:
 
+	if (traced)
+		pkg_trace_end();
 	utstring_free(script_cmd);
 	if (stdin_pipe[0] != -1)
 		close(stdin_pipe[0]);
@@ -13,10 +13,40 @@
 *********************************************************************/
 
 /*************************** HEADER FILES ***************************/
+#ifdef HAVE_CONFIG_H
+#include "pkg_config.h"
+#endif
 #include <stdlib.h>
+#include <stdint.h>
 #include <memory.h>
+#include <string.h>
 #include "sha256.h"
 
+/*
+ * Accelerated transforms, picked at runtime by checking the CPU: SHA
+ * extensions on x86 and the ARMv8 cryptographic extensions on aarch64.
+ * The portable code below stays the reference and the fallback.
+ */
+#if (defined(__x86_64__) || defined(__i386__)) && defined(HAVE_CPUID_H) && \
+    (defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 5))
+#define SHA256_X86_SHANI
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__) && defined(HAVE_SYS_AUXV_H) && \
+    (defined(HAVE_GETAUXVAL) || defined(HAVE_ELF_AUX_INFO)) && \
+    (defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 6))
+#include <sys/auxv.h>
+#ifdef __linux__
+#include <asm/hwcap.h>
+#endif
+#ifdef HWCAP_SHA2
+#define SHA256_ARMV8_CE
+#include <arm_neon.h>
+#endif
+#endif
+
 /****************************** MACROS ******************************/
 #define ROTLEFT(a,b) (((a) << (b)) | ((a) >> (32-(b))))
 #define ROTRIGHT(a,b) (((a) >> (b)) | ((a) << (32-(b))))
@@ -41,45 +71,277 @@ static const WORD k[64] = {
 };
 
 /*********************** FUNCTION DEFINITIONS ***********************/
-void sha256_transform(SHA256_CTX *ctx, const BYTE data[])
+typedef void (*sha256_transform_fn)(WORD state[8], const BYTE data[],
+    size_t nblocks);
+
+static void sha256_transform_c(WORD state[8], const BYTE data[], size_t nblocks)
 {
 	WORD a, b, c, d, e, f, g, h, i, j, t1, t2, m[64];
 
-	for (i = 0, j = 0; i < 16; ++i, j += 4)
-		m[i] = (data[j] << 24) | (data[j + 1] << 16) | (data[j + 2] << 8) | (data[j + 3]);
-	for ( ; i < 64; ++i)
-		m[i] = SIG1(m[i - 2]) + m[i - 7] + SIG0(m[i - 15]) + m[i - 16];
-
-	a = ctx->state[0];
-	b = ctx->state[1];
-	c = ctx->state[2];
-	d = ctx->state[3];
-	e = ctx->state[4];
-	f = ctx->state[5];
-	g = ctx->state[6];
-	h = ctx->state[7];
-
-	for (i = 0; i < 64; ++i) {
-		t1 = h + EP1(e) + CH(e,f,g) + k[i] + m[i];
-		t2 = EP0(a) + MAJ(a,b,c);
-		h = g;
-		g = f;
-		f = e;
-		e = d + t1;
-		d = c;
-		c = b;
-		b = a;
-		a = t1 + t2;
+	for (; nblocks > 0; nblocks--, data += 64) {
+		for (i = 0, j = 0; i < 16; ++i, j += 4)
+			m[i] = (data[j] << 24) | (data[j + 1] << 16) | (data[j + 2] << 8) | (data[j + 3]);
+		for ( ; i < 64; ++i)
+			m[i] = SIG1(m[i - 2]) + m[i - 7] + SIG0(m[i - 15]) + m[i - 16];
+
+		a = state[0];
+		b = state[1];
+		c = state[2];
+		d = state[3];
+		e = state[4];
+		f = state[5];
+		g = state[6];
+		h = state[7];
+
+		for (i = 0; i < 64; ++i) {
+			t1 = h + EP1(e) + CH(e,f,g) + k[i] + m[i];
+			t2 = EP0(a) + MAJ(a,b,c);
+			h = g;
+			g = f;
+			f = e;
+			e = d + t1;
+			d = c;
+			c = b;
+			b = a;
+			a = t1 + t2;
+		}
+
+		state[0] += a;
+		state[1] += b;
+		state[2] += c;
+		state[3] += d;
+		state[4] += e;
+		state[5] += f;
+		state[6] += g;
+		state[7] += h;
+	}
+}
+
+#ifdef SHA256_X86_SHANI
+static int sha256_has_shani(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return (0);
+	/* SSSE3 and SSE4.1 are needed for the byte shuffles and blends */
+	if ((ecx & (1U << 9)) == 0 || (ecx & (1U << 19)) == 0)
+		return (0);
+	if (__get_cpuid_max(0, NULL) < 7)
+		return (0);
+	__cpuid_count(7, 0, eax, ebx, ecx, edx);
+
+	return ((ebx & (1U << 29)) != 0);
+}
+
+/* W[t..t+3] from the 16 previous words, held in w0 (oldest) to w3 */
+#define SHANI_SCHEDULE(w0, w1, w2, w3) do {				\
+	w0 = _mm_add_epi32(_mm_sha256msg1_epu32(w0, w1),		\
+	    _mm_alignr_epi8(w3, w2, 4));				\
+	w0 = _mm_sha256msg2_epu32(w0, w3);				\
+} while (0)
+
+#define SHANI_ROUNDS(w, i) do {						\
+	msg = _mm_add_epi32(w, _mm_loadu_si128((const __m128i *)&k[4 * (i)])); \
+	state1 = _mm_sha256rnds2_epu32(state1, state0, msg);		\
+	msg = _mm_shuffle_epi32(msg, 0x0E);				\
+	state0 = _mm_sha256rnds2_epu32(state0, state1, msg);		\
+} while (0)
+
+__attribute__((target("sha,ssse3,sse4.1")))
+static void sha256_transform_shani(WORD state[8], const BYTE data[], size_t nblocks)
+{
+	const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL,
+	    0x0405060700010203ULL);
+	__m128i state0, state1, abef, cdgh, msg, tmp, w0, w1, w2, w3;
+	int i;
+
+	/* The instructions want the state as ABEF/CDGH */
+	tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[0]), 0xB1);
+	state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[4]), 0x1B);
+	state0 = _mm_alignr_epi8(tmp, state1, 8);
+	state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+
+	for (; nblocks > 0; nblocks--, data += 64) {
+		abef = state0;
+		cdgh = state1;
+
+		w0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 0)), mask);
+		w1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 16)), mask);
+		w2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 32)), mask);
+		w3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 48)), mask);
+
+		SHANI_ROUNDS(w0, 0);
+		SHANI_ROUNDS(w1, 1);
+		SHANI_ROUNDS(w2, 2);
+		SHANI_ROUNDS(w3, 3);
+		for (i = 4; i < 16; i += 4) {
+			SHANI_SCHEDULE(w0, w1, w2, w3);
+			SHANI_ROUNDS(w0, i);
+			SHANI_SCHEDULE(w1, w2, w3, w0);
+			SHANI_ROUNDS(w1, i + 1);
+			SHANI_SCHEDULE(w2, w3, w0, w1);
+			SHANI_ROUNDS(w2, i + 2);
+			SHANI_SCHEDULE(w3, w0, w1, w2);
+			SHANI_ROUNDS(w3, i + 3);
+		}
+
+		state0 = _mm_add_epi32(state0, abef);
+		state1 = _mm_add_epi32(state1, cdgh);
 	}
 
-	ctx->state[0] += a;
-	ctx->state[1] += b;
-	ctx->state[2] += c;
-	ctx->state[3] += d;
-	ctx->state[4] += e;
-	ctx->state[5] += f;
-	ctx->state[6] += g;
-	ctx->state[7] += h;
+	tmp = _mm_shuffle_epi32(state0, 0x1B);
+	state1 = _mm_shuffle_epi32(state1, 0xB1);
+	state0 = _mm_blend_epi16(tmp, state1, 0xF0);
+	state1 = _mm_alignr_epi8(state1, tmp, 8);
+	_mm_storeu_si128((__m128i *)&state[0], state0);
+	_mm_storeu_si128((__m128i *)&state[4], state1);
+}
+#endif
+
+#ifdef SHA256_ARMV8_CE
+static int sha256_has_armv8_ce(void)
+{
+	unsigned long hwcap = 0;
+
+#ifdef HAVE_GETAUXVAL
+	hwcap = getauxval(AT_HWCAP);
+#else
+	if (elf_aux_info(AT_HWCAP, &hwcap, sizeof(hwcap)) != 0)
+		return (0);
+#endif
+
+	return ((hwcap & HWCAP_SHA2) != 0);
+}
+
+/* W[t..t+3] from the 16 previous words, held in w0 (oldest) to w3 */
+#define ARMV8_SCHEDULE(w0, w1, w2, w3)					\
+	w0 = vsha256su1q_u32(vsha256su0q_u32(w0, w1), w2, w3)
+
+#define ARMV8_ROUNDS(w, i) do {						\
+	msg = vaddq_u32(w, vld1q_u32(&k[4 * (i)]));			\
+	tmp = state0;							\
+	state0 = vsha256hq_u32(state0, state1, msg);			\
+	state1 = vsha256h2q_u32(state1, tmp, msg);			\
+} while (0)
+
+#ifdef __clang__
+__attribute__((target("crypto")))
+#else
+__attribute__((target("+crypto")))
+#endif
+static void sha256_transform_armv8(WORD state[8], const BYTE data[], size_t nblocks)
+{
+	uint32x4_t state0, state1, abcd, efgh, msg, tmp, w0, w1, w2, w3;
+	int i;
+
+	state0 = vld1q_u32(&state[0]);
+	state1 = vld1q_u32(&state[4]);
+
+	for (; nblocks > 0; nblocks--, data += 64) {
+		abcd = state0;
+		efgh = state1;
+
+		w0 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 0)));
+		w1 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 16)));
+		w2 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 32)));
+		w3 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 48)));
+
+		ARMV8_ROUNDS(w0, 0);
+		ARMV8_ROUNDS(w1, 1);
+		ARMV8_ROUNDS(w2, 2);
+		ARMV8_ROUNDS(w3, 3);
+		for (i = 4; i < 16; i += 4) {
+			ARMV8_SCHEDULE(w0, w1, w2, w3);
+			ARMV8_ROUNDS(w0, i);
+			ARMV8_SCHEDULE(w1, w2, w3, w0);
+			ARMV8_ROUNDS(w1, i + 1);
+			ARMV8_SCHEDULE(w2, w3, w0, w1);
+			ARMV8_ROUNDS(w2, i + 2);
+			ARMV8_SCHEDULE(w3, w0, w1, w2);
+			ARMV8_ROUNDS(w3, i + 3);
+		}
+
+		state0 = vaddq_u32(state0, abcd);
+		state1 = vaddq_u32(state1, efgh);
+	}
+
+	vst1q_u32(&state[0], state0);
+	vst1q_u32(&state[4], state1);
+}
+#endif
+
+static const struct sha256_backend {
+	const char *name;
+	sha256_transform_fn transform;
+	int (*supported)(void);
+} backends[] = {
+#ifdef SHA256_X86_SHANI
+	{ "shani", sha256_transform_shani, sha256_has_shani },
+#endif
+#ifdef SHA256_ARMV8_CE
+	{ "armv8", sha256_transform_armv8, sha256_has_armv8_ce },
+#endif
+	{ "c", sha256_transform_c, NULL },
+};
+
+#define NBACKENDS (sizeof(backends) / sizeof(backends[0]))
+
+static const struct sha256_backend *backend = NULL;
+
+static void sha256_transform(WORD state[8], const BYTE data[], size_t nblocks)
+{
+	size_t i;
+
+	/* The first backend the cpu supports is the fastest one */
+	if (backend == NULL) {
+		for (i = 0; i < NBACKENDS; i++) {
+			if (backends[i].supported == NULL ||
+			    backends[i].supported())
+				break;
+		}
+		backend = &backends[i];
+	}
+
+	backend->transform(state, data, nblocks);
+}
+
+const char *sha256_backend_name(size_t idx)
+{
+	size_t i;
+
+	for (i = 0; i < NBACKENDS; i++) {
+		if (backends[i].supported != NULL && !backends[i].supported())
+			continue;
+		if (idx-- == 0)
+			return (backends[i].name);
+	}
+
+	return (NULL);
+}
+
+int sha256_backend_select(const char *name)
+{
+	size_t i;
+
+	for (i = 0; i < NBACKENDS; i++) {
+		if (strcmp(backends[i].name, name) != 0)
+			continue;
+		if (backends[i].supported != NULL && !backends[i].supported())
+			return (-1);
+		backend = &backends[i];
+		return (0);
+	}
+
+	return (-1);
+}
+
+const char *sha256_backend_current(void)
+{
+	if (backend == NULL)
+		sha256_backend_select(sha256_backend_name(0));
+
+	return (backend->name);
 }
 
 void sha256_init(SHA256_CTX *ctx)
@@ -98,16 +360,36 @@ void sha256_init(SHA256_CTX *ctx)
 
 void sha256_update(SHA256_CTX *ctx, const BYTE data[], size_t len)
 {
-	WORD i;
+	size_t n;
 
-	for (i = 0; i < len; ++i) {
-		ctx->data[ctx->datalen] = data[i];
-		ctx->datalen++;
-		if (ctx->datalen == 64) {
-			sha256_transform(ctx, ctx->data);
-			ctx->bitlen += 512;
-			ctx->datalen = 0;
-		}
+	// Complete a block started by a previous call.
+	if (ctx->datalen > 0) {
+		n = 64 - ctx->datalen;
+		if (n > len)
+			n = len;
+		memcpy(ctx->data + ctx->datalen, data, n);
+		ctx->datalen += n;
+		data += n;
+		len -= n;
+		if (ctx->datalen < 64)
+			return;
+		sha256_transform(ctx->state, ctx->data, 1);
+		ctx->bitlen += 512;
+		ctx->datalen = 0;
+	}
+
+	// Hash whole blocks straight from the caller's buffer.
+	if (len >= 64) {
+		n = len / 64;
+		sha256_transform(ctx->state, data, n);
+		ctx->bitlen += 512 * (unsigned long long)n;
+		data += n * 64;
+		len -= n * 64;
+	}
+
+	if (len > 0) {
+		memcpy(ctx->data, data, len);
+		ctx->datalen = len;
 	}
 }
 
@@ -127,7 +409,7 @@ void sha256_final(SHA256_CTX *ctx, BYTE hash[])
 		ctx->data[i++] = 0x80;
 		while (i < 64)
 			ctx->data[i++] = 0x00;
-		sha256_transform(ctx, ctx->data);
+		sha256_transform(ctx->state, ctx->data, 1);
 		memset(ctx->data, 0, 56);
 	}
 
@@ -141,7 +423,7 @@ void sha256_final(SHA256_CTX *ctx, BYTE hash[])
 	ctx->data[58] = ctx->bitlen >> 40;
 	ctx->data[57] = ctx->bitlen >> 48;
 	ctx->data[56] = ctx->bitlen >> 56;
-	sha256_transform(ctx, ctx->data);
+	sha256_transform(ctx->state, ctx->data, 1);
 
 	// Since this implementation uses little endian byte ordering and SHA uses big endian,
 	// reverse all the bytes when copying the final state to the output hash.
@@ -31,4 +31,12 @@ void sha256_init(SHA256_CTX *ctx);
 void sha256_update(SHA256_CTX *ctx, const BYTE data[], size_t len);
 void sha256_final(SHA256_CTX *ctx, BYTE hash[]);
 
+/*
+ * The block transform is chosen at runtime among the backends the cpu
+ * supports, fastest first; "c" is the portable one and always available.
+ */
+const char *sha256_backend_name(size_t idx);
+int sha256_backend_select(const char *name);
+const char *sha256_backend_current(void);
+
 #endif   // SHA256_H
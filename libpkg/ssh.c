@@ -34,6 +34,12 @@
 #include <sys/types.h>
 #include <sys/param.h>
 #include <sys/stat.h>
+#ifdef HAVE_SYS_SENDFILE_H
+#include <sys/sendfile.h>
+#elif defined(__FreeBSD__)
+#include <sys/socket.h>
+#include <sys/uio.h>
+#endif
 
 #include <ctype.h>
 #include <stdlib.h>
@@ -42,24 +48,91 @@
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <errno.h>
 
 #include <bsd_compat.h>
 
 #include "pkg.h"
 #include "private/event.h"
 
+/*
+ * Send size bytes of ffd to stdout, using sendfile(2) when the platform
+ * allows it and falling back to a plain copy for whatever is left.
+ */
+static int
+ssh_sendfile(int ffd, off_t size)
+{
+	char buf[32768];
+	off_t done = 0;
+	ssize_t r, w, l;
+
+	/* The response header must reach the client before the data */
+	fflush(stdout);
+
+#ifdef HAVE_SYS_SENDFILE_H
+	while (done < size) {
+		r = sendfile(STDOUT_FILENO, ffd, &done, size - done);
+		if (r == -1 && errno == EINTR)
+			continue;
+		if (r <= 0)
+			break;
+	}
+#elif defined(__FreeBSD__)
+	while (done < size) {
+		off_t sbytes = 0;
+		int ret;
+
+		ret = sendfile(ffd, STDOUT_FILENO, done, size - done, NULL,
+		    &sbytes, 0);
+		done += sbytes;
+		if (ret == -1 && errno != EINTR && errno != EAGAIN)
+			break;
+		if (ret == 0 && sbytes == 0)
+			break;
+	}
+#endif
+	if (done > 0)
+		pkg_debug(1, "SSH server> sent %" PRIdMAX " bytes with sendfile",
+		    (intmax_t)done);
+
+	while (done < size) {
+		r = pread(ffd, buf, MIN((off_t)sizeof(buf), size - done), done);
+		if (r == -1 && errno == EINTR)
+			continue;
+		if (r <= 0)
+			return (EPKG_FATAL);
+		pkg_debug(1, "SSH server> sending data");
+		for (l = 0; l < r; l += w) {
+			w = write(STDOUT_FILENO, buf + l, r - l);
+			if (w == -1 && errno == EINTR) {
+				w = 0;
+				continue;
+			}
+			if (w <= 0)
+				return (EPKG_FATAL);
+		}
+		done += r;
+	}
+
+	return (EPKG_OK);
+}
+
+/*
+ * Requests are served strictly in order, so a client can queue several
+ * 'get' commands without waiting for the previous answers.  Every answer
+ * is flushed as soon as it is complete to keep such a pipeline moving.
+ */
 int
 pkg_sshserve(int fd)
 {
 	struct stat st;
 	char *line = NULL;
 	char *file, *age;
-	size_t linecap = 0, r;
+	size_t linecap = 0;
 	ssize_t linelen;
 	time_t mtime = 0;
 	const char *errstr;
-	int ffd;
-	char buf[32768];
+	int ffd, ret = EPKG_OK;
 	char fpath[MAXPATHLEN];
 	char rpath[MAXPATHLEN];
 	const char *restricted = NULL;
@@ -68,6 +141,7 @@ pkg_sshserve(int fd)
 
 	printf("ok: pkg "PKGVERSION"\n");
 	for (;;) {
+		fflush(stdout);
 		if ((linelen = getline(&line, &linecap, stdin)) < 0)
 			break;
 
@@ -79,7 +153,7 @@ pkg_sshserve(int fd)
 			line[linelen - 1] = '\0';
 
 		if (strcmp(line, "quit") == 0)
-			return (EPKG_OK);
+			break;
 
 		if (strncmp(line, "get ", 4) != 0) {
 			printf("ko: unknown command '%s'\n", line);
@@ -175,17 +249,18 @@ pkg_sshserve(int fd)
 		printf("ok: %" PRIdMAX "\n", (intmax_t)st.st_size);
 		pkg_debug(1, "SSH server> sending ok: %" PRIdMAX "", (intmax_t)st.st_size);
 
-		while ((r = read(ffd, buf, sizeof(buf))) > 0) {
-			pkg_debug(1, "SSH server> sending data");
-			fwrite(buf, 1, r, stdout);
+		ret = ssh_sendfile(ffd, st.st_size);
+		close(ffd);
+
+		if (ret != EPKG_OK) {
+			pkg_debug(1, "SSH server> failed to send %s", file);
+			break;
 		}
 
 		pkg_debug(1, "SSH server> finished");
-
-		close(ffd);
 	}
 
 	free(line);
 
-	return (EPKG_OK);
+	return (ret);
 }
@@ -180,12 +180,21 @@ populate_sums(struct pkgdb *db)
 }
 
 /*
- * Extract hash from filename in format <name>-<version>-<hash>.txz
+ * Extract hash from filename in format <hash>.txz, or the older
+ * <name>-<version>-<hash>.txz
  */
 static bool
 extract_filename_sum(const char *fname, char sum[])
 {
 	const char *dash_pos, *dot_pos;
+	size_t len;
+
+	len = strcspn(fname, ".");
+	if (len > PKG_FILE_CKSUM_CHARS &&
+	    strspn(fname, "0123456789abcdef") == len) {
+		strlcpy(sum, fname, PKG_FILE_CKSUM_CHARS + 1);
+		return (true);
+	}
 
 	dot_pos = strrchr(fname, '.');
 	if (dot_pos == NULL)
@@ -33,27 +33,38 @@
 
 #include <sys/param.h>
 #include <sys/queue.h>
-
-#ifdef PKG_COMPAT
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/wait.h>
+
+#ifdef PKG_COMPAT
 #include <dirent.h>
 #endif
 
 #include <err.h>
+#include <errno.h>
 #include <getopt.h>
+#ifdef HAVE_LIBUTIL_H
+#include <libutil.h>
+#endif
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <pkg.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <utlist.h>
 #include <sysexits.h>
+#include <bsd_compat.h>
 
 #include "pkgcli.h"
 
 struct pkg_entry {
 	struct pkg *pkg;
+	pid_t pid;
+	bool done;
+	bool failed;
 	struct pkg_entry *next;
 	struct pkg_entry *prev;
 };
@@ -66,16 +77,151 @@ usage_create(void)
 		"[-p plist] [-r rootdir] -m metadatadir\n");
 	fprintf(stderr, "Usage: pkg create [-Onqv] [-f format] [-o outdir] "
 		"[-r rootdir] -M manifest\n");
-	fprintf(stderr, "       pkg create [-Ognqvx] [-f format] [-o outdir] "
-		"[-r rootdir] pkg-name ...\n");
-	fprintf(stderr, "       pkg create [-Onqv] [-f format] [-o outdir] "
-		"[-r rootdir] -a\n\n");
+	fprintf(stderr, "       pkg create [-Ognqvx] [-f format] [-j jobs] "
+		"[-o outdir] [-r rootdir] pkg-name ...\n");
+	fprintf(stderr, "       pkg create [-Onqv] [-f format] [-j jobs] "
+		"[-o outdir] [-r rootdir] -a\n\n");
 	fprintf(stderr, "For more information see 'pkg help create'.\n");
 }
 
+/*
+ * Formats in the order libpkg falls back through when one is not
+ * supported by libarchive.
+ */
+static const char *create_formats[] = { "tzst", "txz", "tbz", "tgz", "tar" };
+
+/*
+ * Size of the package just created.  It may have been written in a
+ * fallback format: the newest of the candidates is the one.
+ */
+static int64_t
+pkg_create_size(const char *outdir, struct pkg *pkg, const char *format)
+{
+	char pkgpath[MAXPATHLEN];
+	struct stat st;
+	int64_t size = 0;
+	time_t newest = 0;
+	size_t i;
+
+	for (i = 0; i < NELEM(create_formats); i++) {
+		if (strcmp(create_formats[i], format) == 0)
+			break;
+	}
+	if (i == NELEM(create_formats))
+		i = 0;
+	for (; i < NELEM(create_formats); i++) {
+		pkg_snprintf(pkgpath, sizeof(pkgpath), "%S/%n-%v.%S", outdir,
+		    pkg, pkg, create_formats[i]);
+		if (stat(pkgpath, &st) == -1 || (size > 0 &&
+		    st.st_mtime < newest))
+			continue;
+		newest = st.st_mtime;
+		size = st.st_size;
+	}
+
+	return (size);
+}
+
+/*
+ * Create the packages with up to jobs children at once, one package per
+ * child.  Completions are reported in the order of the list whatever the
+ * order they finish in.
+ */
+static int
+pkg_create_parallel(struct pkg_entry **ents, int n, int jobs,
+    pkg_formats fmt, const char *outdir, const char *format)
+{
+	struct pkg_entry *e;
+	struct timespec start, end;
+	char size[8];
+	int64_t total = 0, sz;
+	double secs;
+	int next = 0, reported = 0, running = 0, retcode = EPKG_OK, i;
+	int status;
+	pid_t pid;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	fflush(stdout);
+	fflush(stderr);
+
+	while (reported < n) {
+		while (running < jobs && next < n) {
+			e = ents[next++];
+			pid = fork();
+			if (pid == 0) {
+				/* Children only report errors */
+				quiet = true;
+				_exit(pkg_create_installed(outdir, fmt, e->pkg) ==
+				    EPKG_OK ? EXIT_SUCCESS : EXIT_FAILURE);
+			}
+			if (pid == -1) {
+				warn("fork");
+				e->done = e->failed = true;
+				break;
+			}
+			e->pid = pid;
+			running++;
+		}
+
+		/* %d is the dependency list for pkg_printf(3) */
+		for (; reported < n && ents[reported]->done; reported++) {
+			e = ents[reported];
+			if (e->failed) {
+				retcode++;
+				printf("[%d/%d] ", reported + 1, n);
+				pkg_printf("Creating package for %n-%v: failed\n",
+				    e->pkg, e->pkg);
+				continue;
+			}
+			sz = pkg_create_size(outdir, e->pkg, format);
+			total += sz;
+			humanize_number(size, sizeof(size), sz, "B",
+			    HN_AUTOSCALE, HN_IEC_PREFIXES);
+			printf("[%d/%d] ", reported + 1, n);
+			pkg_printf("Creating package for %n-%v: %S\n", e->pkg,
+			    e->pkg, size);
+		}
+
+		if (running == 0)
+			continue;
+
+		pid = waitpid(-1, &status, 0);
+		if (pid == -1) {
+			if (errno == EINTR)
+				continue;
+			err(EXIT_FAILURE, "waitpid");
+		}
+		for (i = 0; i < next; i++) {
+			e = ents[i];
+			if (e->pid != pid || e->done)
+				continue;
+			e->done = true;
+			e->failed = !WIFEXITED(status) ||
+			    WEXITSTATUS(status) != EXIT_SUCCESS;
+			running--;
+			break;
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	humanize_number(size, sizeof(size), total, "B", HN_AUTOSCALE,
+	    HN_IEC_PREFIXES);
+	printf("Created %d packages (%s) in %.1f seconds with %d jobs",
+	    n - retcode, size, secs, jobs);
+	if (secs > 0) {
+		humanize_number(size, sizeof(size), total / secs, "B",
+		    HN_AUTOSCALE, HN_IEC_PREFIXES);
+		printf(", %s/s", size);
+	}
+	printf("\n");
+
+	return (retcode);
+}
+
 static int
 pkg_create_matches(int argc, char **argv, match_t match, pkg_formats fmt,
-    const char * const outdir, bool overwrite)
+    const char * const outdir, bool overwrite, int jobs)
 {
 	int i, ret = EPKG_OK, retcode = EPKG_OK;
 	struct pkg *pkg = NULL;
@@ -88,9 +234,11 @@ pkg_create_matches(int argc, char **argv, match_t match, pkg_formats fmt,
 	    PKG_LOAD_PROVIDES | PKG_LOAD_REQUIRES |
 	    PKG_LOAD_SHLIBS_PROVIDED | PKG_LOAD_ANNOTATIONS;
 	struct pkg_entry *e = NULL, *etmp;
+	struct pkg_entry **ents = NULL;
 	char pkgpath[MAXPATHLEN];
 	const char *format = NULL;
 	bool foundone;
+	int n = 0;
 
 	if (pkgdb_open(&db, PKGDB_DEFAULT) != EPKG_OK) {
 		pkgdb_close(db);
@@ -107,6 +255,9 @@ pkg_create_matches(int argc, char **argv, match_t match, pkg_formats fmt,
 	case TXZ:
 		format = "txz";
 		break;
+	case TZS:
+		format = "tzst";
+		break;
 	case TBZ:
 		format = "tbz";
 		break;
@@ -130,8 +281,8 @@ pkg_create_matches(int argc, char **argv, match_t match, pkg_formats fmt,
 
 		foundone = false;
 		while ((ret = pkgdb_it_next(it, &pkg, query_flags)) == EPKG_OK) {
-			if ((e = malloc(sizeof(struct pkg_entry))) == NULL)
-				err(1, "malloc(pkg_entry)");
+			if ((e = calloc(1, sizeof(struct pkg_entry))) == NULL)
+				err(1, "calloc(pkg_entry)");
 			e->pkg = pkg;
 			pkg = NULL;
 			DL_APPEND(pkg_head, e);
@@ -149,23 +300,42 @@ pkg_create_matches(int argc, char **argv, match_t match, pkg_formats fmt,
 	}
 
 	DL_FOREACH_SAFE(pkg_head, e, etmp) {
-		DL_DELETE(pkg_head, e);
-
 		if (!overwrite) {
 			pkg_snprintf(pkgpath, sizeof(pkgpath), "%S/%n-%v.%S",
 			    outdir, e->pkg, e->pkg, format);
 			if (access(pkgpath, F_OK) == 0) {
 				pkg_printf("%n-%v already packaged, skipping...\n",
 				    e->pkg, e->pkg);
+				DL_DELETE(pkg_head, e);
 				pkg_free(e->pkg);
 				free(e);
 				continue;
 			}
 		}
-		pkg_printf("Creating package for %n-%v\n", e->pkg, e->pkg);
-		if (pkg_create_installed(outdir, fmt, e->pkg) !=
-		    EPKG_OK)
-			retcode++;
+		n++;
+	}
+
+	if (jobs > 1 && n > 1) {
+		if ((ents = calloc(n, sizeof(*ents))) == NULL)
+			err(1, "calloc");
+		n = 0;
+		DL_FOREACH(pkg_head, e)
+			ents[n++] = e;
+		retcode += pkg_create_parallel(ents, n, MIN(jobs, n), fmt,
+		    outdir, format);
+		free(ents);
+	} else {
+		DL_FOREACH(pkg_head, e) {
+			pkg_printf("Creating package for %n-%v\n", e->pkg,
+			    e->pkg);
+			if (pkg_create_installed(outdir, fmt, e->pkg) !=
+			    EPKG_OK)
+				retcode++;
+		}
+	}
+
+	DL_FOREACH_SAFE(pkg_head, e, etmp) {
+		DL_DELETE(pkg_head, e);
 		pkg_free(e->pkg);
 		free(e);
 	}
@@ -185,7 +355,8 @@ cleanup:
  * -m: path to dir where to find the metadata
  * -q: quiet mode
  * -M: manifest file
- * -f <format>: format could be txz, tgz, tbz or tar
+ * -f <format>: format could be tzst, txz, tgz, tbz or tar
+ * -j <jobs>: number of packages created at once, 0 for one per CPU
  * -o: output directory where to create packages by default ./ is used
  */
 
@@ -201,7 +372,9 @@ exec_create(int argc, char **argv)
 	char		*plist = NULL;
 	pkg_formats	 fmt;
 	int		 ch;
+	int		 jobs = 1;
 	bool		 overwrite = true;
+	const char	*errstr;
 
 
 	/* POLA: pkg create is quiet by default, unless
@@ -215,6 +388,7 @@ exec_create(int argc, char **argv)
 		{ "glob",	no_argument,		NULL,	'g' },
 		{ "regex",	no_argument,		NULL,	'x' },
 		{ "format",	required_argument,	NULL,	'f' },
+		{ "jobs",	required_argument,	NULL,	'j' },
 		{ "root-dir",	required_argument,	NULL,	'r' },
 		{ "metadata",	required_argument,	NULL,	'm' },
 		{ "manifest",	required_argument,	NULL,	'M' },
@@ -226,7 +400,7 @@ exec_create(int argc, char **argv)
 		{ NULL,		0,			NULL,	0   },
 	};
 
-	while ((ch = getopt_long(argc, argv, "+agxf:r:m:M:o:np:qv", longopts, NULL)) != -1) {
+	while ((ch = getopt_long(argc, argv, "+agxf:j:r:m:M:o:np:qv", longopts, NULL)) != -1) {
 		switch (ch) {
 		case 'a':
 			match = MATCH_ALL;
@@ -240,6 +414,19 @@ exec_create(int argc, char **argv)
 		case 'f':
 			format = optarg;
 			break;
+		case 'j':
+			jobs = strtonum(optarg, 0, INT_MAX, &errstr);
+			if (errstr != NULL) {
+				warnx("Invalid number of jobs %s: %s", optarg,
+				    errstr);
+				return (EX_USAGE);
+			}
+			if (jobs == 0) {
+				jobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+				if (jobs < 1)
+					jobs = 1;
+			}
+			break;
 		case 'o':
 			outdir = optarg;
 			break;
@@ -295,6 +482,8 @@ exec_create(int argc, char **argv)
 			++format;
 		if (strcmp(format, "txz") == 0)
 			fmt = TXZ;
+		else if (strcmp(format, "tzst") == 0)
+			fmt = TZS;
 		else if (strcmp(format, "tbz") == 0)
 			fmt = TBZ;
 		else if (strcmp(format, "tgz") == 0)
@@ -309,7 +498,7 @@ exec_create(int argc, char **argv)
 
 	if (metadatadir == NULL && manifest == NULL) {
 		return (pkg_create_matches(argc, argv, match, fmt, outdir,
-		    overwrite) == EPKG_OK ? EX_OK : EX_SOFTWARE);
+		    overwrite, jobs) == EPKG_OK ? EX_OK : EX_SOFTWARE);
 	} else if (metadatadir != NULL) {
 		return (pkg_create_staged(outdir, fmt, rootdir, metadatadir,
 		    plist) == EPKG_OK ? EX_OK : EX_SOFTWARE);
@@ -74,6 +74,9 @@ static UT_string *msg_buf = NULL;
 static int last_progress_percent = -1;
 static bool progress_started = false;
 static bool progress_interrupted = false;
+/* Looked up once per progress bar rather than on each tick */
+static bool progress_tty = false;
+static bool progress_notick = false;
 static bool progress_debit = false;
 static int64_t last_tick = 0;
 static int64_t stalled;
@@ -363,7 +366,9 @@ progressbar_start(const char *pmsg)
 
 	progress_started = true;
 	progress_interrupted = false;
-	if (!isatty(STDOUT_FILENO))
+	progress_tty = isatty(STDOUT_FILENO);
+	progress_notick = getenv("NO_TICK") != NULL;
+	if (!progress_tty)
 		printf("%s: ", progress_message);
 	else
 		printf("%s:   0%%", progress_message);
@@ -375,12 +380,12 @@ progressbar_tick(int64_t current, int64_t total)
 	int percent;
 
 	if (!quiet && progress_started) {
-		if (isatty(STDOUT_FILENO))
+		if (progress_tty)
 			draw_progressbar(current, total);
 		else {
 			if (progress_interrupted) {
 				printf("%s...", progress_message);
-			} else if (!getenv("NO_TICK")){
+			} else if (!progress_notick) {
 				percent = (total != 0) ? (current * 100. / total) : 100;
 				if (last_progress_percent / 10 < percent / 10) {
 					last_progress_percent = percent;
@@ -399,7 +404,7 @@ void
 progressbar_stop(void)
 {
 	if (progress_started) {
-		if (!isatty(STDOUT_FILENO))
+		if (!progress_tty)
 			printf(" done");
 		putchar('\n');
 	}
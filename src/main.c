@@ -174,7 +174,7 @@ usage(const char *conffile, const char *reposdir, FILE *out, enum pkg_usage_reas
 #else
 #define JAIL_ARG
 #endif
-	fprintf(out, "Usage: pkg [-v] [-d] [-l] [-N] ["JAIL_ARG"-c <chroot path>|-r <rootdir>] [-C <configuration file>] [-R <repo config dir>] [-o var=value] [-4|-6] <command> [<args>]\n");
+	fprintf(out, "Usage: pkg [-v] [-d] [-l] [-N] ["JAIL_ARG"-c <chroot path>|-r <rootdir>] [-C <configuration file>] [-R <repo config dir>] [-o var=value] [-T <trace file>] [-4|-6] <command> [<args>]\n");
 	if (reason == PKG_USAGE_HELP) {
 		fprintf(out, "Global options supported:\n");
 		fprintf(out, "\t%-15s%s\n", "-d", "Increment debug level");
@@ -189,6 +189,7 @@ usage(const char *conffile, const char *reposdir, FILE *out, enum pkg_usage_reas
 		fprintf(out, "\t%-15s%s\n", "-v", "Display pkg(8) version");
 		fprintf(out, "\t%-15s%s\n", "-N", "Test if pkg(8) is activated and avoid auto-activation");
 		fprintf(out, "\t%-15s%s\n", "-o", "Override configuration option from the command line");
+		fprintf(out, "\t%-15s%s\n", "-T", "Write a timing trace of the pkg(8) phases to <trace file>");
 		fprintf(out, "\t%-15s%s\n", "-4", "Only use IPv4");
 		fprintf(out, "\t%-15s%s\n", "-6", "Only use IPv6");
 		fprintf(out, "\nCommands supported:\n");
@@ -605,8 +606,10 @@ main(int argc, char **argv)
 	struct plugcmd	 *c;
 	const char	 *conffile = NULL;
 	const char	 *reposdir = NULL;
+	const char	 *tracefile = NULL;
 	char		**save_argv;
 	char		  realrootdir[MAXPATHLEN];
+	char		  tracepath[MAXPATHLEN];
 	int		  j;
 
 	struct option longopts[] = {
@@ -621,6 +624,7 @@ main(int argc, char **argv)
 		{ "list",		no_argument,		NULL,	'l' },
 		{ "version",		no_argument,		NULL,	'v' },
 		{ "option",		required_argument,	NULL,	'o' },
+		{ "trace",		required_argument,	NULL,	'T' },
 		{ "only-ipv4",		no_argument,		NULL,	'4' },
 		{ "only-ipv6",		no_argument,		NULL,	'6' },
 		{ NULL,			0,			NULL,	0   },
@@ -651,7 +655,7 @@ main(int argc, char **argv)
 #else
 #define JAIL_OPT
 #endif
-	while ((ch = getopt_long(argc, argv, "+d"JAIL_OPT"c:C:R:r:lNvo:46", longopts, NULL)) != -1) {
+	while ((ch = getopt_long(argc, argv, "+d"JAIL_OPT"c:C:R:r:lNvo:T:46", longopts, NULL)) != -1) {
 		switch (ch) {
 		case 'd':
 			debug++;
@@ -685,6 +689,9 @@ main(int argc, char **argv)
 		case 'o':
 			export_arg_option (optarg);
 			break;
+		case 'T':
+			tracefile = optarg;
+			break;
 		case '4':
 			init_flags = PKG_INIT_FLAG_USE_IPV4;
 			break;
@@ -698,6 +705,19 @@ main(int argc, char **argv)
 	argc -= optind;
 	argv += optind;
 
+	/* -c and -r change the working directory before the trace is opened */
+	if (tracefile != NULL) {
+		if (*tracefile != '/') {
+			if (getcwd(tracepath, sizeof(tracepath)) == NULL)
+				err(EX_SOFTWARE, "getcwd() failed");
+			strlcat(tracepath, "/", sizeof(tracepath));
+			strlcat(tracepath, tracefile, sizeof(tracepath));
+			tracefile = tracepath;
+		}
+		if (setenv("PKG_TRACE_FILE", tracefile, 1) == -1)
+			err(EX_SOFTWARE, "setenv() failed");
+	}
+
 	pkg_set_debug_level(debug);
 
 	if (version == 1)
@@ -883,7 +903,9 @@ main(int argc, char **argv)
 
 	if (ambiguous <= 1) {
 		assert(command->exec != NULL);
+		pkg_trace_begin(command->name, NULL);
 		ret = command->exec(argc, argv);
+		pkg_trace_end();
 	} else {
 		usage(conffile, reposdir, stderr, PKG_USAGE_UNKNOWN_COMMAND, argv[0]);
 	}
@@ -51,7 +51,8 @@
 void
 usage_repo(void)
 {
-	fprintf(stderr, "Usage: pkg repo [-lqL] [-o output-dir] <repo-path> "
+	fprintf(stderr, "Usage: pkg repo [-lqL] [-d base-dir] [-o output-dir] "
+	    "<repo-path> "
 	    "[<rsa-key>|signing_command: <the command>]\n\n");
 	fprintf(stderr, "For more information see 'pkg help repo'.\n");
 }
@@ -96,8 +97,10 @@ exec_repo(int argc, char **argv)
 	bool	 filelist = false;
 	char	*output_dir = NULL;
 	char	*meta_file = NULL;
+	char	*delta_base = NULL;
 
 	struct option longopts[] = {
+		{ "deltas",	required_argument,	NULL,	'd' },
 		{ "list-files", no_argument,		NULL,	'l' },
 		{ "output-dir", required_argument,	NULL,	'o' },
 		{ "quiet",	no_argument,		NULL,	'q' },
@@ -105,8 +108,11 @@ exec_repo(int argc, char **argv)
 		{ NULL,		0,			NULL,	0   },
 	};
 
-	while ((ch = getopt_long(argc, argv, "+lo:qm:", longopts, NULL)) != -1) {
+	while ((ch = getopt_long(argc, argv, "+d:lo:qm:", longopts, NULL)) != -1) {
 		switch (ch) {
+		case 'd':
+			delta_base = optarg;
+			break;
 		case 'l':
 			filelist = true;
 			break;
@@ -147,6 +153,12 @@ exec_repo(int argc, char **argv)
 		return (EX_IOERR);
 	}
 
+	if (delta_base != NULL &&
+	    pkg_create_repo_deltas(argv[0], output_dir, delta_base) != EPKG_OK) {
+		printf("Cannot create package deltas\n");
+		return (EX_IOERR);
+	}
+
 	if (pkg_finish_repo(output_dir, password_cb, argv + 1, argc - 1,
 	    filelist) != EPKG_OK)
 		return (EX_DATAERR);
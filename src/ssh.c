@@ -75,7 +75,7 @@ exec_ssh(int argc, char **argv __unused)
 	}
 
 #ifdef HAVE_CAPSICUM
-	cap_rights_init(&rights, CAP_READ, CAP_FSTATAT, CAP_FCNTL);
+	cap_rights_init(&rights, CAP_READ, CAP_PREAD, CAP_FSTATAT, CAP_FCNTL);
 	if (cap_rights_limit(fd, &rights) < 0 && errno != ENOSYS ) {
 		warn("cap_rights_limit() failed");
 		close(fd);
@@ -737,7 +737,8 @@ set_jobs_summary_pkg(struct pkg_jobs *jobs, struct pkg *new_pkg,
 		} else
 			break;
 
-		if ((ret == EPKG_OK || ret == EPKG_FATAL) && (stat(path, &st) == -1 || pkgsize != st.st_size)) {
+		if ((ret == EPKG_OK || ret == EPKG_FATAL) && (stat(path, &st) == -1 || pkgsize != st.st_size) &&
+		    (destdir != NULL || !pkg_repo_cached_rebuilt(path))) {
 			/* file looks corrupted (wrong size),
 					   assume a checksum mismatch will
 					   occur later and the file will be
@@ -793,7 +794,8 @@ set_jobs_summary_pkg(struct pkg_jobs *jobs, struct pkg *new_pkg,
 		if (stat(path, &st) != -1) {
 			*oldsize += st.st_size;
 
-			if (pkgsize != st.st_size)
+			if (pkgsize != st.st_size &&
+			    (destdir != NULL || !pkg_repo_cached_rebuilt(path)))
 				*dlsize += pkgsize;
 			else {
 				free(it);
@@ -0,0 +1,186 @@
+/*-
+ * Copyright (c) 2026 The pkg contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer
+ *    in this position and unchanged.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Throughput of the sha256 and blake2 backends, in memory and through
+ * pkg_checksum_file(), and of blake2 multi-buffer hashing against one
+ * call per input for many small inputs.  Output is one tab separated
+ * line per measure: algorithm, backend, bytes, seconds, MiB/s.
+ */
+
+#include <sys/types.h>
+
+#include <err.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <pkg.h>
+#include <private/pkg.h>
+#include <sha256.h>
+#include <blake2.h>
+
+#include "bench.h"
+
+static void
+report(const char *what, const char *backend, size_t bytes, double secs)
+{
+	printf("%s\t%s\t%zu\t%.6f\t%.1f\n", what, backend, bytes, secs,
+	    bytes / secs / (1024 * 1024));
+}
+
+static void
+bench_blake2_small(const unsigned char *buf, size_t size, int rounds)
+{
+	const size_t len = 256;
+	unsigned char (*out)[BLAKE2B_OUTBYTES];
+	unsigned char **outp;
+	const void **in;
+	size_t *inlen, count, i;
+	double start;
+	int r;
+
+	count = size / len;
+	out = malloc(count * sizeof(*out));
+	outp = malloc(count * sizeof(*outp));
+	in = malloc(count * sizeof(*in));
+	inlen = malloc(count * sizeof(*inlen));
+	if (out == NULL || outp == NULL || in == NULL || inlen == NULL)
+		err(EXIT_FAILURE, "malloc");
+	for (i = 0; i < count; i++) {
+		outp[i] = out[i];
+		in[i] = buf + i * len;
+		inlen[i] = len;
+	}
+
+	for (r = 0; r < rounds; r++) {
+		start = bench_now();
+		for (i = 0; i < count; i++)
+			blake2b(out[i], BLAKE2B_OUTBYTES, in[i], len, NULL, 0);
+		report("blake2b_256B", blake2_backend_current(), size,
+		    bench_now() - start);
+		start = bench_now();
+		blake2b_many(outp, BLAKE2B_OUTBYTES, in, inlen, count);
+		report("blake2b_many_256B", blake2_backend_current(), size,
+		    bench_now() - start);
+		start = bench_now();
+		for (i = 0; i < count; i++)
+			blake2s(out[i], BLAKE2S_OUTBYTES, in[i], len, NULL, 0);
+		report("blake2s_256B", blake2_backend_current(), size,
+		    bench_now() - start);
+		start = bench_now();
+		blake2s_many(outp, BLAKE2S_OUTBYTES, in, inlen, count);
+		report("blake2s_many_256B", blake2_backend_current(), size,
+		    bench_now() - start);
+	}
+
+	free(out);
+	free(outp);
+	free(in);
+	free(inlen);
+}
+
+int
+main(int argc, char **argv)
+{
+	SHA256_CTX ctx;
+	unsigned char digest[SHA256_BLOCK_SIZE];
+	unsigned char digest2b[BLAKE2B_OUTBYTES];
+	unsigned char *buf, *sum;
+	char path[] = "/tmp/checksum_bench.XXXXXX";
+	const char *name;
+	size_t size, i;
+	double start;
+	int fd, ch, rounds = 3, r;
+
+	size = 64;
+	while ((ch = getopt(argc, argv, "r:s:")) != -1) {
+		switch (ch) {
+		case 'r':
+			rounds = bench_number(optarg);
+			break;
+		case 's':
+			size = bench_number(optarg);
+			break;
+		default:
+			bench_usage("checksum_bench [-r rounds] [-s MiB]");
+		}
+	}
+	size *= 1024 * 1024;
+
+	if ((buf = malloc(size)) == NULL)
+		err(EXIT_FAILURE, "malloc");
+	for (i = 0; i < size; i++)
+		buf[i] = (i * 2654435761U) >> 13;
+
+	for (i = 0; (name = sha256_backend_name(i)) != NULL; i++) {
+		sha256_backend_select(name);
+		for (r = 0; r < rounds; r++) {
+			start = bench_now();
+			sha256_init(&ctx);
+			sha256_update(&ctx, buf, size);
+			sha256_final(&ctx, digest);
+			report("sha256", name, size, bench_now() - start);
+		}
+	}
+
+	for (i = 0; (name = blake2_backend_name(i)) != NULL; i++) {
+		blake2_backend_select(name);
+		for (r = 0; r < rounds; r++) {
+			start = bench_now();
+			blake2b(digest2b, sizeof(digest2b), buf, size, NULL, 0);
+			report("blake2b", name, size, bench_now() - start);
+			start = bench_now();
+			blake2s(digest2b, BLAKE2S_OUTBYTES, buf, size, NULL, 0);
+			report("blake2s", name, size, bench_now() - start);
+		}
+		bench_blake2_small(buf, size, rounds);
+	}
+	blake2_backend_select(blake2_backend_name(0));
+
+	if ((fd = mkstemp(path)) == -1)
+		err(EXIT_FAILURE, "mkstemp");
+	if (write(fd, buf, size) != (ssize_t)size)
+		err(EXIT_FAILURE, "write");
+	close(fd);
+
+	/* Default backend, file read included and most likely cached */
+	sha256_backend_select(sha256_backend_name(0));
+	for (r = 0; r < rounds; r++) {
+		start = bench_now();
+		sum = pkg_checksum_file(path, PKG_HASH_TYPE_SHA256_HEX);
+		report("sha256_file", sha256_backend_current(), size,
+		    bench_now() - start);
+		free(sum);
+	}
+
+	unlink(path);
+	free(buf);
+
+	return (EXIT_SUCCESS);
+}
@@ -0,0 +1,147 @@
+/*-
+ * Copyright (c) 2026 The pkg contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer
+ *    in this position and unchanged.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Cost of pkg_ini() with many repository configuration files, parsing
+ * everything each time and reusing the configuration snapshot.  Output
+ * is one tab separated line per round: mode, repositories, inits,
+ * seconds, microseconds per init.
+ */
+
+#include <sys/param.h>
+#include <sys/stat.h>
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <pkg.h>
+
+#include "bench.h"
+
+static void
+write_file(const char *path, const char *content)
+{
+	FILE *f;
+
+	if ((f = fopen(path, "w")) == NULL)
+		err(EXIT_FAILURE, "%s", path);
+	fputs(content, f);
+	fclose(f);
+}
+
+static void
+bench_init(const char *mode, const char *conf, size_t nrepos, int inits)
+{
+	double start;
+	int i;
+
+	setenv("CONFIG_SNAPSHOT", strcmp(mode, "snapshot") == 0 ? "YES" : "NO",
+	    1);
+	/* Not timed: writes the snapshot for this environment */
+	if (pkg_ini(conf, NULL, 0) != EPKG_OK)
+		errx(EXIT_FAILURE, "pkg_ini");
+	pkg_shutdown();
+
+	start = bench_now();
+	for (i = 0; i < inits; i++) {
+		if (pkg_ini(conf, NULL, 0) != EPKG_OK)
+			errx(EXIT_FAILURE, "pkg_ini");
+		if (pkg_repos_total_count() != (int)nrepos)
+			errx(EXIT_FAILURE, "expected %zu repositories, got %d",
+			    nrepos, pkg_repos_total_count());
+		pkg_shutdown();
+	}
+	start = bench_now() - start;
+	printf("%s\t%zu\t%d\t%.6f\t%.1f\n", mode, nrepos, inits, start,
+	    start * 1e6 / inits);
+}
+
+int
+main(int argc, char **argv)
+{
+	char dir[] = "/tmp/config_bench.XXXXXX";
+	char path[MAXPATHLEN], buf[BUFSIZ], cmd[64];
+	size_t nrepos = 100, i;
+	int ch, inits = 200, rounds = 3, r;
+
+	while ((ch = getopt(argc, argv, "i:n:r:")) != -1) {
+		switch (ch) {
+		case 'i':
+			inits = bench_number(optarg);
+			break;
+		case 'n':
+			nrepos = bench_number(optarg);
+			break;
+		case 'r':
+			rounds = bench_number(optarg);
+			break;
+		default:
+			bench_usage("config_bench [-i inits] "
+			    "[-n repositories] [-r rounds]");
+		}
+	}
+
+	if (mkdtemp(dir) == NULL)
+		err(EXIT_FAILURE, "mkdtemp");
+	setenv("PKG_DBDIR", dir, 1);
+
+	snprintf(path, sizeof(path), "%s/repos", dir);
+	if (mkdir(path, 0755) == -1)
+		err(EXIT_FAILURE, "mkdir");
+	for (i = 0; i < nrepos; i++) {
+		snprintf(path, sizeof(path), "%s/repos/bench%zu.conf", dir, i);
+		snprintf(buf, sizeof(buf),
+		    "bench%zu: {\n"
+		    "  url: \"pkg+http://pkg.example.org/${ABI}/bench%zu\",\n"
+		    "  mirror_type: \"srv\",\n"
+		    "  signature_type: \"fingerprints\",\n"
+		    "  fingerprints: \"/usr/share/keys/pkg\",\n"
+		    "  priority: %zu,\n"
+		    "  enabled: yes\n"
+		    "}\n", i, i, i);
+		write_file(path, buf);
+	}
+	snprintf(path, sizeof(path), "%s/pkg.conf", dir);
+	snprintf(buf, sizeof(buf),
+	    "REPOS_DIR: [\"%s/repos\"]\n"
+	    "ASSUME_ALWAYS_YES: true\n"
+	    "PKG_ENV: { BENCH: yes }\n"
+	    "ALIAS: { bench: \"info -q\" }\n", dir);
+	write_file(path, buf);
+
+	for (r = 0; r < rounds; r++) {
+		bench_init("parse", path, nrepos, inits);
+		bench_init("snapshot", path, nrepos, inits);
+	}
+
+	snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+	system(cmd);
+
+	return (EXIT_SUCCESS);
+}
@@ -0,0 +1,166 @@
+/*-
+ * Copyright (c) 2026 The pkg contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer
+ *    in this position and unchanged.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * pkg create over a synthetic staging tree, as a plain tar so that
+ * compression does not hide the I/O.  Output is one tab separated line
+ * per round: files, seconds, bytes of file content packed, bytes of file
+ * content read from disk (from libpkg's debug output) and their ratio,
+ * which was 2 when every file was read once to be hashed and once more
+ * to be packed.
+ */
+
+#include <sys/stat.h>
+
+#include <err.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <pkg.h>
+#include <private/pkg.h>
+
+#include "bench.h"
+
+static intmax_t content, bytesread;
+
+static int
+event_cb(void *data, struct pkg_event *ev)
+{
+	if (ev->type == PKG_EVENT_DEBUG)
+		sscanf(ev->e_debug.msg,
+		    "Packed %jd bytes of file content, %jd bytes read",
+		    &content, &bytesread);
+
+	return (bench_event(data, ev));
+}
+
+/* Sizes in a rough ports tree mix: mostly small, a few large files */
+static size_t
+file_size(size_t i)
+{
+	if (i % 100 == 0)
+		return (4 * 1024 * 1024 + i * 97);
+	if (i % 10 == 0)
+		return (96 * 1024 + i * 13);
+	return (512 + (i * 2654435761U) % 16384);
+}
+
+static void
+stage(const char *root, size_t nfiles, const char *plist,
+    const char *manifest)
+{
+	char path[PATH_MAX];
+	unsigned char *buf;
+	size_t i, j, sz;
+	FILE *fp;
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/share", root);
+	if (mkdir(root, 0755) == -1 || mkdir(path, 0755) == -1)
+		err(EXIT_FAILURE, "mkdir");
+	if ((buf = malloc(file_size(0) + nfiles * 97)) == NULL)
+		err(EXIT_FAILURE, "malloc");
+	if ((fp = fopen(plist, "w")) == NULL)
+		err(EXIT_FAILURE, "%s", plist);
+	for (i = 0; i < nfiles; i++) {
+		sz = file_size(i);
+		for (j = 0; j < sz; j++)
+			buf[j] = (i + j * 2654435761U) >> 11;
+		snprintf(path, sizeof(path), "%s/share/file%zu", root, i);
+		if ((fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0644)) == -1)
+			err(EXIT_FAILURE, "%s", path);
+		if (write(fd, buf, sz) != (ssize_t)sz)
+			err(EXIT_FAILURE, "write");
+		close(fd);
+		fprintf(fp, "share/file%zu\n", i);
+	}
+	fclose(fp);
+	free(buf);
+
+	if ((fp = fopen(manifest, "w")) == NULL)
+		err(EXIT_FAILURE, "%s", manifest);
+	fprintf(fp, "name: bench\norigin: bench/bench\nversion: 1\n"
+	    "maintainer: bench\ncomment: bench\ndesc: bench\n"
+	    "www: http://bench\nprefix: /\nabi: \"*\"\n");
+	fclose(fp);
+}
+
+int
+main(int argc, char **argv)
+{
+	char dir[] = "/tmp/create_bench.XXXXXX";
+	char root[PATH_MAX], plist[PATH_MAX], manifest[PATH_MAX];
+	char cmd[PATH_MAX + 16];
+	size_t nfiles = 2000;
+	double start;
+	int ch, rounds = 3, r;
+
+	while ((ch = getopt(argc, argv, "n:r:")) != -1) {
+		switch (ch) {
+		case 'n':
+			nfiles = bench_number(optarg);
+			break;
+		case 'r':
+			rounds = bench_number(optarg);
+			break;
+		default:
+			bench_usage("create_bench [-n files] [-r rounds]");
+		}
+	}
+
+	if (mkdtemp(dir) == NULL)
+		err(EXIT_FAILURE, "mkdtemp");
+	snprintf(root, sizeof(root), "%s/root", dir);
+	snprintf(plist, sizeof(plist), "%s/plist", dir);
+	snprintf(manifest, sizeof(manifest), "%s/manifest", dir);
+	stage(root, nfiles, plist, manifest);
+
+	pkg_event_register(event_cb, NULL);
+	if (pkg_init(NULL, NULL) != EPKG_OK)
+		errx(EXIT_FAILURE, "pkg_init");
+	ctx.debug_level = 1;
+
+	for (r = 0; r < rounds; r++) {
+		content = bytesread = -1;
+		start = bench_now();
+		if (pkg_create_from_manifest(dir, TAR, root, manifest,
+		    plist) != EPKG_OK)
+			errx(EXIT_FAILURE, "pkg_create_from_manifest");
+		printf("create\t%zu\t%.6f\t%jd\t%jd\t%.2f\n", nfiles,
+		    bench_now() - start, content, bytesread,
+		    content > 0 ? (double)bytesread / content : 0);
+	}
+
+	pkg_shutdown();
+	snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+	system(cmd);
+
+	return (EXIT_SUCCESS);
+}
@@ -0,0 +1,139 @@
+#!/bin/sh
+#
+# Measures what package deltas save on an upgrade.
+#
+# Usage: deltas.sh [-c changed] [-f files] [-k] [-n packages] [-s KiB]
+#
+# Packages are named delta<N> and install <files> files of <KiB> random,
+# so incompressible, data.  Version 2 changes <changed> files of each
+# package; pkg repo -d then publishes deltas against version 1, which is
+# installed in a rootdir and upgraded, with only the deltas left in the
+# repository.  Output is one tab separated line: packages, files per
+# package, changed files, bytes of the version 2 packages, bytes of their
+# deltas, seconds to create the deltas and seconds of the upgrade.
+#
+# The pkg binary is taken from $PKG, then from the build tree.  -k keeps
+# the work directory.
+
+set -e
+
+npkgs=20
+nfiles=20
+nchanged=1
+size=64
+keep=no
+
+while getopts "c:f:kn:s:" ch; do
+	case ${ch} in
+	c) nchanged=${OPTARG} ;;
+	f) nfiles=${OPTARG} ;;
+	k) keep=yes ;;
+	n) npkgs=${OPTARG} ;;
+	s) size=${OPTARG} ;;
+	*)
+		echo "usage: deltas.sh [-c changed] [-f files] [-k]" \
+		    "[-n packages] [-s KiB]" >&2
+		exit 1
+		;;
+	esac
+done
+
+if [ -z "${PKG}" ]; then
+	PKG=$(cd "$(dirname "$0")/../../src" 2>/dev/null && pwd)/pkg
+	[ -x "${PKG}" ] || PKG=pkg
+fi
+
+work=$(mktemp -d "${TMPDIR:-/tmp}/pkg_bench.XXXXXX")
+cleanup() {
+	if [ "${keep}" = "yes" ]; then
+		echo "work directory: ${work}" >&2
+	else
+		rm -rf "${work}"
+	fi
+}
+trap cleanup EXIT
+
+# date(1) only has sub-second precision where %N is supported
+case $(date +%N) in
+*N*|"") now() { date +%s; } ;;
+*) now() { date +%s.%N; } ;;
+esac
+
+export INSTALL_AS_USER=yes
+export NO_TICK=yes
+root=${work}/root
+
+# build <version> <repo directory>: files below <changed> differ per version
+build() {
+	mkdir -p "$2"
+	i=0
+	while [ ${i} -lt ${npkgs} ]; do
+		name=delta${i}
+		dir=${work}/stage/usr/local/share/${name}
+		mkdir -p "${dir}"
+		: > "${work}/${name}.plist"
+		j=0
+		while [ ${j} -lt ${nfiles} ]; do
+			if [ ! -f "${dir}/file${j}" ] || [ ${j} -lt ${nchanged} ]; then
+				dd if=/dev/urandom of="${dir}/file${j}" bs=1024 \
+				    count=${size} 2>/dev/null
+			fi
+			echo "share/${name}/file${j}" >> "${work}/${name}.plist"
+			j=$((j + 1))
+		done
+		cat > "${work}/${name}.ucl" <<EOF
+name: ${name}
+origin: bench/${name}
+version: "$1"
+maintainer: bench
+categories: [bench]
+comment: synthetic benchmark package
+www: http://bench
+prefix: /usr/local
+abi: "*"
+desc: synthetic benchmark package
+EOF
+		"${PKG}" create -r "${work}/stage" -o "$2" \
+		    -M "${work}/${name}.ucl" -p "${work}/${name}.plist"
+		i=$((i + 1))
+	done
+}
+
+build 1 "${work}/base"
+"${PKG}" repo -q "${work}/base" >/dev/null
+build 2 "${work}/repo"
+
+start=$(now)
+"${PKG}" repo -q -d "${work}/base" "${work}/repo" >/dev/null
+created=$(now)
+
+mkdir -p "${root}/var/db/pkg"
+"${PKG}" -o REPOS_DIR=/dev/null -r "${root}" install -qy \
+    "${work}"/base/delta*.txz >/dev/null
+
+bytes() {
+	cat "$@" | wc -c | tr -d ' '
+}
+full=$(bytes "${work}"/repo/delta*.txz)
+deltas=$(bytes "${work}"/repo/Deltas/*)
+rm "${work}"/repo/delta*.txz
+
+cat > "${work}/bench.conf" <<EOF
+bench: {
+	url: "file://${work}/repo",
+	enabled: true
+}
+EOF
+upgrade=$(now)
+if ! "${PKG}" -o REPOS_DIR="${work}" -o PKG_CACHEDIR="${work}/cache" \
+    -r "${root}" upgrade -y >"${work}/upgrade.log" 2>&1; then
+	echo "upgrade failed, see ${work}/upgrade.log" >&2
+	keep=yes
+	exit 1
+fi
+end=$(now)
+
+printf "%d\t%d\t%d\t%s\t%s\t%s\t%s\n" "${npkgs}" "${nfiles}" "${nchanged}" \
+    "${full}" "${deltas}" \
+    "$(echo "${start} ${created}" | awk '{ printf "%.6f", $2 - $1 }')" \
+    "$(echo "${upgrade} ${end}" | awk '{ printf "%.6f", $2 - $1 }')"
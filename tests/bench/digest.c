@@ -0,0 +1,159 @@
+/*-
+ * Copyright (c) 2026 The pkg contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer
+ *    in this position and unchanged.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * pkg_checksum_generate() over a synthetic repository, the way pkg repo
+ * computes one digest per package, then pkg_checksum_calculate() one
+ * package at a time against pkg_checksum_calculate_many(), the way the
+ * missing digests of the local database are filled in.  Output is one tab
+ * separated line per measure: digest type, packages, seconds, digests/s.
+ */
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <pkg.h>
+#include <private/pkg.h>
+
+#include "bench.h"
+
+/* A package shaped like an average ports tree entry */
+static struct pkg *
+synthetic_pkg(size_t n)
+{
+	struct pkg *p;
+	char name[64], origin[64], version[32], buf[64], dorigin[64];
+	size_t i;
+
+	if (pkg_new(&p, PKG_REMOTE) != EPKG_OK)
+		errx(EXIT_FAILURE, "pkg_new");
+
+	snprintf(name, sizeof(name), "package%zu", n);
+	snprintf(origin, sizeof(origin), "category%zu/package%zu", n % 64, n);
+	snprintf(version, sizeof(version), "%zu.%zu.%zu_1", n % 7, n % 13, n);
+	pkg_set(p, PKG_NAME, name, PKG_ORIGIN, origin, PKG_VERSION, version,
+	    PKG_ARCH, "FreeBSD:13:amd64");
+
+	for (i = 0; i < n % 12; i++) {
+		snprintf(buf, sizeof(buf), "OPTION%zu", i);
+		pkg_addoption(p, buf, i % 2 ? "on" : "off");
+	}
+	for (i = 0; i < n % 5; i++) {
+		snprintf(buf, sizeof(buf), "liblib%zu.so.%zu", (n + i) % 100, i);
+		pkg_addshlib_required(p, buf);
+	}
+	snprintf(buf, sizeof(buf), "libpackage%zu.so.1", n);
+	pkg_addshlib_provided(p, buf);
+	for (i = 0; i < n % 8 && i < n; i++) {
+		snprintf(buf, sizeof(buf), "package%zu", n - i - 1);
+		snprintf(dorigin, sizeof(dorigin), "category%zu/package%zu",
+		    (n - i - 1) % 64, n - i - 1);
+		pkg_adddep(p, buf, dorigin, "1.0", false);
+	}
+	if (n % 50 == 0) {
+		snprintf(buf, sizeof(buf), "user%zu", n);
+		pkg_adduser(p, buf);
+		pkg_addgroup(p, buf);
+	}
+
+	return (p);
+}
+
+int
+main(int argc, char **argv)
+{
+	const pkg_checksum_type_t types[] = {
+		PKG_HASH_TYPE_SHA256_BASE32,
+		PKG_HASH_TYPE_BLAKE2_BASE32,
+		PKG_HASH_TYPE_BLAKE2S_BASE32,
+	};
+	const char *names[] = { "sha256_base32", "blake2_base32",
+	    "blake2s_base32" };
+	struct pkg **pkgs;
+	char digest[256];
+	size_t npkgs = 30000, i, t;
+	double start, secs;
+	int ch, rounds = 3, r;
+
+	while ((ch = getopt(argc, argv, "n:r:")) != -1) {
+		switch (ch) {
+		case 'n':
+			npkgs = bench_number(optarg);
+			break;
+		case 'r':
+			rounds = bench_number(optarg);
+			break;
+		default:
+			bench_usage("digest_bench [-n packages] [-r rounds]");
+		}
+	}
+
+	if ((pkgs = calloc(npkgs, sizeof(*pkgs))) == NULL)
+		err(EXIT_FAILURE, "calloc");
+	for (i = 0; i < npkgs; i++)
+		pkgs[i] = synthetic_pkg(i);
+
+	for (t = 0; t < sizeof(types) / sizeof(types[0]); t++) {
+		for (r = 0; r < rounds; r++) {
+			start = bench_now();
+			for (i = 0; i < npkgs; i++) {
+				if (pkg_checksum_generate(pkgs[i], digest,
+				    sizeof(digest), types[t]) != EPKG_OK)
+					errx(EXIT_FAILURE, "pkg_checksum_generate");
+			}
+			secs = bench_now() - start;
+			printf("%s\t%zu\t%.6f\t%.0f\n", names[t], npkgs, secs,
+			    npkgs / secs);
+		}
+	}
+
+	for (r = 0; r < rounds; r++) {
+		start = bench_now();
+		for (i = 0; i < npkgs; i++) {
+			if (pkg_checksum_calculate(pkgs[i], NULL) != EPKG_OK)
+				errx(EXIT_FAILURE, "pkg_checksum_calculate");
+		}
+		secs = bench_now() - start;
+		printf("calculate\t%zu\t%.6f\t%.0f\n", npkgs, secs,
+		    npkgs / secs);
+
+		start = bench_now();
+		if (pkg_checksum_calculate_many(pkgs, npkgs) != EPKG_OK)
+			errx(EXIT_FAILURE, "pkg_checksum_calculate_many");
+		secs = bench_now() - start;
+		printf("calculate_many\t%zu\t%.6f\t%.0f\n", npkgs, secs,
+		    npkgs / secs);
+	}
+
+	for (i = 0; i < npkgs; i++)
+		pkg_free(pkgs[i]);
+	free(pkgs);
+
+	return (EXIT_SUCCESS);
+}
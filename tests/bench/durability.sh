@@ -0,0 +1,24 @@
+#!/bin/sh
+#
+# Compares the FSYNC_POLICY settings on the synthetic install benchmark.
+#
+# Usage: durability.sh [-p policy,...] [synthetic.sh options]
+#
+# Runs synthetic.sh once per policy, none, batch and syncfs by default,
+# and prefixes each of its lines with the policy.  Only the install phase
+# depends on the policy, the others give the noise between runs.  Point
+# TMPDIR to the filesystem to measure: on tmpfs every policy is free.
+
+set -e
+
+policies="none batch syncfs"
+
+if [ "$1" = "-p" ]; then
+	policies=$(echo "$2" | tr ',' ' ')
+	shift 2
+fi
+
+for policy in ${policies}; do
+	FSYNC_POLICY=${policy} sh "$(dirname "$0")/synthetic.sh" "$@" |
+	    sed "s/^/${policy}	/"
+done
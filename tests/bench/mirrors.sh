@@ -0,0 +1,198 @@
+#!/bin/sh
+#
+# Shows which mirrors an HTTP mirrored repository is fetched from.
+#
+# Usage: mirrors.sh [-k] [-n packages] [-r rounds] [-s KiB] [-t KiB/s]
+#
+# Three local HTTP servers, python3 ones, serve the same repository of
+# <packages> packages of <KiB> random data: the first one listed answers
+# after a second and sends <KiB/s>, the second sends at the same rate but
+# stops for a minute in the middle of each file, and the last one is not
+# throttled.  Each round, pkg update -f and pkg fetch -a run against the
+# mirror list, with the mirror measures kept from one round to the next.
+# Output is one tab separated line per round: round, seconds, then the
+# bytes sent by each mirror, in the listed order.
+#
+# The pkg binary is taken from $PKG, then from the build tree.  -k keeps
+# the work directory.
+
+set -e
+
+npkgs=10
+rounds=3
+size=512
+rate=128
+keep=no
+
+while getopts "kn:r:s:t:" ch; do
+	case ${ch} in
+	k) keep=yes ;;
+	n) npkgs=${OPTARG} ;;
+	r) rounds=${OPTARG} ;;
+	s) size=${OPTARG} ;;
+	t) rate=${OPTARG} ;;
+	*)
+		echo "usage: mirrors.sh [-k] [-n packages] [-r rounds]" \
+		    "[-s KiB] [-t KiB/s]" >&2
+		exit 1
+		;;
+	esac
+done
+
+if ! command -v python3 >/dev/null 2>&1; then
+	echo "mirrors.sh: python3 is needed for the HTTP servers" >&2
+	exit 1
+fi
+
+if [ -z "${PKG}" ]; then
+	PKG=$(cd "$(dirname "$0")/../../src" 2>/dev/null && pwd)/pkg
+	[ -x "${PKG}" ] || PKG=pkg
+fi
+
+work=$(mktemp -d "${TMPDIR:-/tmp}/pkg_bench.XXXXXX")
+pids=""
+cleanup() {
+	[ -n "${pids}" ] && kill ${pids} 2>/dev/null
+	if [ "${keep}" = "yes" ]; then
+		echo "work directory: ${work}" >&2
+	else
+		rm -rf "${work}"
+	fi
+}
+trap cleanup EXIT
+
+# date(1) only has sub-second precision where %N is supported
+case $(date +%N) in
+*N*|"") now() { date +%s; } ;;
+*) now() { date +%s.%N; } ;;
+esac
+
+export INSTALL_AS_USER=yes
+export NO_TICK=yes
+
+mkdir -p "${work}/repo" "${work}/stage" "${work}/index"
+i=0
+while [ ${i} -lt ${npkgs} ]; do
+	name=mirror${i}
+	dd if=/dev/urandom of="${work}/stage/${name}" bs=1024 count=${size} \
+	    2>/dev/null
+	cat > "${work}/${name}.ucl" <<EOF
+name: ${name}
+origin: bench/${name}
+version: "1"
+maintainer: bench
+categories: [bench]
+comment: synthetic benchmark package
+www: http://bench
+prefix: /
+abi: "*"
+desc: synthetic benchmark package
+files: {
+	/${name}: ""
+}
+EOF
+	"${PKG}" create -r "${work}/stage" -o "${work}/repo" \
+	    -M "${work}/${name}.ucl"
+	i=$((i + 1))
+done
+"${PKG}" repo -q "${work}/repo" >/dev/null
+
+# serve.py <root> <port file> <bytes log> <delay> <KiB/s> <stall>
+cat > "${work}/serve.py" <<'EOF'
+import http.server, os, sys, time
+
+root, portfile, log = sys.argv[1:4]
+delay, rate, stall = float(sys.argv[4]), int(sys.argv[5]), float(sys.argv[6])
+
+class Handler(http.server.SimpleHTTPRequestHandler):
+    def __init__(self, *args, **kwargs):
+        super().__init__(*args, directory=root, **kwargs)
+
+    def log_message(self, *args):
+        pass
+
+    def send_head(self):
+        time.sleep(delay)
+        return super().send_head()
+
+    def copyfile(self, src, dst):
+        chunk = rate * 1024 if rate > 0 else 1 << 20
+        sent, stalled = 0, stall <= 0
+        while True:
+            buf = src.read(chunk)
+            if not buf:
+                break
+            dst.write(buf)
+            sent += len(buf)
+            with open(log, "a") as f:
+                f.write("%d\n" % len(buf))
+            if not stalled and sent * 2 >= os.fstat(src.fileno()).st_size:
+                stalled = True
+                time.sleep(stall)
+            elif rate > 0:
+                time.sleep(1)
+
+server = http.server.ThreadingHTTPServer(("127.0.0.1", 0), Handler)
+with open(portfile + ".tmp", "w") as f:
+    f.write("%d\n" % server.server_address[1])
+os.rename(portfile + ".tmp", portfile)
+server.serve_forever()
+EOF
+
+# serve <name> <root> <delay> <KiB/s> <stall>: prints the port
+serve() {
+	: > "${work}/$1.log"
+	python3 "${work}/serve.py" "$2" "${work}/$1.port" "${work}/$1.log" \
+	    "$3" "$4" "$5" &
+	pids="${pids} $!"
+	while [ ! -f "${work}/$1.port" ]; do
+		sleep 0.1
+	done
+	cat "${work}/$1.port"
+}
+
+mirrors="slow stalling fast"
+: > "${work}/index/index.html"
+for m in ${mirrors}; do
+	case ${m} in
+	slow) port=$(serve ${m} "${work}/repo" 1 ${rate} 0) ;;
+	stalling) port=$(serve ${m} "${work}/repo" 0 ${rate} 60) ;;
+	fast) port=$(serve ${m} "${work}/repo" 0 0 0) ;;
+	esac
+	echo "URL: http://127.0.0.1:${port}" >> "${work}/index/index.html"
+done
+port=$(serve index "${work}/index" 0 0 0)
+
+mkdir -p "${work}/repos" "${work}/db" "${work}/cache"
+cat > "${work}/repos/bench.conf" <<EOF
+bench: {
+	url: "http://127.0.0.1:${port}",
+	mirror_type: "http",
+	enabled: true
+}
+EOF
+
+bytes() {
+	awk '{ n += $1 } END { printf "%d", n }' "${work}/$1.log"
+}
+
+r=1
+while [ ${r} -le ${rounds} ]; do
+	for m in ${mirrors}; do
+		: > "${work}/${m}.log"
+	done
+	rm -rf "${work}/cache"/*
+	start=$(now)
+	"${PKG}" -o REPOS_DIR="${work}/repos" -o PKG_DBDIR="${work}/db" \
+	    -o PKG_CACHEDIR="${work}/cache" update -fq
+	"${PKG}" -o REPOS_DIR="${work}/repos" -o PKG_DBDIR="${work}/db" \
+	    -o PKG_CACHEDIR="${work}/cache" fetch -qya >/dev/null
+	end=$(now)
+	printf "%d\t%s" ${r} \
+	    "$(echo "${start} ${end}" | awk '{ printf "%.6f", $2 - $1 }')"
+	for m in ${mirrors}; do
+		printf "\t%s" "$(bytes ${m})"
+	done
+	printf "\n"
+	r=$((r + 1))
+done
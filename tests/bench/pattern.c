@@ -0,0 +1,185 @@
+/*-
+ * Copyright (c) 2026 The pkg contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer
+ *    in this position and unchanged.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Cost of glob and regex matching on the name-version of packages, with
+ * the bare pattern clause scanning the table and with the literal prefix
+ * range driving the name and name-version indexes.
+ * Output is one tab separated line per pattern and mode: pattern, mode,
+ * packages, matches, queries, seconds, microseconds per query.
+ */
+
+#include <sys/param.h>
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sqlite3.h>
+
+#include <pkg.h>
+#include <private/pkgdb.h>
+
+#include "bench.h"
+
+static const struct {
+	const char	*pattern;
+	match_t		 match;
+} patterns[] = {
+	{ "py39-*", MATCH_GLOB },
+	{ "py39-foo1*", MATCH_GLOB },
+	{ "foo-1.0*", MATCH_GLOB },
+	{ "*-doc", MATCH_GLOB },
+	{ "^py39-.*", MATCH_REGEX },
+	{ "^p5-foo12", MATCH_REGEX },
+	{ "doc$", MATCH_REGEX },
+};
+#define NPATTERNS (sizeof(patterns) / sizeof(patterns[0]))
+
+static const char *flavours[] = { "", "py39-", "py38-", "p5-", "rubygem-",
+    "php81-" };
+#define NFLAVOURS (sizeof(flavours) / sizeof(flavours[0]))
+
+static void
+populate(sqlite3 *db, int npkgs)
+{
+	sqlite3_stmt *stmt;
+	char name[64], version[16], origin[80];
+	int i;
+
+	if (sqlite3_exec(db, "CREATE TABLE packages ("
+	    "id INTEGER PRIMARY KEY, origin TEXT NOT NULL, "
+	    "name TEXT NOT NULL, version TEXT NOT NULL);"
+	    "BEGIN;", NULL, NULL, NULL) != SQLITE_OK)
+		errx(EXIT_FAILURE, "%s", sqlite3_errmsg(db));
+	if (sqlite3_prepare_v2(db, "INSERT INTO packages(origin, name, version) "
+	    "VALUES (?1, ?2, ?3);", -1, &stmt, NULL) != SQLITE_OK)
+		errx(EXIT_FAILURE, "%s", sqlite3_errmsg(db));
+	for (i = 0; i < npkgs; i++) {
+		snprintf(name, sizeof(name), "%sfoo%d%s",
+		    flavours[i % NFLAVOURS], i / 7,
+		    i % 11 == 0 ? "-doc" : "");
+		snprintf(version, sizeof(version), "%d.%d", i % 5, i % 13);
+		snprintf(origin, sizeof(origin), "cat%d/%s", i % 60, name);
+		sqlite3_bind_text(stmt, 1, origin, -1, SQLITE_STATIC);
+		sqlite3_bind_text(stmt, 2, name, -1, SQLITE_STATIC);
+		sqlite3_bind_text(stmt, 3, version, -1, SQLITE_STATIC);
+		if (sqlite3_step(stmt) != SQLITE_DONE)
+			errx(EXIT_FAILURE, "%s", sqlite3_errmsg(db));
+		sqlite3_reset(stmt);
+	}
+	sqlite3_finalize(stmt);
+
+	/* The indexes pkg update creates */
+	if (sqlite3_exec(db, "COMMIT;"
+	    "CREATE INDEX packages_origin ON packages(origin COLLATE NOCASE);"
+	    "CREATE INDEX packages_name ON packages(name COLLATE NOCASE);"
+	    "CREATE INDEX packages_uid ON packages(name, origin);"
+	    "CREATE INDEX packages_version ON packages(name, version);"
+	    "CREATE INDEX packages_namever "
+		"ON packages((name || '-' || version) COLLATE NOCASE);",
+	    NULL, NULL, NULL) != SQLITE_OK)
+		errx(EXIT_FAILURE, "%s", sqlite3_errmsg(db));
+}
+
+static void
+bench_query(sqlite3 *db, int npkgs, int queries, const char *pattern,
+    match_t match, bool range)
+{
+	sqlite3_stmt *stmt;
+	char *sql, *cond = NULL;
+	double start;
+	int i, matches = 0;
+
+	if (range)
+		cond = pkgdb_get_pattern_range(pattern, match);
+	sql = sqlite3_mprintf("SELECT id FROM packages AS p%s%s;",
+	    pkgdb_get_pattern_query(pattern, match), cond ? cond : "");
+	sqlite3_free(cond);
+	if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK)
+		errx(EXIT_FAILURE, "%s: %s", sql, sqlite3_errmsg(db));
+	sqlite3_free(sql);
+
+	start = bench_now();
+	for (i = 0; i < queries; i++) {
+		sqlite3_bind_text(stmt, 1, pattern, -1, SQLITE_STATIC);
+		matches = 0;
+		while (sqlite3_step(stmt) == SQLITE_ROW)
+			matches++;
+		sqlite3_reset(stmt);
+	}
+	start = bench_now() - start;
+	sqlite3_finalize(stmt);
+
+	printf("%s\t%s\t%d\t%d\t%d\t%.6f\t%.1f\n", pattern,
+	    range ? "range" : "scan", npkgs, matches, queries, start,
+	    start * 1e6 / queries);
+}
+
+int
+main(int argc, char **argv)
+{
+	sqlite3 *db;
+	size_t i;
+	int ch, npkgs = 35000, queries = 20, rounds = 3, n;
+
+	while ((ch = getopt(argc, argv, "n:q:r:")) != -1) {
+		switch (ch) {
+		case 'n':
+			npkgs = bench_number(optarg);
+			break;
+		case 'q':
+			queries = bench_number(optarg);
+			break;
+		case 'r':
+			rounds = bench_number(optarg);
+			break;
+		default:
+			bench_usage("pattern_bench [-n packages] "
+			    "[-q queries] [-r rounds]");
+		}
+	}
+
+	if (sqlite3_open(":memory:", &db) != SQLITE_OK)
+		errx(EXIT_FAILURE, "sqlite3_open");
+	pkgdb_sqlcmd_init(db, NULL, NULL);
+	populate(db, npkgs);
+
+	for (n = 0; n < rounds; n++) {
+		for (i = 0; i < NPATTERNS; i++) {
+			bench_query(db, npkgs, queries, patterns[i].pattern,
+			    patterns[i].match, false);
+			bench_query(db, npkgs, queries, patterns[i].pattern,
+			    patterns[i].match, true);
+		}
+	}
+
+	sqlite3_close(db);
+
+	return (EXIT_SUCCESS);
+}
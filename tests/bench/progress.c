@@ -0,0 +1,118 @@
+/*-
+ * Copyright (c) 2026 The pkg contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer
+ *    in this position and unchanged.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Cost of the progress ticks of a package with many files, as do_extract()
+ * and pkg_delete_files() emit them: one event per file as before, and
+ * coalesced by pkg_emit_progress_tick().  The events go to a
+ * callback and, with -p, to an event pipe opened on /dev/null.  Output is
+ * one tab separated line per measure: mode, ticks, events delivered,
+ * seconds, nanoseconds per tick.
+ *
+ * For the end to end time, run synthetic.sh -n 1 -f 100000 with and
+ * without this change.
+ */
+
+#include <sys/types.h>
+
+#include <err.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <pkg.h>
+#include <private/pkg.h>
+#include <private/event.h>
+
+#include "bench.h"
+
+static int64_t delivered;
+
+static int
+event_cb(void *data, struct pkg_event *ev)
+{
+	if (ev->type == PKG_EVENT_PROGRESS_TICK)
+		delivered++;
+	return (0);
+}
+
+static void
+report(const char *mode, int64_t ticks, double secs)
+{
+	printf("%s\t%jd\t%jd\t%.6f\t%.1f\n", mode, (intmax_t)ticks,
+	    (intmax_t)delivered, secs, secs * 1e9 / ticks);
+}
+
+int
+main(int argc, char **argv)
+{
+	int64_t ticks = 100000, i;
+	double start;
+	int ch, rounds = 3, r;
+	bool pipe = false;
+
+	while ((ch = getopt(argc, argv, "n:pr:")) != -1) {
+		switch (ch) {
+		case 'n':
+			ticks = bench_number(optarg);
+			break;
+		case 'p':
+			pipe = true;
+			break;
+		case 'r':
+			rounds = bench_number(optarg);
+			break;
+		default:
+			bench_usage("progress_bench [-n ticks] [-p] "
+			    "[-r rounds]");
+		}
+	}
+
+	pkg_event_register(event_cb, NULL);
+	if (pipe && (ctx.eventpipe = open("/dev/null", O_WRONLY)) == -1)
+		err(EXIT_FAILURE, "/dev/null");
+
+	for (r = 0; r < rounds; r++) {
+		/* A total changing on each tick defeats the coalescing */
+		delivered = 0;
+		pkg_emit_progress_start(NULL);
+		start = bench_now();
+		for (i = 0; i <= ticks; i++)
+			pkg_emit_progress_tick(i, ticks + (i & 1));
+		report("every", ticks, bench_now() - start);
+
+		delivered = 0;
+		pkg_emit_progress_start(NULL);
+		start = bench_now();
+		for (i = 0; i <= ticks; i++)
+			pkg_emit_progress_tick(i, ticks);
+		report("coalesced", ticks, bench_now() - start);
+	}
+
+	return (EXIT_SUCCESS);
+}
@@ -0,0 +1,210 @@
+/*-
+ * Copyright (c) 2026 The pkg contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer
+ *    in this position and unchanged.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Cost of loading the reverse dependencies of repository packages: one
+ * lookup per package without and with the deps name index, and the bulk
+ * load iterators over the whole repository do.
+ * Output is one tab separated line per round and mode: mode, packages,
+ * dependencies, packages loaded, reverse dependencies, seconds,
+ * microseconds per package.
+ */
+
+#include <sys/param.h>
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sqlite3.h>
+
+#include <pkg.h>
+#include <private/pkg.h>
+
+#include "bench.h"
+
+static void
+exec(sqlite3 *db, const char *sql)
+{
+	if (sqlite3_exec(db, sql, NULL, NULL, NULL) != SQLITE_OK)
+		errx(EXIT_FAILURE, "%s: %s", sql, sqlite3_errmsg(db));
+}
+
+/*
+ * Dependencies favour the first packages, the way most of the ports tree
+ * depends on a few hundred libraries and tools.
+ */
+static int
+populate(sqlite3 *db, int npkgs, int maxdeps)
+{
+	sqlite3_stmt *pkg, *dep;
+	char name[32], dname[32];
+	int i, j, n, target, ndeps = 0;
+
+	exec(db, "BEGIN;");
+	if (sqlite3_prepare_v2(db, "INSERT INTO packages(id, origin, name, "
+	    "version, comment, desc, arch, maintainer, prefix, pkgsize, "
+	    "flatsize, licenselogic, cksum, path) VALUES (?1, ?2, ?2, '1.0', "
+	    "'', '', '*', 'bench', '/usr/local', 0, 0, 1, '', '');", -1, &pkg,
+	    NULL) != SQLITE_OK ||
+	    sqlite3_prepare_v2(db, "INSERT OR IGNORE INTO deps(origin, name, "
+	    "version, package_id) VALUES (?1, ?1, '1.0', ?2);", -1, &dep,
+	    NULL) != SQLITE_OK)
+		errx(EXIT_FAILURE, "%s", sqlite3_errmsg(db));
+
+	srandom(npkgs);
+	for (i = 1; i <= npkgs; i++) {
+		snprintf(name, sizeof(name), "pkg%d", i);
+		sqlite3_bind_int(pkg, 1, i);
+		sqlite3_bind_text(pkg, 2, name, -1, SQLITE_STATIC);
+		if (sqlite3_step(pkg) != SQLITE_DONE)
+			errx(EXIT_FAILURE, "%s", sqlite3_errmsg(db));
+		sqlite3_reset(pkg);
+
+		n = i > 1 ? random() % (maxdeps + 1) : 0;
+		for (j = 0; j < n; j++) {
+			/* A product of two draws skews the targets low */
+			target = 1 + (int)((double)(random() % 1000) *
+			    (random() % 1000) / 1e6 * (i - 1));
+			snprintf(dname, sizeof(dname), "pkg%d", target);
+			sqlite3_bind_text(dep, 1, dname, -1, SQLITE_STATIC);
+			sqlite3_bind_int(dep, 2, i);
+			if (sqlite3_step(dep) != SQLITE_DONE)
+				errx(EXIT_FAILURE, "%s", sqlite3_errmsg(db));
+			ndeps += sqlite3_changes(db);
+			sqlite3_reset(dep);
+		}
+	}
+	sqlite3_finalize(pkg);
+	sqlite3_finalize(dep);
+	exec(db, "COMMIT;");
+
+	return (ndeps);
+}
+
+static void
+bench_rdeps(struct pkg_repo *r, const char *mode, int npkgs, int ndeps,
+    int sample)
+{
+	struct pkg_repo_it *it;
+	struct pkg *pkg = NULL;
+	double start;
+	int loaded = 0, rdeps = 0;
+	bool bulk = strcmp(mode, "bulk") == 0;
+
+	start = bench_now();
+	if ((it = r->ops->query(r, NULL, MATCH_ALL)) == NULL)
+		errx(EXIT_FAILURE, "query");
+	while ((sample == 0 || loaded < sample) &&
+	    it->ops->next(it, &pkg, bulk ? PKG_LOAD_BASIC|PKG_LOAD_RDEPS :
+	    PKG_LOAD_BASIC) == EPKG_OK) {
+		/* The per package path pkgdb_it_next() takes otherwise */
+		if (!bulk && r->ops->ensure_loaded(r, pkg, PKG_LOAD_RDEPS) !=
+		    EPKG_OK)
+			errx(EXIT_FAILURE, "ensure_loaded");
+		rdeps += pkg_list_count(pkg, PKG_RDEPS);
+		loaded++;
+	}
+	it->ops->free(it);
+	pkg_free(pkg);
+	start = bench_now() - start;
+
+	printf("%s\t%d\t%d\t%d\t%d\t%.6f\t%.1f\n", mode, npkgs, ndeps, loaded,
+	    rdeps, start, start * 1e6 / loaded);
+}
+
+int
+main(int argc, char **argv)
+{
+	char dir[] = "/tmp/rdeps_bench.XXXXXX";
+	char path[MAXPATHLEN], cmd[64];
+	struct pkg_repo *r = NULL;
+	sqlite3 *db;
+	FILE *f;
+	int ch, npkgs = 32000, maxdeps = 20, sample = 200, rounds = 3, n;
+	int ndeps;
+
+	while ((ch = getopt(argc, argv, "d:n:r:s:")) != -1) {
+		switch (ch) {
+		case 'd':
+			maxdeps = bench_number(optarg);
+			break;
+		case 'n':
+			npkgs = bench_number(optarg);
+			break;
+		case 'r':
+			rounds = bench_number(optarg);
+			break;
+		case 's':
+			sample = bench_number(optarg);
+			break;
+		default:
+			bench_usage("rdeps_bench [-d max deps] "
+			    "[-n packages] [-r rounds] [-s scan sample]");
+		}
+	}
+
+	if (mkdtemp(dir) == NULL)
+		err(EXIT_FAILURE, "mkdtemp");
+	setenv("PKG_DBDIR", dir, 1);
+
+	snprintf(path, sizeof(path), "%s/pkg.conf", dir);
+	if ((f = fopen(path, "w")) == NULL)
+		err(EXIT_FAILURE, "%s", path);
+	fprintf(f, "REPOS_DIR: []\nrepositories: {\n"
+	    "  bench: { url: \"file://%s/bench\" }\n}\n", dir);
+	fclose(f);
+
+	if (pkg_ini(path, NULL, 0) != EPKG_OK)
+		errx(EXIT_FAILURE, "pkg_ini");
+	if (pkg_repos(&r) != EPKG_OK)
+		errx(EXIT_FAILURE, "no repository");
+	if (r->ops->create(r) != EPKG_OK ||
+	    r->ops->open(r, R_OK|W_OK) != EPKG_OK ||
+	    r->ops->init(r) != EPKG_OK)
+		errx(EXIT_FAILURE, "cannot create %s", pkg_repo_name(r));
+	db = r->priv;
+	ndeps = populate(db, npkgs, maxdeps);
+
+	/* Without the index every lookup scans deps: sample a few packages */
+	for (n = 0; n < rounds; n++)
+		bench_rdeps(r, "scan", npkgs, ndeps, sample);
+	exec(db, "CREATE INDEX deps_name ON deps(name);");
+	for (n = 0; n < rounds; n++) {
+		bench_rdeps(r, "index", npkgs, ndeps, 0);
+		bench_rdeps(r, "bulk", npkgs, ndeps, 0);
+	}
+
+	r->ops->close(r, false);
+	pkg_shutdown();
+
+	snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+	system(cmd);
+
+	return (EXIT_SUCCESS);
+}
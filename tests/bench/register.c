@@ -0,0 +1,160 @@
+/*-
+ * Copyright (c) 2026 The pkg contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer
+ *    in this position and unchanged.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * pkgdb_register_pkg() of packages with large file lists into a local
+ * database already holding other packages.  Output is one tab separated
+ * line per round: test, files, seconds.  "register" installs new paths,
+ * "register_forced" registers the same paths again under another name
+ * in forced mode, where every file is a conflict.
+ */
+
+#include <sys/param.h>
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <pkg.h>
+#include <private/pkg.h>
+#include <private/pkgdb.h>
+
+#include "bench.h"
+
+static int
+event_cb(void *data, struct pkg_event *ev)
+{
+	/* Conflicts are expected in forced mode */
+	return (0);
+}
+
+static struct pkg *
+bench_pkg(const char *name, const char *dir, size_t nfiles)
+{
+	struct pkg *pkg = NULL;
+	char path[MAXPATHLEN];
+	size_t i, j;
+
+	if (pkg_new(&pkg, PKG_FILE) != EPKG_OK)
+		errx(EXIT_FAILURE, "pkg_new");
+	pkg_set(pkg, PKG_NAME, name, PKG_ORIGIN, "bench/bench",
+	    PKG_VERSION, "1", PKG_COMMENT, "bench", PKG_DESC, "bench",
+	    PKG_MAINTAINER, "bench", PKG_WWW, "http://bench",
+	    PKG_PREFIX, "/usr/local");
+	/* Plists are not always sorted, spread the paths around */
+	for (i = 0; i < nfiles; i++) {
+		j = (i * 7919) % nfiles;
+		snprintf(path, sizeof(path), "/usr/local/%s/%zu/file%zu",
+		    dir, j % 512, j);
+		pkg_addfile(pkg, path,
+		    "1$0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef",
+		    false);
+	}
+
+	return (pkg);
+}
+
+static double
+bench_register(struct pkgdb *db, struct pkg *pkg, int forced)
+{
+	double start;
+	int ret;
+
+	start = bench_now();
+	ret = pkgdb_register_pkg(db, pkg, forced);
+	pkgdb_register_finale(db, ret);
+	if (ret != EPKG_OK)
+		errx(EXIT_FAILURE, "pkgdb_register_pkg");
+
+	return (bench_now() - start);
+}
+
+int
+main(int argc, char **argv)
+{
+	char dir[] = "/tmp/register_bench.XXXXXX";
+	char name[32], subdir[32], cmd[64];
+	struct pkgdb *db = NULL;
+	struct pkg *pkg;
+	size_t nfiles = 100000, background = 200000;
+	int ch, rounds = 3, r;
+
+	while ((ch = getopt(argc, argv, "b:n:r:")) != -1) {
+		switch (ch) {
+		case 'b':
+			background = bench_number(optarg);
+			break;
+		case 'n':
+			nfiles = bench_number(optarg);
+			break;
+		case 'r':
+			rounds = bench_number(optarg);
+			break;
+		default:
+			bench_usage("register_bench [-b files] "
+			    "[-n files] [-r rounds]");
+		}
+	}
+
+	if (mkdtemp(dir) == NULL)
+		err(EXIT_FAILURE, "mkdtemp");
+	setenv("PKG_DBDIR", dir, 1);
+	pkg_event_register(event_cb, NULL);
+	if (pkg_init(NULL, NULL) != EPKG_OK)
+		errx(EXIT_FAILURE, "pkg_init");
+	if (pkgdb_open(&db, PKGDB_DEFAULT) != EPKG_OK)
+		errx(EXIT_FAILURE, "pkgdb_open");
+
+	if (background > 0) {
+		pkg = bench_pkg("background", "lib", background);
+		bench_register(db, pkg, 0);
+		pkg_free(pkg);
+	}
+
+	for (r = 0; r < rounds; r++) {
+		snprintf(name, sizeof(name), "bench%d", r);
+		snprintf(subdir, sizeof(subdir), "share/bench%d", r);
+		pkg = bench_pkg(name, subdir, nfiles);
+		printf("register\t%zu\t%.6f\n", nfiles,
+		    bench_register(db, pkg, 0));
+		pkg_free(pkg);
+
+		snprintf(name, sizeof(name), "bench%d-forced", r);
+		pkg = bench_pkg(name, subdir, nfiles);
+		printf("register_forced\t%zu\t%.6f\n", nfiles,
+		    bench_register(db, pkg, 1));
+		pkg_free(pkg);
+	}
+
+	pkgdb_close(db);
+	pkg_shutdown();
+	snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+	system(cmd);
+
+	return (EXIT_SUCCESS);
+}
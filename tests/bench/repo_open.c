@@ -0,0 +1,146 @@
+/*-
+ * Copyright (c) 2026 The pkg contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer
+ *    in this position and unchanged.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Cost of opening repository databases, running the validation checks on
+ * every open and skipping them once a validation stamp is recorded.
+ * Output is one tab separated line per round: mode, repositories, opens,
+ * seconds, microseconds per open.
+ */
+
+#include <sys/param.h>
+#include <sys/stat.h>
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <pkg.h>
+#include <private/pkg.h>
+
+#include "bench.h"
+
+static void
+open_all(void)
+{
+	struct pkg_repo *r = NULL;
+
+	while (pkg_repos(&r) == EPKG_OK) {
+		if (r->ops->open(r, R_OK) != EPKG_OK)
+			errx(EXIT_FAILURE, "cannot open %s", pkg_repo_name(r));
+		r->ops->close(r, false);
+	}
+}
+
+static void
+bench_open(const char *mode, const char *conf, size_t nrepos, int opens)
+{
+	double start;
+	int i;
+
+	setenv("REPO_VALIDATION_STAMP",
+	    strcmp(mode, "stamp") == 0 ? "YES" : "NO", 1);
+	if (pkg_ini(conf, NULL, 0) != EPKG_OK)
+		errx(EXIT_FAILURE, "pkg_ini");
+	/* Not timed: records the stamps */
+	open_all();
+
+	start = bench_now();
+	for (i = 0; i < opens; i++)
+		open_all();
+	start = bench_now() - start;
+	printf("%s\t%zu\t%d\t%.6f\t%.1f\n", mode, nrepos, opens, start,
+	    start * 1e6 / (opens * nrepos));
+	pkg_shutdown();
+}
+
+int
+main(int argc, char **argv)
+{
+	char dir[] = "/tmp/repo_open_bench.XXXXXX";
+	char path[MAXPATHLEN], cmd[64];
+	struct pkg_repo *r = NULL;
+	FILE *f;
+	size_t nrepos = 20, i;
+	int ch, opens = 100, rounds = 3, n;
+
+	while ((ch = getopt(argc, argv, "n:o:r:")) != -1) {
+		switch (ch) {
+		case 'n':
+			nrepos = bench_number(optarg);
+			break;
+		case 'o':
+			opens = bench_number(optarg);
+			break;
+		case 'r':
+			rounds = bench_number(optarg);
+			break;
+		default:
+			bench_usage("repo_open_bench [-n repositories] "
+			    "[-o opens] [-r rounds]");
+		}
+	}
+
+	if (mkdtemp(dir) == NULL)
+		err(EXIT_FAILURE, "mkdtemp");
+	setenv("PKG_DBDIR", dir, 1);
+
+	snprintf(path, sizeof(path), "%s/pkg.conf", dir);
+	if ((f = fopen(path, "w")) == NULL)
+		err(EXIT_FAILURE, "%s", path);
+	fprintf(f, "REPOS_DIR: []\nrepositories: {\n");
+	for (i = 0; i < nrepos; i++)
+		fprintf(f, "  bench%zu: { url: \"file://%s/bench%zu\" },\n", i,
+		    dir, i);
+	fprintf(f, "}\n");
+	fclose(f);
+
+	/* Empty databases, as pkg update creates them */
+	if (pkg_ini(path, NULL, 0) != EPKG_OK)
+		errx(EXIT_FAILURE, "pkg_ini");
+	n = 0;
+	while (pkg_repos(&r) == EPKG_OK) {
+		if (r->ops->create(r) != EPKG_OK)
+			errx(EXIT_FAILURE, "cannot create %s", pkg_repo_name(r));
+		n++;
+	}
+	pkg_shutdown();
+	if (n != (int)nrepos)
+		errx(EXIT_FAILURE, "expected %zu repositories, got %d", nrepos,
+		    n);
+
+	for (n = 0; n < rounds; n++) {
+		bench_open("probe", path, nrepos, opens);
+		bench_open("stamp", path, nrepos, opens);
+	}
+
+	snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+	system(cmd);
+
+	return (EXIT_SUCCESS);
+}
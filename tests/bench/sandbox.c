@@ -0,0 +1,179 @@
+/*-
+ * Copyright (c) 2026 The pkg contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer
+ *    in this position and unchanged.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Latency of sandboxed signature checks: rsa_verify() of a small file,
+ * with the sandbox worker and with a process forked per call.  The
+ * sandbox handler is the frontend's, minus the privilege dropping.
+ * Output is one tab separated line per round: mode, calls, seconds and
+ * microseconds per call.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <err.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <openssl/pem.h>
+#include <openssl/rsa.h>
+
+#include <pkg.h>
+#include <private/pkg.h>
+#include <private/utils.h>
+
+#include "bench.h"
+
+static int
+sandbox_call(pkg_sandbox_cb func, int fd, void *ud)
+{
+	pid_t pid;
+	int status;
+
+	if ((pid = fork()) == -1)
+		err(EXIT_FAILURE, "fork");
+	if (pid == 0)
+		_exit(func(fd, ud));
+	while (waitpid(pid, &status, 0) == -1)
+		;
+
+	return (WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+}
+
+static int
+event_cb(void *data, struct pkg_event *ev)
+{
+	switch (ev->type) {
+	case PKG_EVENT_SANDBOX_CALL:
+		return (sandbox_call(ev->e_sandbox_call.call,
+		    ev->e_sandbox_call.fd, ev->e_sandbox_call.userdata));
+	default:
+		return (bench_event(data, ev));
+	}
+}
+
+static void
+make_key(const char *priv, const char *pub)
+{
+	BIGNUM *e;
+	RSA *rsa;
+	FILE *fp;
+
+	rsa = RSA_new();
+	e = BN_new();
+	BN_set_word(e, RSA_F4);
+	if (RSA_generate_key_ex(rsa, 2048, e, NULL) != 1)
+		errx(EXIT_FAILURE, "RSA_generate_key_ex");
+	if ((fp = fopen(priv, "w")) == NULL)
+		err(EXIT_FAILURE, "%s", priv);
+	PEM_write_RSAPrivateKey(fp, rsa, NULL, NULL, 0, NULL, NULL);
+	fclose(fp);
+	if ((fp = fopen(pub, "w")) == NULL)
+		err(EXIT_FAILURE, "%s", pub);
+	PEM_write_RSA_PUBKEY(fp, rsa);
+	fclose(fp);
+	BN_free(e);
+	RSA_free(rsa);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct rsa_key *key = NULL;
+	unsigned char *sig = NULL;
+	unsigned int siglen;
+	char dir[] = "/tmp/sandbox_bench.XXXXXX";
+	char priv[PATH_MAX], pub[PATH_MAX], data[PATH_MAX];
+	const char *modes[] = { "YES", "NO" };
+	double start;
+	size_t m;
+	int fd, ch, i, r, calls = 200, rounds = 3;
+
+	while ((ch = getopt(argc, argv, "n:r:")) != -1) {
+		switch (ch) {
+		case 'n':
+			calls = bench_number(optarg);
+			break;
+		case 'r':
+			rounds = bench_number(optarg);
+			break;
+		default:
+			bench_usage("sandbox_bench [-n calls] [-r rounds]");
+		}
+	}
+
+	if (mkdtemp(dir) == NULL)
+		err(EXIT_FAILURE, "mkdtemp");
+	snprintf(priv, sizeof(priv), "%s/key", dir);
+	snprintf(pub, sizeof(pub), "%s/key.pub", dir);
+	snprintf(data, sizeof(data), "%s/data", dir);
+
+	make_key(priv, pub);
+	if ((fd = open(data, O_RDWR | O_CREAT, 0644)) == -1)
+		err(EXIT_FAILURE, "%s", data);
+	for (i = 0; i < 1024; i++)
+		dprintf(fd, "line %d of the signed file\n", i);
+
+	pkg_event_register(event_cb, NULL);
+
+	for (m = 0; m < NELEM(modes); m++) {
+		setenv("SANDBOX_WORKER", modes[m], 1);
+		if (pkg_init(NULL, NULL) != EPKG_OK)
+			errx(EXIT_FAILURE, "pkg_init");
+		if (sig == NULL) {
+			rsa_new(&key, NULL, priv);
+			if (rsa_sign(data, key, &sig, &siglen) != EPKG_OK)
+				errx(EXIT_FAILURE, "rsa_sign");
+			rsa_free(key);
+		}
+		for (r = 0; r < rounds; r++) {
+			start = bench_now();
+			for (i = 0; i < calls; i++) {
+				if (rsa_verify(pub, sig, siglen, fd) != EPKG_OK)
+					errx(EXIT_FAILURE, "rsa_verify");
+			}
+			start = bench_now() - start;
+			printf("%s\t%d\t%.6f\t%.1f\n",
+			    m == 0 ? "worker" : "fork", calls, start,
+			    start * 1e6 / calls);
+		}
+		pkg_shutdown();
+	}
+
+	close(fd);
+	unlink(data);
+	unlink(priv);
+	unlink(pub);
+	rmdir(dir);
+	free(sig);
+
+	return (EXIT_SUCCESS);
+}
@@ -0,0 +1,152 @@
+#!/bin/sh
+#
+# Times the pkg hot paths against a synthetic file:// repository.
+#
+# Usage: synthetic.sh [-d deps] [-f files] [-k] [-n packages] [-r rounds]
+#
+# Packages are named bench<N>; each depends on the next <deps> ones and
+# installs <files> small files.  Every round runs, in a rootdir:
+#   update	pkg update -f
+#   solve	pkg install -n of all the packages
+#   install	pkg install -y of all the packages
+#   check	pkg check -s -a
+#   delete	pkg delete -y -a
+# Output is one tab separated line per phase and round: phase, packages,
+# files per package, deps per package, round, seconds.
+#
+# The pkg binary is taken from $PKG, then from the build tree.  -k keeps
+# the work directory.
+
+set -e
+
+npkgs=200
+nfiles=50
+ndeps=3
+rounds=3
+keep=no
+
+while getopts "d:f:kn:r:" ch; do
+	case ${ch} in
+	d) ndeps=${OPTARG} ;;
+	f) nfiles=${OPTARG} ;;
+	k) keep=yes ;;
+	n) npkgs=${OPTARG} ;;
+	r) rounds=${OPTARG} ;;
+	*)
+		echo "usage: synthetic.sh [-d deps] [-f files] [-k]" \
+		    "[-n packages] [-r rounds]" >&2
+		exit 1
+		;;
+	esac
+done
+
+if [ -z "${PKG}" ]; then
+	PKG=$(cd "$(dirname "$0")/../../src" 2>/dev/null && pwd)/pkg
+	[ -x "${PKG}" ] || PKG=pkg
+fi
+
+work=$(mktemp -d "${TMPDIR:-/tmp}/pkg_bench.XXXXXX")
+cleanup() {
+	if [ "${keep}" = "yes" ]; then
+		echo "work directory: ${work}" >&2
+	else
+		rm -rf "${work}"
+	fi
+}
+trap cleanup EXIT
+
+# date(1) only has sub-second precision where %N is supported
+case $(date +%N) in
+*N*|"") now() { date +%s; } ;;
+*) now() { date +%s.%N; } ;;
+esac
+
+export INSTALL_AS_USER=yes
+export NO_TICK=yes
+root=${work}/root
+pkgcmd() {
+	"${PKG}" -o REPOS_DIR="${work}" -o PKG_CACHEDIR="${work}/cache" \
+	    -r "${root}" "$@"
+}
+
+# measure <phase> <expected exit status> <pkg arguments>
+measure() {
+	phase=$1
+	expect=$2
+	shift 2
+	status=0
+	start=$(now)
+	pkgcmd "$@" >"${work}/${phase}.log" 2>&1 || status=$?
+	end=$(now)
+	if [ ${status} -ne ${expect} ]; then
+		echo "${phase} failed, see ${work}/${phase}.log" >&2
+		keep=yes
+		exit 1
+	fi
+	printf "%s\t%d\t%d\t%d\t%d\t%s\n" "${phase}" "${npkgs}" "${nfiles}" \
+	    "${ndeps}" "${round}" \
+	    "$(echo "${start} ${end}" | awk '{ printf "%.6f", $2 - $1 }')"
+}
+
+# Stage and package the synthetic tree
+mkdir -p "${work}/stage" "${work}/repo" "${root}/var/db/pkg"
+i=0
+while [ ${i} -lt ${npkgs} ]; do
+	name=bench${i}
+	dir=${work}/stage/usr/local/share/${name}
+	mkdir -p "${dir}"
+	awk -v dir="${dir}" -v n="${nfiles}" -v name="${name}" 'BEGIN {
+		for (j = 0; j < n; j++) {
+			f = dir "/file" j
+			printf "%s %d\n", name, j > f
+			close(f)
+			printf "share/%s/file%d\n", name, j
+		}
+	}' > "${work}/${name}.plist"
+	{
+		cat <<EOF
+name: ${name}
+origin: bench/${name}
+version: "1"
+maintainer: bench
+categories: [bench]
+comment: synthetic benchmark package
+www: http://bench
+prefix: /usr/local
+abi: "*"
+desc: synthetic benchmark package
+EOF
+		echo "deps: {"
+		j=$((i + 1))
+		while [ ${j} -le $((i + ndeps)) ] && [ ${j} -lt ${npkgs} ]; do
+			echo "  bench${j}: { origin: bench/bench${j}, version: \"1\" },"
+			j=$((j + 1))
+		done
+		echo "}"
+	} > "${work}/${name}.ucl"
+	"${PKG}" create -r "${work}/stage" -o "${work}/repo" \
+	    -M "${work}/${name}.ucl" -p "${work}/${name}.plist"
+	i=$((i + 1))
+done
+"${PKG}" repo -q "${work}/repo" >/dev/null
+
+cat > "${work}/bench.conf" <<EOF
+bench: {
+	url: "file://${work}/repo",
+	enabled: true
+}
+EOF
+
+# A dry run does not create the local database
+pkgcmd stats -l >/dev/null 2>&1
+
+round=0
+while [ ${round} -lt ${rounds} ]; do
+	measure update 0 update -f
+	# A dry run exits with 1 when there is something to do
+	measure solve 1 install -n -U -g 'bench*'
+	measure install 0 install -y -U -g 'bench*'
+	measure check 0 check -s -a
+	measure delete 0 delete -y -a
+	round=$((round + 1))
+done
@@ -5,7 +5,8 @@ tests_init \
 	empty_conf \
 	duplicate_pkgs_notallowed \
 	inline_repo \
-	nameserver
+	nameserver \
+	snapshot
 #	duplicate_pkgs_allowed \
 
 duplicate_pkgs_allowed_body() {
@@ -115,3 +116,31 @@ nameserver_body()
 		-e inline:"${PROGNAME}: Unable to set nameserver, ignoring\n" \
 		pkg -o NAMESERVER="plop" -C /dev/null config nameserver
 }
+
+snapshot_body()
+{
+	mkdir repos
+	cat > repos/test.conf << EOF
+test: { url = file:///tmp }
+EOF
+	atf_check -o match:'^    url             : "file:///tmp",$' \
+		pkg -o REPOS_DIR=${TMPDIR}/repos -C /dev/null -vv
+	test -f config.snapshot || atf_fail "no snapshot written"
+
+	atf_check -o match:'^    url             : "file:///tmp",$' \
+		pkg -o REPOS_DIR=${TMPDIR}/repos -C /dev/null -vv
+
+	cat > repos/test.conf << EOF
+test: { url = file:///tmp/changed }
+EOF
+	cat > repos/other.conf << EOF
+other: { url = file:///other }
+EOF
+	atf_check -o match:'^    url             : "file:///tmp/changed",$' \
+		-o match:'^    url             : "file:///other",$' \
+		pkg -o REPOS_DIR=${TMPDIR}/repos -C /dev/null -vv
+
+	rm repos/other.conf
+	atf_check -o not-match:'file:///other' \
+		pkg -o REPOS_DIR=${TMPDIR}/repos -C /dev/null -vv
+}
@@ -3,7 +3,8 @@
 . $(atf_get_srcdir)/test_environment.sh
 
 tests_init \
-	find_conflicts
+	find_conflicts \
+	find_conflicts_filelist
 
 find_conflicts_body() {
 	touch a
@@ -98,3 +99,66 @@ ${JAILED}[2/2] Extracting test2-1:  done
 		-s exit:0 \
 		pkg -o REPOS_DIR="${TMPDIR}" -o PKG_CACHEDIR="${TMPDIR}" install -y test2-1
 }
+
+find_conflicts_filelist_body() {
+	touch a
+	for p in test test2; do
+		cat << EOF > manifest.${p}
+name: ${p}
+origin: test
+version: 1
+maintainer: test
+categories: [test]
+comment: a test
+www: http://test
+prefix: /
+abi = "*";
+desc: <<EOD
+Yet another test
+EOD
+files: {
+	${TMPDIR}/a: "",
+}
+EOF
+	done
+
+	atf_check \
+		-o match:".*Installing.*\.\.\.$" \
+		-e empty \
+		-s exit:0 \
+		pkg register -M manifest.test
+
+	mkdir repo
+	atf_check \
+		-o empty \
+		-e empty \
+		-s exit:0 \
+		pkg create -M manifest.test2 -o repo
+
+	atf_check \
+		-o ignore \
+		-e empty \
+		-s exit:0 \
+		pkg repo -l repo
+
+	cat << EOF > repo.conf
+local: {
+	url: file:///${TMPDIR}/repo,
+	enabled: true
+}
+EOF
+
+	atf_check \
+		-o match:"Fetching filesite.txz" \
+		-e ignore \
+		-s exit:0 \
+		pkg -o REPOS_DIR="${TMPDIR}" update
+
+	# The package is gone: only the imported file list knows its files
+	rm repo/test2-1.txz
+	atf_check \
+		-o match:"test2-1 conflicts with test-1 on ${TMPDIR}/a" \
+		-e ignore \
+		-s exit:1 \
+		pkg -o REPOS_DIR="${TMPDIR}" -o PKG_CACHEDIR="${TMPDIR}" -o REPO_AUTOUPDATE=no install -n test2
+}
@@ -4,6 +4,7 @@
 
 tests_init \
 	create_from_plist \
+	create_from_plist_tzst \
 	create_from_plist_set_owner \
 	create_from_plist_set_group \
 	create_from_plist_gather_mode \
@@ -15,7 +16,8 @@ tests_init \
 	create_from_plist_with_keyword_arguments \
 	create_from_manifest_and_plist \
 	create_from_plist_pkg_descr \
-	create_from_plist_with_keyword_and_message
+	create_from_plist_with_keyword_and_message \
+	create_installed_jobs
 
 genmanifest() {
 	cat << EOF >> +MANIFEST
@@ -71,6 +73,29 @@ create_from_plist_body() {
 		tar tvf test-1.txz
 }
 
+create_from_plist_tzst_body() {
+	touch file1
+	genmanifest
+	genplist "file1"
+
+	atf_check \
+		-o empty \
+		-e ignore \
+		-s exit:0 \
+		env COMPRESSION_LEVEL=3 COMPRESSION_THREADS=0 \
+		pkg create -f tzst -o ${TMPDIR} -m . -p test.plist -r .
+
+	if [ -f test-1.txz ]; then
+		atf_skip "libarchive built without zstd support"
+	fi
+	test -f test-1.tzst || atf_fail "Package not created"
+	atf_check \
+		-o inline:"test-1\n" \
+		-e empty \
+		-s exit:0 \
+		pkg query -F test-1.tzst %n-%v
+}
+
 create_from_plist_set_owner_body() {
 
 	preparetestcredentials "(plop,,)"
@@ -424,3 +449,42 @@ on install
 	atf_check -o inline:"${OUTPUT}" pkg info -D -F ./test-1.txz
 
 }
+
+create_installed_jobs_body() {
+	for p in test1 test2 test3; do
+		touch ${p}.file
+		cat << EOF > ${p}.ucl
+name: ${p}
+origin: test/${p}
+version: 1
+maintainer: test
+categories: [test]
+comment: a test
+www: http://test
+prefix: /usr/local
+desc: <<EOD
+Yet another test
+EOD
+files: {
+	${TMPDIR}/${p}.file: "",
+}
+EOF
+		atf_check \
+		    -o match:".*Installing.*\.\.\.$" \
+		    -e empty \
+		    -s exit:0 \
+		    pkg register -M ${p}.ucl
+	done
+
+	atf_check \
+	    -o match:"^\[1/3\] Creating package for test1-1: " \
+	    -o match:"^\[3/3\] Creating package for test3-1: " \
+	    -o match:"^Created 3 packages .* with 2 jobs" \
+	    -e empty \
+	    -s exit:0 \
+	    pkg create -j 2 -o out -a
+
+	for p in test1 test2 test3; do
+		test -f out/${p}-1.txz || atf_fail "${p} not created"
+	done
+}
@@ -9,7 +9,10 @@ tests_init \
 	setuid_hardlinks \
 	chflags \
 	chflags_schg \
-	symlinks
+	symlinks \
+	unchanged_files \
+	fsync_policy \
+	checksum_mismatch
 
 basic_body()
 {
@@ -274,3 +277,127 @@ EOF
 		pkg -o REPOS_DIR=/dev/null -r ${TMPDIR}/target install -qfy \
 			${TMPDIR}/test-1.txz
 }
+
+unchanged_files_body()
+{
+	echo "same" > a
+	echo "old" > b
+	echo "local" > c
+	for v in 1 2 3; do
+		new_pkg "test${v}" "test" "${v}" || \
+		    atf_fail "fail to create the ucl file"
+		cat << EOF >> test${v}.ucl
+files: {
+${TMPDIR}/a = "";
+${TMPDIR}/b = "";
+${TMPDIR}/c = "";
+}
+EOF
+	done
+	mkdir repo repos
+	cat > repos/local.conf << EOF
+local: { url: file://${TMPDIR}/repo }
+EOF
+
+	atf_check -o empty -e empty -s exit:0 pkg create -M test1.ucl
+	mkdir ${TMPDIR}/target
+	atf_check \
+		-o empty \
+		-e empty \
+		-s exit:0 \
+		pkg -o REPOS_DIR=/dev/null -r ${TMPDIR}/target install -qy \
+			${TMPDIR}/test-1.txz
+
+	inode=$(ls -i ${TMPDIR}/target${TMPDIR}/a | awk '{ print $1 }')
+	echo "edited" > ${TMPDIR}/target${TMPDIR}/c
+	echo "new" > b
+	atf_check -o empty -e empty -s exit:0 pkg create -M test2.ucl -o repo
+	atf_check -o ignore -e empty -s exit:0 pkg repo repo
+	atf_check -o ignore -e ignore -s exit:0 \
+		pkg -o REPOS_DIR=${TMPDIR}/repos -r ${TMPDIR}/target update
+
+	# On upgrade, a is left in place, b changed in the package and c
+	# on disk
+	atf_check \
+		-o ignore \
+		-e empty \
+		-s exit:0 \
+		pkg -o REPOS_DIR=${TMPDIR}/repos -r ${TMPDIR}/target upgrade -y
+	atf_check -o inline:"2\n" pkg -r ${TMPDIR}/target query %v test
+	test "$(ls -i ${TMPDIR}/target${TMPDIR}/a | awk '{ print $1 }')" = \
+	    "${inode}" || atf_fail "unchanged file extracted again"
+	atf_check -o inline:"new\n" cat ${TMPDIR}/target${TMPDIR}/b
+	atf_check -o inline:"local\n" cat ${TMPDIR}/target${TMPDIR}/c
+
+	atf_check -o empty -e empty -s exit:0 pkg create -M test3.ucl -o repo
+	atf_check -o ignore -e empty -s exit:0 pkg repo repo
+	atf_check -o ignore -e ignore -s exit:0 \
+		pkg -o REPOS_DIR=${TMPDIR}/repos -r ${TMPDIR}/target update -f
+	atf_check \
+		-o ignore \
+		-e empty \
+		-s exit:0 \
+		pkg -o REPOS_DIR=${TMPDIR}/repos -o SKIP_UNCHANGED_FILES=no \
+			-r ${TMPDIR}/target upgrade -y
+	atf_check -o inline:"3\n" pkg -r ${TMPDIR}/target query %v test
+	test "$(ls -i ${TMPDIR}/target${TMPDIR}/a | awk '{ print $1 }')" != \
+	    "${inode}" || atf_fail "file not extracted again"
+}
+
+fsync_policy_body()
+{
+	echo "test" > a
+	mkdir b
+	echo "test" > b/c
+	new_pkg "test" "test" "1" || atf_fail "fail to create the ucl file"
+	cat << EOF >> test.ucl
+files: {
+${TMPDIR}/a = "";
+${TMPDIR}/b/c = "";
+}
+EOF
+
+	atf_check -o empty -e empty -s exit:0 pkg create -M test.ucl
+	for policy in none batch syncfs; do
+		rm -rf ${TMPDIR}/target
+		mkdir ${TMPDIR}/target
+		atf_check \
+			-o empty \
+			-e empty \
+			-s exit:0 \
+			pkg -o REPOS_DIR=/dev/null -o FSYNC_POLICY=${policy} \
+				-r ${TMPDIR}/target install -qy ${TMPDIR}/test-1.txz
+		atf_check -o inline:"test\n" cat ${TMPDIR}/target${TMPDIR}/b/c
+	done
+}
+
+checksum_mismatch_body()
+{
+	echo "test" > a
+	new_pkg "test" "test" "1" || atf_fail "fail to create the ucl file"
+	cat << EOF >> test.ucl
+files: {
+${TMPDIR}/a = "";
+}
+EOF
+
+	atf_check -o empty -e empty -s exit:0 pkg create -M test.ucl
+
+	# Same manifest, other content, the path kept absolute as pkg does
+	mkdir repack
+	atf_check -s exit:0 tar -xf test-1.txz -C repack \
+		+COMPACT_MANIFEST +MANIFEST
+	echo "TEST" > a
+	atf_check -s exit:0 tar -cJPf bad-1.txz -C repack \
+		+COMPACT_MANIFEST +MANIFEST ${TMPDIR}/a
+
+	mkdir ${TMPDIR}/target
+	atf_check \
+		-o ignore \
+		-e match:"checksum mismatch for ${TMPDIR}/a" \
+		-s not-exit:0 \
+		pkg -o REPOS_DIR=/dev/null -r ${TMPDIR}/target install -qy \
+			${TMPDIR}/bad-1.txz
+	test -e ${TMPDIR}/target${TMPDIR}/a && atf_fail "file left in place"
+	return 0
+}
@@ -0,0 +1,293 @@
+#! /usr/bin/env atf-sh
+
+. $(atf_get_srcdir)/test_environment.sh
+
+CLEANUP="mirrors_rank mirrors_stall mirrors_older mirrors_resume mirrors_race"
+tests_init \
+	mirrors_rank \
+	mirrors_stall \
+	mirrors_older \
+	mirrors_resume \
+	mirrors_race
+
+# Two local HTTP servers, a and b, serve the repository, a third one the
+# list of mirrors.  The servers log the requested paths to <name>.log.
+mirrors_setup() {
+	command -v python3 >/dev/null 2>&1 || atf_skip "Requires python3"
+
+	# serve.py <root> <port file> <log> [<suffix> <bytes> <B/s>|close [norange]]
+	# Past <bytes> of the files whose path ends with <suffix>, the
+	# server sends <B/s> or closes the connection.  norange ignores
+	# Range requests.
+	cat > serve.py << 'EOF'
+import email.utils, http.server, os, sys, time
+
+root, portfile, log = sys.argv[1:4]
+suffix = sys.argv[4] if len(sys.argv) > 4 and sys.argv[4] else None
+after = int(sys.argv[5]) if len(sys.argv) > 5 else 0
+rate = sys.argv[6] if len(sys.argv) > 6 else "0"
+norange = len(sys.argv) > 7 and sys.argv[7] == "norange"
+
+class Handler(http.server.BaseHTTPRequestHandler):
+    def log_message(self, *args):
+        pass
+
+    def do_GET(self):
+        rel = self.path.lstrip("/")
+        with open(log, "a") as f:
+            f.write("%s %s\n" % (rel, self.headers.get("Range", "-")))
+        path = os.path.join(root, rel or "index")
+        if not os.path.isfile(path):
+            self.send_error(404)
+            return
+        with open(path, "rb") as f:
+            data = f.read()
+        start = 0
+        ranged = self.headers.get("Range", "")
+        if ranged.startswith("bytes=") and not norange:
+            start = int(ranged[6:].split("-")[0])
+        if start > 0:
+            self.send_response(206)
+            self.send_header("Content-Range", "bytes %d-%d/%d" %
+                (start, len(data) - 1, len(data)))
+        else:
+            self.send_response(200)
+        self.send_header("Content-Length", str(len(data) - start))
+        self.send_header("Last-Modified",
+            email.utils.formatdate(os.path.getmtime(path), usegmt=True))
+        self.end_headers()
+        slow = suffix is not None and rel.endswith(suffix)
+        sent = start
+        try:
+            while sent < len(data):
+                n = 4096
+                if slow and sent < after:
+                    n = min(n, after - sent)
+                elif slow and rate == "close":
+                    return
+                self.wfile.write(data[sent:sent + n])
+                self.wfile.flush()
+                sent += n
+                if slow and sent > after:
+                    time.sleep(n / int(rate))
+        except (BrokenPipeError, ConnectionResetError):
+            pass
+
+server = http.server.ThreadingHTTPServer(("127.0.0.1", 0), Handler)
+server.daemon_threads = True
+with open(portfile + ".tmp", "w") as f:
+    f.write("%d\n" % server.server_address[1])
+os.rename(portfile + ".tmp", portfile)
+server.serve_forever()
+EOF
+
+	dd if=/dev/urandom of=big bs=1024 count=256 2>/dev/null
+	new_pkg "test" "test" "1" "${TMPDIR}" || atf_fail "fail to create the ucl file"
+	cat >> test.ucl << EOF
+files: {
+	"${TMPDIR}/big": ""
+}
+EOF
+	mkdir repo list repos
+	atf_check -o empty -e empty -s exit:0 pkg create -M test.ucl -o repo
+	atf_check -o ignore -e empty -s exit:0 pkg repo repo
+}
+
+# mirrors_serve <name> <root> [<serve.py options>]
+mirrors_serve() {
+	name=$1
+	root=$2
+	shift 2
+	: > ${name}.log
+	python3 serve.py ${root} ${name}.port ${name}.log "$@" \
+		> /dev/null 2>&1 &
+	echo $! >> servers.pid
+	i=0
+	while [ ! -f ${name}.port ]; do
+		i=$((i + 1))
+		[ ${i} -lt 100 ] || atf_fail "server ${name} did not start"
+		sleep 0.1
+	done
+	eval ${name}=$(cat ${name}.port)
+}
+
+# Once a and b are started: the list of mirrors and the repository
+mirrors_list() {
+	printf "URL: http://127.0.0.1:%s\nURL: http://127.0.0.1:%s\n" \
+		${a} ${b} > list/index
+	mirrors_serve list list
+	cat > repos/test.conf << EOF
+test: {
+	url: "http://127.0.0.1:${list}",
+	mirror_type: "http",
+}
+EOF
+}
+
+# mirrors_stats <latency a> <rate a> <failures a> <latency b> <rate b> <failures b>
+mirrors_stats() {
+	now=$(date +%s)
+	cat > repo-test.mirrors << EOF
+{"http://127.0.0.1:${a}":{"latency":$1,"rate":$2,"failures":$3,"updated":${now}},
+"http://127.0.0.1:${b}":{"latency":$4,"rate":$5,"failures":$6,"updated":${now}},
+"http://127.0.0.1:1":{"latency":"fast","rate":1.0,"failures":0,"updated":${now}}}
+EOF
+}
+
+# mirrors_stat <mirror> <field>: as saved by pkg
+mirrors_stat() {
+	python3 -c 'import json, sys
+stats = json.load(open("repo-test.mirrors"))
+print(stats.get("http://127.0.0.1:" + sys.argv[1], {}).get(sys.argv[2]))' \
+		$1 $2
+}
+
+# mirrors_expect <mirror> <field> <value>
+mirrors_expect() {
+	v=$(mirrors_stat $1 $2)
+	[ "${v}" = "$3" ] || atf_fail "mirror $1: $2 is ${v}, not $3"
+}
+
+mirrors_kill() {
+	[ -f servers.pid ] && kill $(cat servers.pid) 2>/dev/null
+	:
+}
+
+mirrors_rank_body() {
+	mirrors_setup
+	mirrors_serve a repo
+	mirrors_serve b repo
+	mirrors_list
+
+	# b was measured the fastest, it is asked first
+	mirrors_stats 0.5 1000.0 0 0.01 100000000.0 0
+	atf_check -o ignore -e ignore -s exit:0 \
+		pkg -o FETCH_MIRROR_RACE=1 -R repos update
+	atf_check -o ignore -s exit:0 grep -q "^meta.txz " b.log
+	atf_check -o empty -s not-exit:0 grep "^meta.txz " a.log
+	atf_check -o inline:"test\n" -e empty -s exit:0 \
+		pkg -R repos rquery -U %n
+
+	# The measures are saved, a untouched, b updated, the invalid
+	# entry dropped
+	mirrors_expect ${a} rate 1000.0
+	mirrors_expect ${b} failures 0
+	mirrors_expect 1 rate None
+	[ $(mirrors_stat ${b} updated) -ge ${now} ] || \
+		atf_fail "the measures of b were not saved"
+
+	# Failures in a row rank b last, read back at most at 8
+	mirrors_stats 0.5 100000000.0 0 0.01 100000000.0 40
+	: > a.log
+	: > b.log
+	atf_check -o ignore -e ignore -s exit:0 \
+		pkg -o FETCH_MIRROR_RACE=1 -R repos update -f
+	atf_check -o ignore -s exit:0 grep -q "^meta.txz " a.log
+	atf_check -o empty -s not-exit:0 grep "^meta.txz " b.log
+	mirrors_expect ${b} failures 8
+}
+
+mirrors_rank_cleanup() {
+	mirrors_kill
+}
+
+mirrors_stall_body() {
+	mirrors_setup
+	# Past 64KiB, a sends the package at 16KiB/s
+	mirrors_serve a repo test-1.txz 65536 16384
+	mirrors_serve b repo
+	mirrors_list
+
+	mirrors_stats 0.001 100000000.0 0 0.1 100000000.0 0
+	atf_check -o ignore -e ignore -s exit:0 \
+		pkg -o FETCH_MIRROR_RACE=1 -R repos update
+	atf_check -o ignore -e save:fetch.err -s exit:0 \
+		pkg -d -o FETCH_MIRROR_RACE=1 -o PKG_CACHEDIR=${TMPDIR}/cache \
+		-R repos fetch -y test
+	atf_check -o ignore -s exit:0 grep -q "stalled at" fetch.err
+
+	# b only sent the rest of the package
+	atf_check -o ignore -s exit:0 grep -q "test-1.txz bytes=" b.log
+	mirrors_expect ${a} failures 1
+	for f in cache/*.txz; do
+		atf_check -s exit:0 cmp repo/test-1.txz ${f}
+	done
+}
+
+mirrors_stall_cleanup() {
+	mirrors_kill
+}
+
+mirrors_older_body() {
+	mirrors_setup
+	# b has an older copy of the package
+	cp -Rp repo old
+	touch -t 202001010000 old/test-1.txz
+	mirrors_serve a repo test-1.txz 65536 16384
+	mirrors_serve b old
+	mirrors_list
+
+	mirrors_stats 0.001 100000000.0 0 0.1 100000000.0 0
+	atf_check -o ignore -e ignore -s exit:0 \
+		pkg -o FETCH_MIRROR_RACE=1 -R repos update
+	atf_check -o ignore -e save:fetch.err -s exit:0 \
+		pkg -d -o FETCH_MIRROR_RACE=1 -o PKG_CACHEDIR=${TMPDIR}/cache \
+		-R repos fetch -y test
+	atf_check -o ignore -s exit:0 grep -q "stalled at" fetch.err
+	atf_check -o ignore -s exit:0 \
+		grep -q "serves another version of .*test-1.txz" fetch.err
+
+	# b sent all of its package again, not the rest of a's
+	atf_check -o ignore -s exit:0 grep -q "^test-1.txz -$" b.log
+	for f in cache/*.txz; do
+		atf_check -s exit:0 cmp old/test-1.txz ${f}
+	done
+}
+
+mirrors_older_cleanup() {
+	mirrors_kill
+}
+
+mirrors_resume_body() {
+	mirrors_setup
+	# a breaks off the catalogue, b sends all of it again
+	mirrors_serve a repo packagesite.txz 64 close
+	mirrors_serve b repo "" 0 0 norange
+	mirrors_list
+
+	mirrors_stats 0.001 100000000.0 0 0.1 100000000.0 0
+	atf_check -o ignore -e save:update.err -s exit:0 \
+		pkg -d -o FETCH_MIRROR_RACE=1 -R repos update
+	atf_check -o ignore -s exit:0 grep -q "Resume at 64 refused" update.err
+	atf_check -o ignore -s exit:0 grep -q "^packagesite.txz bytes=64-" b.log
+	atf_check -o inline:"test\n" -e empty -s exit:0 \
+		pkg -R repos rquery -U %n
+}
+
+mirrors_resume_cleanup() {
+	mirrors_kill
+}
+
+mirrors_race_body() {
+	mirrors_setup
+	mirrors_serve a repo
+	mirrors_serve b repo
+	mirrors_list
+
+	atf_check -o ignore -e save:race.err -s exit:0 \
+		pkg -d -R repos update
+	atf_check -o ignore -s exit:0 grep -q "connected first" race.err
+
+	# Without FETCH_TIMEOUT, the race waits as long as it takes
+	atf_check -o ignore -e save:notimeout.err -s exit:0 \
+		pkg -d -o FETCH_TIMEOUT=0 -R repos update -f
+	atf_check -o ignore -s exit:0 grep -q "connected first" notimeout.err
+
+	atf_check -o ignore -e save:norace.err -s exit:0 \
+		pkg -d -o FETCH_MIRROR_RACE=1 -R repos update -f
+	atf_check -o empty -s not-exit:0 grep "connected first" norace.err
+}
+
+mirrors_race_cleanup() {
+	mirrors_kill
+}
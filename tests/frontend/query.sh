@@ -3,7 +3,8 @@
 . $(atf_get_srcdir)/test_environment.sh
 
 tests_init \
-	query
+	query \
+	patterns
 
 query_body() {
 	touch plop
@@ -64,3 +65,25 @@ EOF
 		-s exit:0 \
 		pkg query -e "%#O == 0" "%n"
 }
+
+patterns_body() {
+	new_pkg "test" "test" "1"
+	new_pkg "test2" "test2" "1.5"
+	new_pkg "py39-foo" "py39-foo" "2"
+	for p in test test2 py39-foo; do
+		atf_check -o ignore -e empty -s exit:0 pkg register -M ${p}.ucl
+	done
+
+	atf_check -o inline:"test\ntest2\n" -e empty -s exit:0 \
+		pkg query -g "%n" 'test*'
+	atf_check -o inline:"test\n" -e empty -s exit:0 \
+		pkg query -g "%n" 'test-1*'
+	atf_check -o inline:"py39-foo\n" -e empty -s exit:0 \
+		pkg query -g "%n" '*-2'
+	atf_check -o inline:"test2\n" -e empty -s exit:0 \
+		pkg query -x "%n" '^test2-1\.5'
+	atf_check -o inline:"py39-foo\ntest2\n" -e empty -s exit:0 \
+		pkg query -x "%n" '^(py39|test2)-'
+	atf_check -o inline:"py39-foo\n" -e empty -s exit:0 \
+		pkg query -x "%n" 'foo'
+}
@@ -4,7 +4,8 @@
 
 tests_init \
 	repo \
-	repo_multiversion
+	repo_multiversion \
+	repo_deltas
 
 repo_body() {
 	touch plop
@@ -102,3 +103,82 @@ EOF
 	atf_check -o match:"Installing test-1.1" \
 		pkg -C ./pkg.conf install -y test
 }
+
+repo_deltas_body() {
+	dd if=/dev/urandom of=big bs=1024 count=256 2>/dev/null
+	echo "old" > small
+	for v in 1 2; do
+		new_pkg test${v} test ${v} "${TMPDIR}"
+		cat >> test${v}.ucl << EOF
+files: {
+	"${TMPDIR}/big": ""
+	"${TMPDIR}/small": ""
+}
+EOF
+	done
+	mkdir base repo repos target
+	atf_check pkg create -M test1.ucl -o base
+	atf_check -o ignore pkg repo base
+	echo "new" > small
+	# Rebuilt at the default level, the package differs from this one
+	atf_check pkg -o COMPRESSION_LEVEL=0 create -M test2.ucl -o repo
+
+	atf_check -o ignore -e empty pkg repo -d base repo
+	test -f repo/Deltas/test-1-2.txz || atf_fail "no delta created"
+	atf_check -o match:'"basever":"1"' \
+		tar -xf repo/deltasite.txz -O deltasite.yaml
+
+	cat > repos/local.conf << EOF
+local: { url: file://${TMPDIR}/repo }
+EOF
+	atf_check -o ignore -e empty \
+		pkg -o REPOS_DIR=/dev/null -r ${TMPDIR}/target install -qy \
+		${TMPDIR}/base/test-1.txz
+
+	# Only the delta is left to upgrade from the installed version
+	rm repo/test-2.txz
+	atf_check -o ignore -e ignore \
+		pkg -o REPOS_DIR=${TMPDIR}/repos -r ${TMPDIR}/target update
+	atf_check -o ignore -e empty \
+		pkg -o REPOS_DIR=${TMPDIR}/repos -o PKG_CACHEDIR=${TMPDIR}/cache \
+		-r ${TMPDIR}/target upgrade -y
+	atf_check -o inline:"2\n" pkg -r ${TMPDIR}/target query %v test
+	atf_check -o inline:"new\n" cat target${TMPDIR}/small
+	atf_check cmp big target${TMPDIR}/big
+
+	# The rebuilt package is cached under the checksum of the repository
+	# package: pkg clean keeps it and it is used again without the delta
+	atf_check -o match:"Nothing to do" -e ignore \
+		pkg -o REPOS_DIR=${TMPDIR}/repos -o PKG_CACHEDIR=${TMPDIR}/cache \
+		-r ${TMPDIR}/target clean -ny
+	mkdir target3
+	atf_check -o ignore -e empty \
+		pkg -o REPOS_DIR=/dev/null -r ${TMPDIR}/target3 install -qy \
+		${TMPDIR}/base/test-1.txz
+	mv repo/Deltas/test-1-2.txz delta.txz
+	atf_check -o ignore -e ignore \
+		pkg -o REPOS_DIR=${TMPDIR}/repos -r ${TMPDIR}/target3 update
+	atf_check -o match:"Number of packages to be upgraded: 1" \
+		-o not-match:"to be downloaded" -e empty -s exit:1 \
+		pkg -o REPOS_DIR=${TMPDIR}/repos -o PKG_CACHEDIR=${TMPDIR}/cache \
+		-r ${TMPDIR}/target3 upgrade -n
+	atf_check -o ignore -e empty \
+		pkg -o REPOS_DIR=${TMPDIR}/repos -o PKG_CACHEDIR=${TMPDIR}/cache \
+		-r ${TMPDIR}/target3 upgrade -y
+	atf_check -o inline:"2\n" pkg -r ${TMPDIR}/target3 query %v test
+	mv delta.txz repo/Deltas/test-1-2.txz
+
+	# An installed file that changed cannot be used as a base
+	mkdir target2
+	atf_check -o ignore -e empty \
+		pkg -o REPOS_DIR=/dev/null -r ${TMPDIR}/target2 install -qy \
+		${TMPDIR}/base/test-1.txz
+	echo "edited" >> target2${TMPDIR}/big
+	atf_check -o ignore -e ignore \
+		pkg -o REPOS_DIR=${TMPDIR}/repos -r ${TMPDIR}/target2 update
+	atf_check -o ignore \
+		-e match:"checksum mismatch for ${TMPDIR}/big" \
+		-s not-exit:0 \
+		pkg -o REPOS_DIR=${TMPDIR}/repos -o PKG_CACHEDIR=${TMPDIR}/cache2 \
+		-r ${TMPDIR}/target2 upgrade -y
+}
@@ -3,7 +3,8 @@
 . $(atf_get_srcdir)/test_environment.sh
 
 tests_init \
-	rootdir
+	rootdir \
+	rootdir_check
 
 rootdir_body() {
 	unset PKG_DBDIR
@@ -19,3 +20,27 @@ rootdir_body() {
 		-s exit:0 \
 		pkg -r "${TMPDIR}" config pkg_dbdir
 }
+
+rootdir_check_body() {
+	echo "content" > plop
+	new_pkg test test 1 "${TMPDIR}"
+	cat >> test.ucl << EOF
+files: {
+	"${TMPDIR}/plop": ""
+}
+EOF
+	atf_check pkg create -M test.ucl
+	mkdir target
+	atf_check -o ignore -e empty \
+		pkg -o REPOS_DIR=/dev/null -r ${TMPDIR}/target install -qy \
+		${TMPDIR}/test-1.txz
+
+	# The files are checked in the rootdir, not in /
+	rm plop
+	atf_check -o ignore -e empty \
+		pkg -r ${TMPDIR}/target check -s -a
+	echo "edited" >> target${TMPDIR}/plop
+	atf_check -o ignore -e match:"checksum mismatch for ${TMPDIR}/plop" \
+		-s not-exit:0 \
+		pkg -r ${TMPDIR}/target check -s -a
+}
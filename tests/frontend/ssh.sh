@@ -0,0 +1,93 @@
+#! /usr/bin/env atf-sh
+
+. $(atf_get_srcdir)/test_environment.sh
+
+tests_init \
+	pipelined \
+	fetch
+
+pipelined_body() {
+	mkdir repo repo/sub
+	echo "first" > repo/a
+	echo "second file" > repo/b
+	echo "third" > repo/sub/c
+
+	# All the requests are sent at once, before any answer is read
+	printf "get a 0\nget /b 0\nget missing 0\nget sub/c 0\nget a 99999999999\nquit\n" > requests
+
+	atf_check \
+		-o save:out \
+		-e empty \
+		-s exit:0 \
+		pkg -o REPOS_DIR=/dev/null -o SSH_RESTRICT_DIR=${TMPDIR}/repo ssh < requests
+
+cat > expected << EOF
+ok: 6
+first
+ok: 12
+second file
+ko: file not found
+ok: 6
+third
+ok: 0
+EOF
+
+	atf_check \
+		-o match:"^ok: pkg " \
+		-s exit:0 \
+		head -1 out
+
+	atf_check \
+		-o file:expected \
+		-s exit:0 \
+		sed 1d out
+}
+
+fetch_body() {
+	mkdir repo
+	for i in 1 2 3; do
+		echo "content of file ${i}" > file${i}
+		new_pkg "test${i}" "test${i}" "1" || atf_fail "fail to create the ucl file"
+		cat << EOF >> test${i}.ucl
+files: {
+	${TMPDIR}/file${i}: ""
+}
+EOF
+		atf_check -o empty -e empty -s exit:0 \
+			pkg create -M test${i}.ucl -o repo
+	done
+	atf_check -o ignore -e empty -s exit:0 pkg repo repo
+
+	# The transport runs the server locally, whatever the host
+	cat > ssh << EOF
+#!/bin/sh
+exec pkg ssh
+EOF
+	chmod 755 ssh
+	mkdir repos
+	cat > repos/test.conf << EOF
+test: {
+	url: "ssh://localhost${TMPDIR}/repo",
+	enabled: true
+}
+EOF
+
+	atf_check \
+		-o ignore \
+		-e ignore \
+		-s exit:0 \
+		pkg -o REPOS_DIR=${TMPDIR}/repos -o PKG_SSH=${TMPDIR}/ssh \
+			-o PKG_CACHEDIR=${TMPDIR}/cache update
+
+	# The three packages are asked for at once on the same connection
+	atf_check \
+		-o ignore \
+		-e empty \
+		-s exit:0 \
+		pkg -o REPOS_DIR=${TMPDIR}/repos -o PKG_SSH=${TMPDIR}/ssh \
+			-o PKG_CACHEDIR=${TMPDIR}/cache fetch -yaU
+
+	openssl dgst -sha256 -r repo/test*.txz | cut -d ' ' -f 1 | sort > expected
+	openssl dgst -sha256 -r cache/test*.txz | cut -d ' ' -f 1 | sort > fetched
+	atf_check -o file:expected -s exit:0 cat fetched
+}
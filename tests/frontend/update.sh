@@ -3,7 +3,10 @@
 . $(atf_get_srcdir)/test_environment.sh
 
 tests_init \
-	update_error
+	update_error \
+	update_stamp \
+	update_rdeps \
+	update_trace
 
 update_error_body() {
 
@@ -21,3 +24,98 @@ EOF
 		-s exit:70 \
 		pkg -R repos update
 }
+
+update_stamp_body() {
+	new_pkg "test" "test" "1" || atf_fail "fail to create the ucl file"
+	mkdir repo
+	atf_check -o empty -e empty -s exit:0 pkg create -M test.ucl -o repo
+	atf_check -o ignore -e empty -s exit:0 pkg repo repo
+	mkdir repos
+	cat > repos/test.conf << EOF
+test: {
+  url: "file://${TMPDIR}/repo",
+}
+EOF
+
+	atf_check -o ignore -e ignore -s exit:0 pkg -R repos update
+	test -f test.stamp || atf_fail "no validation stamp written"
+	atf_check -o inline:"test\n" -e empty -s exit:0 \
+		pkg -R repos rquery -U %n
+
+	# The stamp does not hide a packagesite change
+	cat > repos/test.conf << EOF
+test: {
+  url: "file://${TMPDIR}/other",
+}
+EOF
+	atf_check -o empty -e match:"wrong packagesite" -s ignore \
+		pkg -R repos rquery -U %n
+}
+
+update_rdeps_body() {
+	mkdir repo
+	for p in a b c; do
+		new_pkg "${p}" "${p}" "1" || atf_fail "fail to create the ucl file"
+		if [ ${p} != a ]; then
+			cat << EOF >> ${p}.ucl
+deps: {
+	a: {
+		origin: "a",
+		version: "1"
+	}
+}
+EOF
+		fi
+		atf_check -o empty -e empty -s exit:0 \
+			pkg create -M ${p}.ucl -o repo
+	done
+	atf_check -o ignore -e empty -s exit:0 pkg repo repo
+	mkdir repos
+	cat > repos/test.conf << EOF
+test: {
+  url: "file://${TMPDIR}/repo",
+}
+EOF
+	atf_check -o ignore -e ignore -s exit:0 pkg -R repos update
+
+	# All the packages load the reverse dependencies at once, one
+	# package looks them up
+	atf_check -o inline:"a b\na c\n" -e empty -s exit:0 \
+		sh -c "pkg -R repos rquery -U -a '%n %rn' | sort"
+	atf_check -o inline:"b\nc\n" -e empty -s exit:0 \
+		sh -c "pkg -R repos rquery -U '%rn' a | sort"
+}
+
+update_trace_body() {
+	command -v jq >/dev/null 2>&1 || atf_skip "Requires jq"
+
+	new_pkg "test" "test" "1" || atf_fail "fail to create the ucl file"
+	mkdir repo
+	atf_check -o empty -e empty -s exit:0 pkg create -M test.ucl -o repo
+	atf_check -o ignore -e empty -s exit:0 pkg repo repo
+	mkdir repos
+	cat > repos/test.conf << EOF
+test: {
+  url: "file://${TMPDIR}/repo",
+}
+EOF
+
+	atf_check -o ignore -e ignore -s exit:0 pkg -R repos -T trace.json update
+	atf_check -o ignore -e empty -s exit:0 jq -e . trace.json
+	# The command is the outermost span, the fetches are nested in it
+	atf_check -o inline:"update\n" -e empty -s exit:0 \
+		jq -r '[.[] | select(.ph == "B")][0].name' trace.json
+	atf_check -o inline:"true\n" -e empty -s exit:0 \
+		jq 'any(.[]; .ph == "B" and .name == "fetch")' trace.json
+	# Every span is closed, the command one counting the SQL statements
+	atf_check -o inline:"true\n" -e empty -s exit:0 \
+		jq '([.[] | select(.ph == "B")] | length) ==
+		    ([.[] | select(.ph == "E")] | length)' trace.json
+	atf_check -o inline:"true\n" -e empty -s exit:0 \
+		jq '[.[] | select(.ph == "E")] | last | .args.sql > 0' trace.json
+
+	atf_check -o ignore -e ignore -s exit:0 \
+		env PKG_TRACE_FILE=${TMPDIR}/env.json pkg -R repos update -f
+	atf_check -o inline:"update\n" -e empty -s exit:0 \
+		jq -r '[.[] | select(.ph == "B")][0].name' env.json
+}
@@ -29,6 +29,8 @@
 #include <unistd.h>
 #include <pkg.h>
 #include <private/pkg.h>
+#include <sha256.h>
+#include <blake2.h>
 
 ATF_TC(check_symlinks);
 
@@ -89,12 +91,279 @@ ATF_TC_BODY(check_files, tc)
 
 	sum=pkg_checksum_generate_file("foo", PKG_HASH_TYPE_SHA256_HEX);
 	ATF_REQUIRE_STREQ(sum, "1$7d865e959b2466918c9863afca942d0fb89d7c9ac0c99bafc3749504ded97730");
+	free(sum);
+
+	/* What pkg create computes from content kept in memory */
+	sum = pkg_checksum_generate_data("bar\n", 4, PKG_HASH_TYPE_SHA256_HEX);
+	ATF_REQUIRE_STREQ(sum, "1$7d865e959b2466918c9863afca942d0fb89d7c9ac0c99bafc3749504ded97730");
+	free(sum);
+}
+
+ATF_TC(sha256_backends);
+
+ATF_TC_HEAD(sha256_backends, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "testing sha256 backends against the portable one");
+}
+
+static void
+sha256_split(const unsigned char *in, size_t len, size_t chunk,
+    unsigned char *out)
+{
+	SHA256_CTX ctx;
+	size_t done, n;
+
+	sha256_init(&ctx);
+	for (done = 0; done < len; done += n) {
+		n = len - done < chunk ? len - done : chunk;
+		sha256_update(&ctx, in + done, n);
+	}
+	sha256_final(&ctx, out);
+}
+
+ATF_TC_BODY(sha256_backends, tc)
+{
+	unsigned char buf[4099];
+	unsigned char ref[SHA256_BLOCK_SIZE], out[SHA256_BLOCK_SIZE];
+	const size_t lens[] = { 0, 1, 3, 55, 56, 63, 64, 65, 127, 128, 129,
+	    1000, 4096, sizeof(buf) };
+	const size_t chunks[] = { 1, 7, 64, 100, sizeof(buf) };
+	unsigned char *sum;
+	const char *name;
+	size_t b, l, c;
+
+	for (l = 0; l < sizeof(buf); l++)
+		buf[l] = (l * 2654435761U) >> 13;
+
+	ATF_REQUIRE_EQ(sha256_backend_name(0) != NULL, true);
+	ATF_REQUIRE_EQ(sha256_backend_select("nonexistent"), -1);
+
+	for (b = 0; (name = sha256_backend_name(b)) != NULL; b++) {
+		for (l = 0; l < sizeof(lens) / sizeof(lens[0]); l++) {
+			ATF_REQUIRE_EQ(sha256_backend_select("c"), 0);
+			sha256_split(buf, lens[l], lens[l] + 1, ref);
+
+			ATF_REQUIRE_EQ(sha256_backend_select(name), 0);
+			ATF_REQUIRE_STREQ(sha256_backend_current(), name);
+			for (c = 0; c < sizeof(chunks) / sizeof(chunks[0]); c++) {
+				sha256_split(buf, lens[l], chunks[c], out);
+				ATF_CHECK_MSG(memcmp(ref, out, sizeof(out)) == 0,
+				    "%s: mismatch for %zu bytes in chunks of %zu",
+				    name, lens[l], chunks[c]);
+			}
+		}
+	}
+
+	/* Every backend must agree with the known digests too */
+	for (b = 0; (name = sha256_backend_name(b)) != NULL; b++) {
+		ATF_REQUIRE_EQ(sha256_backend_select(name), 0);
+		sum = pkg_checksum_data((const unsigned char *)"bar\n", 4,
+		    PKG_HASH_TYPE_SHA256_HEX);
+		ATF_CHECK_STREQ(sum, "7d865e959b2466918c9863afca942d0fb89d7c9ac0c99bafc3749504ded97730");
+		free(sum);
+	}
+	sha256_backend_select(sha256_backend_name(0));
+}
+
+ATF_TC(blake2_backends);
+
+ATF_TC_HEAD(blake2_backends, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "testing blake2 backends against the reference one");
+}
+
+static void
+blake2_hex(const unsigned char *in, size_t len, char *out)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		sprintf(out + i * 2, "%02x", in[i]);
+}
+
+ATF_TC_BODY(blake2_backends, tc)
+{
+	unsigned char buf[4099];
+	unsigned char refs[BLAKE2S_OUTBYTES], outs[BLAKE2S_OUTBYTES];
+	unsigned char refb[BLAKE2B_OUTBYTES], outb[BLAKE2B_OUTBYTES];
+	char hex[BLAKE2B_OUTBYTES * 2 + 1];
+	const size_t lens[] = { 0, 1, 63, 64, 65, 127, 128, 129, 256, 1000,
+	    sizeof(buf) };
+	const char *name;
+	size_t b, l;
+
+	for (l = 0; l < sizeof(buf); l++)
+		buf[l] = (l * 2654435761U) >> 13;
+
+	ATF_REQUIRE_EQ(blake2_backend_name(0) != NULL, true);
+	ATF_REQUIRE_EQ(blake2_backend_select("nonexistent"), -1);
+
+	for (b = 0; (name = blake2_backend_name(b)) != NULL; b++) {
+		for (l = 0; l < sizeof(lens) / sizeof(lens[0]); l++) {
+			ATF_REQUIRE_EQ(blake2_backend_select("ref"), 0);
+			blake2s(refs, sizeof(refs), buf, lens[l], NULL, 0);
+			blake2b(refb, sizeof(refb), buf, lens[l], NULL, 0);
+
+			ATF_REQUIRE_EQ(blake2_backend_select(name), 0);
+			ATF_REQUIRE_STREQ(blake2_backend_current(), name);
+			blake2s(outs, sizeof(outs), buf, lens[l], NULL, 0);
+			blake2b(outb, sizeof(outb), buf, lens[l], NULL, 0);
+			ATF_CHECK_MSG(memcmp(refs, outs, sizeof(outs)) == 0,
+			    "%s: blake2s mismatch for %zu bytes", name, lens[l]);
+			ATF_CHECK_MSG(memcmp(refb, outb, sizeof(outb)) == 0,
+			    "%s: blake2b mismatch for %zu bytes", name, lens[l]);
+		}
+
+		blake2s(outs, sizeof(outs), "abc", 3, NULL, 0);
+		blake2_hex(outs, sizeof(outs), hex);
+		ATF_CHECK_STREQ(hex, "508c5e8c327c14e2e1a72ba34eeb452f37458b209ed63a294d999b4c86675982");
+		blake2b(outb, sizeof(outb), "abc", 3, NULL, 0);
+		blake2_hex(outb, sizeof(outb), hex);
+		ATF_CHECK_STREQ(hex, "ba80a53f981c4d0d6a2797b69f12f6e94c212f14685ac4b74b12bb6fdbffa2d17d87c5392aab792dc252d5de4533cc9518d38aa8dbf1925ab92386edd4009923");
+	}
+	blake2_backend_select(blake2_backend_name(0));
+}
+
+ATF_TC(blake2_many);
+
+ATF_TC_HEAD(blake2_many, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "testing blake2 multi-buffer hashing");
+}
+
+ATF_TC_BODY(blake2_many, tc)
+{
+	unsigned char buf[1024];
+	unsigned char outs[37][BLAKE2S_OUTBYTES], outb[37][BLAKE2B_OUTBYTES];
+	unsigned char refs[BLAKE2S_OUTBYTES], refb[BLAKE2B_OUTBYTES];
+	unsigned char *ps[37], *pb[37];
+	const void *in[37];
+	size_t inlen[37];
+	const char *name;
+	size_t b, i, outlen;
+
+	for (i = 0; i < sizeof(buf); i++)
+		buf[i] = (i * 2654435761U) >> 13;
+	/* uneven lengths, so lanes finish at different blocks */
+	for (i = 0; i < 37; i++) {
+		in[i] = buf + i * 3;
+		inlen[i] = (i * 97) % 700;
+		ps[i] = outs[i];
+		pb[i] = outb[i];
+	}
+
+	ATF_REQUIRE_EQ(blake2s_many(ps, 0, in, inlen, 37), -1);
+	ATF_REQUIRE_EQ(blake2b_many(pb, BLAKE2B_OUTBYTES + 1, in, inlen, 37), -1);
+	ATF_REQUIRE_EQ(blake2b_many(NULL, BLAKE2B_OUTBYTES, NULL, NULL, 0), 0);
+
+	for (b = 0; (name = blake2_backend_name(b)) != NULL; b++) {
+		ATF_REQUIRE_EQ(blake2_backend_select(name), 0);
+		for (outlen = 16; outlen <= BLAKE2B_OUTBYTES; outlen += 16) {
+			ATF_REQUIRE_EQ(blake2s_many(ps, MIN(outlen, BLAKE2S_OUTBYTES),
+			    in, inlen, 37), 0);
+			ATF_REQUIRE_EQ(blake2b_many(pb, outlen, in, inlen, 37), 0);
+			for (i = 0; i < 37; i++) {
+				blake2s(refs, MIN(outlen, BLAKE2S_OUTBYTES), in[i],
+				    inlen[i], NULL, 0);
+				blake2b(refb, outlen, in[i], inlen[i], NULL, 0);
+				ATF_CHECK_MSG(memcmp(refs, outs[i],
+				    MIN(outlen, BLAKE2S_OUTBYTES)) == 0,
+				    "%s: blake2s_many mismatch for input %zu",
+				    name, i);
+				ATF_CHECK_MSG(memcmp(refb, outb[i], outlen) == 0,
+				    "%s: blake2b_many mismatch for input %zu",
+				    name, i);
+			}
+		}
+	}
+	blake2_backend_select(blake2_backend_name(0));
+}
+
+ATF_TC(generate_digest);
+
+ATF_TC_HEAD(generate_digest, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "testing package digests stay stable");
+}
+
+ATF_TC_BODY(generate_digest, tc)
+{
+	struct pkg *p;
+	char digest[256];
+
+	ATF_REQUIRE_EQ(EPKG_OK, pkg_new(&p, PKG_FILE));
+	pkg_set(p, PKG_NAME, "foo", PKG_ORIGIN, "devel/foo",
+	    PKG_VERSION, "1.0_1", PKG_ARCH, "FreeBSD:13:amd64");
+	pkg_addoption(p, "X11", "off");
+	pkg_addoption(p, "DOCS", "on");
+	/* "lib~devel/lib" must sort before "libbar~devel/libbar" */
+	pkg_adddep(p, "libbar", "devel/libbar", "2.0", false);
+	pkg_adddep(p, "lib", "devel/lib", "1.0", false);
+	pkg_addshlib_required(p, "libbar.so.1");
+	pkg_addshlib_provided(p, "libfoo.so.2");
+
+	ATF_REQUIRE_EQ(EPKG_OK, pkg_checksum_generate(p, digest, sizeof(digest),
+	    PKG_HASH_TYPE_SHA256_BASE32));
+	ATF_CHECK_STREQ(digest, "2$0$5kt1r1r6zc5xkgu3ihqaqskqbh43escqhygmgmmfthrtd8wtdory");
+	ATF_REQUIRE_EQ(EPKG_OK, pkg_checksum_generate(p, digest, sizeof(digest),
+	    PKG_HASH_TYPE_SHA256_HEX));
+	ATF_CHECK_STREQ(digest, "2$1$5b454924f197eda7cccc953becac7281eb8c2c731c9865d62a9193380e8d0312");
+	ATF_REQUIRE_EQ(EPKG_OK, pkg_checksum_generate(p, digest, sizeof(digest),
+	    PKG_HASH_TYPE_BLAKE2_BASE32));
+	ATF_CHECK_STREQ(digest, "2$2$34ajuryqi8qwu58itxbmffjhb96pwo9rb6h4erwrmdek5n8i6amxncfcdfj1n6xch899kfoeujzmybdfg946tg35j7dqpeq8fzz5txb");
+	ATF_REQUIRE_EQ(EPKG_OK, pkg_checksum_generate(p, digest, sizeof(digest),
+	    PKG_HASH_TYPE_BLAKE2S_BASE32));
+	ATF_CHECK_STREQ(digest, "2$5$isshgsbj59px7p7471fcn6jdnhodoz15mrs336czwdxxnukg14ob");
+
+	pkg_free(p);
+}
+
+ATF_TC(calculate_many);
+
+ATF_TC_HEAD(calculate_many, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "testing package digests computed at once");
+}
+
+ATF_TC_BODY(calculate_many, tc)
+{
+	struct pkg *p[11];
+	char name[32], dep[32], *digest;
+	int i, j;
+
+	/* As many fields as lanes and more, so lanes finish apart */
+	for (i = 0; i < 11; i++) {
+		ATF_REQUIRE_EQ(EPKG_OK, pkg_new(&p[i], PKG_INSTALLED));
+		snprintf(name, sizeof(name), "pkg%d", i);
+		pkg_set(p[i], PKG_NAME, name, PKG_ORIGIN, "devel/pkg",
+		    PKG_VERSION, "1.0", PKG_ARCH, "FreeBSD:13:amd64");
+		for (j = 0; j < i * 3; j++) {
+			snprintf(dep, sizeof(dep), "dep%d", j);
+			pkg_adddep(p[i], dep, "devel/dep", "1.0", false);
+		}
+	}
+
+	ATF_REQUIRE_EQ(EPKG_OK, pkg_checksum_calculate_many(p, 11));
+	for (i = 0; i < 11; i++) {
+		ATF_REQUIRE(p[i]->digest != NULL);
+		digest = strdup(p[i]->digest);
+		ATF_REQUIRE_EQ(EPKG_OK, pkg_checksum_calculate(p[i], NULL));
+		ATF_CHECK_STREQ(digest, p[i]->digest);
+		free(digest);
+		pkg_free(p[i]);
+	}
+	ATF_REQUIRE_EQ(EPKG_OK, pkg_checksum_calculate_many(NULL, 0));
 }
 
 ATF_TP_ADD_TCS(tp)
 {
 	ATF_TP_ADD_TC(tp, check_symlinks);
 	ATF_TP_ADD_TC(tp, check_files);
+	ATF_TP_ADD_TC(tp, sha256_backends);
+	ATF_TP_ADD_TC(tp, blake2_backends);
+	ATF_TP_ADD_TC(tp, blake2_many);
+	ATF_TP_ADD_TC(tp, generate_digest);
+	ATF_TP_ADD_TC(tp, calculate_many);
 
 	return (atf_no_error());
 }
@@ -60,9 +60,46 @@ ATF_TC_BODY(pkg_add_dir_to_del, tc)
 	pkg_free(p);
 }
 
+ATF_TC(pkg_add_dir_to_del_deepest);
+
+ATF_TC_HEAD(pkg_add_dir_to_del_deepest, tc)
+{
+	atf_tc_set_md_var(tc, "descr",
+	    "pkg_add_dir_to_del() keeps the deepest directories");
+}
+
+ATF_TC_BODY(pkg_add_dir_to_del_deepest, tc)
+{
+	struct pkg *p = NULL;
+
+	ATF_REQUIRE_EQ(EPKG_OK, pkg_new(&p, PKG_FILE));
+	pkg_set(p, PKG_PREFIX, "/usr/local");
+
+	pkg_add_dir_to_del(p, "usr/local/share/foo/file", NULL);
+	pkg_add_dir_to_del(p, "usr/local/share/foo/bar/file", NULL);
+	ATF_REQUIRE(p->dir_to_del_len == 1);
+	ATF_REQUIRE_STREQ(p->dir_to_del[0], "usr/local/share/foo/bar/");
+
+	pkg_add_dir_to_del(p, NULL, "usr/local/share");
+	pkg_add_dir_to_del(p, "usr/local/share/foo/bar/file2", NULL);
+	ATF_REQUIRE(p->dir_to_del_len == 1);
+
+	/* a sibling whose name starts like an existing directory */
+	pkg_add_dir_to_del(p, "usr/local/share/foobar/file", NULL);
+	ATF_REQUIRE(p->dir_to_del_len == 2);
+	ATF_REQUIRE_STREQ(p->dir_to_del[1], "usr/local/share/foobar/");
+
+	pkg_add_dir_to_del(p, NULL, "usr/local/share/foo/bar/baz/");
+	ATF_REQUIRE(p->dir_to_del_len == 2);
+	ATF_REQUIRE_STREQ(p->dir_to_del[0], "usr/local/share/foo/bar/baz/");
+
+	pkg_free(p);
+}
+
 ATF_TP_ADD_TCS(tp)
 {
 	ATF_TP_ADD_TC(tp, pkg_add_dir_to_del); 
+	ATF_TP_ADD_TC(tp, pkg_add_dir_to_del_deepest);
 
 	return (atf_no_error());
 }